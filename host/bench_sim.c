@@ -0,0 +1,162 @@
+// Runs the firmware benchmark (main/bench.c) over the mesh simulator and prints the same
+// JSON shape as GET /api/bench on the root, plus per-node simulator counters.
+//
+//   bench_sim [--nodes N] [--fanout F] [--rate PPS] [--size BYTES] [--tos p2p|e2e|def]
+//             [--dur MS] [--dst root|<node>] [--layer L] [--loss PPM] [--queue FRAMES] [--seed S]
+//
+// --layer restricts the senders to one mesh layer (root = 1); by default every non-root
+// node sends.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "mesh_sim.h"
+
+#define POLL_US    10000    // bench task period on the device (one FreeRTOS tick)
+#define DRAIN_US   2000000  // let in-flight frames land before reporting
+
+typedef struct {
+    sim_t *sim;
+    int node;
+} sim_port_t;
+
+static bench_t benches[SIM_MAX_NODES];
+static sim_port_t ports[SIM_MAX_NODES];
+
+static int sim_port_send(void *ctx, const uint8_t dst[6], const uint8_t *frame, size_t len, uint8_t tos) {
+    static const uint8_t root_addr[6] = {0};
+    sim_port_t *port = ctx;
+    int dst_node = memcmp(dst, root_addr, 6) == 0 ? 0 : sim_node_by_mac(port->sim, dst);
+    if (dst_node < 0) {
+        return -1;
+    }
+    return sim_send(port->sim, port->node, dst_node, frame, len, tos);
+}
+
+static void sim_port_deliver(void *ctx, int dst, int src, const uint8_t *data, size_t len, uint8_t tos) {
+    (void)tos;
+    sim_t *sim = *(sim_t **)ctx;
+    uint8_t src_mac[6];
+    sim_mac(src, src_mac);
+    bench_on_frame(&benches[dst], src_mac, data, len, sim_now(sim));
+}
+
+static int sim_layer_of(void *ctx, const uint8_t mac[6]) {
+    sim_t *sim = ctx;
+    int node = sim_node_by_mac(sim, mac);
+    return node < 0 ? -1 : sim_layer(sim, node);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--nodes N] [--fanout F] [--rate PPS] [--size BYTES] [--tos p2p|e2e|def]\n"
+                    "          [--dur MS] [--dst root|<node>] [--layer L] [--loss PPM] [--queue FRAMES] [--seed S]\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int nodes = 10;
+    int fanout = 3;
+    int dst = -1;
+    int only_layer = 0;
+    bench_params_t params = {.run = 1, .rate = 50, .size = 200, .tos = BENCH_TOS_P2P, .duration_ms = 10000};
+    sim_config_t cfg;
+    sim_default_config(&cfg);
+
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        const char *val = argv[++i];
+        if (strcmp(opt, "--nodes") == 0) nodes = atoi(val);
+        else if (strcmp(opt, "--fanout") == 0) fanout = atoi(val);
+        else if (strcmp(opt, "--rate") == 0) params.rate = (uint32_t)atoi(val);
+        else if (strcmp(opt, "--size") == 0) params.size = (uint16_t)atoi(val);
+        else if (strcmp(opt, "--dur") == 0) params.duration_ms = (uint32_t)atoi(val);
+        else if (strcmp(opt, "--layer") == 0) only_layer = atoi(val);
+        else if (strcmp(opt, "--loss") == 0) cfg.loss_ppm = (uint32_t)atoi(val);
+        else if (strcmp(opt, "--queue") == 0) cfg.queue_limit = (uint16_t)atoi(val);
+        else if (strcmp(opt, "--seed") == 0) cfg.seed = (uint32_t)atoi(val);
+        else if (strcmp(opt, "--dst") == 0) dst = strcmp(val, "root") == 0 ? -1 : atoi(val);
+        else if (strcmp(opt, "--tos") == 0) {
+            if (strcmp(val, "p2p") == 0) params.tos = BENCH_TOS_P2P;
+            else if (strcmp(val, "e2e") == 0) params.tos = BENCH_TOS_E2E;
+            else if (strcmp(val, "def") == 0) params.tos = BENCH_TOS_DEF;
+            else usage(argv[0]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (nodes < 2 || nodes > SIM_MAX_NODES || dst >= nodes) {
+        usage(argv[0]);
+    }
+
+    sim_t *sim = NULL;
+    sim = sim_create(&cfg, sim_port_deliver, &sim);
+    sim_build_tree(sim, nodes, fanout);
+    if (dst >= 0) {
+        sim_mac(dst, params.dst);
+    }
+
+    for (int i = 0; i < nodes; i++) {
+        uint8_t mac[6];
+        sim_mac(i, mac);
+        ports[i] = (sim_port_t){.sim = sim, .node = i};
+        bench_transport_t tp = {.send = sim_port_send, .ctx = &ports[i]};
+        bench_init(&benches[i], mac, &tp);
+        bench_reset(&benches[i], params.run);
+    }
+    int senders = 0;
+    for (int i = 1; i < nodes; i++) {
+        if (i == dst || (only_layer && sim_layer(sim, i) != only_layer)) {
+            continue;
+        }
+        bench_start(&benches[i], &params, 0);
+        senders++;
+    }
+
+    int64_t end = (int64_t)params.duration_ms * 1000 + DRAIN_US;
+    for (int64_t t = 0; t <= end; t += POLL_US) {
+        sim_run_until(sim, t);
+        for (int i = 0; i < nodes; i++) {
+            bench_tx_poll(&benches[i], t);
+        }
+    }
+
+    static char buf[4096];
+    int receiver = dst >= 0 ? dst : 0;
+    printf("{\"run\":%u,\"params\":{\"nodes\":%d,\"fanout\":%d,\"senders\":%d,\"rate\":%lu,\"size\":%u,\"tos\":%u,"
+           "\"dur_ms\":%lu,\"dst\":%d,\"loss_ppm\":%lu},\n",
+           params.run, nodes, fanout, senders, (unsigned long)params.rate, params.size, params.tos,
+           (unsigned long)params.duration_ms, dst, (unsigned long)cfg.loss_ppm);
+    bench_format_result(&benches[receiver], buf, sizeof(buf), end);
+    printf(" \"receiver\":%s,\n", buf);
+    bench_layer_t layers[BENCH_MAX_LAYERS + 1];
+    bench_layer_summary(&benches[receiver], sim_layer_of, sim, layers);
+    bench_format_layers(layers, buf, sizeof(buf));
+    printf(" \"layers\":%s,\n \"nodes\":[", buf);
+    bool first = true;
+    for (int i = 0; i < nodes; i++) {
+        if (benches[i].params.rate == 0) {
+            continue;
+        }
+        bench_format_result(&benches[i], buf, sizeof(buf), end);
+        printf("%s\n  %s", first ? "" : ",", buf);
+        first = false;
+    }
+    printf("],\n \"sim\":[");
+    for (int i = 0; i < nodes; i++) {
+        const sim_node_stats_t *st = sim_stats(sim, i);
+        printf("%s\n  {\"node\":%d,\"layer\":%d,\"parent\":%d,\"tx_attempts\":%lu,\"retries\":%lu,\"queue_max\":%u,"
+               "\"queue_drops\":%lu,\"loss_drops\":%lu,\"refused\":%lu,\"delivered\":%lu}",
+               i ? "," : "", i, sim_layer(sim, i), sim_parent(sim, i), (unsigned long)st->tx_attempts,
+               (unsigned long)st->retries, st->queue_max, (unsigned long)st->queue_drops,
+               (unsigned long)st->loss_drops, (unsigned long)st->send_refused, (unsigned long)st->delivered);
+    }
+    printf("]}\n");
+
+    sim_destroy(sim);
+    return 0;
+}
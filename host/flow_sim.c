@@ -0,0 +1,415 @@
+// Reconnect storm in the mesh simulator with and without the firmware's AIMD flow control
+// (main/flow_ctl.c).
+//
+// Every node reports its state to the root periodically; the root sends a small command to
+// a random node every few ms and the node acks it (both exempt from flow control). At
+// --storm-at every node below layer 1 drops off the mesh for --storm-ms and then all of them
+// reconnect at once, each announcing itself and answering the root's status_request, which
+// is what the firmware does after self-heal. Self-heal does not rebuild the old tree: the
+// root takes back only --root-conn of its children and the other subtrees rejoin under
+// those, so a few relays carry the whole mesh from then on. With flow control, nodes watch
+// their own transmit queue and the backlog their parent advertises, and pace state reports;
+// a deferred report is replaced by the next one (latest state wins).
+//
+// Three runs: no flow control, pacing only (token bucket and slow start after the rejoin,
+// but the rate never cut) and full AIMD, so what the multiplicative decrease adds shows up
+// on its own. --check exits non-zero unless AIMD cut the rate during the storm and lost
+// fewer frames than pacing alone.
+//
+//   flow_sim [--nodes N] [--fanout F] [--period MS] [--size BYTES] [--cmd-every MS]
+//            [--storm-at MS] [--storm-ms MS] [--root-conn N] [--dur MS] [--queue FRAMES]
+//            [--loss PPM] [--flow on|off|pace|all] [--seed S] [--check 1]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flow_ctl.h"
+#include "mesh_sim.h"
+
+#define TICK_US        200000   // flow controller tick (timer service on the device)
+#define ADVERT_US      1000000  // re-advertise backlog to children this often while congested
+#define ADVERT_TTL_US  3000000  // a parent's advertisement is trusted this long
+#define AFTER_STORM_US 10000000 // storm window: from the disconnect until 10 s after reconnect
+#define MAX_RTTS       65536
+
+typedef enum {
+    RUN_OFF,
+    RUN_PACE,   // flow control without the multiplicative decrease
+    RUN_AIMD,
+} run_mode_t;
+
+enum {
+    FR_STATE = 1,
+    FR_CMD,
+    FR_ACK,
+    FR_ADVERT,
+};
+
+typedef struct {
+    flow_ctl_t fc;
+    bool pending;              // a deferred state report is waiting
+    int64_t next_report_us;
+    int64_t tick_offset_us;    // controllers on different nodes are not in phase
+    int64_t parent_adv_us;
+    uint16_t parent_adv;
+    int64_t last_advert_us;
+    uint32_t min_rate_mps;
+    uint32_t coalesced;        // deferred reports replaced by a newer one
+    uint32_t state_attempts;
+    uint32_t state_refused;    // sim_send refused (queue full at the source)
+} node_t;
+
+typedef struct {
+    int nodes;
+    int fanout;
+    int64_t period_us;
+    int size;
+    int64_t cmd_every_us;
+    int64_t storm_at_us;
+    int64_t storm_us;
+    int root_conn;
+    int64_t dur_us;
+    bool flow;
+    sim_config_t sim_cfg;
+} params_t;
+
+// What --check compares across runs
+typedef struct {
+    uint32_t decreases;
+    uint32_t frames_lost;      // queue drops, loss drops and refused sends
+    uint32_t storm_acked;
+} run_result_t;
+
+typedef struct {
+    uint32_t sent;
+    uint32_t acked;
+    uint32_t n;
+    uint32_t rtt_us[MAX_RTTS];
+} rtt_set_t;
+
+static params_t P;
+static sim_t *sim;
+static node_t nodes[SIM_MAX_NODES];
+static int64_t cmd_sent_us[1 << 16];
+static uint16_t cmd_seq;
+static rtt_set_t rtt_calm, rtt_storm;
+static uint32_t state_delivered;
+
+static bool in_storm(int64_t t) {
+    return t >= P.storm_at_us && t < P.storm_at_us + P.storm_us + AFTER_STORM_US;
+}
+
+static int send_frame(int src, int dst, uint8_t kind, uint16_t arg, size_t len) {
+    uint8_t buf[1500];
+    memset(buf, 0, len);
+    buf[0] = kind;
+    buf[1] = (uint8_t)(arg >> 8);
+    buf[2] = (uint8_t)arg;
+    return sim_send(sim, src, dst, buf, len, SIM_TOS_P2P);
+}
+
+static void send_state(int i) {
+    nodes[i].state_attempts++;
+    if (send_frame(i, 0, FR_STATE, 0, (size_t)P.size) != 0) {
+        nodes[i].state_refused++;
+    }
+}
+
+// One state report: through the flow controller when enabled
+static void report_state(int i, int64_t now) {
+    node_t *n = &nodes[i];
+    if (!sim_is_connected(sim, i)) {
+        return;
+    }
+    if (!P.flow) {
+        send_state(i);
+        return;
+    }
+    if (n->pending) {
+        n->coalesced++;  // the waiting report is superseded by this one
+        return;
+    }
+    if (flow_admit(&n->fc, FLOW_CLASS_STATE, now) == FLOW_SEND) {
+        send_state(i);
+    } else {
+        n->pending = true;
+    }
+}
+
+static void deliver(void *ctx, int dst, int src, const uint8_t *data, size_t len, uint8_t tos) {
+    (void)ctx;
+    (void)len;
+    (void)tos;
+    int64_t now = sim_now(sim);
+    uint16_t arg = (uint16_t)(data[1] << 8 | data[2]);
+    switch (data[0]) {
+    case FR_STATE:
+        state_delivered++;
+        break;
+    case FR_CMD:
+        send_frame(dst, 0, FR_ACK, arg, 48);  // acks are control traffic: never throttled
+        break;
+    case FR_ACK: {
+        rtt_set_t *set = in_storm(cmd_sent_us[arg]) ? &rtt_storm : &rtt_calm;
+        if (set->n < MAX_RTTS) {
+            set->rtt_us[set->n++] = (uint32_t)(now - cmd_sent_us[arg]);
+        }
+        set->acked++;
+        break;
+    }
+    case FR_ADVERT:
+        if (src == sim_parent(sim, dst)) {
+            nodes[dst].parent_adv = arg;
+            nodes[dst].parent_adv_us = now;
+        }
+        break;
+    }
+}
+
+static void flow_tick(int i, int64_t now) {
+    node_t *n = &nodes[i];
+    uint16_t parent_q = now - n->parent_adv_us < ADVERT_TTL_US ? n->parent_adv : 0;
+    uint16_t local_q = sim_tx_pending(sim, i);
+    bool changed = flow_update(&n->fc, local_q, parent_q, now);
+    if (n->fc.rate_mps < n->min_rate_mps) {
+        n->min_rate_mps = n->fc.rate_mps;
+    }
+    // Tell children how deep our queue is when it changes state, and keep reminding them
+    if (changed || (n->fc.congested && now - n->last_advert_us >= ADVERT_US)) {
+        uint16_t q = flow_backlog(&n->fc);
+        for (int c = 1; c < P.nodes; c++) {
+            if (sim_parent(sim, c) == i) {
+                send_frame(i, c, FR_ADVERT, q, 16);
+            }
+        }
+        n->last_advert_us = now;
+    }
+    if (n->pending && sim_is_connected(sim, i) && flow_retry(&n->fc, now)) {
+        n->pending = false;
+        send_state(i);
+    }
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_rtt(const char *name, rtt_set_t *set) {
+    qsort(set->rtt_us, set->n, sizeof(uint32_t), cmp_u32);
+    uint32_t p50 = set->n ? set->rtt_us[(set->n - 1) / 2] : 0;
+    uint32_t p95 = set->n ? set->rtt_us[(set->n * 95 + 99) / 100 - 1] : 0;
+    uint32_t max = set->n ? set->rtt_us[set->n - 1] : 0;
+    printf("\"%s\":{\"sent\":%lu,\"acked\":%lu,\"p50_ms\":%.1f,\"p95_ms\":%.1f,\"max_ms\":%.1f}", name,
+           (unsigned long)set->sent, (unsigned long)set->acked, p50 / 1000.0, p95 / 1000.0, max / 1000.0);
+}
+
+// The root takes back its first root_conn children; the other subtrees hang off those
+static void regroup(void) {
+    int kept[SIM_MAX_NODES];
+    int n_kept = 0, n_moved = 0;
+    for (int i = 1; i < P.nodes; i++) {
+        if (sim_parent(sim, i) != 0) {
+            continue;
+        }
+        if (P.root_conn <= 0 || n_kept < P.root_conn) {
+            kept[n_kept++] = i;
+        } else {
+            sim_set_parent(sim, i, kept[n_moved++ % n_kept]);
+        }
+    }
+}
+
+static void run(run_mode_t mode, run_result_t *res) {
+    bool flow = mode != RUN_OFF;
+    P.flow = flow;
+    memset(nodes, 0, sizeof(nodes));
+    memset(&rtt_calm, 0, sizeof(rtt_calm));
+    memset(&rtt_storm, 0, sizeof(rtt_storm));
+    cmd_seq = 0;
+    state_delivered = 0;
+    sim = sim_create(&P.sim_cfg, deliver, NULL);
+    sim_build_tree(sim, P.nodes, P.fanout);
+
+    flow_config_t cfg;
+    flow_default_config(&cfg);
+    if (mode == RUN_PACE) {
+        cfg.high_water = UINT16_MAX;  // never congested: the rate only grows
+    }
+    for (int i = 0; i < P.nodes; i++) {
+        flow_init(&nodes[i].fc, &cfg, 0);
+        nodes[i].min_rate_mps = nodes[i].fc.rate_mps;
+        // Spread the periodic reports over the period like independently booted nodes
+        nodes[i].next_report_us = (int64_t)(sim_rand(sim) % (uint32_t)P.period_us);
+        nodes[i].tick_offset_us = (int64_t)(sim_rand(sim) % (TICK_US / 1000)) * 1000;
+    }
+
+    bool down = false;
+    int64_t next_cmd = 0;
+    for (int64_t t = 0; t <= P.dur_us; t += 1000) {
+        sim_run_until(sim, t);
+        if (!down && t >= P.storm_at_us && t < P.storm_at_us + P.storm_us) {
+            for (int i = 1; i < P.nodes; i++) {
+                if (sim_parent(sim, i) == 0) {
+                    sim_set_connected(sim, i, false);  // layer 2 drops: every subtree goes with it
+                }
+            }
+            down = true;
+        } else if (down && t >= P.storm_at_us + P.storm_us) {
+            regroup();
+            for (int i = 1; i < P.nodes; i++) {
+                sim_set_connected(sim, i, true);
+                if (flow) {
+                    flow_restart(&nodes[i].fc, t);
+                }
+            }
+            // PARENT_CONNECTED announce plus the answer to the root's status_request
+            for (int i = 1; i < P.nodes; i++) {
+                report_state(i, t);
+                report_state(i, t);
+            }
+            down = false;
+        }
+        if (t >= next_cmd) {
+            int dst = 1 + (int)(sim_rand(sim) % (uint32_t)(P.nodes - 1));
+            cmd_sent_us[cmd_seq] = t;
+            (in_storm(t) ? &rtt_storm : &rtt_calm)->sent++;
+            send_frame(0, dst, FR_CMD, cmd_seq, 64);
+            cmd_seq++;
+            next_cmd = t + P.cmd_every_us;
+        }
+        for (int i = 1; i < P.nodes; i++) {
+            if (t >= nodes[i].next_report_us) {
+                report_state(i, t);
+                nodes[i].next_report_us += P.period_us;
+            }
+            if (flow && (t + nodes[i].tick_offset_us) % TICK_US == 0) {
+                flow_tick(i, t);
+            }
+        }
+    }
+    sim_run_until(sim, P.dur_us + 2000000);
+
+    uint32_t attempts = 0, refused = 0, coalesced = 0, deferred = 0, retried = 0, decreases = 0;
+    uint32_t min_rate = UINT32_MAX;
+    uint32_t queue_drops = 0, loss_drops = 0, queue_max = 0;
+    for (int i = 0; i < P.nodes; i++) {
+        attempts += nodes[i].state_attempts;
+        refused += nodes[i].state_refused;
+        coalesced += nodes[i].coalesced;
+        deferred += nodes[i].fc.deferred;
+        retried += nodes[i].fc.retried;
+        decreases += nodes[i].fc.decreases;
+        if (i && nodes[i].min_rate_mps < min_rate) {
+            min_rate = nodes[i].min_rate_mps;
+        }
+        const sim_node_stats_t *st = sim_stats(sim, i);
+        queue_drops += st->queue_drops;
+        loss_drops += st->loss_drops;
+        if (st->queue_max > queue_max) {
+            queue_max = st->queue_max;
+        }
+    }
+    res->decreases = decreases;
+    res->frames_lost = queue_drops + loss_drops + refused;
+    res->storm_acked = rtt_storm.acked;
+    printf(" \"%s\":{\"state\":{\"sent\":%lu,\"refused\":%lu,\"delivered\":%lu,\"deferred\":%lu,\"retried\":%lu,"
+           "\"coalesced\":%lu},\n  \"mesh\":{\"queue_drops\":%lu,\"loss_drops\":%lu,\"queue_max\":%lu},\n"
+           "  \"flow\":{\"decreases\":%lu,\"min_rate_mps\":%lu},\n  ",
+           mode == RUN_AIMD ? "flow_on" : mode == RUN_PACE ? "pace_only" : "flow_off", (unsigned long)attempts, (unsigned long)refused,
+           (unsigned long)state_delivered, (unsigned long)deferred, (unsigned long)retried,
+           (unsigned long)coalesced, (unsigned long)queue_drops, (unsigned long)loss_drops,
+           (unsigned long)queue_max, (unsigned long)decreases, (unsigned long)(flow ? min_rate : 0));
+    print_rtt("cmd_calm", &rtt_calm);
+    printf(",\n  ");
+    print_rtt("cmd_storm", &rtt_storm);
+    printf("}");
+    sim_destroy(sim);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--nodes N] [--fanout F] [--period MS] [--size BYTES] [--cmd-every MS]\n"
+                    "          [--storm-at MS] [--storm-ms MS] [--root-conn N] [--dur MS] [--queue FRAMES]\n"
+                    "          [--loss PPM] [--flow on|off|pace|all] [--seed S] [--check 1]\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    P.nodes = 60;
+    P.fanout = 3;
+    P.period_us = 100000;
+    P.size = 600;
+    P.cmd_every_us = 50000;
+    P.storm_at_us = 10000000;
+    P.storm_us = 2000000;
+    P.root_conn = 1;
+    P.dur_us = 30000000;
+    sim_default_config(&P.sim_cfg);
+    const char *mode = "all";
+    bool check = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        const char *val = argv[++i];
+        if (strcmp(opt, "--nodes") == 0) P.nodes = atoi(val);
+        else if (strcmp(opt, "--fanout") == 0) P.fanout = atoi(val);
+        else if (strcmp(opt, "--period") == 0) P.period_us = atoll(val) * 1000;
+        else if (strcmp(opt, "--size") == 0) P.size = atoi(val);
+        else if (strcmp(opt, "--cmd-every") == 0) P.cmd_every_us = atoll(val) * 1000;
+        else if (strcmp(opt, "--storm-at") == 0) P.storm_at_us = atoll(val) * 1000;
+        else if (strcmp(opt, "--storm-ms") == 0) P.storm_us = atoll(val) * 1000;
+        else if (strcmp(opt, "--root-conn") == 0) P.root_conn = atoi(val);
+        else if (strcmp(opt, "--dur") == 0) P.dur_us = atoll(val) * 1000;
+        else if (strcmp(opt, "--queue") == 0) P.sim_cfg.queue_limit = (uint16_t)atoi(val);
+        else if (strcmp(opt, "--loss") == 0) P.sim_cfg.loss_ppm = (uint32_t)atoi(val);
+        else if (strcmp(opt, "--seed") == 0) P.sim_cfg.seed = (uint32_t)atoi(val);
+        else if (strcmp(opt, "--flow") == 0) mode = val;
+        else if (strcmp(opt, "--check") == 0) check = atoi(val) != 0;
+        else usage(argv[0]);
+    }
+    bool all = strcmp(mode, "all") == 0;
+    if (P.nodes < 2 || P.nodes > SIM_MAX_NODES || P.size < 16 || P.size > 1400 || P.period_us <= 0 ||
+        P.cmd_every_us <= 0 || P.root_conn < 0 ||
+        (!all && strcmp(mode, "on") && strcmp(mode, "off") && strcmp(mode, "pace")) || (check && !all)) {
+        usage(argv[0]);
+    }
+
+    printf("{\"params\":{\"nodes\":%d,\"fanout\":%d,\"period_ms\":%lld,\"size\":%d,\"cmd_every_ms\":%lld,"
+           "\"storm_at_ms\":%lld,\"storm_ms\":%lld,\"root_conn\":%d,\"dur_ms\":%lld,\"queue\":%u},\n",
+           P.nodes, P.fanout, (long long)(P.period_us / 1000), P.size, (long long)(P.cmd_every_us / 1000),
+           (long long)(P.storm_at_us / 1000), (long long)(P.storm_us / 1000), P.root_conn,
+           (long long)(P.dur_us / 1000), P.sim_cfg.queue_limit);
+    static const struct {
+        const char *name;
+        run_mode_t mode;
+    } runs[] = {{"off", RUN_OFF}, {"pace", RUN_PACE}, {"on", RUN_AIMD}};
+    run_result_t res[3] = {0};
+    bool first = true;
+    for (int r = 0; r < 3; r++) {
+        if (!all && strcmp(mode, runs[r].name) != 0) {
+            continue;
+        }
+        if (!first) {
+            printf(",\n");
+        }
+        run(runs[r].mode, &res[r]);
+        first = false;
+    }
+    printf("}\n");
+
+    if (check) {
+        const run_result_t *pace = &res[RUN_PACE], *aimd = &res[RUN_AIMD];
+        if (aimd->decreases == 0 || aimd->frames_lost >= pace->frames_lost) {
+            fprintf(stderr, "flow_sim: AIMD did not engage (%lu decreases) or lost no fewer frames than pacing "
+                            "alone (%lu vs %lu)\n",
+                    (unsigned long)aimd->decreases, (unsigned long)aimd->frames_lost,
+                    (unsigned long)pace->frames_lost);
+            return 1;
+        }
+    }
+    return 0;
+}
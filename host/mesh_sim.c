@@ -0,0 +1,380 @@
+#include <stdlib.h>
+#include <string.h>
+#include "mesh_sim.h"
+
+typedef struct sim_frame {
+    struct sim_frame *next;  // transmit queue link
+    int src;
+    int dst;
+    uint8_t tos;
+    uint8_t attempts;
+    size_t len;
+    uint8_t data[];
+} sim_frame_t;
+
+enum {
+    SIM_EV_TX_DONE,  // node finished one transmit attempt of its queue head
+    SIM_EV_ARRIVE,   // frame reaches node after a hop
+    SIM_EV_TIMER,
+};
+
+typedef struct {
+    int64_t t;
+    uint64_t order;  // FIFO among events at the same time
+    int kind;
+    int node;
+    sim_frame_t *frame;
+    sim_timer_fn fn;
+    void *ctx;
+} sim_event_t;
+
+typedef struct {
+    int parent;
+    bool connected;
+    bool busy;
+    sim_frame_t *q_head;
+    sim_frame_t *q_tail;
+    sim_node_stats_t st;
+} sim_node_t;
+
+struct sim {
+    sim_config_t cfg;
+    sim_deliver_fn deliver;
+    void *ctx;
+    sim_node_t nodes[SIM_MAX_NODES];
+    int n;
+    int64_t now;
+    sim_event_t *heap;
+    size_t heap_len;
+    size_t heap_cap;
+    uint64_t order;
+    uint32_t rng;
+};
+
+void sim_default_config(sim_config_t *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    // Roughly an ESP32 at a modest PHY rate: ~1.1 ms per 200-byte frame including contention
+    cfg->hop_delay_us = 300;
+    cfg->hop_jitter_us = 400;
+    cfg->frame_overhead_us = 700;
+    cfg->ns_per_byte = 2000;
+    cfg->queue_limit = 32;
+    cfg->loss_ppm = 5000;
+    cfg->max_retries = 3;
+    cfg->seed = 1;
+}
+
+uint32_t sim_rand(sim_t *s) {
+    // xorshift32
+    uint32_t x = s->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    s->rng = x;
+    return x;
+}
+
+static bool sim_ev_before(const sim_event_t *a, const sim_event_t *b) {
+    return a->t < b->t || (a->t == b->t && a->order < b->order);
+}
+
+static void sim_push(sim_t *s, sim_event_t ev) {
+    if (s->heap_len == s->heap_cap) {
+        s->heap_cap = s->heap_cap ? s->heap_cap * 2 : 256;
+        s->heap = realloc(s->heap, s->heap_cap * sizeof(sim_event_t));
+    }
+    ev.order = s->order++;
+    size_t i = s->heap_len++;
+    while (i > 0) {
+        size_t p = (i - 1) / 2;
+        if (!sim_ev_before(&ev, &s->heap[p])) {
+            break;
+        }
+        s->heap[i] = s->heap[p];
+        i = p;
+    }
+    s->heap[i] = ev;
+}
+
+static sim_event_t sim_pop(sim_t *s) {
+    sim_event_t top = s->heap[0];
+    sim_event_t last = s->heap[--s->heap_len];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= s->heap_len) {
+            break;
+        }
+        if (c + 1 < s->heap_len && sim_ev_before(&s->heap[c + 1], &s->heap[c])) {
+            c++;
+        }
+        if (!sim_ev_before(&s->heap[c], &last)) {
+            break;
+        }
+        s->heap[i] = s->heap[c];
+        i = c;
+    }
+    if (s->heap_len) {
+        s->heap[i] = last;
+    }
+    return top;
+}
+
+sim_t *sim_create(const sim_config_t *cfg, sim_deliver_fn deliver, void *ctx) {
+    sim_t *s = calloc(1, sizeof(*s));
+    s->cfg = *cfg;
+    s->deliver = deliver;
+    s->ctx = ctx;
+    s->rng = cfg->seed ? cfg->seed : 1;
+    return s;
+}
+
+static void sim_free_queue(sim_node_t *nd) {
+    while (nd->q_head) {
+        sim_frame_t *f = nd->q_head;
+        nd->q_head = f->next;
+        free(f);
+    }
+    nd->q_tail = NULL;
+}
+
+void sim_destroy(sim_t *s) {
+    for (size_t i = 0; i < s->heap_len; i++) {
+        if (s->heap[i].kind == SIM_EV_ARRIVE) {
+            free(s->heap[i].frame);
+        }
+    }
+    for (int i = 0; i < s->n; i++) {
+        sim_free_queue(&s->nodes[i]);
+    }
+    free(s->heap);
+    free(s);
+}
+
+void sim_build_tree(sim_t *s, int n, int fanout) {
+    if (n > SIM_MAX_NODES) n = SIM_MAX_NODES;
+    if (fanout < 1) fanout = 1;
+    s->n = n;
+    for (int i = 0; i < n; i++) {
+        memset(&s->nodes[i], 0, sizeof(s->nodes[i]));
+        s->nodes[i].parent = i == 0 ? -1 : (i - 1) / fanout;
+        s->nodes[i].connected = true;
+    }
+}
+
+int sim_node_count(const sim_t *s) {
+    return s->n;
+}
+
+int sim_parent(const sim_t *s, int node) {
+    return s->nodes[node].parent;
+}
+
+int sim_layer(const sim_t *s, int node) {
+    int layer = 1;
+    for (int p = s->nodes[node].parent; p >= 0 && layer <= SIM_MAX_NODES; p = s->nodes[p].parent) {
+        layer++;
+    }
+    return layer;
+}
+
+void sim_mac(int node, uint8_t mac[6]) {
+    static const uint8_t base[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
+    memcpy(mac, base, 6);
+    mac[5] = (uint8_t)node;
+}
+
+int sim_node_by_mac(const sim_t *s, const uint8_t mac[6]) {
+    uint8_t m[6];
+    for (int i = 0; i < s->n; i++) {
+        sim_mac(i, m);
+        if (memcmp(m, mac, 6) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool sim_is_ancestor(const sim_t *s, int a, int node) {
+    for (int p = s->nodes[node].parent; p >= 0; p = s->nodes[p].parent) {
+        if (p == a) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool sim_set_parent(sim_t *s, int node, int parent) {
+    if (node == 0 || node == parent || sim_is_ancestor(s, node, parent)) {
+        return false;
+    }
+    s->nodes[node].parent = parent;
+    return true;
+}
+
+void sim_set_connected(sim_t *s, int node, bool connected) {
+    s->nodes[node].connected = connected;
+}
+
+// A node can exchange frames only if it and every ancestor are connected
+bool sim_is_connected(const sim_t *s, int node) {
+    for (int p = node; p >= 0; p = s->nodes[p].parent) {
+        if (!s->nodes[p].connected) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Child of at on the path to dst if dst is below at, else at's parent
+static int sim_next_hop(const sim_t *s, int at, int dst) {
+    if (sim_is_ancestor(s, at, dst)) {
+        int c = dst;
+        while (s->nodes[c].parent != at) {
+            c = s->nodes[c].parent;
+        }
+        return c;
+    }
+    return s->nodes[at].parent;
+}
+
+static void sim_start_tx(sim_t *s, int node) {
+    sim_node_t *nd = &s->nodes[node];
+    sim_frame_t *f = nd->q_head;
+    nd->busy = true;
+    int64_t airtime = s->cfg.frame_overhead_us + (int64_t)f->len * s->cfg.ns_per_byte / 1000;
+    sim_push(s, (sim_event_t){.t = s->now + airtime, .kind = SIM_EV_TX_DONE, .node = node});
+}
+
+static bool sim_enqueue(sim_t *s, int node, sim_frame_t *f) {
+    sim_node_t *nd = &s->nodes[node];
+    if (nd->st.queue_len >= s->cfg.queue_limit) {
+        return false;
+    }
+    f->next = NULL;
+    f->attempts = 0;
+    if (nd->q_tail) {
+        nd->q_tail->next = f;
+    } else {
+        nd->q_head = f;
+    }
+    nd->q_tail = f;
+    nd->st.queue_len++;
+    if (nd->st.queue_len > nd->st.queue_max) {
+        nd->st.queue_max = nd->st.queue_len;
+    }
+    if (!nd->busy) {
+        sim_start_tx(s, node);
+    }
+    return true;
+}
+
+static sim_frame_t *sim_dequeue(sim_node_t *nd) {
+    sim_frame_t *f = nd->q_head;
+    nd->q_head = f->next;
+    if (!nd->q_head) {
+        nd->q_tail = NULL;
+    }
+    nd->st.queue_len--;
+    return f;
+}
+
+static void sim_tx_done(sim_t *s, int node) {
+    sim_node_t *nd = &s->nodes[node];
+    sim_frame_t *f = nd->q_head;
+    f->attempts++;
+    nd->st.tx_attempts++;
+
+    int next = sim_next_hop(s, node, f->dst);
+    bool reachable = next >= 0 && sim_is_connected(s, node) && sim_is_connected(s, next);
+    bool lost = !reachable || sim_rand(s) % 1000000 < s->cfg.loss_ppm;
+    if (lost && reachable && f->tos != SIM_TOS_DEF && f->attempts <= s->cfg.max_retries) {
+        nd->st.retries++;
+        sim_start_tx(s, node);
+        return;
+    }
+    sim_dequeue(nd);
+    if (lost) {
+        nd->st.loss_drops++;
+        free(f);
+    } else {
+        int64_t delay = s->cfg.hop_delay_us + (s->cfg.hop_jitter_us ? sim_rand(s) % s->cfg.hop_jitter_us : 0);
+        sim_push(s, (sim_event_t){.t = s->now + delay, .kind = SIM_EV_ARRIVE, .node = next, .frame = f});
+    }
+    if (nd->q_head) {
+        sim_start_tx(s, node);
+    } else {
+        nd->busy = false;
+    }
+}
+
+static void sim_arrive(sim_t *s, int node, sim_frame_t *f) {
+    sim_node_t *nd = &s->nodes[node];
+    if (node == f->dst) {
+        nd->st.delivered++;
+        s->deliver(s->ctx, node, f->src, f->data, f->len, f->tos);
+        free(f);
+        return;
+    }
+    if (!sim_is_connected(s, node) || !sim_enqueue(s, node, f)) {
+        nd->st.queue_drops++;
+        free(f);
+    }
+}
+
+int sim_send(sim_t *s, int src, int dst, const uint8_t *data, size_t len, uint8_t tos) {
+    if (dst < 0) {
+        dst = 0;
+    }
+    if (src == dst || dst >= s->n || !sim_is_connected(s, src)) {
+        s->nodes[src].st.send_refused++;
+        return -1;
+    }
+    sim_frame_t *f = malloc(sizeof(*f) + len);
+    f->src = src;
+    f->dst = dst;
+    f->tos = tos;
+    f->len = len;
+    memcpy(f->data, data, len);
+    if (!sim_enqueue(s, src, f)) {
+        s->nodes[src].st.send_refused++;
+        free(f);
+        return -1;
+    }
+    return 0;
+}
+
+uint16_t sim_tx_pending(const sim_t *s, int node) {
+    return s->nodes[node].st.queue_len;
+}
+
+void sim_schedule(sim_t *s, int64_t at_us, int node, sim_timer_fn fn, void *ctx) {
+    sim_push(s, (sim_event_t){.t = at_us, .kind = SIM_EV_TIMER, .node = node, .fn = fn, .ctx = ctx});
+}
+
+void sim_run_until(sim_t *s, int64_t t_us) {
+    while (s->heap_len && s->heap[0].t <= t_us) {
+        sim_event_t ev = sim_pop(s);
+        s->now = ev.t;
+        switch (ev.kind) {
+        case SIM_EV_TX_DONE:
+            sim_tx_done(s, ev.node);
+            break;
+        case SIM_EV_ARRIVE:
+            sim_arrive(s, ev.node, ev.frame);
+            break;
+        case SIM_EV_TIMER:
+            ev.fn(ev.ctx, ev.node);
+            break;
+        }
+    }
+    s->now = t_us;
+}
+
+int64_t sim_now(const sim_t *s) {
+    return s->now;
+}
+
+const sim_node_stats_t *sim_stats(const sim_t *s, int node) {
+    return &s->nodes[node].st;
+}
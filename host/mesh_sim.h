@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Discrete-event simulator of an ESP-MESH tree for running the portable firmware modules
+// (bench, timer wheel, ...) on a host.
+//
+// Every node has one radio: frames leaving a node, up or down the tree, share a FIFO
+// transmit queue and are sent one at a time (airtime = overhead + size * per-byte cost).
+// Each hop attempt can be lost; P2P/E2E frames are retried up to max_retries, DEF frames
+// are dropped. Per-hop jitter lets frames overtake each other, so reordering happens.
+
+#define SIM_MAX_NODES 64
+
+enum {
+    SIM_TOS_P2P = 0,
+    SIM_TOS_E2E = 1,
+    SIM_TOS_DEF = 2,
+};
+
+typedef struct {
+    uint32_t hop_delay_us;       // propagation + processing per hop
+    uint32_t hop_jitter_us;      // uniform extra delay per hop
+    uint32_t frame_overhead_us;  // per-attempt airtime independent of size (preamble, ack, backoff)
+    uint32_t ns_per_byte;        // airtime per byte
+    uint16_t queue_limit;        // frames per node transmit queue
+    uint32_t loss_ppm;           // per hop attempt
+    uint8_t max_retries;
+    uint32_t seed;
+} sim_config_t;
+
+typedef struct {
+    uint32_t tx_attempts;
+    uint32_t retries;
+    uint32_t queue_drops;    // frames dropped at a full transmit queue (relayed frames)
+    uint32_t loss_drops;     // frames dropped after exhausting retries
+    uint32_t send_refused;   // sim_send calls refused at the source (queue full)
+    uint16_t queue_len;
+    uint16_t queue_max;
+    uint32_t delivered;      // frames delivered to this node as destination
+} sim_node_stats_t;
+
+typedef struct sim sim_t;
+
+// Called when a frame reaches its destination node
+typedef void (*sim_deliver_fn)(void *ctx, int dst, int src, const uint8_t *data, size_t len, uint8_t tos);
+// Called for scheduled callbacks (sim_schedule)
+typedef void (*sim_timer_fn)(void *ctx, int node);
+
+void sim_default_config(sim_config_t *cfg);
+sim_t *sim_create(const sim_config_t *cfg, sim_deliver_fn deliver, void *ctx);
+void sim_destroy(sim_t *s);
+
+// Nodes 0..n-1; node 0 is the root, node i hangs off (i - 1) / fanout
+void sim_build_tree(sim_t *s, int n, int fanout);
+int sim_node_count(const sim_t *s);
+int sim_parent(const sim_t *s, int node);
+int sim_layer(const sim_t *s, int node);          // root = 1, like esp_mesh_get_layer()
+void sim_mac(int node, uint8_t mac[6]);           // 02:00:00:00:00:<node>
+int sim_node_by_mac(const sim_t *s, const uint8_t mac[6]);
+// Move a node (and its subtree) under another parent; fails if that would create a cycle
+bool sim_set_parent(sim_t *s, int node, int parent);
+// Detach a node from the tree: frames routed through it are dropped until it is re-attached
+void sim_set_connected(sim_t *s, int node, bool connected);
+bool sim_is_connected(const sim_t *s, int node);
+
+// Queue a frame at src for dst (-1 = root). Returns 0, or -1 if src's queue is full or
+// src is disconnected (the analogue of esp_mesh_send failing with MESH_DATA_NONBLOCK).
+int sim_send(sim_t *s, int src, int dst, const uint8_t *data, size_t len, uint8_t tos);
+uint16_t sim_tx_pending(const sim_t *s, int node);
+
+void sim_schedule(sim_t *s, int64_t at_us, int node, sim_timer_fn fn, void *ctx);
+// Process every event up to and including t_us; sim_now() is t_us afterwards
+void sim_run_until(sim_t *s, int64_t t_us);
+int64_t sim_now(const sim_t *s);
+
+const sim_node_stats_t *sim_stats(const sim_t *s, int node);
+uint32_t sim_rand(sim_t *s);
@@ -0,0 +1,208 @@
+// Times the edge rules interpreter (rules.c) as the firmware drives it: local events, signals
+// from other nodes and timer ticks dispatched against a full rule set. Compile and load
+// (what a push costs each node) are timed as well.
+//
+//   rules_bench [--rules N] [--match all|mixed] [--dispatches COUNT] [--rounds R] [--max-ns NS]
+//
+// "mixed" spreads the rules over events, signals from specific nodes and timers, like a real
+// rule set. "all" makes every rule a "signal *" rule, so each signal fires all of them: the
+// bound on one dispatch. Exits 1 if the slowest dispatch kind averages more than --max-ns.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rules.h"
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void node_mac(int node, uint8_t mac[6]) {
+    const uint8_t base[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
+    memcpy(mac, base, 6);
+    mac[5] = (uint8_t)(node + 1);
+}
+
+static int fmt_mac(char *buf, int node) {
+    uint8_t m[6];
+    node_mac(node, m);
+    return sprintf(buf, "%02x:%02x:%02x:%02x:%02x:%02x", m[0], m[1], m[2], m[3], m[4], m[5]);
+}
+
+// Groups of three over all RULES_MAX_NODES nodes, then the rules
+static void make_text(char *text, int rules, bool all) {
+    int n = 0;
+    for (int g = 0; g * 3 < RULES_MAX_NODES; g++) {
+        n += sprintf(text + n, "group %d", g + 1);
+        for (int i = g * 3; i < g * 3 + 3 && i < RULES_MAX_NODES; i++) {
+            text[n++] = ' ';
+            n += fmt_mac(text + n, i);
+        }
+        text[n++] = '\n';
+    }
+    static const char *const events[] = { "connected", "disconnected", "root", "led_on", "led_off" };
+    for (int r = 0; r < rules; r++) {
+        int groups = (RULES_MAX_NODES + 2) / 3;
+        if (all) {
+            n += sprintf(text + n, "on signal * do signal %d to %d\n", r + 1, r % groups + 1);
+            continue;
+        }
+        switch (r % 4) {
+        case 0:
+            n += sprintf(text + n, "on event %s do led toggle\n", events[r / 4 % 5]);
+            break;
+        case 1:
+            n += sprintf(text + n, "on signal %d from ", r % 5 + 1);
+            n += fmt_mac(text + n, r % RULES_MAX_NODES);
+            n += sprintf(text + n, " do signal %d to %d cooldown 200\n", r + 1, r % groups + 1);
+            break;
+        case 2:
+            n += sprintf(text + n, "on signal %d do led on\n", r % 5 + 1);
+            break;
+        default:
+            n += sprintf(text + n, "on timer %d do signal %d to %d\n", 1000 * (r % 3 + 1), r + 1, r % groups + 1);
+            break;
+        }
+    }
+    text[n] = '\0';
+}
+
+static unsigned long actions;
+
+static void count_action(void *ctx, const rule_action_t *a) {
+    (void)ctx;
+    (void)a;
+    actions++;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--rules N] [--match all|mixed] [--dispatches COUNT] [--rounds R] [--max-ns NS]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int nrules = RULES_MAX;
+    bool all = false;
+    int count = 4096;
+    int rounds = 200;
+    double max_ns = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        const char *val = argv[++i];
+        if (strcmp(opt, "--rules") == 0) nrules = atoi(val);
+        else if (strcmp(opt, "--dispatches") == 0) count = atoi(val);
+        else if (strcmp(opt, "--rounds") == 0) rounds = atoi(val);
+        else if (strcmp(opt, "--max-ns") == 0) max_ns = atof(val);
+        else if (strcmp(opt, "--match") == 0) {
+            if (strcmp(val, "all") == 0) all = true;
+            else if (strcmp(val, "mixed") != 0) usage(argv[0]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (nrules < 1 || nrules > RULES_MAX || count < 1 || rounds < 1) {
+        usage(argv[0]);
+    }
+
+    static char text[4096];
+    make_text(text, nrules, all);
+    uint8_t blob[RULES_BLOB_MAX];
+    const char *why;
+    int line;
+    int len = 0;
+    int64_t t0 = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        len = rules_compile(text, blob, sizeof(blob), &why, &line);
+    }
+    double compile_ns = (double)(now_ns() - t0) / rounds;
+    if (len < 0) {
+        fprintf(stderr, "rules_bench: line %d: %s\n%s", line, why, text);
+        return 2;
+    }
+
+    static rules_t rs;
+    rules_init(&rs, count_action, NULL);
+    t0 = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        why = rules_load(&rs, 1, blob, len, 0);
+    }
+    double load_ns = (double)(now_ns() - t0) / rounds;
+    if (why) {
+        fprintf(stderr, "rules_bench: load: %s\n", why);
+        return 2;
+    }
+
+    // Inputs drawn once so the timed loops only dispatch
+    uint8_t *evs = malloc(count);
+    uint8_t *sigs = malloc(count);
+    uint8_t (*srcs)[6] = malloc((size_t)count * 6);
+    uint32_t rnd = 1;
+    for (int i = 0; i < count; i++) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 17;
+        rnd ^= rnd << 5;
+        evs[i] = (uint8_t)(1 + rnd % (RULE_EV_COUNT - 1));
+        sigs[i] = (uint8_t)(1 + (rnd >> 8) % 5);
+        node_mac((int)((rnd >> 16) % RULES_MAX_NODES), srcs[i]);
+    }
+
+    // Timestamps advance 1 s per dispatch so cooldowns do not hide the work
+    uint32_t now = 0;
+    t0 = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < count; i++) {
+            rules_event(&rs, evs[i], 0, now += 1000);
+        }
+    }
+    double event_ns = (double)(now_ns() - t0) / ((double)rounds * count);
+    unsigned long event_actions = actions;
+
+    actions = 0;
+    t0 = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < count; i++) {
+            rules_signal(&rs, srcs[i], sigs[i], 0, now += 1000);
+        }
+    }
+    double signal_ns = (double)(now_ns() - t0) / ((double)rounds * count);
+    unsigned long signal_actions = actions;
+
+    actions = 0;
+    t0 = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < count; i++) {
+            rules_tick(&rs, now += 1000);
+        }
+    }
+    double tick_ns = (double)(now_ns() - t0) / ((double)rounds * count);
+    unsigned long tick_actions = actions;
+
+    double n = (double)rounds * count;
+    printf("{\"rules\":%d,\"match\":\"%s\",\"blob_bytes\":%d,\"dispatches\":%d,\"rounds\":%d,\n"
+           " \"compile_us\":%.2f,\"load_ns\":%.1f,\n"
+           " \"event\":{\"ns\":%.1f,\"actions_per_dispatch\":%.2f},\n"
+           " \"signal\":{\"ns\":%.1f,\"actions_per_dispatch\":%.2f},\n"
+           " \"tick\":{\"ns\":%.1f,\"actions_per_dispatch\":%.2f},\n"
+           " \"cooled\":%lu}\n",
+           nrules, all ? "all" : "mixed", len, count, rounds, compile_ns / 1000, load_ns,
+           event_ns, event_actions / n, signal_ns, signal_actions / n, tick_ns, tick_actions / n,
+           (unsigned long)rs.cooled);
+    free(evs);
+    free(sigs);
+    free(srcs);
+
+    double worst = event_ns > signal_ns ? event_ns : signal_ns;
+    worst = tick_ns > worst ? tick_ns : worst;
+    if (max_ns > 0 && worst > max_ns) {
+        fprintf(stderr, "rules_bench: %.1f ns/dispatch exceeds limit of %.1f\n", worst, max_ns);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,472 @@
+// Replays recorded heartbeat/status_response/led_toggle traffic through the firmware's
+// receive path (rx_dispatch.c, the function rx_task calls, with the root's registry and
+// topology updates as handlers) and reports ns/msg and heap allocations. The pre-refactor
+// rx_task (strstr chain, sscanf MAC parsing, snprintf/strcmp registry lookup) runs on the
+// same input for comparison.
+//
+//   rx_bench [--nodes N] [--mix HB:SR:LT] [--msgs COUNT] [--rounds R]
+//            [--max-ns NS] [--max-allocs N]
+//
+// Exits 1 if the firmware path is slower than --max-ns per message or allocates more
+// than --max-allocs times, so the host build can gate on it.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mesh_msg.h"
+#include "node_registry.h"
+#include "rx_dispatch.h"
+#include "topology.h"
+
+// glibc-only: count heap traffic while the timed loop runs
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+static volatile int counting;
+static unsigned long alloc_count;
+
+void *malloc(size_t size) {
+    if (counting) alloc_count++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    if (counting) alloc_count++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    if (counting) alloc_count++;
+    return __libc_realloc(p, size);
+}
+
+#define MAX_MSGS 4096
+#define MSG_LEN  320   // firmware status buffer size
+
+static char msgs[MAX_MSGS][MSG_LEN];
+static size_t msg_len[MAX_MSGS];
+static uint8_t routes[MAX_MSGS][6];
+static const uint8_t self_mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+static void node_mac(int node, uint8_t mac[6]) {
+    memcpy(mac, self_mac, 6);
+    mac[5] = (uint8_t)node;
+}
+
+// Same shape as format_status()/send_heartbeat() in the firmware; node 0 is the root,
+// node i hangs off (i - 1) / 3
+static size_t format_msg(char *buf, int kind, int node, int nodes, uint32_t rnd) {
+    uint8_t m[6];
+    node_mac(node, m);
+    if (kind == 2) {
+        return snprintf(buf, MSG_LEN, "{\"cmd\":\"led_toggle\",\"target_mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\"}",
+                        m[0], m[1], m[2], m[3], m[4], m[5]);
+    }
+    int layer = 1;
+    for (int p = node; p > 0; p = (p - 1) / 3) layer++;
+    char parent[18] = "";
+    if (layer > 1) {
+        uint8_t p[6];
+        node_mac((node - 1) / 3, p);
+        snprintf(parent, sizeof(parent), "%02x:%02x:%02x:%02x:%02x:%02x", p[0], p[1], p[2], p[3], p[4], p[5]);
+    }
+    char children[6 * 13 + 1] = "";
+    int cn = 0;
+    for (int c = node * 3 + 1; c <= node * 3 + 3 && c < nodes; c++) {
+        uint8_t cm[6];
+        node_mac(c, cm);
+        cn += snprintf(children + cn, sizeof(children) - cn, "%s%02x%02x%02x%02x%02x%02x",
+                       cn ? "," : "", cm[0], cm[1], cm[2], cm[3], cm[4], cm[5]);
+    }
+    int n = snprintf(buf, MSG_LEN,
+        "{\"cmd\":\"%s\",\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"led_state\":%s,\"layer\":%d,\"rssi\":%d,"
+        "\"parent\":\"%s\",\"children\":\"%s\"",
+        kind == 0 ? "heartbeat" : "status_response", m[0], m[1], m[2], m[3], m[4], m[5],
+        rnd & 1 ? "true" : "false", layer, -40 - (int)(rnd % 50), parent, children);
+    if (kind == 0) {
+        n += snprintf(buf + n, MSG_LEN - n, ",\"join_ms\":%d,\"reg_ms\":%d", 900 + (int)(rnd % 400),
+                      1100 + (int)(rnd % 600));
+    }
+    n += snprintf(buf + n, MSG_LEN - n, "}");
+    return (size_t)n;
+}
+
+// Firmware path: rx_dispatch, the function rx_task calls per JSON frame, with the root's
+// status handling (registry + topology, as handle_status_report) and the led_toggle ack
+typedef struct {
+    node_registry_t *reg;
+    topo_t *topo;
+    uint32_t now;
+    uint32_t sink;
+} fw_ctx_t;
+
+static void fw_on_status(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    fw_ctx_t *c = ctx;
+    bool is_new;
+    node_info_t *node = registry_apply_status(c->reg, m, f->from, 2, c->now, &is_new);
+    if (!node) {
+        return;
+    }
+    if (m->has_tree) {
+        if (m->has_parent) {
+            topo_set_parent(c->topo, node->mac, m->parent);
+        }
+        topo_set_children(c->topo, node->mac, (const uint8_t (*)[6])m->children, m->child_count);
+        topo_set_rssi(c->topo, node->mac, m->rssi);
+    }
+    c->sink += (uint32_t)node->layer;
+}
+
+static void fw_on_led_toggle(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    (void)f;
+    fw_ctx_t *c = ctx;
+    c->sink += m->has_target;
+}
+
+// Pre-refactor path, ported from rx_task as it was: copy into a local buffer, a strstr chain
+// over the command names, fields via strstr + atoi, MACs via sscanf, the registry searched by
+// memcmp and then again by snprintf + strcmp, and an esp_wifi_get_mac() (memcpy here) per
+// lookup. Handlers that send or log are left out, as they are on the firmware side.
+#define LEGACY_RX_BUF_SZ 512
+
+typedef struct {
+    uint8_t mac[6];
+    uint32_t last_seen;
+    int layer;
+    bool is_active;
+    bool led_state;
+    int rssi;
+    int join_ms;
+    int reg_ms;
+    uint8_t last_from[6];
+    bool has_route;
+} legacy_node_t;
+
+static legacy_node_t legacy_nodes[REGISTRY_MAX_NODES];
+static int legacy_count;
+static topo_t legacy_topo;
+
+static bool legacy_parse_mac_hex12(const char *s, uint8_t out[6]) {
+    for (int i = 0; i < 12; i++) {
+        char c = s[i];
+        int v;
+        if (c >= '0' && c <= '9') v = c - '0';
+        else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+        else return false;
+        if (i % 2 == 0) out[i / 2] = (uint8_t)(v << 4);
+        else out[i / 2] |= (uint8_t)v;
+    }
+    return true;
+}
+
+static bool legacy_parse_mac_str(const char *s, uint8_t out[6]) {
+    if (!s) return false;
+    int vals[6];
+    if (sscanf(s, "%x:%x:%x:%x:%x:%x", &vals[0], &vals[1], &vals[2], &vals[3], &vals[4], &vals[5]) != 6) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) {
+        out[i] = (uint8_t)vals[i];
+    }
+    return true;
+}
+
+static void legacy_add_or_update_node(const uint8_t addr[6], int layer, uint32_t now) {
+    if (layer < 1) {
+        return;
+    }
+    uint8_t self_wifi_mac[6];
+    memcpy(self_wifi_mac, self_mac, 6);
+    if (memcmp(self_wifi_mac, addr, 6) == 0) {
+        return;
+    }
+    for (int i = 0; i < legacy_count; i++) {
+        if (memcmp(legacy_nodes[i].mac, addr, 6) == 0) {
+            legacy_nodes[i].last_seen = now;
+            legacy_nodes[i].layer = layer;
+            legacy_nodes[i].is_active = true;
+            return;
+        }
+    }
+    if (legacy_count == REGISTRY_MAX_NODES) {
+        return;
+    }
+    legacy_node_t *node = &legacy_nodes[legacy_count++];
+    memset(node, 0, sizeof(*node));
+    memcpy(node->mac, addr, 6);
+    node->last_seen = now;
+    node->layer = layer;
+    node->is_active = true;
+    node->rssi = -127;
+    node->join_ms = -1;
+    node->reg_ms = -1;
+}
+
+static void legacy_topology_apply_report(const uint8_t mac[6], const char *msg, int rssi) {
+    const char *parent_ptr = strstr(msg, "\"parent\":\"");
+    const char *children_ptr = strstr(msg, "\"children\":\"");
+    if (!parent_ptr || !children_ptr) {
+        return;
+    }
+    uint8_t parent[6];
+    bool has_parent = parent_ptr[10] != '"' && legacy_parse_mac_str(parent_ptr + 10, parent);
+
+    uint8_t children[MESH_MSG_MAX_CHILDREN][6];
+    int n = 0;
+    const char *c = children_ptr + 12;
+    while (*c != '"' && n < MESH_MSG_MAX_CHILDREN && legacy_parse_mac_hex12(c, children[n])) {
+        n++;
+        c += 12;
+        if (*c == ',') c++;
+    }
+    if (has_parent) {
+        topo_set_parent(&legacy_topo, mac, parent);
+    }
+    topo_set_children(&legacy_topo, mac, (const uint8_t (*)[6])children, n);
+    topo_set_rssi(&legacy_topo, mac, rssi);
+}
+
+static uint32_t legacy_dispatch(const char *buf, size_t len, const uint8_t route[6], uint32_t now) {
+    legacy_add_or_update_node(route, -1, now);
+
+    char msg_copy[LEGACY_RX_BUF_SZ];
+    int copy_len = (len < sizeof(msg_copy) - 1) ? (int)len : (int)sizeof(msg_copy) - 1;
+    memcpy(msg_copy, buf, copy_len);
+    msg_copy[copy_len] = '\0';
+
+    if (strstr(msg_copy, "\"cmd\":\"ping\"")) {
+    } else if (strstr(msg_copy, "\"cmd\":\"pong\"")) {
+    } else if (strstr(msg_copy, "\"cmd\":\"bench_start\"")) {
+    } else if (strstr(msg_copy, "\"cmd\":\"bench_stop\"")) {
+    } else if (strstr(msg_copy, "\"cmd\":\"bench_report\"")) {
+    } else if (strstr(msg_copy, "\"cmd\":\"bench_result\"")) {
+    } else if (strstr(msg_copy, "\"cmd\":\"toggle\"") || strstr(msg_copy, "\"cmd\":\"led_toggle\"")) {
+        char *target_mac_start = strstr(msg_copy, "\"target_mac\":\"");
+        if (target_mac_start) {
+            target_mac_start += 14;
+            char target_mac[18];
+            strncpy(target_mac, target_mac_start, 17);
+            target_mac[17] = '\0';
+            uint8_t self_addr[6];
+            memcpy(self_addr, self_mac, 6);
+            char self_str[18];
+            snprintf(self_str, sizeof(self_str), "%02x:%02x:%02x:%02x:%02x:%02x",
+                     self_addr[0], self_addr[1], self_addr[2], self_addr[3], self_addr[4], self_addr[5]);
+            // led_toggle() + send_status_response() when it matches
+            return strncmp(target_mac, self_str, 17) == 0 ? 1 : 0;
+        }
+        return 1;
+    } else if (strstr(msg_copy, "\"cmd\":\"status_request\"")) {
+    } else if (strstr(msg_copy, "\"cmd\":\"status_response\"")) {
+        char *mac_start = strstr(msg_copy, "\"mac\":\"");
+        if (!mac_start) {
+            return 0;
+        }
+        mac_start += 7;
+        char resp_mac[18];
+        strncpy(resp_mac, mac_start, 17);
+        resp_mac[17] = '\0';
+        int resp_layer = -1;
+        char *layer_ptr = strstr(msg_copy, "\"layer\":");
+        if (layer_ptr) {
+            resp_layer = atoi(layer_ptr + 8);
+        }
+        uint8_t mac_bytes[6];
+        if (legacy_parse_mac_str(resp_mac, mac_bytes)) {
+            legacy_add_or_update_node(mac_bytes, resp_layer > 0 ? resp_layer : 2, now);
+            char *rssi_ptr = strstr(msg_copy, "\"rssi\":");
+            legacy_topology_apply_report(mac_bytes, msg_copy, rssi_ptr ? atoi(rssi_ptr + 7) : -127);
+            for (int i = 0; i < legacy_count; i++) {
+                if (memcmp(legacy_nodes[i].mac, mac_bytes, 6) == 0) {
+                    memcpy(legacy_nodes[i].last_from, route, 6);
+                    legacy_nodes[i].has_route = true;
+                    break;
+                }
+            }
+        }
+        bool resp_led_state = strstr(msg_copy, "\"led_state\":true") != NULL;
+        int resp_rssi = -127;
+        char *rssi_ptr = strstr(msg_copy, "\"rssi\":");
+        if (rssi_ptr) {
+            resp_rssi = atoi(rssi_ptr + 7);
+        }
+        uint32_t layer = 0;
+        for (int i = 0; i < legacy_count; i++) {
+            char node_mac[18];
+            const uint8_t *h = legacy_nodes[i].mac;
+            snprintf(node_mac, sizeof(node_mac), "%02x:%02x:%02x:%02x:%02x:%02x", h[0], h[1], h[2], h[3], h[4], h[5]);
+            if (strcmp(node_mac, resp_mac) == 0) {
+                legacy_nodes[i].led_state = resp_led_state;
+                legacy_nodes[i].rssi = resp_rssi;
+                layer = (uint32_t)legacy_nodes[i].layer;
+            }
+        }
+        return layer;
+    } else if (strstr(msg_copy, "\"cmd\":\"heartbeat\"")) {
+        char *mac_start = strstr(msg_copy, "\"mac\":\"");
+        if (!mac_start) {
+            return 0;
+        }
+        mac_start += 7;
+        char hb_mac[18];
+        strncpy(hb_mac, mac_start, 17);
+        hb_mac[17] = '\0';
+        int hb_layer = -1;
+        char *layer_ptr = strstr(msg_copy, "\"layer\":");
+        if (layer_ptr) {
+            hb_layer = atoi(layer_ptr + 8);
+        }
+        bool hb_led_state = strstr(msg_copy, "\"led_state\":true") != NULL;
+        int hb_rssi = -127;
+        char *rssi_ptr = strstr(msg_copy, "\"rssi\":");
+        if (rssi_ptr) {
+            hb_rssi = atoi(rssi_ptr + 7);
+        }
+        char *join_ptr = strstr(msg_copy, "\"join_ms\":");
+        char *reg_ptr = strstr(msg_copy, "\"reg_ms\":");
+        uint8_t mac_bytes[6];
+        if (!legacy_parse_mac_str(hb_mac, mac_bytes)) {
+            return 0;
+        }
+        legacy_add_or_update_node(mac_bytes, hb_layer > 0 ? hb_layer : 2, now);
+        legacy_topology_apply_report(mac_bytes, msg_copy, hb_rssi);
+        for (int i = 0; i < legacy_count; i++) {
+            if (memcmp(legacy_nodes[i].mac, mac_bytes, 6) == 0) {
+                memcpy(legacy_nodes[i].last_from, route, 6);
+                legacy_nodes[i].has_route = true;
+                legacy_nodes[i].led_state = hb_led_state;
+                legacy_nodes[i].rssi = hb_rssi;
+                legacy_nodes[i].join_ms = join_ptr ? atoi(join_ptr + 10) : -1;
+                legacy_nodes[i].reg_ms = reg_ptr ? atoi(reg_ptr + 9) : -1;
+                return (uint32_t)legacy_nodes[i].layer;
+            }
+        }
+    } else if (strstr(msg_copy, "\"cmd\":\"join_ack\"")) {
+    }
+    return 0;
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--nodes N] [--mix HB:SR:LT] [--msgs COUNT] [--rounds R] [--max-ns NS] [--max-allocs N]\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int nodes = REGISTRY_MAX_NODES;
+    int mix[3] = {80, 15, 5};  // heartbeat : status_response : led_toggle
+    int count = 2048;
+    int rounds = 200;
+    double max_ns = 0;
+    long max_allocs = -1;
+
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        const char *val = argv[++i];
+        if (strcmp(opt, "--nodes") == 0) nodes = atoi(val);
+        else if (strcmp(opt, "--msgs") == 0) count = atoi(val);
+        else if (strcmp(opt, "--rounds") == 0) rounds = atoi(val);
+        else if (strcmp(opt, "--max-ns") == 0) max_ns = atof(val);
+        else if (strcmp(opt, "--max-allocs") == 0) max_allocs = atol(val);
+        else if (strcmp(opt, "--mix") == 0) {
+            if (sscanf(val, "%d:%d:%d", &mix[0], &mix[1], &mix[2]) != 3) usage(argv[0]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    int total = mix[0] + mix[1] + mix[2];
+    if (nodes < 2 || nodes > REGISTRY_MAX_NODES + 1 || count < 1 || count > MAX_MSGS || rounds < 1 || total <= 0) {
+        usage(argv[0]);
+    }
+
+    // Record the traffic once; the replay only touches the receive path
+    uint32_t rnd = 1;
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 17;
+        rnd ^= rnd << 5;
+        int pick = (int)(rnd % (uint32_t)total);
+        int kind = pick < mix[0] ? 0 : pick < mix[0] + mix[1] ? 1 : 2;
+        int node = 1 + (int)((rnd >> 8) % (uint32_t)(nodes - 1));
+        msg_len[i] = format_msg(msgs[i], kind, node, nodes, rnd >> 16);
+        node_mac(node, routes[i]);  // esp_mesh_recv reports the originating node
+        bytes += msg_len[i];
+    }
+
+    node_registry_t *reg = calloc(1, sizeof(*reg));
+    registry_init(reg, self_mac, NULL, NULL);
+    topo_t *topo = calloc(1, sizeof(*topo));
+    topo_init(topo, self_mac);
+    topo_init(&legacy_topo, self_mac);
+    fw_ctx_t fw = { .reg = reg, .topo = topo };
+    rx_dispatch_t *rx = calloc(1, sizeof(*rx));
+    rx_dispatch_init(rx, self_mac, &fw);
+    rx->is_root = true;
+    rx->on[MESH_MSG_HEARTBEAT] = fw_on_status;
+    rx->on[MESH_MSG_STATUS_RESPONSE] = fw_on_status;
+    rx->on[MESH_MSG_LED_TOGGLE] = fw_on_led_toggle;
+    uint32_t sink = 0;
+
+    counting = 1;
+    alloc_count = 0;
+    int64_t t0 = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < count; i++) {
+            rx_frame_t f = { .raw = msgs[i], .len = msg_len[i], .from = routes[i], .src = routes[i] };
+            fw.now = (uint32_t)(r * count + i);
+            rx_dispatch(rx, &f);
+        }
+    }
+    int64_t fw_ns = now_ns() - t0;
+    unsigned long fw_allocs = alloc_count;
+    sink += fw.sink;
+
+    alloc_count = 0;
+    t0 = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < count; i++) {
+            sink += legacy_dispatch(msgs[i], msg_len[i], routes[i], (uint32_t)(r * count + i));
+        }
+    }
+    int64_t legacy_ns = now_ns() - t0;
+    unsigned long legacy_allocs = alloc_count;
+    counting = 0;
+
+    double n_msgs = (double)count * rounds;
+    double fw_per = fw_ns / n_msgs;
+    double legacy_per = legacy_ns / n_msgs;
+    printf("{\"nodes\":%d,\"mix\":\"%d:%d:%d\",\"msgs\":%d,\"rounds\":%d,\"avg_bytes\":%.1f,\"registered\":%d,\n"
+           " \"firmware\":{\"ns_per_msg\":%.1f,\"allocs\":%lu},\n"
+           " \"legacy\":{\"ns_per_msg\":%.1f,\"allocs\":%lu},\n"
+           " \"speedup\":%.2f,\"check\":%lu}\n",
+           nodes, mix[0], mix[1], mix[2], count, rounds, (double)bytes / count, reg->count,
+           fw_per, fw_allocs, legacy_per, legacy_allocs, legacy_per / fw_per, (unsigned long)sink);
+    free(rx);
+    free(topo);
+    free(reg);
+
+    int rc = 0;
+    if (max_ns > 0 && fw_per > max_ns) {
+        fprintf(stderr, "rx_bench: %.1f ns/msg exceeds limit of %.1f\n", fw_per, max_ns);
+        rc = 1;
+    }
+    if (max_allocs >= 0 && (long)fw_allocs > max_allocs) {
+        fprintf(stderr, "rx_bench: %lu allocations exceed limit of %ld\n", fw_allocs, max_allocs);
+        rc = 1;
+    }
+    return rc;
+}
@@ -0,0 +1,363 @@
+// Mesh time sync in the mesh simulator with injected clock drift (main/time_sync.c).
+//
+// Every node's crystal is off by a random rate within +-drift ppm and every node booted at
+// a different time, so local clocks start up to a second apart and walk away from each
+// other. Once per --period each node runs one exchange with the root (the firmware starts
+// these on the root's time_sync broadcast, each node after its own random delay; here every
+// node is given a random phase). Receive timestamps are taken up to --ts-jitter late, like
+// rx_task waking up after the radio. Background reports (--load-ms) add queueing, which
+// makes the two directions of a path unequal.
+//
+// Once a second the true error of every synced node's mesh time is sampled. Every
+// --action-every the root schedules a group action --lead ms ahead and floods it down the
+// tree; the sim records when each node runs it and compares with running it on receipt.
+//
+//   time_sim [--nodes N] [--fanout F] [--drift PPM] [--period MS] [--ts-jitter US]
+//            [--load-ms MS] [--load-size BYTES] [--action-every MS] [--lead MS]
+//            [--dur MS] [--loss PPM] [--seed S]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mesh_sim.h"
+#include "time_sync.h"
+
+#define SAMPLE_US   1000000
+#define MAX_SAMPLES 65536
+#define MAX_ACTIONS 1024
+#define MAX_LAYER   8
+
+enum {
+    FR_REQ = 1,
+    FR_RESP,
+    FR_ACTION,
+    FR_LOAD,
+};
+
+typedef struct {
+    uint8_t kind;
+    uint16_t seq;
+    int64_t t1;
+    int64_t t2;
+    int64_t t3;
+    int64_t at;
+} frame_t;
+
+typedef struct {
+    time_sync_t ts;
+    double drift_ppm;
+    int64_t boot_us;        // local clock reads boot_us at sim time 0
+    int64_t next_sync_us;
+    int64_t next_load_us;
+    int64_t req_t1;         // outstanding request (0 = none)
+} node_t;
+
+typedef struct {
+    int64_t send_us;
+    int64_t at_mesh;
+    int64_t recv_min, recv_max;   // on receipt
+    int64_t exec_min, exec_max;   // scheduled
+    int got;
+    int late;                     // arrived after the execute-at time
+} action_t;
+
+typedef struct {
+    int nodes;
+    int fanout;
+    double drift_ppm;
+    int64_t period_us;
+    uint32_t ts_jitter_us;
+    int64_t load_us;
+    int load_size;
+    int64_t action_every_us;
+    int64_t lead_us;
+    int64_t dur_us;
+    sim_config_t sim_cfg;
+} params_t;
+
+typedef struct {
+    uint32_t n;
+    uint32_t v[MAX_SAMPLES];
+} set_t;
+
+// Replies leave the root after its receive and processing delay (sim_schedule context)
+typedef struct {
+    int dst;
+    frame_t f;
+} reply_t;
+
+#define MAX_REPLIES 1024
+
+static params_t P;
+static reply_t replies[MAX_REPLIES];
+static unsigned reply_head;
+static sim_t *sim;
+static node_t nodes[SIM_MAX_NODES];
+static action_t actions[MAX_ACTIONS];
+static int action_count;
+static set_t err_all, err_layer[MAX_LAYER + 1], spread_recv, spread_exec;
+
+// Local clock of node i at sim time t
+static int64_t local_at(int i, int64_t t) {
+    return nodes[i].boot_us + t + (int64_t)((double)t * nodes[i].drift_ppm / 1e6);
+}
+
+// Sim time at which node i's local clock reads l
+static int64_t sim_at_local(int i, int64_t l) {
+    return (int64_t)((double)(l - nodes[i].boot_us) / (1.0 + nodes[i].drift_ppm / 1e6));
+}
+
+// A receive timestamp: the frame is noticed a little after it arrived
+static int64_t rx_stamp(int i, int64_t t) {
+    return local_at(i, t + (P.ts_jitter_us ? sim_rand(sim) % P.ts_jitter_us : 0));
+}
+
+// Mesh time is the root's clock
+static int64_t mesh_now(int i, int64_t t) {
+    return i == 0 ? local_at(0, t) : ts_to_mesh(&nodes[i].ts, local_at(i, t));
+}
+
+static void add(set_t *s, int64_t v) {
+    if (s->n < MAX_SAMPLES) {
+        s->v[s->n++] = (uint32_t)(v < 0 ? -v : v);
+    }
+}
+
+static void send(int src, int dst, const frame_t *f, size_t len) {
+    uint8_t buf[1500];
+    memset(buf, 0, len);
+    memcpy(buf, f, sizeof(*f));
+    sim_send(sim, src, dst, buf, len < sizeof(*f) ? sizeof(*f) : len, SIM_TOS_P2P);
+}
+
+// Group commands travel like a mesh broadcast: every node passes them on to its children
+static void flood(int i, const frame_t *f) {
+    for (int c = 1; c < P.nodes; c++) {
+        if (sim_parent(sim, c) == i) {
+            send(i, c, f, 64);
+        }
+    }
+}
+
+static void send_reply(void *ctx, int node) {
+    const reply_t *r = ctx;
+    send(node, r->dst, &r->f, 96);
+}
+
+static void run_action(int i, const frame_t *f, int64_t now) {
+    action_t *a = &actions[f->seq];
+    // The firmware arms an esp_timer for the local time that matches the mesh time
+    int64_t exec = now;
+    int64_t local_target = i == 0 ? f->at : ts_to_local(&nodes[i].ts, f->at);
+    int64_t t = sim_at_local(i, local_target);
+    if (t > now) {
+        exec = t;
+    } else {
+        a->late++;
+    }
+    if (!a->got) {
+        a->recv_min = a->recv_max = now;
+        a->exec_min = a->exec_max = exec;
+    }
+    a->recv_min = now < a->recv_min ? now : a->recv_min;
+    a->recv_max = now > a->recv_max ? now : a->recv_max;
+    a->exec_min = exec < a->exec_min ? exec : a->exec_min;
+    a->exec_max = exec > a->exec_max ? exec : a->exec_max;
+    a->got++;
+}
+
+static void deliver(void *ctx, int dst, int src, const uint8_t *data, size_t len, uint8_t tos) {
+    (void)ctx;
+    (void)len;
+    (void)tos;
+    int64_t now = sim_now(sim);
+    frame_t f;
+    memcpy(&f, data, sizeof(f));
+    switch (f.kind) {
+    case FR_REQ: {
+        // t2 when rx_task gets to the frame, t3 right before the reply goes out
+        int64_t wake = now + (P.ts_jitter_us ? sim_rand(sim) % P.ts_jitter_us : 0);
+        reply_t *r = &replies[reply_head++ % MAX_REPLIES];
+        r->dst = src;
+        r->f = (frame_t){ .kind = FR_RESP, .t1 = f.t1, .t2 = local_at(0, wake), .t3 = local_at(0, wake + 100) };
+        sim_schedule(sim, wake + 100, 0, send_reply, r);
+        break;
+    }
+    case FR_RESP:
+        if (nodes[dst].req_t1 == f.t1) {
+            ts_add_exchange(&nodes[dst].ts, f.t1, f.t2, f.t3, rx_stamp(dst, now));
+            nodes[dst].req_t1 = 0;
+        }
+        break;
+    case FR_ACTION:
+        run_action(dst, &f, now);
+        flood(dst, &f);
+        break;
+    }
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_set(const char *name, set_t *s) {
+    qsort(s->v, s->n, sizeof(uint32_t), cmp_u32);
+    uint32_t p50 = s->n ? s->v[(s->n - 1) / 2] : 0;
+    uint32_t p95 = s->n ? s->v[(s->n * 95 + 99) / 100 - 1] : 0;
+    uint32_t max = s->n ? s->v[s->n - 1] : 0;
+    printf("\"%s\":{\"n\":%lu,\"p50_ms\":%.3f,\"p95_ms\":%.3f,\"max_ms\":%.3f}", name, (unsigned long)s->n,
+           p50 / 1000.0, p95 / 1000.0, max / 1000.0);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--nodes N] [--fanout F] [--drift PPM] [--period MS] [--ts-jitter US]\n"
+                    "          [--load-ms MS] [--load-size BYTES] [--action-every MS] [--lead MS]\n"
+                    "          [--dur MS] [--loss PPM] [--seed S]\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    P.nodes = 40;
+    P.fanout = 3;
+    P.drift_ppm = 40;
+    P.period_us = 10000000;
+    P.ts_jitter_us = 300;
+    P.load_us = 1000000;
+    P.load_size = 300;
+    P.action_every_us = 5000000;
+    P.lead_us = 500000;
+    P.dur_us = 300000000;
+    sim_default_config(&P.sim_cfg);
+
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        const char *val = argv[++i];
+        if (strcmp(opt, "--nodes") == 0) P.nodes = atoi(val);
+        else if (strcmp(opt, "--fanout") == 0) P.fanout = atoi(val);
+        else if (strcmp(opt, "--drift") == 0) P.drift_ppm = atof(val);
+        else if (strcmp(opt, "--period") == 0) P.period_us = atoll(val) * 1000;
+        else if (strcmp(opt, "--ts-jitter") == 0) P.ts_jitter_us = (uint32_t)atoi(val);
+        else if (strcmp(opt, "--load-ms") == 0) P.load_us = atoll(val) * 1000;
+        else if (strcmp(opt, "--load-size") == 0) P.load_size = atoi(val);
+        else if (strcmp(opt, "--action-every") == 0) P.action_every_us = atoll(val) * 1000;
+        else if (strcmp(opt, "--lead") == 0) P.lead_us = atoll(val) * 1000;
+        else if (strcmp(opt, "--dur") == 0) P.dur_us = atoll(val) * 1000;
+        else if (strcmp(opt, "--loss") == 0) P.sim_cfg.loss_ppm = (uint32_t)atoi(val);
+        else if (strcmp(opt, "--seed") == 0) P.sim_cfg.seed = (uint32_t)atoi(val);
+        else usage(argv[0]);
+    }
+    if (P.nodes < 2 || P.nodes > SIM_MAX_NODES || P.period_us < 1000000 || P.action_every_us <= 0 ||
+        P.lead_us <= 0 || P.load_size < 64 || P.load_size > 1400) {
+        usage(argv[0]);
+    }
+
+    sim = sim_create(&P.sim_cfg, deliver, NULL);
+    sim_build_tree(sim, P.nodes, P.fanout);
+    for (int i = 0; i < P.nodes; i++) {
+        ts_init(&nodes[i].ts);
+        nodes[i].drift_ppm = ((double)(sim_rand(sim) % 2001) / 1000.0 - 1.0) * P.drift_ppm;
+        nodes[i].boot_us = (int64_t)(sim_rand(sim) % 1000000);
+        nodes[i].next_sync_us = (int64_t)(sim_rand(sim) % (uint32_t)(P.period_us / 1000)) * 1000;
+        nodes[i].next_load_us = P.load_us ? (int64_t)(sim_rand(sim) % (uint32_t)(P.load_us / 1000)) * 1000 : -1;
+    }
+
+    // Warm-up: the first error samples and actions wait for three rounds
+    int64_t warmup_us = 3 * P.period_us;
+    int64_t next_sample = warmup_us;
+    int64_t next_action = warmup_us;
+    for (int64_t t = 0; t <= P.dur_us; t += 1000) {
+        sim_run_until(sim, t);
+        for (int i = 1; i < P.nodes; i++) {
+            node_t *n = &nodes[i];
+            if (t >= n->next_sync_us) {
+                // A lost request or reply just means no sample this round
+                n->req_t1 = local_at(i, t);
+                frame_t f = { .kind = FR_REQ, .t1 = n->req_t1 };
+                send(i, -1, &f, 64);
+                n->next_sync_us += P.period_us;
+            }
+            if (P.load_us && t >= n->next_load_us) {
+                frame_t f = { .kind = FR_LOAD };
+                send(i, -1, &f, (size_t)P.load_size);
+                n->next_load_us += P.load_us;
+            }
+        }
+        if (t >= next_sample) {
+            for (int i = 1; i < P.nodes; i++) {
+                if (nodes[i].ts.synced) {
+                    int64_t err = mesh_now(i, t) - local_at(0, t);
+                    add(&err_all, err);
+                    int layer = sim_layer(sim, i);
+                    add(&err_layer[layer > MAX_LAYER ? MAX_LAYER : layer], err);
+                }
+            }
+            next_sample += SAMPLE_US;
+        }
+        if (t >= next_action && action_count < MAX_ACTIONS && t + P.lead_us <= P.dur_us) {
+            frame_t f = { .kind = FR_ACTION, .seq = (uint16_t)action_count, .at = local_at(0, t) + P.lead_us };
+            actions[action_count].send_us = t;
+            actions[action_count].at_mesh = f.at;
+            action_count++;
+            run_action(0, &f, t);
+            flood(0, &f);
+            next_action += P.action_every_us;
+        }
+    }
+    sim_run_until(sim, P.dur_us + 5000000);
+
+    int late = 0, partial = 0;
+    for (int a = 0; a < action_count; a++) {
+        late += actions[a].late;
+        if (actions[a].got < P.nodes) {
+            partial++;
+        }
+        add(&spread_recv, actions[a].recv_max - actions[a].recv_min);
+        add(&spread_exec, actions[a].exec_max - actions[a].exec_min);
+    }
+    double drift_err = 0;
+    uint32_t exchanges = 0, filtered = 0, steps = 0;
+    int synced = 0;
+    for (int i = 1; i < P.nodes; i++) {
+        const time_sync_t *ts = &nodes[i].ts;
+        // Offset (mesh - local) grows by root rate / node rate - 1 per local us
+        double truth = ((1.0 + nodes[0].drift_ppm / 1e6) / (1.0 + nodes[i].drift_ppm / 1e6) - 1.0) * 1e9;
+        double d = ts->drift_ppb - truth;
+        drift_err += d < 0 ? -d : d;
+        exchanges += ts->exchanges;
+        filtered += ts->filtered;
+        steps += ts->steps;
+        synced += ts->synced;
+    }
+
+    printf("{\"params\":{\"nodes\":%d,\"fanout\":%d,\"drift_ppm\":%.1f,\"period_ms\":%lld,\"ts_jitter_us\":%u,"
+           "\"load_ms\":%lld,\"load_size\":%d,\"lead_ms\":%lld,\"dur_ms\":%lld},\n",
+           P.nodes, P.fanout, P.drift_ppm, (long long)(P.period_us / 1000), P.ts_jitter_us,
+           (long long)(P.load_us / 1000), P.load_size, (long long)(P.lead_us / 1000), (long long)(P.dur_us / 1000));
+    printf(" \"sync\":{\"synced\":%d,\"exchanges\":%lu,\"filtered\":%lu,\"steps\":%lu,\"drift_err_ppm\":%.2f},\n ",
+           synced, (unsigned long)exchanges, (unsigned long)filtered, (unsigned long)steps,
+           drift_err / (P.nodes - 1) / 1000.0);
+    print_set("error", &err_all);
+    printf(",\n \"error_by_layer\":{");
+    bool first = true;
+    for (int l = 2; l <= MAX_LAYER; l++) {
+        if (err_layer[l].n) {
+            char name[8];
+            snprintf(name, sizeof(name), "%d", l);
+            printf("%s", first ? "" : ",");
+            print_set(name, &err_layer[l]);
+            first = false;
+        }
+    }
+    printf("},\n \"actions\":{\"n\":%d,\"late_nodes\":%d,\"incomplete\":%d,\n  ", action_count, late, partial);
+    print_set("spread_on_receipt", &spread_recv);
+    printf(",\n  ");
+    print_set("spread_scheduled", &spread_exec);
+    printf("}}\n");
+    sim_destroy(sim);
+    return 0;
+}
@@ -0,0 +1,434 @@
+// Replays a capture downloaded from /api/trace through the firmware's receive path
+// (rx_dispatch.c routing over the mesh_msg.c parse, node_registry.c update with stale timers
+// on timer_wheel.c, topology.c and pong RTTs into latency.c, as rx_task does on the root),
+// driven by the trace's own clock so the same trace always ends in the same state.
+//
+//   trace_replay FILE [--speed X] [--rounds R] [--stale-ms MS] [--dump]
+//
+// --speed 1 keeps the original timing, 0 (default) runs as fast as possible. --rounds
+// repeats the replay from a clean state for steadier ns/msg figures. --dump prints the
+// timeline instead of the summary. Frames captured in hash mode (or truncated) are counted
+// but cannot be replayed.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "latency.h"
+#include "mesh_msg.h"
+#include "node_registry.h"
+#include "rx_dispatch.h"
+#include "timer_wheel.h"
+#include "topology.h"
+#include "trace.h"
+
+#define TICK_US 100000  // timer service tick
+
+// mesh_event_id_t and ip_event_t order in ESP-IDF 5.5
+static const char *const mesh_event_names[] = {
+    "STARTED", "STOPPED", "CHANNEL_SWITCH", "CHILD_CONNECTED", "CHILD_DISCONNECTED",
+    "ROUTING_TABLE_ADD", "ROUTING_TABLE_REMOVE", "PARENT_CONNECTED", "PARENT_DISCONNECTED",
+    "NO_PARENT_FOUND", "LAYER_CHANGE", "TODS_STATE", "VOTE_STARTED", "VOTE_STOPPED",
+    "ROOT_ADDRESS", "ROOT_SWITCH_REQ", "ROOT_SWITCH_ACK", "ROOT_ASKED_YIELD", "ROOT_FIXED",
+    "SCAN_DONE", "NETWORK_STATE", "STOP_RECONNECTION", "FIND_NETWORK", "ROUTER_SWITCH",
+    "PS_PARENT_DUTY", "PS_CHILD_DUTY", "PS_DEVICE_DUTY",
+};
+static const char *const ip_event_names[] = {
+    "STA_GOT_IP", "STA_LOST_IP", "AP_STAIPASSIGNED", "GOT_IP6", "ETH_GOT_IP", "ETH_LOST_IP",
+    "PPP_GOT_IP", "PPP_LOST_IP",
+};
+#define MAX_EVENT_IDS 32
+
+// http_method from http_parser.h
+static const char *const http_methods[] = { "DELETE", "GET", "HEAD", "POST", "PUT" };
+
+#define MAX_URIS 32
+
+typedef struct {
+    uint32_t n;
+    uint64_t bytes;
+    int64_t ns;
+} cmd_stats_t;
+
+typedef struct {
+    char key[80];
+    uint32_t n;
+} uri_count_t;
+
+// Everything one replay round builds up
+typedef struct {
+    node_registry_t reg;
+    topo_t topo;
+    tw_wheel_t wheel;
+    lat_series_t rtt;
+    rx_dispatch_t rx;
+    uint8_t self[6];
+    bool is_root;
+    int layer;
+    uint32_t went_stale;
+    uint32_t replayed, opaque, bad_hash, not_msg;
+    cmd_stats_t cmds[MESH_MSG_TYPE_COUNT];
+    uint32_t mesh_events[MAX_EVENT_IDS], ip_events[MAX_EVENT_IDS], other_events;
+    uri_count_t uris[MAX_URIS];
+    int uri_count;
+    uint32_t http;
+} replay_t;
+
+static replay_t R;
+static uint32_t stale_ms = 60000;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static const char *event_name(uint8_t source, int32_t id, char *buf, size_t len) {
+    if (source == TRACE_SRC_MESH && id >= 0 && id < (int32_t)(sizeof(mesh_event_names) / sizeof(mesh_event_names[0]))) {
+        snprintf(buf, len, "MESH_EVENT_%s", mesh_event_names[id]);
+    } else if (source == TRACE_SRC_IP && id >= 0 && id < (int32_t)(sizeof(ip_event_names) / sizeof(ip_event_names[0]))) {
+        snprintf(buf, len, "IP_EVENT_%s", ip_event_names[id]);
+    } else {
+        snprintf(buf, len, "%s_EVENT_%ld", source == TRACE_SRC_IP ? "IP" : "MESH", (long)id);
+    }
+    return buf;
+}
+
+static const char *method_name(uint8_t m) {
+    return m < sizeof(http_methods) / sizeof(http_methods[0]) ? http_methods[m] : "?";
+}
+
+static void stale_cb(tw_timer_t *timer, void *arg) {
+    (void)timer;
+    node_info_t *node = arg;
+    node->is_active = false;
+    R.went_stale++;
+}
+
+static void evict_cb(void *ctx, node_info_t *node) {
+    (void)ctx;
+    tw_cancel(&R.wheel, &node->stale_timer);
+    if (R.is_root) {
+        topo_remove(&R.topo, node->mac);
+    }
+}
+
+// rx_task's handlers that keep root-side state, behind the firmware's own rx_dispatch
+static void on_status(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    (void)ctx;
+    bool is_new;
+    node_info_t *node = registry_apply_status(&R.reg, m, f->from, R.layer, (uint32_t)(f->rx_us / 1000), &is_new);
+    if (!node) {
+        return;
+    }
+    if (is_new) {
+        tw_timer_init(&node->stale_timer, stale_cb, node);
+    }
+    tw_arm(&R.wheel, &node->stale_timer, stale_ms / (TICK_US / 1000), 0);
+    if (R.is_root && m->has_tree) {
+        if (m->has_parent) {
+            topo_set_parent(&R.topo, node->mac, m->parent);
+        }
+        topo_set_children(&R.topo, node->mac, (const uint8_t (*)[6])m->children, m->child_count);
+        topo_set_rssi(&R.topo, node->mac, m->rssi);
+    }
+}
+
+static void on_pong(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    (void)ctx;
+    // The ping carried the root's clock, which is also the trace clock
+    node_info_t *node = m->has_mac ? registry_find(&R.reg, m->mac) : NULL;
+    int64_t rtt = f->rx_us - m->t;
+    if (rtt >= 0 && rtt <= UINT32_MAX) {
+        R.rtt.received++;
+        lat_record(&R.rtt, (uint32_t)rtt);
+        if (node) {
+            node->lat.received++;
+            lat_record(&node->lat, (uint32_t)rtt);
+        }
+    }
+}
+
+static void replay_init(const uint8_t self[6], uint32_t tick0) {
+    memset(&R, 0, sizeof(R));
+    registry_init(&R.reg, self, evict_cb, NULL);
+    topo_init(&R.topo, self);
+    tw_init(&R.wheel, tick0);
+    lat_series_init(&R.rtt);
+    memcpy(R.self, self, 6);
+    rx_dispatch_init(&R.rx, R.self, NULL);
+    R.rx.on[MESH_MSG_HEARTBEAT] = on_status;
+    R.rx.on[MESH_MSG_STATUS_RESPONSE] = on_status;
+    R.rx.on[MESH_MSG_PONG] = on_pong;
+}
+
+static void dispatch(const uint8_t src[6], const char *buf, size_t len, int64_t t_us) {
+    int64_t t0 = now_ns();
+    rx_frame_t f = { .raw = buf, .len = len, .from = src, .src = src, .rx_us = t_us };
+    R.rx.is_root = R.is_root;
+    const mesh_msg_t *m = rx_dispatch(&R.rx, &f);
+    if (!m) {
+        R.not_msg++;
+        return;
+    }
+    cmd_stats_t *c = &R.cmds[m->type];
+    c->n++;
+    c->bytes += len;
+    c->ns += now_ns() - t0;
+    R.replayed++;
+}
+
+static void count_uri(uint8_t method, const char *uri, size_t len) {
+    char key[80];
+    size_t path = 0;
+    while (path < len && uri[path] != '?') {
+        path++;
+    }
+    snprintf(key, sizeof(key), "%s %.*s", method_name(method), (int)path, uri);
+    for (int i = 0; i < R.uri_count; i++) {
+        if (strcmp(R.uris[i].key, key) == 0) {
+            R.uris[i].n++;
+            return;
+        }
+    }
+    if (R.uri_count < MAX_URIS) {
+        snprintf(R.uris[R.uri_count].key, sizeof(R.uris[0].key), "%s", key);
+        R.uris[R.uri_count++].n = 1;
+    }
+}
+
+static void print_mac(const uint8_t *m) {
+    printf("%02x:%02x:%02x:%02x:%02x:%02x", m[0], m[1], m[2], m[3], m[4], m[5]);
+}
+
+static void dump_record(const trace_rec_t *rec, const uint8_t *body, double t_s) {
+    printf("%12.6f ", t_s);
+    if (rec->type == TRACE_REC_RX) {
+        trace_rx_t rx;
+        memcpy(&rx, body, sizeof(rx));
+        int kept = rec->len - (int)sizeof(rx);
+        printf("RX    ");
+        print_mac(rx.src);
+        printf(" %4u B %08lx", rx.size, (unsigned long)rx.hash);
+        if (kept > 0) {
+            const char *p = (const char *)body + sizeof(rx);
+            bool text = true;
+            for (int i = 0; i < kept && text; i++) {
+                text = p[i] >= 0x20 && p[i] < 0x7f;
+            }
+            if (text) {
+                printf(" %.*s%s", kept, p, rec->flags & TRACE_RX_TRUNC ? "..." : "");
+            } else {
+                printf(" (binary)");
+            }
+        }
+        printf("\n");
+    } else if (rec->type == TRACE_REC_EVENT) {
+        trace_event_t ev;
+        memcpy(&ev, body, sizeof(ev));
+        char name[48];
+        printf("EVENT %s layer %d\n", event_name(rec->flags, ev.id, name, sizeof(name)), ev.layer);
+    } else {
+        printf("HTTP  %s %.*s\n", method_name(rec->flags), rec->len, (const char *)body);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s FILE [--speed X] [--rounds R] [--stale-ms MS] [--dump]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *path = NULL;
+    double speed = 0;
+    int rounds = 1;
+    bool dump = false;
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if (strcmp(opt, "--dump") == 0) {
+            dump = true;
+            continue;
+        }
+        if (opt[0] != '-') {
+            path = opt;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        const char *val = argv[++i];
+        if (strcmp(opt, "--speed") == 0) speed = atof(val);
+        else if (strcmp(opt, "--rounds") == 0) rounds = atoi(val);
+        else if (strcmp(opt, "--stale-ms") == 0) stale_ms = (uint32_t)atol(val);
+        else usage(argv[0]);
+    }
+    if (!path || rounds < 1 || speed < 0 || stale_ms < TICK_US / 1000) {
+        usage(argv[0]);
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size > 0 ? (size_t)size : 1);
+    if (!data || fread(data, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        return 1;
+    }
+    fclose(f);
+    trace_file_hdr_t h;
+    if ((size_t)size < sizeof(h)) {
+        fprintf(stderr, "%s: too short for a trace\n", path);
+        return 1;
+    }
+    memcpy(&h, data, sizeof(h));
+    if (h.magic != TRACE_MAGIC || h.version != TRACE_VERSION || h.hdr_len > (size_t)size) {
+        fprintf(stderr, "%s: not a version %d trace\n", path, TRACE_VERSION);
+        return 1;
+    }
+
+    // Unwrap the 32-bit times: forward deltas, then anchor the last record to the dump time
+    size_t records = 0;
+    size_t pos = h.hdr_len;
+    trace_rec_t rec;
+    const uint8_t *body;
+    while (trace_next(data, (size_t)size, &pos, &rec, &body)) {
+        records++;
+    }
+    if (pos != (size_t)size) {
+        fprintf(stderr, "%s: malformed record at offset %zu, replaying the %zu before it\n", path, pos, records);
+    }
+    int64_t *t_abs = malloc((records ? records : 1) * sizeof(int64_t));
+    pos = h.hdr_len;
+    uint32_t prev = 0;
+    int64_t acc = 0;
+    for (size_t i = 0; i < records; i++) {
+        trace_next(data, (size_t)size, &pos, &rec, &body);
+        acc += i ? (uint32_t)(rec.t_us - prev) : 0;
+        prev = rec.t_us;
+        t_abs[i] = acc;
+    }
+    int64_t shift = records ? h.now_us - (uint32_t)((uint32_t)h.now_us - prev) - acc : 0;
+    for (size_t i = 0; i < records; i++) {
+        t_abs[i] += shift;
+    }
+
+    int64_t replay_ns = 0;
+    for (int round = 0; round < rounds; round++) {
+        replay_init(h.self, records ? (uint32_t)(t_abs[0] / TICK_US) : 0);
+        int64_t wall0 = now_ns();
+        int64_t busy = 0;
+        pos = h.hdr_len;
+        for (size_t i = 0; i < records; i++) {
+            trace_next(data, (size_t)size, &pos, &rec, &body);
+            if (speed > 0) {
+                int64_t due = wall0 + (int64_t)((t_abs[i] - t_abs[0]) * 1000 / speed);
+                int64_t wait = due - now_ns();
+                if (wait > 0) {
+                    struct timespec ts = { .tv_sec = wait / 1000000000, .tv_nsec = wait % 1000000000 };
+                    nanosleep(&ts, NULL);
+                }
+            }
+            if (dump && round == 0) {
+                dump_record(&rec, body, (t_abs[i] - t_abs[0]) / 1e6);
+            }
+            int64_t t0 = now_ns();
+            tw_advance(&R.wheel, (uint32_t)(t_abs[i] / TICK_US));
+            if (rec.type == TRACE_REC_RX) {
+                trace_rx_t rx;
+                memcpy(&rx, body, sizeof(rx));
+                size_t kept = rec.len - sizeof(rx);
+                const char *payload = (const char *)body + sizeof(rx);
+                if (kept == 0 || (rec.flags & TRACE_RX_TRUNC)) {
+                    R.opaque++;
+                } else if (trace_hash(payload, kept) != rx.hash) {
+                    R.bad_hash++;
+                } else {
+                    dispatch(rx.src, payload, kept, t_abs[i]);
+                }
+            } else if (rec.type == TRACE_REC_EVENT) {
+                trace_event_t ev;
+                memcpy(&ev, body, sizeof(ev));
+                uint32_t *counts = rec.flags == TRACE_SRC_IP ? R.ip_events : R.mesh_events;
+                if (ev.id >= 0 && ev.id < MAX_EVENT_IDS) {
+                    counts[ev.id]++;
+                } else {
+                    R.other_events++;
+                }
+                // Root transitions restart the tree, as handle_root_transition does
+                bool root = ev.layer == 1;
+                if (root && !R.is_root) {
+                    topo_init(&R.topo, h.self);
+                }
+                R.is_root = root;
+                R.layer = ev.layer;
+            } else {
+                R.http++;
+                count_uri(rec.flags, (const char *)body, rec.len);
+            }
+            busy += now_ns() - t0;
+        }
+        replay_ns += busy;
+    }
+    if (dump) {
+        free(t_abs);
+        free(data);
+        return 0;
+    }
+
+    static const char *const modes[] = { "off", "hash", "full" };
+    double span = records ? (t_abs[records - 1] - t_abs[0]) / 1e6 : 0;
+    printf("{\"trace\":{\"self\":\"");
+    print_mac(h.self);
+    printf("\",\"mode\":\"%s\",\"records\":%zu,\"dropped\":%lu,\"missed\":%lu,\"span_s\":%.3f,\"bytes\":%ld},\n",
+           h.mode < 3 ? modes[h.mode] : "?", records, (unsigned long)h.dropped, (unsigned long)h.missed, span, size);
+    printf(" \"frames\":{\"replayed\":%lu,\"opaque\":%lu,\"bad_hash\":%lu,\"not_msg\":%lu,\"by_cmd\":{",
+           (unsigned long)R.replayed, (unsigned long)R.opaque, (unsigned long)R.bad_hash, (unsigned long)R.not_msg);
+    bool first = true;
+    for (int i = 0; i < MESH_MSG_TYPE_COUNT; i++) {
+        const cmd_stats_t *c = &R.cmds[i];
+        if (c->n) {
+            printf("%s\"%s\":{\"n\":%lu,\"avg_bytes\":%.0f,\"ns_per_msg\":%.0f}", first ? "" : ",", mesh_msg_type_name(i),
+                   (unsigned long)c->n, (double)c->bytes / c->n, (double)c->ns / c->n);
+            first = false;
+        }
+    }
+    printf("}},\n \"events\":{");
+    first = true;
+    for (int s = 0; s < 2; s++) {
+        const uint32_t *counts = s ? R.ip_events : R.mesh_events;
+        for (int id = 0; id < MAX_EVENT_IDS; id++) {
+            if (counts[id]) {
+                char name[48];
+                printf("%s\"%s\":%lu", first ? "" : ",", event_name(s ? TRACE_SRC_IP : TRACE_SRC_MESH, id, name, sizeof(name)),
+                       (unsigned long)counts[id]);
+                first = false;
+            }
+        }
+    }
+    printf("},\n \"http\":{");
+    for (int i = 0; i < R.uri_count; i++) {
+        printf("%s\"%s\":%lu", i ? "," : "", R.uris[i].key, (unsigned long)R.uris[i].n);
+    }
+    topo_summary_t ts;
+    topo_get_summary(&R.topo, &ts);
+    lat_pct_t rtt;
+    lat_percentiles(&R.rtt, &rtt);
+    printf("},\n \"registry\":{\"nodes\":%d,\"active\":%d,\"went_stale\":%lu,\"evictions\":%lu,\"drops\":%lu},\n",
+           R.reg.count, registry_active_count(&R.reg), (unsigned long)R.went_stale, (unsigned long)R.reg.evictions,
+           (unsigned long)R.reg.drops);
+    printf(" \"topology\":{\"root\":%s,\"nodes\":%d,\"orphans\":%d,\"max_depth\":%d,\"changes\":%lu},\n",
+           R.is_root ? "true" : "false", ts.nodes, ts.orphans, ts.max_depth, (unsigned long)ts.changes);
+    printf(" \"rtt\":{\"n\":%lu,\"p50_ms\":%.1f,\"p95_ms\":%.1f,\"max_ms\":%.1f},\n", (unsigned long)R.rtt.received,
+           rtt.p50_us / 1000.0, rtt.p95_us / 1000.0, rtt.max_us / 1000.0);
+    printf(" \"replay\":{\"rounds\":%d,\"ns_per_record\":%.0f}}\n", rounds,
+           records ? (double)replay_ns / ((double)records * rounds) : 0.0);
+    free(t_abs);
+    free(data);
+    return 0;
+}
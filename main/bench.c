@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+
+// Frame header (little endian):
+//   0 magic, 1 type, 2-3 run, 4-7 seq, 8-13 source mac, 14-17 send time (us, low 32 bits),
+//   18 flags, 19 tos
+#define BENCH_TYPE_DATA  0
+#define BENCH_TYPE_ECHO  1
+#define BENCH_FLAG_ECHO  0x01
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void bench_init(bench_t *b, const uint8_t self[6], const bench_transport_t *tp) {
+    memset(b, 0, sizeof(*b));
+    memcpy(b->self, self, 6);
+    b->tp = *tp;
+    lat_series_init(&b->rtt);
+}
+
+void bench_reset(bench_t *b, uint16_t run) {
+    b->rx_run = run;
+    memset(b->peers, 0, sizeof(b->peers));
+    b->rx_other_run = 0;
+    b->rx_overflow = 0;
+}
+
+void bench_start(bench_t *b, const bench_params_t *p, int64_t now_us) {
+    bench_reset(b, p->run);
+    b->params = *p;
+    if (b->params.rate < 1) b->params.rate = 1;
+    if (b->params.rate > BENCH_MAX_RATE) b->params.rate = BENCH_MAX_RATE;
+    if (b->params.size < BENCH_HDR_SIZE) b->params.size = BENCH_HDR_SIZE;
+    if (b->params.size > BENCH_MAX_FRAME) b->params.size = BENCH_MAX_FRAME;
+    if (b->params.tos > BENCH_TOS_DEF) b->params.tos = BENCH_TOS_P2P;
+
+    b->tx_active = true;
+    b->tx_start_us = now_us;
+    b->tx_end_us = 0;
+    b->tx_seq = 0;
+    b->tx_slots = 0;
+    b->tx_sent = 0;
+    b->tx_failed = 0;
+    b->tx_skipped = 0;
+    b->tx_bytes = 0;
+    lat_series_init(&b->rtt);
+
+    // Payload is a fixed pattern; only the header changes per frame
+    for (int i = BENCH_HDR_SIZE; i < b->params.size; i++) {
+        b->frame[i] = (uint8_t)i;
+    }
+    b->frame[0] = BENCH_MAGIC;
+    b->frame[1] = BENCH_TYPE_DATA;
+    put_u16(b->frame + 2, b->params.run);
+    memcpy(b->frame + 8, b->self, 6);
+    b->frame[19] = b->params.tos;
+}
+
+void bench_stop(bench_t *b, int64_t now_us) {
+    if (b->tx_active) {
+        b->tx_active = false;
+        b->tx_end_us = now_us;
+    }
+}
+
+int bench_tx_poll(bench_t *b, int64_t now_us) {
+    if (!b->tx_active) {
+        return 0;
+    }
+    int64_t elapsed = now_us - b->tx_start_us;
+    if (elapsed >= (int64_t)b->params.duration_ms * 1000) {
+        bench_stop(b, now_us);
+        return 0;
+    }
+    // Slots are pacing positions; falling more than a burst behind skips slots rather than
+    // bursting later, so a stalled transport doesn't turn into a flood once it drains
+    uint32_t due = (uint32_t)(elapsed * b->params.rate / 1000000) + 1;
+    if (due - b->tx_slots > BENCH_MAX_BURST) {
+        b->tx_skipped += due - b->tx_slots - BENCH_MAX_BURST;
+        b->tx_slots = due - BENCH_MAX_BURST;
+    }
+    int sent = 0;
+    while (b->tx_slots < due) {
+        b->tx_slots++;
+        put_u32(b->frame + 4, b->tx_seq);
+        put_u32(b->frame + 14, (uint32_t)now_us);
+        b->frame[18] = (b->tx_seq % BENCH_ECHO_EVERY == 0) ? BENCH_FLAG_ECHO : 0;
+        if (b->tp.send(b->tp.ctx, b->params.dst, b->frame, b->params.size, b->params.tos) == 0) {
+            // Seq only advances for queued frames, so receiver gaps are in-mesh loss
+            b->tx_seq++;
+            b->tx_sent++;
+            b->tx_bytes += b->params.size;
+            sent++;
+        } else {
+            b->tx_failed++;
+        }
+    }
+    return sent;
+}
+
+static bench_peer_t *bench_peer(bench_t *b, const uint8_t mac[6]) {
+    bench_peer_t *free_slot = NULL;
+    for (int i = 0; i < BENCH_MAX_PEERS; i++) {
+        if (b->peers[i].used) {
+            if (memcmp(b->peers[i].mac, mac, 6) == 0) {
+                return &b->peers[i];
+            }
+        } else if (!free_slot) {
+            free_slot = &b->peers[i];
+        }
+    }
+    if (free_slot) {
+        memset(free_slot, 0, sizeof(*free_slot));
+        free_slot->used = true;
+        memcpy(free_slot->mac, mac, 6);
+    }
+    return free_slot;
+}
+
+static void bench_rx_data(bench_t *b, const uint8_t *frame, size_t len, int64_t now_us) {
+    bench_peer_t *peer = bench_peer(b, frame + 8);
+    if (!peer) {
+        b->rx_overflow++;
+        return;
+    }
+    uint32_t seq = get_u32(frame + 4);
+    if (peer->frames == 0) {
+        peer->first_seq = seq;
+        peer->highest_seq = seq;
+        peer->window = 1;
+        peer->first_us = now_us;
+    } else if (seq > peer->highest_seq) {
+        uint32_t shift = seq - peer->highest_seq;
+        peer->window = shift >= 64 ? 0 : peer->window << shift;
+        peer->window |= 1;
+        peer->highest_seq = seq;
+    } else {
+        uint32_t off = peer->highest_seq - seq;
+        if (off < 64 && (peer->window & (1ull << off))) {
+            peer->dup++;
+            return;
+        }
+        if (off < 64) {
+            peer->window |= 1ull << off;
+        }
+        if (seq < peer->first_seq) {
+            peer->first_seq = seq;
+        }
+        peer->reordered++;
+    }
+    peer->frames++;
+    peer->bytes += len;
+    peer->last_us = now_us;
+}
+
+void bench_on_frame(bench_t *b, const uint8_t src[6], const uint8_t *frame, size_t len, int64_t now_us) {
+    if (!bench_is_frame(frame, len)) {
+        return;
+    }
+    uint16_t run = get_u16(frame + 2);
+    if (frame[1] == BENCH_TYPE_ECHO) {
+        if (run == b->params.run && memcmp(frame + 8, b->self, 6) == 0) {
+            lat_record(&b->rtt, (uint32_t)now_us - get_u32(frame + 14));
+        }
+        return;
+    }
+    if (run != b->rx_run) {
+        b->rx_other_run++;
+        return;
+    }
+    bench_rx_data(b, frame, len, now_us);
+
+    if (frame[18] & BENCH_FLAG_ECHO) {
+        uint8_t echo[BENCH_HDR_SIZE];
+        memcpy(echo, frame, BENCH_HDR_SIZE);
+        echo[1] = BENCH_TYPE_ECHO;
+        echo[18] = 0;
+        b->tp.send(b->tp.ctx, src, echo, sizeof(echo), frame[19]);
+    }
+}
+
+static uint32_t bench_rate(uint64_t count, int64_t span_us) {
+    return span_us > 0 ? (uint32_t)(count * 1000000 / (uint64_t)span_us) : 0;
+}
+
+static uint32_t bench_peer_lost(const bench_peer_t *peer) {
+    uint32_t expected = peer->highest_seq - peer->first_seq + 1;
+    return expected > peer->frames ? expected - peer->frames : 0;
+}
+
+static uint32_t bench_peer_pps(const bench_peer_t *peer) {
+    return bench_rate(peer->frames > 0 ? peer->frames - 1 : 0, peer->last_us - peer->first_us);
+}
+
+void bench_layer_summary(const bench_t *b, int (*layer_of)(void *ctx, const uint8_t mac[6]), void *ctx,
+                         bench_layer_t out[BENCH_MAX_LAYERS + 1]) {
+    memset(out, 0, sizeof(bench_layer_t) * (BENCH_MAX_LAYERS + 1));
+    for (int i = 0; i < BENCH_MAX_PEERS; i++) {
+        const bench_peer_t *peer = &b->peers[i];
+        if (!peer->used) {
+            continue;
+        }
+        int layer = layer_of(ctx, peer->mac);
+        if (layer < 1) {
+            continue;
+        }
+        if (layer > BENCH_MAX_LAYERS) {
+            layer = BENCH_MAX_LAYERS;
+        }
+        out[layer].senders++;
+        out[layer].frames += peer->frames;
+        out[layer].lost += bench_peer_lost(peer);
+        out[layer].pps += bench_peer_pps(peer);
+    }
+}
+
+int bench_format_layers(const bench_layer_t layers[BENCH_MAX_LAYERS + 1], char *buf, size_t len) {
+    int n = snprintf(buf, len, "[");
+    bool first = true;
+    for (int l = 1; l <= BENCH_MAX_LAYERS; l++) {
+        if (!layers[l].senders) {
+            continue;
+        }
+        n += snprintf(buf + n, len > (size_t)n ? len - n : 0,
+                      "%s{\"layer\":%d,\"senders\":%d,\"frames\":%lu,\"lost\":%lu,\"pps\":%lu}",
+                      first ? "" : ",", l, layers[l].senders, (unsigned long)layers[l].frames,
+                      (unsigned long)layers[l].lost, (unsigned long)layers[l].pps);
+        first = false;
+    }
+    n += snprintf(buf + n, len > (size_t)n ? len - n : 0, "]");
+    return n;
+}
+
+int bench_format_result(const bench_t *b, char *buf, size_t len, int64_t now_us) {
+    const uint8_t *m = b->self;
+    int n = snprintf(buf, len, "{\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"run\":%u,",
+                     m[0], m[1], m[2], m[3], m[4], m[5], b->rx_run);
+    if (b->params.rate) {
+        // Has been a sender at least once
+        lat_pct_t p;
+        lat_percentiles(&b->rtt, &p);
+        int64_t span = (b->tx_active ? now_us : b->tx_end_us) - b->tx_start_us;
+        n += snprintf(buf + n, len > (size_t)n ? len - n : 0,
+                      "\"tx\":{\"active\":%s,\"rate\":%lu,\"size\":%u,\"tos\":%u,\"sent\":%lu,\"failed\":%lu,"
+                      "\"skipped\":%lu,\"pps\":%lu,\"rtt\":{\"n\":%d,\"p50_us\":%lu,\"p95_us\":%lu,\"p99_us\":%lu}},",
+                      b->tx_active ? "true" : "false", (unsigned long)b->params.rate, b->params.size,
+                      b->params.tos, (unsigned long)b->tx_sent, (unsigned long)b->tx_failed,
+                      (unsigned long)b->tx_skipped, (unsigned long)bench_rate(b->tx_sent, span), p.n,
+                      (unsigned long)p.p50_us, (unsigned long)p.p95_us, (unsigned long)p.p99_us);
+    }
+    n += snprintf(buf + n, len > (size_t)n ? len - n : 0, "\"rx_other_run\":%lu,\"rx_overflow\":%lu,\"rx\":[",
+                  (unsigned long)b->rx_other_run, (unsigned long)b->rx_overflow);
+
+    bool first = true;
+    for (int i = 0; i < BENCH_MAX_PEERS; i++) {
+        const bench_peer_t *peer = &b->peers[i];
+        if (!peer->used) {
+            continue;
+        }
+        char entry[200];
+        int e = snprintf(entry, sizeof(entry),
+                         "%s{\"src\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"frames\":%lu,\"bytes\":%llu,\"lost\":%lu,"
+                         "\"reordered\":%lu,\"dup\":%lu,\"pps\":%lu}",
+                         first ? "" : ",", peer->mac[0], peer->mac[1], peer->mac[2], peer->mac[3], peer->mac[4],
+                         peer->mac[5], (unsigned long)peer->frames, (unsigned long long)peer->bytes,
+                         (unsigned long)bench_peer_lost(peer), (unsigned long)peer->reordered,
+                         (unsigned long)peer->dup, (unsigned long)bench_peer_pps(peer));
+        // Leave room for the closing "]}"
+        if (n + e + 3 > (int)len) {
+            break;
+        }
+        memcpy(buf + n, entry, e + 1);
+        n += e;
+        first = false;
+    }
+    if (n + 3 <= (int)len) {
+        n += snprintf(buf + n, len - n, "]}");
+    }
+    return n;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "latency.h"
+
+// Mesh throughput benchmark: paced traffic generator plus per-source receiver statistics.
+// Plain C with no RTOS dependency; frames leave through a bench_transport_t so the same
+// code runs over esp_mesh on the device and over the host simulator (host/). Callers
+// serialize access.
+//
+// Frames are binary with a first byte that can never start a JSON message, so the RX path
+// can divert them before any string parsing. Every BENCH_ECHO_EVERY-th frame asks the
+// receiver to echo its header back, which gives the sender RTT samples without needing
+// synchronized clocks.
+
+#define BENCH_MAGIC       0xB7
+#define BENCH_HDR_SIZE    20
+#define BENCH_MAX_FRAME   1400
+#define BENCH_MAX_RATE    2000  // frames/s per sender
+#define BENCH_MAX_PEERS   16    // distinct sources tracked per receiver
+#define BENCH_ECHO_EVERY  16
+#define BENCH_MAX_BURST   8     // frames sent per poll at most; the rest catch up next poll
+#define BENCH_MAX_LAYERS  8
+
+enum {
+    BENCH_TOS_P2P = 0,  // per-hop retransmission (esp-mesh default)
+    BENCH_TOS_E2E = 1,  // end-to-end retransmission
+    BENCH_TOS_DEF = 2,  // no retransmission
+};
+
+typedef struct {
+    uint16_t run;          // run id; frames from other runs are ignored
+    uint32_t rate;         // frames/s
+    uint16_t size;         // frame size in bytes (>= BENCH_HDR_SIZE)
+    uint8_t tos;           // BENCH_TOS_*
+    uint32_t duration_ms;
+    uint8_t dst[6];        // all zero = root
+} bench_params_t;
+
+typedef struct {
+    // Returns 0 if the frame was queued; non-zero counts as a send failure (queue full, no route)
+    int (*send)(void *ctx, const uint8_t dst[6], const uint8_t *frame, size_t len, uint8_t tos);
+    void *ctx;
+} bench_transport_t;
+
+typedef struct {
+    bool used;
+    uint8_t mac[6];
+    uint32_t frames;      // unique frames received
+    uint64_t bytes;
+    uint32_t reordered;   // arrived after a higher seq
+    uint32_t dup;
+    uint32_t first_seq;
+    uint32_t highest_seq;
+    uint64_t window;      // bit i set = highest_seq - i seen (duplicate/reorder detection)
+    int64_t first_us;
+    int64_t last_us;
+} bench_peer_t;
+
+typedef struct {
+    bench_transport_t tp;
+    uint8_t self[6];
+    bench_params_t params;
+
+    // Sender
+    bool tx_active;
+    int64_t tx_start_us;
+    int64_t tx_end_us;
+    uint32_t tx_seq;         // next seq; advances only for frames the transport accepted
+    uint32_t tx_slots;       // pacing slots consumed
+    uint32_t tx_sent;
+    uint32_t tx_failed;      // transport refused the frame
+    uint32_t tx_skipped;     // slots dropped after falling more than a burst behind
+    uint64_t tx_bytes;
+    lat_series_t rtt;
+    uint8_t frame[BENCH_MAX_FRAME];
+
+    // Receiver
+    uint16_t rx_run;
+    bench_peer_t peers[BENCH_MAX_PEERS];
+    uint32_t rx_other_run;   // frames from a different run
+    uint32_t rx_overflow;    // frames from sources beyond BENCH_MAX_PEERS
+} bench_t;
+
+// Receiver statistics folded by the sender's mesh layer
+typedef struct {
+    int senders;
+    uint32_t frames;
+    uint32_t lost;
+    uint32_t pps;
+} bench_layer_t;
+
+void bench_init(bench_t *b, const uint8_t self[6], const bench_transport_t *tp);
+// Clear receiver statistics and accept frames of this run
+void bench_reset(bench_t *b, uint16_t run);
+// Reset for p->run and start sending; parameters are clamped to the supported range
+void bench_start(bench_t *b, const bench_params_t *p, int64_t now_us);
+void bench_stop(bench_t *b, int64_t now_us);
+// Send the frames due by now (at most BENCH_MAX_BURST); stops once the duration is over.
+// Returns the number of frames handed to the transport.
+int bench_tx_poll(bench_t *b, int64_t now_us);
+
+static inline bool bench_is_frame(const uint8_t *data, size_t len) {
+    return len >= BENCH_HDR_SIZE && data[0] == BENCH_MAGIC;
+}
+void bench_on_frame(bench_t *b, const uint8_t src[6], const uint8_t *frame, size_t len, int64_t now_us);
+
+// {"mac":..,"run":..,"tx":{..},"rx":[..]} - receivers beyond what fits in len are omitted
+int bench_format_result(const bench_t *b, char *buf, size_t len, int64_t now_us);
+
+// Sum a receiver's per-source statistics into out[layer]; layer_of maps a source MAC to its
+// layer (values < 1 are skipped, deeper than BENCH_MAX_LAYERS count as the last one)
+void bench_layer_summary(const bench_t *b, int (*layer_of)(void *ctx, const uint8_t mac[6]), void *ctx,
+                         bench_layer_t out[BENCH_MAX_LAYERS + 1]);
+// [{"layer":..,"senders":..,"frames":..,"lost":..,"pps":..},...] for layers with senders
+int bench_format_layers(const bench_layer_t layers[BENCH_MAX_LAYERS + 1], char *buf, size_t len);
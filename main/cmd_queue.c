@@ -0,0 +1,156 @@
+#include <string.h>
+#include "cmd_queue.h"
+
+void cmdq_init(cmd_queue_t *q, uint32_t ttl_ms) {
+    memset(q, 0, sizeof(*q));
+    q->ttl_ms = ttl_ms;
+}
+
+static cmdq_node_t *find(const cmd_queue_t *q, const uint8_t mac[6]) {
+    for (int i = 0; i < CMDQ_MAX_NODES; i++) {
+        if (q->nodes[i].used && memcmp(q->nodes[i].mac, mac, 6) == 0) {
+            return (cmdq_node_t *)&q->nodes[i];
+        }
+    }
+    return NULL;
+}
+
+static void expire_node(cmd_queue_t *q, cmdq_node_t *n, uint32_t now_ms) {
+    for (int k = 0; k < CMDQ_KIND_COUNT; k++) {
+        if ((n->pending & (1u << k)) && (int32_t)(now_ms - n->expires_ms[k]) >= 0) {
+            n->pending &= ~(1u << k);
+            n->sent &= ~(1u << k);
+            q->expired++;
+        }
+    }
+    if (!n->pending) {
+        n->used = false;
+    }
+}
+
+bool cmdq_put(cmd_queue_t *q, const uint8_t mac[6], cmdq_kind_t kind, uint8_t arg, uint32_t now_ms) {
+    cmdq_node_t *n = find(q, mac);
+    if (n) {
+        expire_node(q, n, now_ms);
+    }
+    if (!n || !n->used) {
+        n = NULL;
+        for (int i = 0; i < CMDQ_MAX_NODES && !n; i++) {
+            if (q->nodes[i].used) {
+                expire_node(q, &q->nodes[i], now_ms);
+            }
+            if (!q->nodes[i].used) {
+                n = &q->nodes[i];
+            }
+        }
+        if (!n) {
+            q->rejected++;
+            return false;
+        }
+        memset(n, 0, sizeof(*n));
+        n->used = true;
+        memcpy(n->mac, mac, 6);
+    }
+    uint8_t bit = 1u << kind;
+    if (n->pending & bit) {
+        n->coalesced++;
+        q->coalesced++;
+    } else {
+        n->pending |= bit;
+        n->queued_ms[kind] = now_ms;
+    }
+    n->sent &= ~bit;  // an ack for an earlier batch no longer covers it
+    n->arg[kind] = arg;
+    n->expires_ms[kind] = now_ms + q->ttl_ms;
+    q->queued++;
+    return true;
+}
+
+bool cmdq_peek(const cmd_queue_t *q, const uint8_t mac[6], cmdq_kind_t kind, uint8_t *arg) {
+    const cmdq_node_t *n = find(q, mac);
+    if (!n || !(n->pending & (1u << kind))) {
+        return false;
+    }
+    *arg = n->arg[kind];
+    return true;
+}
+
+bool cmdq_due(cmd_queue_t *q, const uint8_t mac[6], bool resend, uint32_t now_ms) {
+    cmdq_node_t *n = find(q, mac);
+    if (!n) {
+        return false;
+    }
+    expire_node(q, n, now_ms);
+    return n->used && (resend || (n->pending & ~n->sent));
+}
+
+bool cmdq_send(cmd_queue_t *q, const uint8_t mac[6], uint32_t seq, uint32_t now_ms, cmdq_batch_t *out) {
+    cmdq_node_t *n = find(q, mac);
+    if (!n) {
+        return false;
+    }
+    expire_node(q, n, now_ms);
+    if (!n->used) {
+        return false;
+    }
+    memset(out, 0, sizeof(*out));
+    out->led = n->pending & (1u << CMDQ_LED) ? n->arg[CMDQ_LED] : -1;
+    out->status = n->pending & (1u << CMDQ_STATUS);
+    out->coalesced = n->coalesced;
+    for (int k = 0; k < CMDQ_KIND_COUNT; k++) {
+        if (!(n->pending & (1u << k))) {
+            continue;
+        }
+        if (now_ms - n->queued_ms[k] > out->oldest_ms) {
+            out->oldest_ms = now_ms - n->queued_ms[k];
+        }
+        n->sent_seq[k] = seq;
+    }
+    q->batches++;
+    if (!(n->pending & ~n->sent)) {
+        q->resent++;
+    }
+    n->sent = n->pending;
+    return true;
+}
+
+int cmdq_ack(cmd_queue_t *q, const uint8_t mac[6], uint32_t seq) {
+    cmdq_node_t *n = find(q, mac);
+    if (!n) {
+        return 0;
+    }
+    int acked = 0;
+    for (int k = 0; k < CMDQ_KIND_COUNT; k++) {
+        uint8_t bit = 1u << k;
+        if ((n->sent & bit) && n->sent_seq[k] == seq) {
+            n->pending &= ~bit;
+            n->sent &= ~bit;
+            acked++;
+        }
+    }
+    q->delivered += acked;
+    if (!n->pending) {
+        n->used = false;
+    }
+    return acked;
+}
+
+void cmdq_expire(cmd_queue_t *q, uint32_t now_ms) {
+    for (int i = 0; i < CMDQ_MAX_NODES; i++) {
+        if (q->nodes[i].used) {
+            expire_node(q, &q->nodes[i], now_ms);
+        }
+    }
+}
+
+int cmdq_depth(const cmdq_node_t *n) {
+    return n->used ? __builtin_popcount(n->pending) : 0;
+}
+
+int cmdq_total(const cmd_queue_t *q) {
+    int total = 0;
+    for (int i = 0; i < CMDQ_MAX_NODES; i++) {
+        total += cmdq_depth(&q->nodes[i]);
+    }
+    return total;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Root-side store-and-forward queue for nodes that are inactive or have no route. Plain C
+// with no RTOS dependency; callers serialize access.
+//
+// A node's queue holds desired state, not a log of commands: at most one entry per kind,
+// and a newer command of the same kind replaces the older one (counted as coalesced), so
+// ten toggles sent to an offline node cost one entry and one frame. When the node is heard
+// from again (heartbeat or status_response) the root sends everything still pending for it
+// as one batch tagged with a seq. The entries stay queued until the node acks that seq; a
+// batch that goes unacked is sent again on the node's next heartbeat. Entries older than
+// ttl_ms are dropped instead of being delivered late, acked or not. With every node slot in
+// use a command for another node is refused.
+
+#ifndef CMDQ_MAX_NODES
+#define CMDQ_MAX_NODES 8
+#endif
+
+typedef enum {
+    CMDQ_LED = 0,          // arg: desired LED state
+    CMDQ_STATUS,           // status_request (every batch is acked with a status_response)
+    CMDQ_KIND_COUNT,
+} cmdq_kind_t;
+
+typedef struct {
+    bool used;
+    uint8_t mac[6];
+    uint8_t pending;                   // bit per cmdq_kind_t
+    uint8_t sent;                      // ... of which are in a batch awaiting its ack
+    uint8_t arg[CMDQ_KIND_COUNT];
+    uint32_t sent_seq[CMDQ_KIND_COUNT];// batch that last carried the kind
+    uint32_t queued_ms[CMDQ_KIND_COUNT]; // first command of the kind (age)
+    uint32_t expires_ms[CMDQ_KIND_COUNT];// latest command of the kind + ttl
+    uint16_t coalesced;                // commands folded into the pending ones
+} cmdq_node_t;
+
+// What to send a node that came back
+typedef struct {
+    int led;               // desired LED state, -1 if none pending
+    bool status;
+    uint16_t coalesced;
+    uint32_t oldest_ms;    // age of the oldest entry in the batch
+} cmdq_batch_t;
+
+typedef struct {
+    uint32_t ttl_ms;
+    cmdq_node_t nodes[CMDQ_MAX_NODES];
+    // Counters
+    uint32_t queued;       // commands accepted
+    uint32_t coalesced;    // ... of which replaced a pending one
+    uint32_t expired;      // entries dropped at ttl_ms
+    uint32_t rejected;     // no free node slot
+    uint32_t batches;      // batches sent
+    uint32_t resent;       // ... of which repeated an unacked one
+    uint32_t delivered;    // entries acked
+} cmd_queue_t;
+
+void cmdq_init(cmd_queue_t *q, uint32_t ttl_ms);
+
+// Queue a command for mac; false if every node slot holds pending commands for other nodes
+bool cmdq_put(cmd_queue_t *q, const uint8_t mac[6], cmdq_kind_t kind, uint8_t arg, uint32_t now_ms);
+// Pending entry of kind for mac: true with *arg set, false if none
+bool cmdq_peek(const cmd_queue_t *q, const uint8_t mac[6], cmdq_kind_t kind, uint8_t *arg);
+// Whether mac has a batch to send: something not sent yet, or with resend anything unacked
+bool cmdq_due(cmd_queue_t *q, const uint8_t mac[6], bool resend, uint32_t now_ms);
+// Everything pending for mac as one batch tagged seq; the entries stay queued. False if nothing is.
+bool cmdq_send(cmd_queue_t *q, const uint8_t mac[6], uint32_t seq, uint32_t now_ms, cmdq_batch_t *out);
+// The node acked batch seq: drops the entries it carried (not ones changed since). Returns how many.
+int cmdq_ack(cmd_queue_t *q, const uint8_t mac[6], uint32_t seq);
+// Drops expired entries everywhere (put, due and send do it for the node they touch)
+void cmdq_expire(cmd_queue_t *q, uint32_t now_ms);
+
+// Entries pending for one node, and in total
+int cmdq_depth(const cmdq_node_t *n);
+int cmdq_total(const cmd_queue_t *q);
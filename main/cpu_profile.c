@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include "cpu_profile.h"
+
+// Room kept for the closing "],\"more\":N}" while entries are appended
+#define PROF_FORMAT_RESERVE 32
+
+static int copy_tasks(prof_task_t *dst, const prof_task_t *src, int n) {
+    if (n > PROF_MAX_TASKS) {
+        n = PROF_MAX_TASKS;
+    }
+    memcpy(dst, src, n * sizeof(*src));
+    return n;
+}
+
+void prof_begin(prof_t *p, const prof_task_t *tasks, int n, uint32_t total_runtime, int64_t now_us) {
+    memset(p, 0, sizeof(*p));
+    p->task_count = copy_tasks(p->start, tasks, n);
+    p->total_start = total_runtime;
+    p->start_us = now_us;
+    p->open = true;
+}
+
+void prof_end(prof_t *p, const prof_task_t *tasks, int n, uint32_t total_runtime, int64_t now_us) {
+    p->open = false;
+    p->end_us = now_us;
+    p->total_end = total_runtime;
+    // Tasks at the end of the window; start holds the first snapshot, matched by id
+    int start_count = p->task_count;
+    p->task_count = copy_tasks(p->end, tasks, n);
+    for (int i = start_count; i < PROF_MAX_TASKS; i++) {
+        p->start[i].id = UINT32_MAX;
+    }
+}
+
+void prof_sample(prof_t *p, uint32_t pc) {
+    if (!p->open) {
+        return;
+    }
+    p->samples++;
+    uint32_t bucket = pc & ~(uint32_t)(PROF_PC_GRAIN - 1);
+    if (!bucket) {
+        bucket = PROF_PC_GRAIN;  // 0 marks a free slot; nothing runs there anyway
+    }
+    uint32_t h = (bucket / PROF_PC_GRAIN) * 2654435761u;
+    for (int probe = 0; probe < 8; probe++) {
+        prof_pc_t *s = &p->pcs[(h + probe) & (PROF_PC_SLOTS - 1)];
+        if (s->pc == bucket) {
+            s->count++;
+            return;
+        }
+        if (!s->pc) {
+            s->pc = bucket;
+            s->count = 1;
+            return;
+        }
+    }
+    p->overflow++;
+}
+
+static uint32_t task_delta(const prof_t *p, const prof_task_t *t) {
+    for (int i = 0; i < PROF_MAX_TASKS; i++) {
+        if (p->start[i].id == t->id) {
+            return t->runtime - p->start[i].runtime;
+        }
+    }
+    return t->runtime;  // created during the window
+}
+
+static bool append(char *buf, size_t len, int *n, int *more, const char *entry, int elen) {
+    if (elen < 0 || *n + elen + PROF_FORMAT_RESERVE >= (int)len) {
+        (*more)++;
+        return false;
+    }
+    memcpy(buf + *n, entry, elen);
+    *n += elen;
+    buf[*n] = '\0';
+    return true;
+}
+
+int prof_format(const prof_t *p, const char *mac, char *buf, size_t len) {
+    int n = 0, more = 0;
+    char e[96];
+    if (len < 2 * PROF_FORMAT_RESERVE) {
+        return snprintf(buf, len, "{}");
+    }
+    uint32_t ms = p->end_us > p->start_us ? (uint32_t)((p->end_us - p->start_us) / 1000) : 0;
+    if (mac) {
+        n = snprintf(buf, len, "{\"mac\":\"%s\",", mac);
+    } else {
+        n = snprintf(buf, len, "{");
+    }
+    n += snprintf(buf + n, len - n, "\"ms\":%lu,\"samples\":%lu,\"overflow\":%lu,\"tasks\":[",
+                  (unsigned long)ms, (unsigned long)p->samples, (unsigned long)p->overflow);
+
+    // Busiest first: selection over the small task list
+    uint32_t total = p->total_end - p->total_start;
+    uint32_t delta[PROF_MAX_TASKS];
+    bool done[PROF_MAX_TASKS] = {0};
+    for (int i = 0; i < p->task_count; i++) {
+        delta[i] = task_delta(p, &p->end[i]);
+    }
+    bool first = true;
+    for (int k = 0; k < p->task_count; k++) {
+        int best = -1;
+        for (int i = 0; i < p->task_count; i++) {
+            if (!done[i] && (best < 0 || delta[i] > delta[best])) {
+                best = i;
+            }
+        }
+        done[best] = true;
+        const prof_task_t *t = &p->end[best];
+        uint32_t cpu = total ? (uint32_t)((uint64_t)delta[best] * 10000 / total) : 0;
+        int elen = snprintf(e, sizeof(e), "%s{\"name\":\"%s\",\"cpu\":%lu,\"stack_free\":%lu,\"prio\":%u}",
+                            first ? "" : ",", t->name, (unsigned long)cpu, (unsigned long)t->stack_free, t->prio);
+        if (append(buf, len, &n, &more, e, elen)) {
+            first = false;
+        }
+    }
+    n += snprintf(buf + n, len - n, "],\"pcs\":[");
+
+    // Hottest first: repeatedly take the largest count below the previous one
+    uint32_t below = UINT32_MAX;
+    first = true;
+    while (true) {
+        uint32_t top = 0;
+        for (int i = 0; i < PROF_PC_SLOTS; i++) {
+            if (p->pcs[i].count > top && p->pcs[i].count < below) {
+                top = p->pcs[i].count;
+            }
+        }
+        if (!top) {
+            break;
+        }
+        for (int i = 0; i < PROF_PC_SLOTS; i++) {
+            if (p->pcs[i].count != top) {
+                continue;
+            }
+            uint32_t pct = p->samples ? (uint32_t)((uint64_t)top * 10000 / p->samples) : 0;
+            int elen = snprintf(e, sizeof(e), "%s{\"pc\":\"0x%08lx\",\"n\":%lu,\"pct\":%lu}", first ? "" : ",",
+                                (unsigned long)p->pcs[i].pc, (unsigned long)top, (unsigned long)pct);
+            if (append(buf, len, &n, &more, e, elen)) {
+                first = false;
+            }
+        }
+        below = top;
+    }
+    n += snprintf(buf + n, len - n, "],\"more\":%d}", more);
+    return n;
+}
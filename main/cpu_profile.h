@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// One profiling window: CPU share and stack high-water mark per task, from the RTOS
+// run-time counters at the start and end of the window, and a histogram of the PCs a timer
+// interrupt found the CPU at. Plain C with no RTOS dependency; the caller converts the task
+// list and owns the timer.
+//
+// prof_sample runs in the interrupt and takes no locks: only the interrupt writes the
+// histogram while a window is open, and nobody reads it until the window is closed. PCs are
+// bucketed in PROF_PC_GRAIN bytes so a hot loop shows up as one location; the report gives
+// the bucket start address, which addr2line against the ELF turns into a function.
+
+#define PROF_MAX_TASKS 24
+#define PROF_PC_SLOTS  256          // power of two
+#define PROF_PC_GRAIN  16
+#define PROF_TASK_NAME 16
+
+typedef struct {
+    uint32_t id;                    // stable per task (FreeRTOS task number)
+    char name[PROF_TASK_NAME];
+    uint32_t runtime;               // run-time counter
+    uint32_t stack_free;            // high-water mark: least free stack seen, bytes
+    uint8_t prio;
+} prof_task_t;
+
+typedef struct {
+    uint32_t pc;                    // bucket start; 0 = empty slot
+    uint32_t count;
+} prof_pc_t;
+
+typedef struct {
+    // Window
+    bool open;
+    int64_t start_us;
+    int64_t end_us;
+    uint32_t total_start;           // run-time counter total at each end
+    uint32_t total_end;
+    int task_count;
+    prof_task_t start[PROF_MAX_TASKS];
+    prof_task_t end[PROF_MAX_TASKS];
+    // Written by prof_sample
+    prof_pc_t pcs[PROF_PC_SLOTS];
+    uint32_t samples;
+    uint32_t overflow;              // samples whose bucket found no free slot
+} prof_t;
+
+// Both take the task list as the RTOS reports it; tasks beyond PROF_MAX_TASKS are ignored
+void prof_begin(prof_t *p, const prof_task_t *tasks, int n, uint32_t total_runtime, int64_t now_us);
+void prof_end(prof_t *p, const prof_task_t *tasks, int n, uint32_t total_runtime, int64_t now_us);
+
+void prof_sample(prof_t *p, uint32_t pc);
+
+// {"mac":..,"ms":..,"samples":..,"overflow":..,"tasks":[{"name":..,"cpu":x100 %,"stack_free":..,
+//  "prio":..}],"pcs":[{"pc":"0x..","n":..,"pct":x100 %}],"more":..}, busiest tasks and hottest
+// PCs first ("mac" only if given). Entries that do not fit len are left out and counted in
+// "more". Returns the length written.
+int prof_format(const prof_t *p, const char *mac, char *buf, size_t len);
@@ -0,0 +1,104 @@
+#include <string.h>
+#include "flow_ctl.h"
+
+void flow_default_config(flow_config_t *cfg) {
+    cfg->min_rate_mps = 500;      // one state message every 2 s
+    cfg->max_rate_mps = 20000;
+    cfg->alpha_mps = 2000;
+    cfg->high_water = 8;
+    cfg->low_water = 2;
+    cfg->hold_ms = 1000;
+    cfg->burst = 4;
+}
+
+void flow_init(flow_ctl_t *fc, const flow_config_t *cfg, int64_t now_us) {
+    memset(fc, 0, sizeof(*fc));
+    fc->cfg = *cfg;
+    fc->rate_mps = cfg->max_rate_mps;
+    fc->tokens_m = (uint32_t)cfg->burst * 1000;
+    fc->last_update_us = now_us;
+    fc->last_decrease_us = now_us - (int64_t)cfg->hold_ms * 1000;
+}
+
+void flow_restart(flow_ctl_t *fc, int64_t now_us) {
+    fc->rate_mps = fc->cfg.min_rate_mps;
+    fc->tokens_m = 1000;
+    fc->last_update_us = now_us;
+}
+
+static void refill(flow_ctl_t *fc, int64_t now_us) {
+    int64_t dt_us = now_us - fc->last_update_us;
+    if (dt_us <= 0) {
+        return;
+    }
+    fc->last_update_us = now_us;
+    uint64_t cap = (uint64_t)fc->cfg.burst * 1000;
+    uint64_t tokens = fc->tokens_m + (uint64_t)fc->rate_mps * (uint64_t)dt_us / 1000000;
+    fc->tokens_m = (uint32_t)(tokens > cap ? cap : tokens);
+
+    // Additive increase is time based so the tick period does not change the slope
+    if (!fc->congested && flow_backlog(fc) <= fc->cfg.low_water && fc->rate_mps < fc->cfg.max_rate_mps) {
+        uint64_t rate = fc->rate_mps + (uint64_t)fc->cfg.alpha_mps * (uint64_t)dt_us / 1000000;
+        fc->rate_mps = (uint32_t)(rate > fc->cfg.max_rate_mps ? fc->cfg.max_rate_mps : rate);
+    }
+}
+
+bool flow_update(flow_ctl_t *fc, uint16_t local_backlog, uint16_t parent_backlog, int64_t now_us) {
+    refill(fc, now_us);
+    fc->local_backlog = local_backlog;
+    fc->parent_backlog = parent_backlog;
+    uint16_t backlog = flow_backlog(fc);
+    if (backlog > fc->max_backlog) {
+        fc->max_backlog = backlog;
+    }
+
+    bool was = fc->congested;
+    if (backlog >= fc->cfg.high_water) {
+        fc->congested = true;
+        if (now_us - fc->last_decrease_us >= (int64_t)fc->cfg.hold_ms * 1000) {
+            fc->rate_mps /= 2;
+            if (fc->rate_mps < fc->cfg.min_rate_mps) {
+                fc->rate_mps = fc->cfg.min_rate_mps;
+            }
+            // Do not let a full bucket push a burst into the congested path
+            if (fc->tokens_m > 1000) {
+                fc->tokens_m = 1000;
+            }
+            fc->last_decrease_us = now_us;
+            fc->decreases++;
+        }
+    } else if (backlog <= fc->cfg.low_water) {
+        fc->congested = false;
+    }
+    return was != fc->congested;
+}
+
+flow_verdict_t flow_admit(flow_ctl_t *fc, flow_class_t cls, int64_t now_us) {
+    if (cls == FLOW_CLASS_CONTROL) {
+        fc->exempt++;
+        return FLOW_SEND;
+    }
+    refill(fc, now_us);
+    if (fc->tokens_m >= 1000) {
+        fc->tokens_m -= 1000;
+        fc->sent++;
+        return FLOW_SEND;
+    }
+    if (cls == FLOW_CLASS_STATE) {
+        fc->deferred++;
+        return FLOW_DEFER;
+    }
+    fc->dropped++;
+    return FLOW_DROP;
+}
+
+bool flow_retry(flow_ctl_t *fc, int64_t now_us) {
+    refill(fc, now_us);
+    if (fc->tokens_m < 1000) {
+        return false;
+    }
+    fc->tokens_m -= 1000;
+    fc->sent++;
+    fc->retried++;
+    return true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// AIMD rate control for non-critical mesh traffic. Plain C with no RTOS dependency;
+// callers serialize access.
+//
+// The congestion signal is the worse of our own upstream backlog (mesh TX queue toward the
+// parent plus frames waiting in our RX queue) and the backlog our parent advertises. Above
+// high_water the send rate is cut by half (at most once per hold_ms, so one burst is not
+// punished repeatedly); at or below low_water it grows by alpha per second. Sends draw
+// from a token bucket refilled at that rate.
+//
+// Control traffic (commands, acks, join/flow signalling) is never throttled; it is only
+// counted. State reports are deferred and retried on the next tick (the caller sends the
+// latest state, so deferral also coalesces). Probes are dropped.
+
+typedef enum {
+    FLOW_CLASS_CONTROL,  // exempt
+    FLOW_CLASS_STATE,    // heartbeat, status report: defer
+    FLOW_CLASS_PROBE,    // ping replies and other measurement traffic: drop
+} flow_class_t;
+
+typedef enum {
+    FLOW_SEND,
+    FLOW_DEFER,
+    FLOW_DROP,
+} flow_verdict_t;
+
+typedef struct {
+    uint32_t min_rate_mps;   // milli-messages per second
+    uint32_t max_rate_mps;
+    uint32_t alpha_mps;      // additive increase per second below low_water
+    uint16_t high_water;     // backlog (frames) that counts as congestion
+    uint16_t low_water;      // backlog at or below which the rate may grow
+    uint32_t hold_ms;        // minimum spacing between decreases
+    uint16_t burst;          // token bucket depth (messages)
+} flow_config_t;
+
+typedef struct {
+    flow_config_t cfg;
+    uint32_t rate_mps;
+    uint32_t tokens_m;       // milli-tokens
+    int64_t last_update_us;
+    int64_t last_decrease_us;
+    bool congested;
+    uint16_t local_backlog;
+    uint16_t parent_backlog;
+    // Counters
+    uint32_t sent;
+    uint32_t exempt;
+    uint32_t deferred;       // state messages postponed (each counted once)
+    uint32_t retried;        // deferred messages sent later
+    uint32_t dropped;
+    uint32_t decreases;
+    uint16_t max_backlog;
+} flow_ctl_t;
+
+void flow_default_config(flow_config_t *cfg);
+void flow_init(flow_ctl_t *fc, const flow_config_t *cfg, int64_t now_us);
+// After (re)joining the mesh: start from min rate with one token, so a whole subtree that
+// reconnects at once ramps up instead of bursting. Counters are kept.
+void flow_restart(flow_ctl_t *fc, int64_t now_us);
+
+// Feed the current backlogs (call periodically). Returns true if the congested state changed.
+bool flow_update(flow_ctl_t *fc, uint16_t local_backlog, uint16_t parent_backlog, int64_t now_us);
+
+flow_verdict_t flow_admit(flow_ctl_t *fc, flow_class_t cls, int64_t now_us);
+// Retry of a message flow_admit deferred: takes a token if one is available, without
+// counting another deferral
+bool flow_retry(flow_ctl_t *fc, int64_t now_us);
+
+static inline uint16_t flow_backlog(const flow_ctl_t *fc) {
+    return fc->local_backlog > fc->parent_backlog ? fc->local_backlog : fc->parent_backlog;
+}
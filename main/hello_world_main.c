@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "nvs_flash.h"
+#include "nvs.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_wifi.h"
@@ -8,31 +9,56 @@
 #include "esp_mesh_internal.h"
 #include "esp_netif.h"
 #include "esp_mac.h"
+#include "esp_timer.h"
 #include "esp_http_server.h"
 #include "mdns.h"
 #include "driver/gpio.h"
+#include "driver/gptimer.h"
+#include "riscv/csr.h"
+#include "freertos/semphr.h"
+#include "timer_service.h"
+#include "mqtt_uplink.h"
+#include "topology.h"
+#include "latency.h"
+#include "bench.h"
+#include "mesh_msg.h"
+#include "rx_dispatch.h"
+#include "node_registry.h"
+#include "mem_budget.h"
+#include "flow_ctl.h"
+#include "node_config.h"
+#include "time_sync.h"
+#include "trace.h"
+#include "parent_opt.h"
+#include "rules.h"
+#include "cmd_queue.h"
+#include "cpu_profile.h"
+#include "node_results.h"
 
 
 static const char *TAG = "MESH_UNIFIED";
 
 // Forward declarations
-static void ip_check_task(void *arg);
+static void ip_wait_cb(tw_timer_t *timer, void *arg);
 static void log_all_netifs(const char *reason);
 static void try_start_dhcp_on_all(void);
-static bool parse_mac_str(const char *s, uint8_t out[6]);
+static void rules_raise(rule_event_t ev, uint8_t hops);
 
 // Mesh netif handles (STA connects upstream to router; AP serves downstream children)
 static esp_netif_t *mesh_netif_sta = NULL;
 static esp_netif_t *mesh_netif_ap = NULL;
 
-// --- Demo config (later: load these from NVS/captive portal) ---
-static const uint8_t MESH_ID[6] = { 0x11,0x22,0x33,0x44,0x55,0x66 };  // same for all nodes
-static const char *ROUTER_SSID   = "IsolationSwitchWiFi";
-static const char *ROUTER_PASS   = "Cutoutswitch1";
+// Mesh ID, router credentials, softAP capacity and timing are runtime config (node_config.c,
+// /api/config); the children's password is fixed
+static const char *MESH_AP_PASS  = "meshpassword";  // children auth
+
+// Outgoing JSON and HTTP response buffers come from fixed pools (menuconfig "Memory budget")
+#define MSG_BUF_SZ  CONFIG_MESH_MSG_BLOCK_SIZE
+#define HTTP_BUF_SZ CONFIG_MESH_HTTP_BLOCK_SIZE
 
 // Simple RX buffer
-#define RX_BUF_SZ 256
-static uint8_t rx_buf[RX_BUF_SZ];
+// Full mesh payload (benchmark frames can be large) plus room for a terminating NUL
+static uint8_t rx_buf[MESH_MPS + 1];
 
 // LED control (ESP32-C3 built-in LED on GPIO8)
 #define LED_GPIO 8
@@ -41,37 +67,250 @@ static bool led_state = false;
 // Web server
 static httpd_handle_t web_server = NULL;
 static bool is_root_node = false;
-static bool ip_check_active = false;
 
-// Node registry for web interface
-#define MAX_MESH_NODES 10
+// POST /api/led/<mac> for a remote node is parked with httpd_req_async_handler_begin until the
+// node's ack (a status_response echoing our seq) arrives or the wait times out; the httpd task
+// serves other clients meanwhile. The answer is sent from the httpd task via httpd_queue_work.
+typedef enum { CMD_WAIT_FREE, CMD_WAIT_RESERVED, CMD_WAIT_PARKED, CMD_WAIT_DONE } cmd_wait_state_t;
+
 typedef struct {
-    mesh_addr_t addr;
-    uint32_t last_seen;
-    bool led_state;
+    cmd_wait_state_t state;
+    httpd_req_t *req;      // async copy, ours until httpd_req_async_handler_complete
+    uint8_t mac[6];
+    uint32_t seq;
+    int64_t sent_us;
+    int64_t done_us;
+    const char *result;    // "ok", "timeout", "send_failed" or "aborted"
+    bool led_state;        // from the ack
     int layer;
-    bool is_active;
-    // Route hint: last mesh source address we saw for this node (for unicast P2P)
-    mesh_addr_t last_from;
-    bool has_route;
-    int rssi; // last reported RSSI (dBm) to parent/router on the node side
-} node_info_t;
-
-static node_info_t known_nodes[MAX_MESH_NODES];
-static int node_count = 0;
-
-// Parse MAC address string (aa:bb:cc:dd:ee:ff) into 6-byte array
-static bool parse_mac_str(const char *s, uint8_t out[6]) {
-    if (!s) return false;
-    int vals[6];
-    if (sscanf(s, "%x:%x:%x:%x:%x:%x", &vals[0], &vals[1], &vals[2], &vals[3], &vals[4], &vals[5]) != 6) {
-        return false;
-    }
-    for (int i = 0; i < 6; i++) {
-        out[i] = (uint8_t)vals[i];
-    }
-    return true;
-}
+    tw_timer_t timer;
+} cmd_wait_t;
+
+static cmd_wait_t cmd_waits[CONFIG_MESH_HTTP_CMD_MAX];
+static portMUX_TYPE cmd_wait_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t cmd_seq_next = 0;
+static uint32_t cmd_acked = 0;
+static uint32_t cmd_timed_out = 0;
+static uint32_t cmd_rejected = 0;  // all slots parked
+
+// Commands for a node the root cannot reach right now (inactive, no route, never seen) are
+// queued as desired state and go out as one cmd_batch on the node's next heartbeat or
+// status_response, instead of a broadcast that gets lost
+static cmd_queue_t cmd_queue;
+static portMUX_TYPE cmd_queue_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Timing (all driven by the timer service); heartbeat, status, staleness and start delay
+// periods are runtime config
+#define IP_WAIT_PERIOD_MS   1000
+#define IP_WAIT_MAX_RETRIES 60
+#define ROOT_SWITCH_DEBOUNCE_MS 100
+
+static tw_timer_t heartbeat_timer;
+static tw_timer_t announce_timer;
+static tw_timer_t status_timer;
+static tw_timer_t ip_wait_timer;
+static tw_timer_t root_check_timer;
+static int ip_wait_retries = 0;
+
+// Highest config version any node reported (root): a change made here always supersedes it
+static uint32_t config_seen_version = 0;
+_Static_assert(200 + 2 * (NODE_CONFIG_SSID_MAX + NODE_CONFIG_PASS_MAX) <= MSG_BUF_SZ,
+               "config message must fit a message pool block");
+
+// Edge rules (rules.c) run on every node. The root compiles them from text, and they are
+// stored in NVS and pushed like the runtime config. A dispatch only collects the actions
+// under rules_lock; they run after it is released, since an LED action raises led_on/led_off
+// and so dispatches again.
+#define RULES_NVS_NAMESPACE "mesh_rules"
+typedef struct {
+    int n;
+    rule_action_t a[RULES_MAX];
+} rule_batch_t;
+
+static rules_t rules;
+static rule_batch_t rules_batch;
+static SemaphoreHandle_t rules_lock;
+static tw_timer_t rules_timer;
+static uint32_t rules_seen_version = 0;  // root: highest any node reported
+static uint32_t rules_evals = 0;
+static int64_t rules_eval_us = 0;        // total, for the average
+static int32_t rules_eval_max_us = 0;
+static uint32_t rules_signals_rx = 0;
+static uint32_t rules_signals_tx = 0;
+_Static_assert(40 + 2 * RULES_BLOB_MAX <= MSG_BUF_SZ, "rules message must fit a message pool block");
+
+// RTT probing (root only): one node per interval round-robin, plus on-demand bursts
+#define PROBE_INTERVAL_MS       CONFIG_MESH_PROBE_INTERVAL_MS // 0 disables periodic probes
+#define PROBE_BURST_INTERVAL_MS 500
+#define PROBE_BURST_MAX_ROUNDS  20
+#define PROBE_MAX_LAYER         8  // deeper layers are accounted to this one
+
+static tw_timer_t probe_timer;
+static tw_timer_t probe_burst_timer;
+static int probe_rr = 0;
+static int probe_burst_rounds = 0;
+static uint16_t probe_seq_next = 0;
+
+// Mesh time (time_sync.c) is the root's clock. Every CONFIG_MESH_TIME_SYNC_PERIOD_MS the root
+// broadcasts time_sync; each node then runs one NTP-style exchange with it, spread over
+// TIME_SYNC_SPREAD_MS so the replies do not collide. A node that becomes root keeps
+// extrapolating its last estimate, so mesh time does not jump on a root change.
+#define TIME_SYNC_SPREAD_MS 2000
+
+static time_sync_t tsync;
+static portMUX_TYPE tsync_mux = portMUX_INITIALIZER_UNLOCKED;
+static tw_timer_t time_sync_timer;  // root: starts rounds
+static tw_timer_t time_req_timer;   // node: our exchange in the current round
+static int64_t time_req_t1 = 0;     // outstanding request (local us)
+
+// Scheduled LED toggle ("at" in mesh time); esp_timer because the timer service ticks at 100 ms
+static esp_timer_handle_t action_timer;
+static int64_t action_at = 0;
+static int64_t action_done_at = 0;  // a looped-back broadcast must not run the same action twice
+static bool action_ran = false;
+static int32_t action_late_us = 0;
+
+// Trace capture (trace.c): received frames, mesh/IP events and HTTP requests, for /api/trace
+static uint8_t trace_buf[CONFIG_MESH_TRACE_BUF_SIZE];
+static trace_t trace;
+static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Node registry for web interface
+#define MAX_MESH_NODES REGISTRY_MAX_NODES
+
+// Written by rx_task (status reports), the mesh event task (parent connected) and the timer
+// task (staleness), read by httpd and MQTT: every access holds registry_lock. Handlers format
+// an entry under it into their pooled buffer and send once it is given back.
+static node_registry_t registry;
+static SemaphoreHandle_t registry_lock = NULL;
+static uint8_t self_sta_mac[6]; // cached at startup; compared against on every message
+static lat_series_t layer_lat[PROBE_MAX_LAYER + 1]; // indexed by layer
+
+// Mesh tree (root only): updated from parent/children reported in status messages and from
+// our own child connect/disconnect events, never rebuilt on read
+static topo_t topology;
+static SemaphoreHandle_t topo_lock = NULL;
+static bool topology_ready = false;
+
+// Rejoin cache: last parent/channel/layer persisted in NVS so a reboot can skip the full scan
+#define REJOIN_NVS_NAMESPACE "mesh_cache"
+#define REJOIN_NVS_KEY       "parent"
+#define REJOIN_CACHE_VERSION 1
+#define REJOIN_FALLBACK_MS   8000 // give the cached parent this long before a full scan
+typedef struct {
+    uint8_t version;
+    uint8_t channel;
+    int8_t layer;
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t ssid[32];
+} rejoin_cache_t;
+
+static rejoin_cache_t rejoin_cache;
+static bool rejoin_cache_valid = false;
+static bool rejoin_attempt_active = false;
+static tw_timer_t rejoin_fallback_timer;
+
+// Parent optimizer (parent_opt.c): now and then a non-root node scans its channel and moves
+// to a stronger, less loaded parent higher up the tree. The switch goes through the
+// targeted-rejoin path, so a parent that does not answer falls back to self-organization.
+#define PARENT_OPT_SCAN_TIMEOUT_MS 2000
+#define PARENT_OPT_PASSIVE_MS      300  // three beacon intervals
+#if CONFIG_MESH_PARENT_OPT
+#define PARENT_OPT_ENABLED true
+#else
+#define PARENT_OPT_ENABLED false        // scores and reporting only; no scans
+#endif
+
+// Root view of the tree: layer and parent RSSI of active nodes
+typedef struct {
+    int nodes;
+    int layer_sum;
+    int max_layer;
+    int rssi_nodes;    // nodes that reported an RSSI
+    int rssi_sum;
+    int weak;          // parent RSSI below the optimizer's min_rssi
+    uint32_t switches; // parent switches the nodes reported
+    int64_t at_us;
+} tree_quality_t;
+
+static parent_opt_t parent_opt;
+static tw_timer_t parent_opt_timer;
+static tw_timer_t parent_opt_guard_timer;
+static bool parent_opt_scanning = false;
+static bool parent_opt_switching = false;
+static int parent_opt_from_layer;
+static int parent_opt_from_rssi;
+static tree_quality_t quality_baseline;
+static bool quality_baseline_set = false;
+
+// Join timing (esp_timer us; join_start_us is 0 at boot and reset on parent loss)
+static int64_t join_start_us = 0;
+static int64_t join_parent_us = 0;
+static int64_t join_registered_us = 0;
+
+// Flow control: heartbeats and status reports are paced by the mesh backlog (ours and the
+// one our parent advertises); commands, acks and backlog adverts bypass the limiter
+#define FLOW_TICK_MS       200
+#define FLOW_ADVERT_MS     1000 // re-advertise to children this often while congested
+#define FLOW_ADVERT_TTL_MS 3000 // an older parent advert counts as no backlog
+#if CONFIG_MESH_FLOW_CONTROL
+#define FLOW_ENFORCED true
+#else
+#define FLOW_ENFORCED false     // the controller still runs and counts
+#endif
+
+static flow_ctl_t flow;
+static portMUX_TYPE flow_mux = portMUX_INITIALIZER_UNLOCKED;
+static tw_timer_t flow_timer;
+static uint16_t parent_backlog = 0;
+static int64_t parent_backlog_us = 0;
+static int64_t flow_advert_us = 0;
+// A deferred report is resent with the then-current state, so only a flag (and the
+// requester for status_response) is kept
+static bool heartbeat_deferred = false;
+static bool status_deferred = false;
+static mesh_addr_t status_deferred_to;
+
+// Throughput benchmark: every node can send and receive; the root starts runs, collects
+// each node's result after the run and aggregates per layer
+#define BENCH_REPORT_DELAY_MS 2000 // after the run ends, before asking nodes for results
+_Static_assert(NODE_RESULT_MAX + 40 <= MSG_BUF_SZ, "bench_result message must fit a message pool block");
+_Static_assert(MAX_MESH_NODES * 13 + 160 <= MSG_BUF_SZ, "bench_start listing every sender must fit a message pool block");
+
+static bench_t bench;
+static SemaphoreHandle_t bench_lock = NULL;
+static TaskHandle_t bench_task_handle = NULL;
+static tw_timer_t bench_report_timer;
+static uint16_t bench_run = 0;
+
+// What nodes report back at the end of a bench run or a profiling window, latest per node
+_Static_assert(NODE_RESULT_MAX + 48 <= HTTP_BUF_SZ, "a node result must fit one HTTP chunk");
+static node_results_t bench_results;
+static node_results_t profile_results;
+static SemaphoreHandle_t results_lock;
+
+// CPU profiler: per-task CPU share and stack high-water marks from the FreeRTOS run-time
+// stats, and PC samples from a gptimer interrupt. Any node runs a window on request; one
+// started by a mesh command reports back to the sender as profile_result.
+_Static_assert(NODE_RESULT_MAX + 40 <= MSG_BUF_SZ, "profile_result message must fit a message pool block");
+
+static prof_t prof;
+static portMUX_TYPE prof_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool prof_running = false;
+static bool prof_report = false;       // send the result to prof_report_to when done
+static mesh_addr_t prof_report_to;
+static tw_timer_t prof_done_timer;
+
+#if CONFIG_MESH_PROFILE
+#define PROFILE_ENABLED true
+#define PROFILE_HZ      CONFIG_MESH_PROFILE_HZ
+#define PROFILE_MAX_MS  CONFIG_MESH_PROFILE_MAX_MS
+#else
+#define PROFILE_ENABLED false           // run-time stats off in sdkconfig: requests are refused
+#define PROFILE_HZ      0
+#define PROFILE_MAX_MS  10000
+#endif
 
 // LED Control Functions
 static void led_init(void) {
@@ -87,261 +326,3203 @@ static void led_init(void) {
     ESP_LOGI(TAG, "LED initialized on GPIO%d", LED_GPIO);
 }
 
-static void led_set(bool state) {
+// hops: rule actions that led to this change (0 when it did not come from a rule)
+static void led_apply(bool state, uint8_t hops) {
+    bool changed = state != led_state;
     led_state = state;
     gpio_set_level(LED_GPIO, state ? 1 : 0);
     ESP_LOGI(TAG, "LED %s", state ? "ON" : "OFF");
+    if (changed) {
+        rules_raise(state ? RULE_EV_LED_ON : RULE_EV_LED_OFF, hops);
+    }
+}
+
+static void led_set(bool state) {
+    led_apply(state, 0);
 }
 
 static void led_toggle(void) {
     led_set(!led_state);
 }
 
-// Node Registry Functions
-static void add_or_update_node(mesh_addr_t *addr, int layer) {
-    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
-    
-    // Filter out invalid entries: ignore self and non-mesh layers
-    if (layer < 1) {
-        ESP_LOGD(TAG, "Ignoring node with invalid layer %d", layer);
+// Rejoin Cache Functions
+static void rejoin_cache_load(void) {
+    nvs_handle_t h;
+    if (nvs_open(REJOIN_NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK) {
+        ESP_LOGI(TAG, "No rejoin cache - full scan");
         return;
     }
-    // Check against WiFi MAC (not mesh ID) to catch heartbeat loopback
-    uint8_t self_wifi_mac[6];
-    esp_wifi_get_mac(WIFI_IF_STA, self_wifi_mac);
-    if (memcmp(self_wifi_mac, addr->addr, 6) == 0) {
-        // Don't add ourselves from loopback/broadcasts
+    size_t len = sizeof(rejoin_cache);
+    esp_err_t err = nvs_get_blob(h, REJOIN_NVS_KEY, &rejoin_cache, &len);
+    nvs_close(h);
+    if (err != ESP_OK || len != sizeof(rejoin_cache) || rejoin_cache.version != REJOIN_CACHE_VERSION ||
+        rejoin_cache.channel == 0 || rejoin_cache.channel > 14 || rejoin_cache.layer < 1 ||
+        rejoin_cache.ssid_len == 0 || rejoin_cache.ssid_len > sizeof(rejoin_cache.ssid)) {
+        ESP_LOGI(TAG, "Rejoin cache missing or invalid (%s) - full scan", esp_err_to_name(err));
         return;
     }
-    
-    // Check if node already exists
-    for (int i = 0; i < node_count; i++) {
-        if (memcmp(known_nodes[i].addr.addr, addr->addr, 6) == 0) {
-            known_nodes[i].last_seen = now;
-            known_nodes[i].layer = layer;
-            known_nodes[i].is_active = true;
-            return;
+    rejoin_cache_valid = true;
+    ESP_LOGI(TAG, "Rejoin cache: channel=%d, layer=%d, parent=%02x:%02x:%02x:%02x:%02x:%02x",
+             rejoin_cache.channel, rejoin_cache.layer,
+             rejoin_cache.bssid[0], rejoin_cache.bssid[1], rejoin_cache.bssid[2],
+             rejoin_cache.bssid[3], rejoin_cache.bssid[4], rejoin_cache.bssid[5]);
+}
+
+static void rejoin_cache_store(const mesh_event_connected_t *conn, int layer) {
+    rejoin_cache_t c = {0};
+    c.version = REJOIN_CACHE_VERSION;
+    c.channel = conn->connected.channel;
+    c.layer = (int8_t)layer;
+    c.ssid_len = conn->connected.ssid_len <= sizeof(c.ssid) ? conn->connected.ssid_len : sizeof(c.ssid);
+    memcpy(c.bssid, conn->connected.bssid, 6);
+    memcpy(c.ssid, conn->connected.ssid, c.ssid_len);
+
+    // Skip the flash write when nothing changed (most reconnects land on the same parent)
+    if (rejoin_cache_valid && memcmp(&c, &rejoin_cache, sizeof(c)) == 0) {
+        return;
+    }
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(REJOIN_NVS_NAMESPACE, NVS_READWRITE, &h);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(h, REJOIN_NVS_KEY, &c, sizeof(c));
+        if (err == ESP_OK) {
+            err = nvs_commit(h);
         }
+        nvs_close(h);
     }
-    
-    // Add new node if there's space
-    if (node_count < MAX_MESH_NODES) {
-        memcpy(known_nodes[node_count].addr.addr, addr->addr, 6);
-        known_nodes[node_count].last_seen = now;
-        known_nodes[node_count].layer = layer;
-        known_nodes[node_count].led_state = false;
-        known_nodes[node_count].is_active = true;
-        memset(&known_nodes[node_count].last_from, 0, sizeof(known_nodes[node_count].last_from));
-        known_nodes[node_count].has_route = false;
-        known_nodes[node_count].rssi = -127;
-        node_count++;
-        ESP_LOGI(TAG, "Added node %02x:%02x:%02x:%02x:%02x:%02x to registry (layer %d)",
-                 addr->addr[0], addr->addr[1], addr->addr[2], addr->addr[3], addr->addr[4], addr->addr[5], layer);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to store rejoin cache: %s", esp_err_to_name(err));
+        return;
     }
+    rejoin_cache = c;
+    rejoin_cache_valid = true;
+    ESP_LOGI(TAG, "Rejoin cache updated: channel=%d, layer=%d", c.channel, c.layer);
 }
 
-// Convert RSSI (dBm) to a rough signal percentage for UI (0 to 100)
-static int rssi_to_percent(int rssi) {
-    if (rssi <= -90) return 0;
-    if (rssi >= -50) return 100;
-    // Map [-90..-50] dBm to [0..100]
-    int pct = (rssi + 90) * 25 / 10; // approx 2.5x
-    if (pct < 0) pct = 0;
-    if (pct > 100) pct = 100;
-    return pct;
+static void rejoin_fallback(const char *reason) {
+    if (!rejoin_attempt_active) {
+        return;
+    }
+    rejoin_attempt_active = false;
+    timer_service_cancel(&rejoin_fallback_timer);
+    ESP_LOGW(TAG, "%s failed (%s) - falling back to full scan", parent_opt_switching ? "Parent switch" : "Targeted rejoin",
+             reason);
+    parent_opt_switching = false;
+    esp_mesh_set_self_organized(true, true);
 }
 
-// Web Server HTTP Handlers
-static esp_err_t root_handler(httpd_req_t *req) {
-    const char* html = "<!DOCTYPE html>\n"
-    "<html><head><title>ESP32 Mesh Controller</title>\n"
-    "<style>body{font-family:Arial;margin:20px}table{border-collapse:collapse;width:100%}th,td{border:1px solid #ddd;padding:8px;text-align:left}th{background-color:#f2f2f2}.btn{padding:5px 10px;margin:2px;cursor:pointer}.btn-on{background-color:#4CAF50;color:white}.btn-off{background-color:#f44336;color:white}.sigbar{height:8px;background:#ddd;border-radius:4px;overflow:hidden}.sigfill{height:8px;background:#4CAF50}</style>\n"
-    "<script>\n"
-    "async function toggleLED(mac) {\n"
-    "  try {\n"
-    "    const response = await fetch(`/api/led/${mac}`, {method: 'POST'});\n"
-    "    if (response.ok) { loadNodes(); }\n"
-    "  } catch (e) { console.error('Failed to toggle LED:', e); }\n"
-    "}\n"
-    "async function loadNodes() {\n"
-    "  try {\n"
-    "    const response = await fetch('/api/nodes');\n"
-    "    const nodes = await response.json();\n"
-    "    const tbody = document.getElementById('nodeTable');\n"
-    "    tbody.innerHTML = '';\n"
-    "    nodes.forEach(node => {\n"
-    "      const label = node.signal >= 75 ? 'Strong' : (node.signal >= 50 ? 'Good' : (node.signal >= 25 ? 'Fair' : 'Weak'));\n"
-    "      const bar = `<div class='sigbar'><div class='sigfill' style='width:${node.signal}%' /></div>`;\n"
-    "      const row = `<tr>\n"
-    "        <td>${node.mac}</td>\n"
-    "        <td>${node.layer}</td>\n"
-    "        <td>${node.active ? 'Active' : 'Inactive'}</td>\n"
-    "        <td>${node.rssi ?? ''} dBm</td>\n"
-    "        <td>${bar} <small>${node.signal ?? 0}% (${label})</small></td>\n"
-    "        <td>${node.via ?? ''}</td>\n"
-    "        <td><button class='btn ${node.led ? 'btn-on' : 'btn-off'}' onclick='toggleLED(\"${node.mac}\")'>${node.led ? 'ON' : 'OFF'}</button></td>\n"
-    "      </tr>`;\n"
-    "      tbody.innerHTML += row;\n"
-    "    });\n"
-    "  } catch (e) { console.error('Failed to load nodes:', e); }\n"
-    "}\n"
-    "setInterval(loadNodes, 2000); // Refresh every 2 seconds\n"
-    "</script></head>\n"
-    "<body onload='loadNodes()'>\n"
-    "<h1>ESP32 Mesh Network Controller</h1>\n"
-    "<h2>Connected Nodes</h2>\n"
-    "<table><thead><tr><th>MAC Address</th><th>Layer</th><th>Status</th><th>RSSI</th><th>Signal</th><th>Via</th><th>LED Control</th></tr></thead><tbody id='nodeTable'></tbody></table>\n"
-    "</body></html>";
-    
-    httpd_resp_set_type(req, "text/html");
-    return httpd_resp_send(req, html, strlen(html));
+static void rejoin_fallback_cb(tw_timer_t *timer, void *arg) {
+    rejoin_fallback("timeout");
 }
 
-static esp_err_t api_nodes_handler(httpd_req_t *req) {
-    // Stream JSON in chunks to keep HTTPD stack usage low
-    uint8_t self_addr[6];
-    esp_wifi_get_mac(WIFI_IF_STA, self_addr);
-    httpd_resp_set_type(req, "application/json");
+// Point the mesh straight at the cached parent; self-organization stays off until it connects or times out
+static void rejoin_start_targeted(void) {
+    wifi_config_t parent = {0};
+    memcpy(parent.sta.ssid, rejoin_cache.ssid, rejoin_cache.ssid_len);
+    memcpy(parent.sta.bssid, rejoin_cache.bssid, 6);
+    parent.sta.bssid_set = true;
+    parent.sta.channel = rejoin_cache.channel;
+    memcpy(parent.sta.password, MESH_AP_PASS, strlen(MESH_AP_PASS));
 
-    // Mark stale nodes as inactive (no heartbeat/status for 60 seconds)
-    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
-    const uint32_t STALE_TIMEOUT_MS = 60000; // 60 seconds
-    for (int i = 0; i < node_count; i++) {
-        if (now - known_nodes[i].last_seen > STALE_TIMEOUT_MS) {
-            known_nodes[i].is_active = false;
+    esp_err_t err = esp_mesh_set_parent(&parent, NULL, MESH_NODE, rejoin_cache.layer);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "esp_mesh_set_parent failed (%s) - full scan", esp_err_to_name(err));
+        esp_mesh_set_self_organized(true, true);
+        return;
+    }
+    rejoin_attempt_active = true;
+    timer_service_arm_ms(&rejoin_fallback_timer, REJOIN_FALLBACK_MS, 0);
+    ESP_LOGI(TAG, "Targeted rejoin to cached parent on channel %d (layer %d)", rejoin_cache.channel, rejoin_cache.layer);
+}
+
+static uint32_t now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void parent_opt_scan_end(void) {
+    parent_opt_scanning = false;
+    timer_service_cancel(&parent_opt_guard_timer);
+}
+
+static void parent_opt_guard_cb(tw_timer_t *timer, void *arg) {
+    if (parent_opt_scanning) {
+        ESP_LOGW(TAG, "Parent scan timed out");
+        parent_opt_scan_end();
+        esp_mesh_set_self_organized(true, false);
+    }
+}
+
+// Scan only our channel (the whole mesh is on it) with self-organization held off, since
+// the mesh stack owns the radio's scans while it runs
+static void parent_opt_cb(tw_timer_t *timer, void *arg) {
+    if (is_root_node || !esp_mesh_is_device_active() || esp_mesh_get_layer() < 2 || rejoin_attempt_active ||
+        parent_opt_scanning) {
+        return;
+    }
+    uint8_t primary;
+    wifi_second_chan_t second;
+    if (esp_wifi_get_channel(&primary, &second) != ESP_OK) {
+        return;
+    }
+    wifi_scan_config_t scan = {
+        .channel = primary,
+        .show_hidden = true,
+        .scan_type = WIFI_SCAN_TYPE_PASSIVE,
+        .scan_time.passive = PARENT_OPT_PASSIVE_MS,
+    };
+    esp_mesh_set_self_organized(false, false);
+    esp_err_t err = esp_wifi_scan_start(&scan, false);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Parent scan failed to start: %s", esp_err_to_name(err));
+        esp_mesh_set_self_organized(true, false);
+        return;
+    }
+    parent_opt_scanning = true;
+    timer_service_arm_ms(&parent_opt_guard_timer, PARENT_OPT_SCAN_TIMEOUT_MS, 0);
+}
+
+// MESH_EVENT_SCAN_DONE for our scan: score the mesh APs and maybe move
+static void parent_opt_scan_done(int num) {
+    if (!parent_opt_scanning) {
+        return; // a scan of the mesh stack's own
+    }
+    parent_opt_scan_end();
+    static po_candidate_t cand[PO_MAX_CANDIDATES];
+    static wifi_ap_record_t recs[PO_MAX_CANDIDATES];
+    node_config_t nc;
+    node_config_get(&nc);
+    mesh_addr_t parent_bssid = {0};
+    esp_mesh_get_parent_bssid(&parent_bssid);
+    int n = 0;
+    for (int i = 0; i < num; i++) {
+        wifi_ap_record_t rec;
+        mesh_assoc_t assoc;
+        int ie_len = 0;
+        esp_mesh_scan_get_ap_ie_len(&ie_len);
+        if (esp_mesh_scan_get_ap_record(&rec, &assoc) != ESP_OK || ie_len != sizeof(assoc) || n == PO_MAX_CANDIDATES) {
+            continue; // the router or a foreign AP
+        }
+        // Leaf and idle nodes take no children
+        if (memcmp(assoc.mesh_id, nc.mesh_id, 6) != 0 || (assoc.mesh_type != MESH_ROOT && assoc.mesh_type != MESH_NODE)) {
+            continue;
         }
+        po_candidate_t *c = &cand[n];
+        memcpy(c->bssid, rec.bssid, 6);
+        c->rssi = rec.rssi;
+        c->layer = assoc.layer;
+        c->assoc = assoc.assoc;
+        c->assoc_cap = assoc.assoc_cap;
+        c->channel = rec.primary;
+        c->is_parent = memcmp(rec.bssid, parent_bssid.addr, 6) == 0;
+        recs[n++] = rec;
+    }
+    esp_mesh_flush_scan_result();
+
+    int my_layer = esp_mesh_get_layer();
+    int pick = po_evaluate(&parent_opt, cand, n, my_layer, now_ms());
+    if (pick < 0) {
+        esp_mesh_set_self_organized(true, false);
+        return;
     }
+    const po_candidate_t *c = &cand[pick];
+    wifi_config_t parent = {0};
+    memcpy(parent.sta.ssid, recs[pick].ssid, sizeof(parent.sta.ssid));
+    memcpy(parent.sta.bssid, c->bssid, 6);
+    parent.sta.bssid_set = true;
+    parent.sta.channel = c->channel;
+    memcpy(parent.sta.password, MESH_AP_PASS, strlen(MESH_AP_PASS));
 
-    // Start JSON array
-    httpd_resp_send_chunk(req, "[", 1);
+    wifi_ap_record_t now_ap = {0};
+    esp_wifi_sta_get_ap_info(&now_ap);
+    ESP_LOGI(TAG, "Parent switch: layer %d, rssi %d (score %d) -> %02x:%02x:%02x:%02x:%02x:%02x layer %d, "
+             "rssi %d, %d/%d children (score %d)", my_layer, now_ap.rssi, parent_opt.parent_score,
+             c->bssid[0], c->bssid[1], c->bssid[2], c->bssid[3], c->bssid[4], c->bssid[5],
+             c->layer + 1, c->rssi, c->assoc, c->assoc_cap, parent_opt.best_score);
+    esp_err_t err = esp_mesh_set_parent(&parent, NULL, MESH_NODE, c->layer + 1);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "esp_mesh_set_parent failed (%s) - staying", esp_err_to_name(err));
+        esp_mesh_set_self_organized(true, false);
+        return;
+    }
+    parent_opt_switching = true;
+    parent_opt_from_layer = my_layer;
+    parent_opt_from_rssi = now_ap.rssi;
+    rejoin_attempt_active = true;
+    timer_service_arm_ms(&rejoin_fallback_timer, REJOIN_FALLBACK_MS, 0);
+}
 
-    // Add self to the list
-    char mac_str[18];
-    snprintf(mac_str, sizeof(mac_str), "%02x:%02x:%02x:%02x:%02x:%02x",
+// From PARENT_CONNECTED: whoever picked the parent, hold off the next switch
+static void parent_opt_connected(void) {
+    po_settled(&parent_opt, now_ms());
+    if (!parent_opt_switching) {
+        return;
+    }
+    parent_opt_switching = false;
+    wifi_ap_record_t ap = {0};
+    esp_wifi_sta_get_ap_info(&ap);
+    ESP_LOGI(TAG, "Parent switch done: layer %d -> %d, rssi %d -> %d", parent_opt_from_layer, esp_mesh_get_layer(),
+             parent_opt_from_rssi, ap.rssi);
+}
+
+static void tree_quality_get(tree_quality_t *q) {
+    memset(q, 0, sizeof(*q));
+    q->at_us = esp_timer_get_time();
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    for (int i = 0; i < registry.count; i++) {
+        const node_info_t *node = &registry.nodes[i];
+        if (!node->is_active) {
+            continue;
+        }
+        q->nodes++;
+        q->layer_sum += node->layer;
+        q->max_layer = node->layer > q->max_layer ? node->layer : q->max_layer;
+        if (node->rssi > -127 && node->rssi < 0) {
+            q->rssi_nodes++;
+            q->rssi_sum += node->rssi;
+            q->weak += node->rssi < parent_opt.cfg.min_rssi;
+        }
+        q->switches += node->parent_switches;
+    }
+    xSemaphoreGive(registry_lock);
+}
+
+static int join_elapsed_ms(int64_t t_us) {
+    return t_us ? (int)((t_us - join_start_us) / 1000) : -1;
+}
+
+// ESP MACs are derived from one base: softAP = station + 1, as a 48-bit number (a softAP
+// ending in :00 borrows from the octets above). Mesh parents are reported by their softAP
+// BSSID; the registry is keyed by station MAC.
+static void mac_sta_from_ap(const uint8_t ap[6], uint8_t sta[6]) {
+    uint64_t v = 0;
+    for (int i = 0; i < 6; i++) {
+        v = v << 8 | ap[i];
+    }
+    v = (v - 1) & 0xFFFFFFFFFFFFull;
+    for (int i = 5; i >= 0; i--) {
+        sta[i] = (uint8_t)v;
+        v >>= 8;
+    }
+}
+
+static int64_t mesh_time_of(int64_t local_us) {
+    taskENTER_CRITICAL(&tsync_mux);
+    int64_t t = ts_to_mesh(&tsync, local_us);
+    taskEXIT_CRITICAL(&tsync_mux);
+    return t;
+}
+
+static int64_t mesh_time_now(void) {
+    return mesh_time_of(esp_timer_get_time());
+}
+
+// Capture hooks: cheap when tracing is off, so they sit directly on the hot paths
+static void trace_capture_rx(const mesh_addr_t *from, const mesh_data_t *data, int64_t rx_us) {
+    if (!trace_on(&trace)) {
+        return;
+    }
+    taskENTER_CRITICAL(&trace_mux);
+    trace_rx(&trace, (uint32_t)rx_us, from->addr, data->data, data->size);
+    taskEXIT_CRITICAL(&trace_mux);
+}
+
+static void trace_capture_event(uint8_t source, int32_t id) {
+    if (!trace_on(&trace)) {
+        return;
+    }
+    int layer = esp_mesh_get_layer();
+    taskENTER_CRITICAL(&trace_mux);
+    trace_event(&trace, (uint32_t)esp_timer_get_time(), source, id, layer);
+    taskEXIT_CRITICAL(&trace_mux);
+}
+
+static void trace_capture_http(httpd_req_t *req) {
+    if (!trace_on(&trace)) {
+        return;
+    }
+    taskENTER_CRITICAL(&trace_mux);
+    trace_http(&trace, (uint32_t)esp_timer_get_time(), (uint8_t)req->method, req->uri);
+    taskEXIT_CRITICAL(&trace_mux);
+}
+
+// Every outgoing heartbeat, status report, pong and command ack is counted
+static flow_verdict_t flow_gate(flow_class_t cls) {
+    taskENTER_CRITICAL(&flow_mux);
+    flow_verdict_t v = flow_admit(&flow, cls, esp_timer_get_time());
+    taskEXIT_CRITICAL(&flow_mux);
+    return FLOW_ENFORCED ? v : FLOW_SEND;
+}
+
+// rules is replaced wholesale by rules_adopt, so even the version is read under rules_lock
+static uint32_t rules_version(void) {
+    xSemaphoreTake(rules_lock, portMAX_DELAY);
+    uint32_t version = rules.version;
+    xSemaphoreGive(rules_lock);
+    return version;
+}
+
+_Static_assert(MESH_MSG_MAX_CHILDREN >= 10, "status reports must list every child max_connection allows");
+
+// Start of the status JSON shared by heartbeat and status_response: identity, LED, layer,
+// RSSI to parent/router, our place in the tree (parent station MAC, children as 12-hex MACs),
+// flow-control state, config version and time sync state. Returns the length written; the
+// caller appends any extra fields and the closing brace.
+static int format_status(char *buf, size_t len, const char *cmd) {
+    const uint8_t *self_addr = self_sta_mac;
+    char self_mac[18];
+    snprintf(self_mac, sizeof(self_mac), "%02x:%02x:%02x:%02x:%02x:%02x",
              self_addr[0], self_addr[1], self_addr[2],
              self_addr[3], self_addr[4], self_addr[5]);
 
-    // Determine our own RSSI to current AP (router if root, parent if not root)
-    int self_rssi = -127;
-    wifi_ap_record_t ap = {0};
-    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
-        self_rssi = ap.rssi;
+    // Capture our current RSSI to parent/router for link quality visualization
+    int my_rssi = -127;
+    wifi_ap_record_t aprec = {0};
+    if (esp_wifi_sta_get_ap_info(&aprec) == ESP_OK) {
+        my_rssi = aprec.rssi;
+    }
+
+    // Parent is only a mesh node below layer 1 (the root's parent is the router)
+    int layer = esp_mesh_get_layer();
+    char parent_mac[18] = "";
+    mesh_addr_t parent_bssid;
+    if (layer > 1 && esp_mesh_get_parent_bssid(&parent_bssid) == ESP_OK) {
+        uint8_t p[6];
+        mac_sta_from_ap(parent_bssid.addr, p);
+        snprintf(parent_mac, sizeof(parent_mac), "%02x:%02x:%02x:%02x:%02x:%02x", p[0], p[1], p[2], p[3], p[4], p[5]);
+    }
+
+    // Room for as many children as the root parses; max_connection is capped at that too
+    char children[MESH_MSG_MAX_CHILDREN * 13 + 1] = "";
+    wifi_sta_list_t sta_list;
+    if (esp_wifi_ap_get_sta_list(&sta_list) == ESP_OK) {
+        int cn = 0;
+        for (int i = 0; i < sta_list.num && i < MESH_MSG_MAX_CHILDREN; i++) {
+            const uint8_t *m = sta_list.sta[i].mac;
+            cn += snprintf(children + cn, sizeof(children) - cn, "%s%02x%02x%02x%02x%02x%02x",
+                           i ? "," : "", m[0], m[1], m[2], m[3], m[4], m[5]);
+        }
+    }
+
+    taskENTER_CRITICAL(&flow_mux);
+    flow_ctl_t fc = flow;
+    taskEXIT_CRITICAL(&flow_mux);
+    taskENTER_CRITICAL(&tsync_mux);
+    bool synced = tsync.synced;
+    int32_t drift_ppb = tsync.drift_ppb;
+    int32_t uncert_us = tsync.uncert_us;
+    taskEXIT_CRITICAL(&tsync_mux);
+
+    int n = snprintf(buf, len,
+        "{\"cmd\":\"%s\",\"mac\":\"%s\",\"led_state\":%s,\"layer\":%d,\"rssi\":%d,\"parent\":\"%s\",\"children\":\"%s\","
+        "\"q\":%u,\"fc\":%d,\"fr\":%lu,\"fd\":%lu,\"fx\":%lu,\"cv\":%lu,\"ts\":%d,\"td\":%ld,\"tu\":%ld,\"ps\":%lu",
+        cmd, self_mac, led_state ? "true" : "false", layer, my_rssi, parent_mac, children,
+        flow_backlog(&fc), fc.congested, (unsigned long)fc.rate_mps, (unsigned long)fc.deferred,
+        (unsigned long)fc.dropped, (unsigned long)node_config_version(), synced || is_root_node,
+        (long)drift_ppb, (long)uncert_us, (unsigned long)parent_opt.switches);
+    if (n > 0 && n < (int)len) {
+        n += snprintf(buf + n, len - n, ",\"rv\":%lu", (unsigned long)rules_version());
+    }
+    if (action_ran && n > 0 && n < (int)len) {
+        n += snprintf(buf + n, len - n, ",\"tl\":%ld", (long)action_late_us);
+    }
+    return n;
+}
+
+// ack is the command being answered; its seq is echoed so the root can match the reply
+static void send_status_frame(const mesh_addr_t *to, const mesh_msg_t *ack) {
+    char *resp_str = mem_budget_get(MEM_POOL_MSG);
+    if (!resp_str) {
+        return;
+    }
+    int n = format_status(resp_str, MSG_BUF_SZ, "status_response");
+    if (ack && ack->has_seq) {
+        n += snprintf(resp_str + n, MSG_BUF_SZ - n, ",\"seq\":%lu", (unsigned long)ack->seq);
+    }
+    snprintf(resp_str + n, MSG_BUF_SZ - n, "}");
+
+    mesh_data_t resp_data = {
+        .data = (uint8_t*)resp_str,
+        .size = strlen(resp_str),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P
+    };
+    esp_mesh_send(to, &resp_data, MESH_DATA_P2P, NULL, 0);
+    mem_budget_put(MEM_POOL_MSG, resp_str);
+}
+
+// Acks to a command are CONTROL and always go out; answers to status_request are STATE and
+// may be deferred to a later flow tick
+static void send_status_response(const mesh_addr_t *to, flow_class_t cls, const mesh_msg_t *ack) {
+    if (flow_gate(cls) != FLOW_SEND) {
+        taskENTER_CRITICAL(&flow_mux);
+        status_deferred = true;
+        status_deferred_to = *to;
+        taskEXIT_CRITICAL(&flow_mux);
+        return;
+    }
+    send_status_frame(to, ack);
+}
+
+// Broadcast our presence (LED state, layer, RSSI, tree position, join timing) so the root can discover/refresh us
+static void send_heartbeat_frame(void) {
+    char *ann_str = mem_budget_get(MEM_POOL_MSG);
+    if (!ann_str) {
+        return;
+    }
+    int n = format_status(ann_str, MSG_BUF_SZ, "heartbeat");
+    n += snprintf(ann_str + n, MSG_BUF_SZ - n, ",\"join_ms\":%d", join_elapsed_ms(join_parent_us));
+    // reg_ms is only present once the root acknowledged us; its absence asks the root for a join_ack
+    if (join_registered_us) {
+        n += snprintf(ann_str + n, MSG_BUF_SZ - n, ",\"reg_ms\":%d", join_elapsed_ms(join_registered_us));
+    }
+    snprintf(ann_str + n, MSG_BUF_SZ - n, "}");
+
+    mesh_data_t d = {
+        .data = (uint8_t*)ann_str,
+        .size = strlen(ann_str),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P
+    };
+    mesh_addr_t bcast = {0};
+    bcast.mip.port = MESH_DATA_P2P;
+    memset(bcast.addr, 0xFF, 6);
+    esp_err_t r = esp_mesh_send(&bcast, &d, MESH_DATA_P2P, NULL, 0);
+    mem_budget_put(MEM_POOL_MSG, ann_str);
+
+    if (r == ESP_OK) {
+        ESP_LOGD(TAG, "Sent heartbeat broadcast");
+    }
+}
+
+// Heartbeats only run on the timer service, like the flow tick that retries them
+static void send_heartbeat(void) {
+    heartbeat_deferred = flow_gate(FLOW_CLASS_STATE) != FLOW_SEND;
+    if (!heartbeat_deferred) {
+        send_heartbeat_frame();
+    }
+}
+
+static void announce_cb(tw_timer_t *timer, void *arg) {
+    if (esp_mesh_is_device_active()) {
+        send_heartbeat();
+    }
+}
+
+// Announce right away (on the timer service) instead of waiting for the next heartbeat period
+static void request_announce(void) {
+    timer_service_arm_ms(&announce_timer, 0, 0);
+}
+
+// Send our runtime config to one node, or to every node when to is NULL
+static void config_send(const mesh_addr_t *to) {
+    char *cfg_str = mem_budget_get(MEM_POOL_MSG);
+    if (!cfg_str) {
+        return;
+    }
+    node_config_t c;
+    node_config_get(&c);
+    int n = node_config_encode(&c, cfg_str, MSG_BUF_SZ);
+    if (n > 0) {
+        mesh_data_t d = {
+            .data = (uint8_t*)cfg_str,
+            .size = n,
+            .proto = MESH_PROTO_BIN,
+            .tos = MESH_TOS_P2P
+        };
+        mesh_addr_t bcast = {0};
+        if (!to) {
+            bcast.mip.port = MESH_DATA_P2P;
+            memset(bcast.addr, 0xFF, 6);
+            to = &bcast;
+        }
+        esp_mesh_send(to, &d, MESH_DATA_P2P, NULL, 0);
+    }
+    mem_budget_put(MEM_POOL_MSG, cfg_str);
+}
+
+// Periodic timers restart with the new periods; stale timers pick up the new timeout on each
+// node's next report
+static void config_apply_timing(void) {
+    node_config_t c;
+    node_config_get(&c);
+    timer_service_arm_ms(&heartbeat_timer, c.heartbeat_ms, c.heartbeat_ms);
+    timer_service_arm_ms(&status_timer, c.status_ms, c.status_ms);
+}
+
+// Make c current (persisted) and apply what can be applied live
+static esp_err_t config_adopt(const node_config_t *c, const char **why) {
+    uint32_t changed;
+    esp_err_t err = node_config_set(c, &changed, why);
+    if (err == ESP_OK && (changed & NODE_CONFIG_CHANGED_TIMING)) {
+        config_apply_timing();
+    }
+    return err;
+}
+
+// The newest version wins everywhere: a newer config is adopted (and, on the root, pushed on),
+// a sender with an older one gets ours back
+static void config_handle_push(const char *raw, const mesh_addr_t *from) {
+    node_config_t c;
+    node_config_get(&c);
+    uint32_t ours = c.version;
+    if (!node_config_decode(raw, &c) || c.version == ours) {
+        return;
+    }
+    if (c.version < ours) {
+        config_send(from);
+        return;
+    }
+    const char *why;
+    if (config_adopt(&c, &why) != ESP_OK) {
+        ESP_LOGW(TAG, "Rejected config v%lu: %s", (unsigned long)c.version, why);
+        return;
+    }
+    if (is_root_node) {
+        config_send(NULL);
+    } else {
+        // Report the new version right away so the root sees the push land
+        request_announce();
+    }
+}
+
+static void rules_collect(void *ctx, const rule_action_t *a) {
+    rule_batch_t *b = ctx;
+    if (b->n < RULES_MAX) {
+        b->a[b->n++] = *a;
+    }
+}
+
+static void rules_begin(void) {
+    xSemaphoreTake(rules_lock, portMAX_DELAY);
+    rules_batch.n = 0;
+}
+
+// Release the lock with the collected actions in *out, and account the evaluation time
+static void rules_end(rule_batch_t *out, int64_t t0) {
+    int32_t us = (int32_t)(esp_timer_get_time() - t0);
+    rules_evals++;
+    rules_eval_us += us;
+    rules_eval_max_us = us > rules_eval_max_us ? us : rules_eval_max_us;
+    *out = rules_batch;
+    xSemaphoreGive(rules_lock);
+}
+
+// {"cmd":"signal","sig":N,"h":hops,"mac":<us>} straight to each member of the group: one
+// hop to a neighbour instead of up to the root and back down
+static void rules_send_signal(const rule_action_t *a) {
+    char sig_str[96];
+    const uint8_t *s = self_sta_mac;
+    int n = snprintf(sig_str, sizeof(sig_str),
+                     "{\"cmd\":\"signal\",\"sig\":%u,\"h\":%u,\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\"}",
+                     a->arg, a->hops, s[0], s[1], s[2], s[3], s[4], s[5]);
+    mesh_data_t d = {
+        .data = (uint8_t*)sig_str,
+        .size = n,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P
+    };
+    xSemaphoreTake(rules_lock, portMAX_DELAY);
+    mesh_addr_t to[RULES_MAX_NODES];
+    int count = 0;
+    for (int i = 0; i < rules.node_count; i++) {
+        if (rules_in_group(&rules, i, a->group) && memcmp(rules.nodes[i].mac, self_sta_mac, 6) != 0) {
+            memcpy(to[count++].addr, rules.nodes[i].mac, 6);
+        }
+    }
+    xSemaphoreGive(rules_lock);
+    for (int i = 0; i < count; i++) {
+        if (esp_mesh_send(&to[i], &d, MESH_DATA_P2P, NULL, 0) == ESP_OK) {
+            rules_signals_tx++;
+        }
+    }
+}
+
+static void rules_run(const rule_batch_t *b) {
+    for (int i = 0; i < b->n; i++) {
+        const rule_action_t *a = &b->a[i];
+        ESP_LOGI(TAG, "Rule %d fired (hop %u)", a->rule, a->hops);
+        if (a->act == RULE_ACT_LED) {
+            led_apply(a->arg == RULE_LED_TOGGLE ? !led_state : a->arg == RULE_LED_ON, a->hops);
+        } else {
+            rules_send_signal(a);
+        }
+    }
+}
+
+static void rules_raise(rule_event_t ev, uint8_t hops) {
+    if (!rules_lock) {
+        return; // before rules_setup
+    }
+    rule_batch_t b;
+    rules_begin();
+    int64_t t0 = esp_timer_get_time();
+    rules_event(&rules, ev, hops, now_ms());
+    rules_end(&b, t0);
+    rules_run(&b);
+}
+
+static void rules_handle_signal(const mesh_msg_t *m) {
+    if (!m->has_mac || m->signal < 1 || m->signal > 255) {
+        return;
+    }
+    rules_signals_rx++;
+    rule_batch_t b;
+    rules_begin();
+    int64_t t0 = esp_timer_get_time();
+    rules_signal(&rules, m->mac, (uint8_t)m->signal, m->hops > RULES_MAX_HOPS ? RULES_MAX_HOPS : m->hops, now_ms());
+    rules_end(&b, t0);
+    rules_run(&b);
+}
+
+static void rules_timer_cb(tw_timer_t *timer, void *arg) {
+    rule_batch_t b;
+    rules_begin();
+    int64_t t0 = esp_timer_get_time();
+    uint32_t next = rules_tick(&rules, now_ms());
+    rules_end(&b, t0);
+    if (next != UINT32_MAX) {
+        timer_service_arm_ms(&rules_timer, next, 0);
+    }
+    rules_run(&b);
+}
+
+// Make a rule set current; with store it is also written to NVS
+static const char *rules_adopt(uint32_t version, const uint8_t *blob, size_t len, bool store) {
+    xSemaphoreTake(rules_lock, portMAX_DELAY);
+    const char *why = rules_load(&rules, version, blob, len, now_ms());
+    int count = rules.count;
+    xSemaphoreGive(rules_lock);
+    if (why) {
+        return why;
+    }
+    timer_service_arm_ms(&rules_timer, 0, 0);
+    ESP_LOGI(TAG, "Rules v%lu: %d rules", (unsigned long)version, count);
+    if (!store) {
+        return NULL;
+    }
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(RULES_NVS_NAMESPACE, NVS_READWRITE, &h);
+    if (err == ESP_OK) {
+        err = nvs_set_u32(h, "ver", version);
+        if (err == ESP_OK) {
+            err = nvs_set_blob(h, "blob", blob, len);
+        }
+        if (err == ESP_OK) {
+            err = nvs_commit(h);
+        }
+        nvs_close(h);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to store rules: %s", esp_err_to_name(err));
+    }
+    return NULL;
+}
+
+// Send our rules to one node, or to every node when to is NULL
+static void rules_send(const mesh_addr_t *to) {
+    char *rules_str = mem_budget_get(MEM_POOL_MSG);
+    if (!rules_str) {
+        return;
+    }
+    xSemaphoreTake(rules_lock, portMAX_DELAY);
+    int n = rules_encode(&rules, rules_str, MSG_BUF_SZ);
+    xSemaphoreGive(rules_lock);
+    if (n > 0) {
+        mesh_data_t d = {
+            .data = (uint8_t*)rules_str,
+            .size = n,
+            .proto = MESH_PROTO_BIN,
+            .tos = MESH_TOS_P2P
+        };
+        mesh_addr_t bcast = {0};
+        if (!to) {
+            bcast.mip.port = MESH_DATA_P2P;
+            memset(bcast.addr, 0xFF, 6);
+            to = &bcast;
+        }
+        esp_mesh_send(to, &d, MESH_DATA_P2P, NULL, 0);
+    }
+    mem_budget_put(MEM_POOL_MSG, rules_str);
+}
+
+// Same newest-wins exchange as the runtime config
+static void rules_handle_push(const char *raw, const mesh_addr_t *from) {
+    uint32_t version;
+    uint8_t blob[RULES_BLOB_MAX];
+    size_t len;
+    if (!rules_decode(raw, &version, blob, sizeof(blob), &len)) {
+        return;
+    }
+    uint32_t current = rules_version();
+    if (version == current) {
+        return;
+    }
+    if (version < current) {
+        rules_send(from);
+        return;
+    }
+    const char *why = rules_adopt(version, blob, len, true);
+    if (why) {
+        ESP_LOGW(TAG, "Rejected rules v%lu: %s", (unsigned long)version, why);
+        return;
+    }
+    if (is_root_node) {
+        rules_send(NULL);
+    } else {
+        request_announce();
+    }
+}
+
+static void rules_setup(void) {
+    rules_lock = xSemaphoreCreateMutex();
+    rules_init(&rules, rules_collect, &rules_batch);
+    tw_timer_init(&rules_timer, rules_timer_cb, NULL);
+    nvs_handle_t h;
+    if (nvs_open(RULES_NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK) {
+        return;
+    }
+    uint32_t version = 0;
+    uint8_t blob[RULES_BLOB_MAX];
+    size_t len = sizeof(blob);
+    if (nvs_get_u32(h, "ver", &version) == ESP_OK && nvs_get_blob(h, "blob", blob, &len) == ESP_OK) {
+        const char *why = rules_adopt(version, blob, len, false);
+        if (why) {
+            ESP_LOGW(TAG, "Stored rules v%lu invalid (%s) - none loaded", (unsigned long)version, why);
+        }
+    }
+    nvs_close(h);
+}
+
+// Tell each direct child how backed up we are; they fold it into their own congestion signal
+static void flow_advertise(uint16_t backlog) {
+    wifi_sta_list_t sta_list;
+    if (esp_wifi_ap_get_sta_list(&sta_list) != ESP_OK) {
+        return;
+    }
+    char adv_str[32];
+    int n = snprintf(adv_str, sizeof(adv_str), "{\"cmd\":\"backlog\",\"q\":%u}", backlog);
+    mesh_data_t d = {
+        .data = (uint8_t*)adv_str,
+        .size = n,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P
+    };
+    for (int i = 0; i < sta_list.num; i++) {
+        mesh_addr_t to = {0};
+        memcpy(to.addr, sta_list.sta[i].mac, 6);
+        flow_gate(FLOW_CLASS_CONTROL);
+        esp_mesh_send(&to, &d, MESH_DATA_P2P, NULL, 0);
+    }
+}
+
+// Backlog from a backlog advert or heartbeat; only our parent's counts
+static void flow_note_parent(const mesh_addr_t *from, int backlog) {
+    mesh_addr_t parent_bssid;
+    if (backlog < 0 || esp_mesh_get_layer() <= 1 || esp_mesh_get_parent_bssid(&parent_bssid) != ESP_OK) {
+        return;
+    }
+    uint8_t parent_sta[6];
+    mac_sta_from_ap(parent_bssid.addr, parent_sta);
+    if (memcmp(from->addr, parent_sta, 6) != 0) {
+        return;
+    }
+    taskENTER_CRITICAL(&flow_mux);
+    parent_backlog = backlog > UINT16_MAX ? UINT16_MAX : backlog;
+    parent_backlog_us = esp_timer_get_time();
+    taskEXIT_CRITICAL(&flow_mux);
+}
+
+// Sample the mesh queues, adjust the rate, resend deferred reports and advertise to children
+static void flow_tick_cb(tw_timer_t *timer, void *arg) {
+    if (!esp_mesh_is_device_active()) {
+        return;
+    }
+    // Our upstream: frames waiting to leave toward the parent plus frames we have not read yet
+    int local = 0;
+    mesh_tx_pending_t tx;
+    if (esp_mesh_get_tx_pending(&tx) == ESP_OK) {
+        local += tx.to_parent + tx.to_parent_p2p + tx.broadcast;
+    }
+    mesh_rx_pending_t rx;
+    if (esp_mesh_get_rx_pending(&rx) == ESP_OK) {
+        local += rx.toSelf;
+    }
+    if (local > UINT16_MAX) {
+        local = UINT16_MAX;
+    }
+
+    int64_t now = esp_timer_get_time();
+    mesh_addr_t status_to;
+    taskENTER_CRITICAL(&flow_mux);
+    uint16_t upstream = now - parent_backlog_us < (int64_t)FLOW_ADVERT_TTL_MS * 1000 ? parent_backlog : 0;
+    bool changed = flow_update(&flow, (uint16_t)local, upstream, now);
+    bool congested = flow.congested;
+    uint16_t backlog = flow_backlog(&flow);
+    uint32_t rate = flow.rate_mps;
+    bool retry_hb = heartbeat_deferred && flow_retry(&flow, now);
+    bool retry_status = status_deferred && flow_retry(&flow, now);
+    if (retry_status) {
+        status_deferred = false;
+        status_to = status_deferred_to;
+    }
+    taskEXIT_CRITICAL(&flow_mux);
+
+    if (retry_hb) {
+        heartbeat_deferred = false;
+        send_heartbeat_frame();
+    }
+    if (retry_status) {
+        send_status_frame(&status_to, NULL);
+    }
+    if (changed) {
+        ESP_LOGI(TAG, "Flow control: %s (backlog %u, rate %lu.%03lu msg/s)", congested ? "congested" : "clear",
+                 backlog, (unsigned long)(rate / 1000), (unsigned long)(rate % 1000));
+    }
+    if (changed || (congested && now - flow_advert_us >= (int64_t)FLOW_ADVERT_MS * 1000)) {
+        flow_advert_us = now;
+        flow_advertise(backlog);
+    }
+}
+
+// Root: start a sync round
+static void time_sync_cb(tw_timer_t *timer, void *arg) {
+    if (!is_root_node || !esp_mesh_is_device_active()) {
+        return;
+    }
+    const char *sync_str = "{\"cmd\":\"time_sync\"}";
+    mesh_data_t sync_data = {
+        .data = (uint8_t*)sync_str,
+        .size = strlen(sync_str),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P
+    };
+    mesh_addr_t bcast = {0};
+    memset(bcast.addr, 0xFF, 6);
+    bcast.mip.port = MESH_DATA_P2P;
+    esp_mesh_send(&bcast, &sync_data, MESH_DATA_P2P, NULL, 0);
+}
+
+// Our slot in the round, by MAC so siblings do not all answer at once
+static void time_req_schedule(void) {
+    uint32_t slot = ((uint32_t)self_sta_mac[4] << 8 | self_sta_mac[5]) % TIME_SYNC_SPREAD_MS;
+    timer_service_arm_ms(&time_req_timer, slot, 0);
+}
+
+// Node: one exchange with the root; t1 is taken right before the send
+static void time_req_cb(tw_timer_t *timer, void *arg) {
+    if (is_root_node || !esp_mesh_is_device_active()) {
+        return;
+    }
+    // Queueing makes the path asymmetric: under congestion skip the round rather than take a bad sample
+    if (flow_gate(FLOW_CLASS_PROBE) != FLOW_SEND) {
+        return;
+    }
+    char req_str[48];
+    int64_t t1 = esp_timer_get_time();
+    int n = snprintf(req_str, sizeof(req_str), "{\"cmd\":\"time_req\",\"t1\":%lld}", (long long)t1);
+    mesh_data_t req_data = {
+        .data = (uint8_t*)req_str,
+        .size = n,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P
+    };
+    taskENTER_CRITICAL(&tsync_mux);
+    time_req_t1 = t1;
+    taskEXIT_CRITICAL(&tsync_mux);
+    esp_mesh_send(NULL, &req_data, MESH_DATA_P2P, NULL, 0);
+}
+
+// Root: t2 is when rx_task got the request, t3 is taken as late as possible before the send
+static void handle_time_req(const mesh_msg_t *m, const mesh_addr_t *from, int64_t rx_us) {
+    char resp_str[96];
+    int n = snprintf(resp_str, sizeof(resp_str), "{\"cmd\":\"time_resp\",\"t1\":%lld,\"t2\":%lld",
+                     (long long)m->t1, (long long)mesh_time_of(rx_us));
+    n += snprintf(resp_str + n, sizeof(resp_str) - n, ",\"t3\":%lld}", (long long)mesh_time_now());
+    mesh_data_t resp_data = {
+        .data = (uint8_t*)resp_str,
+        .size = n,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P
+    };
+    esp_mesh_send(from, &resp_data, MESH_DATA_P2P, NULL, 0);
+}
+
+// Node: only the answer to our outstanding request counts. The fit runs on a copy so the
+// critical section stays short; rx_task is the only writer.
+static void handle_time_resp(const mesh_msg_t *m, int64_t rx_us) {
+    time_sync_t ts;
+    taskENTER_CRITICAL(&tsync_mux);
+    bool ours = time_req_t1 != 0 && m->t1 == time_req_t1;
+    if (ours) {
+        time_req_t1 = 0;
+        ts = tsync;
+    }
+    taskEXIT_CRITICAL(&tsync_mux);
+    if (!ours) {
+        return;
+    }
+    bool was_synced = ts.synced;
+    uint32_t steps = ts.steps;
+    if (!ts_add_exchange(&ts, m->t1, m->t2, m->t3, rx_us)) {
+        return;
+    }
+    taskENTER_CRITICAL(&tsync_mux);
+    tsync = ts;
+    taskEXIT_CRITICAL(&tsync_mux);
+    if (!was_synced || ts.steps != steps) {
+        ESP_LOGI(TAG, "Time sync: offset %lld us, uncertainty %ld us%s", (long long)ts.ref_offset_us,
+                 (long)ts.uncert_us, was_synced ? " (mesh time jumped, window restarted)" : "");
+    }
+}
+
+static void action_cb(void *arg) {
+    led_toggle();
+    action_late_us = (int32_t)(mesh_time_now() - action_at);
+    action_ran = true;
+    // Let the root see the new LED state and how late we were without waiting for a heartbeat
+    request_announce();
+}
+
+// LED toggle at mesh time "at". A newer schedule replaces a pending one; a node that never
+// synced (or gets the command too late) toggles right away.
+static void schedule_led_toggle(int64_t at) {
+    if (at == action_done_at) {
+        return;
+    }
+    esp_timer_stop(action_timer);
+    taskENTER_CRITICAL(&tsync_mux);
+    bool synced = tsync.synced || is_root_node;
+    int64_t local = ts_to_local(&tsync, at);
+    taskEXIT_CRITICAL(&tsync_mux);
+    action_at = at;
+    action_done_at = at;
+    int64_t delay_us = local - esp_timer_get_time();
+    if (!synced || delay_us <= 0) {
+        action_cb(NULL);
+        return;
+    }
+    esp_timer_start_once(action_timer, (uint64_t)delay_us);
+}
+
+// Queue a node's current state for the MQTT uplink (no-op unless we are root with the uplink running)
+static void uplink_node(const node_info_t *node, uint8_t events) {
+    if (!is_root_node) {
+        return;
+    }
+    mqtt_uplink_node_t up = {
+        .layer = node->layer,
+        .active = node->is_active,
+        .led = node->led_state,
+        .rssi = node->rssi,
+    };
+    memcpy(up.mac, node->mac, 6);
+    mqtt_uplink_node_event(&up, events);
+}
+
+// Topology Functions
+static void topology_reset(void) {
+    xSemaphoreTake(topo_lock, portMAX_DELAY);
+    topo_init(&topology, self_sta_mac);
+    topology_ready = true;
+    xSemaphoreGive(topo_lock);
+}
+
+// Our own children come straight from the softAP station list
+static void topology_refresh_self(void) {
+    if (!topology_ready) {
+        return;
+    }
+    wifi_sta_list_t sta_list;
+    if (esp_wifi_ap_get_sta_list(&sta_list) != ESP_OK) {
+        return;
+    }
+    uint8_t children[ESP_WIFI_MAX_CONN_NUM][6];
+    int n = 0;
+    for (int i = 0; i < sta_list.num && n < ESP_WIFI_MAX_CONN_NUM; i++) {
+        memcpy(children[n++], sta_list.sta[i].mac, 6);
+    }
+    const uint8_t *self_addr = self_sta_mac;
+    xSemaphoreTake(topo_lock, portMAX_DELAY);
+    if (topo_set_children(&topology, self_addr, (const uint8_t (*)[6])children, n)) {
+        ESP_LOGI(TAG, "Topology: root now has %d children", n);
+    }
+    xSemaphoreGive(topo_lock);
+}
+
+// Apply "parent"/"children" from a node's heartbeat or status_response; no-op when unchanged
+static void topology_apply_report(const uint8_t mac[6], const mesh_msg_t *m) {
+    if (!topology_ready || !m->has_tree) {
+        return; // older firmware without tree info
+    }
+    xSemaphoreTake(topo_lock, portMAX_DELAY);
+    bool changed = false;
+    if (m->has_parent) {
+        changed |= topo_set_parent(&topology, mac, m->parent);
+    }
+    changed |= topo_set_children(&topology, mac, (const uint8_t (*)[6])m->children, m->child_count);
+    topo_set_rssi(&topology, mac, m->rssi);
+    xSemaphoreGive(topo_lock);
+    if (changed) {
+        ESP_LOGI(TAG, "Topology changed at %02x:%02x:%02x:%02x:%02x:%02x (%d children)",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], m->child_count);
+    }
+}
+
+// Node Registry Functions
+static void node_stale_cb(tw_timer_t *timer, void *arg) {
+    node_info_t *node = (node_info_t *)arg;
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    // A report that got the lock first has re-armed the timer: the node is not stale. Only
+    // this task and holders of registry_lock touch the timer, so the check needs no wheel lock.
+    if (tw_is_armed(&node->stale_timer)) {
+        xSemaphoreGive(registry_lock);
+        return;
+    }
+    node->is_active = false;
+    uplink_node(node, MQTT_UPLINK_EV_STALE);
+    xSemaphoreGive(registry_lock);
+    ESP_LOGI(TAG, "Node %02x:%02x:%02x:%02x:%02x:%02x went stale",
+             node->mac[0], node->mac[1], node->mac[2],
+             node->mac[3], node->mac[4], node->mac[5]);
+}
+
+// Called by the registry, under registry_lock, before an inactive node's slot is reused. The
+// cancel cannot wait on node_stale_cb for this node: only an active node has its timer armed.
+static void registry_evict_cb(void *ctx, node_info_t *node) {
+    timer_service_cancel(&node->stale_timer);
+    uplink_node(node, MQTT_UPLINK_EV_EVICT);
+    if (topology_ready) {
+        xSemaphoreTake(topo_lock, portMAX_DELAY);
+        topo_remove(&topology, node->mac);
+        xSemaphoreGive(topo_lock);
+    }
+    ESP_LOGI(TAG, "Evicting inactive node %02x:%02x:%02x:%02x:%02x:%02x",
+             node->mac[0], node->mac[1], node->mac[2], node->mac[3], node->mac[4], node->mac[5]);
+}
+
+// Stale timer and uplink bookkeeping once the registry has seen a node (under registry_lock)
+static void node_seen(node_info_t *node, bool is_new) {
+    if (is_new) {
+        tw_timer_init(&node->stale_timer, node_stale_cb, node);
+        uplink_node(node, MQTT_UPLINK_EV_JOIN);
+        ESP_LOGI(TAG, "Added node %02x:%02x:%02x:%02x:%02x:%02x to registry (layer %d)",
+                 node->mac[0], node->mac[1], node->mac[2], node->mac[3], node->mac[4], node->mac[5], node->layer);
+    }
+    node_config_t c;
+    node_config_get(&c);
+    timer_service_arm_ms(&node->stale_timer, c.stale_ms, 0);
+}
+
+static void add_or_update_node(const uint8_t mac[6], int layer) {
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    uint32_t drops = registry.drops;
+    bool is_new;
+    node_info_t *node = registry_touch(&registry, mac, layer, now, &is_new);
+    if (node) {
+        node_seen(node, is_new);
+    }
+    bool dropped = registry.drops != drops;
+    xSemaphoreGive(registry_lock);
+    if (dropped) {
+        ESP_LOGW(TAG, "Registry full of active nodes - dropping %02x:%02x:%02x:%02x:%02x:%02x",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
+}
+
+// Convert RSSI (dBm) to a rough signal percentage for UI (0 to 100)
+static int rssi_to_percent(int rssi) {
+    if (rssi <= -90) return 0;
+    if (rssi >= -50) return 100;
+    // Map [-90..-50] dBm to [0..100]
+    int pct = (rssi + 90) * 25 / 10; // approx 2.5x
+    if (pct < 0) pct = 0;
+    if (pct > 100) pct = 100;
+    return pct;
+}
+
+// Web Server HTTP Handlers
+static esp_err_t root_handler(httpd_req_t *req) {
+    const char* html = "<!DOCTYPE html>\n"
+    "<html><head><title>ESP32 Mesh Controller</title>\n"
+    "<style>body{font-family:Arial;margin:20px}table{border-collapse:collapse;width:100%}th,td{border:1px solid #ddd;padding:8px;text-align:left}th{background-color:#f2f2f2}.btn{padding:5px 10px;margin:2px;cursor:pointer}.btn-on{background-color:#4CAF50;color:white}.btn-off{background-color:#f44336;color:white}.sigbar{height:8px;background:#ddd;border-radius:4px;overflow:hidden}.sigfill{height:8px;background:#4CAF50}</style>\n"
+    "<script>\n"
+    "async function toggleLED(mac) {\n"
+    "  try {\n"
+    "    const response = await fetch(`/api/led/${mac}`, {method: 'POST'});\n"
+    "    if (response.ok) { loadNodes(); }\n"
+    "  } catch (e) { console.error('Failed to toggle LED:', e); }\n"
+    "}\n"
+    "async function loadNodes() {\n"
+    "  try {\n"
+    "    const response = await fetch('/api/nodes');\n"
+    "    const nodes = await response.json();\n"
+    "    const tbody = document.getElementById('nodeTable');\n"
+    "    tbody.innerHTML = '';\n"
+    "    nodes.forEach(node => {\n"
+    "      const label = node.signal >= 75 ? 'Strong' : (node.signal >= 50 ? 'Good' : (node.signal >= 25 ? 'Fair' : 'Weak'));\n"
+    "      const bar = `<div class='sigbar'><div class='sigfill' style='width:${node.signal}%' /></div>`;\n"
+    "      const row = `<tr>\n"
+    "        <td>${node.mac}</td>\n"
+    "        <td>${node.layer}</td>\n"
+    "        <td>${node.active ? 'Active' : 'Inactive'}</td>\n"
+    "        <td>${node.rssi ?? ''} dBm</td>\n"
+    "        <td>${bar} <small>${node.signal ?? 0}% (${label})</small></td>\n"
+    "        <td>${node.via ?? ''}</td>\n"
+    "        <td><button class='btn ${node.led ? 'btn-on' : 'btn-off'}' onclick='toggleLED(\"${node.mac}\")'>${node.led ? 'ON' : 'OFF'}</button></td>\n"
+    "      </tr>`;\n"
+    "      tbody.innerHTML += row;\n"
+    "    });\n"
+    "  } catch (e) { console.error('Failed to load nodes:', e); }\n"
+    "}\n"
+    "setInterval(loadNodes, 2000); // Refresh every 2 seconds\n"
+    "</script></head>\n"
+    "<body onload='loadNodes()'>\n"
+    "<h1>ESP32 Mesh Network Controller</h1>\n"
+    "<h2>Connected Nodes</h2>\n"
+    "<table><thead><tr><th>MAC Address</th><th>Layer</th><th>Status</th><th>RSSI</th><th>Signal</th><th>Via</th><th>LED Control</th></tr></thead><tbody id='nodeTable'></tbody></table>\n"
+    "</body></html>";
+    
+    httpd_resp_set_type(req, "text/html");
+    return httpd_resp_send(req, html, strlen(html));
+}
+
+// Response chunk buffer from the HTTP pool; answers 503 itself when the pool is exhausted
+static char *http_buf_get(httpd_req_t *req) {
+    char *buf = mem_budget_get(MEM_POOL_HTTP);
+    if (!buf) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "Out of response buffers");
+    }
+    return buf;
+}
+
+static esp_err_t api_nodes_handler(httpd_req_t *req) {
+    // Stream JSON in chunks to keep HTTPD stack usage low. The buffer comes first: with the
+    // pool empty the client gets a clean 503 instead of a truncated array.
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    const uint8_t *self_addr = self_sta_mac;
+    httpd_resp_set_type(req, "application/json");
+
+    // Add self to the list
+    char mac_str[18];
+    snprintf(mac_str, sizeof(mac_str), "%02x:%02x:%02x:%02x:%02x:%02x",
+             self_addr[0], self_addr[1], self_addr[2],
+             self_addr[3], self_addr[4], self_addr[5]);
+
+    // Determine our own RSSI to current AP (router if root, parent if not root)
+    int self_rssi = -127;
+    wifi_ap_record_t ap = {0};
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        self_rssi = ap.rssi;
+    }
+    // Open the JSON array with our own entry
+    int n = snprintf(buf, HTTP_BUF_SZ,
+                     "[{\"mac\":\"%s\",\"layer\":%d,\"active\":true,\"led\":%s,\"rssi\":%d,\"signal\":%d,\"via\":\"root\",\"join_ms\":%d,\"reg_ms\":%d}",
+                     mac_str, esp_mesh_get_layer(), led_state ? "true" : "false", self_rssi, rssi_to_percent(self_rssi),
+                     join_elapsed_ms(join_parent_us), join_elapsed_ms(join_registered_us));
+    if (n > 0) httpd_resp_send_chunk(req, buf, n);
+    
+    // Add known nodes (show both active and inactive)
+    for (int i = 0; ; i++) {
+        xSemaphoreTake(registry_lock, portMAX_DELAY);
+        if (i >= registry.count) {
+            xSemaphoreGive(registry_lock);
+            break;
+        }
+        const node_info_t *node = &registry.nodes[i];
+        snprintf(mac_str, sizeof(mac_str), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 node->mac[0], node->mac[1], node->mac[2], node->mac[3], node->mac[4], node->mac[5]);
+
+        char via_str[18] = "";
+        if (node->has_route) {
+            snprintf(via_str, sizeof(via_str), "%02x:%02x:%02x:%02x:%02x:%02x",
+                     node->route[0], node->route[1], node->route[2],
+                     node->route[3], node->route[4], node->route[5]);
+            // If via equals node MAC, treat as direct
+            if (strcmp(via_str, mac_str) == 0) {
+                strcpy(via_str, "direct");
+            }
+        } else {
+            strcpy(via_str, "?");
+        }
+        n = snprintf(buf, HTTP_BUF_SZ,
+                     ",{\"mac\":\"%s\",\"layer\":%d,\"active\":%s,\"led\":%s,\"rssi\":%d,\"signal\":%d,\"via\":\"%s\",\"join_ms\":%d,\"reg_ms\":%d}",
+                     mac_str, node->layer,
+                     node->is_active ? "true" : "false",
+                     node->led_state ? "true" : "false",
+                     node->rssi, rssi_to_percent(node->rssi), via_str,
+                     node->join_ms, node->reg_ms);
+        xSemaphoreGive(registry_lock);
+        if (n > 0) httpd_resp_send_chunk(req, buf, n);
+    }
+
+    mem_budget_put(MEM_POOL_HTTP, buf);
+
+    // End JSON array
+    httpd_resp_send_chunk(req, "]", 1);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// RTT Probing Functions
+static lat_series_t *layer_series(int layer) {
+    if (layer < 1) layer = 1;
+    if (layer > PROBE_MAX_LAYER) layer = PROBE_MAX_LAYER;
+    return &layer_lat[layer];
+}
+
+// Ping carries our send time; the node echoes it back so no per-probe state is needed beyond the seq.
+// Probe state and the latency series belong to the registry: the timer task sends, rx_task
+// records the pong, both under registry_lock, which is not held across the send itself.
+static void send_probe(const uint8_t mac[6]) {
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    node_info_t *node = registry_find(&registry, mac);
+    if (!node || !node->is_active || !node->has_route) {
+        xSemaphoreGive(registry_lock);
+        return;
+    }
+    if (node->probe_pending) {
+        node->lat.lost++;
+        layer_series(node->layer)->lost++;
+    }
+    uint16_t seq = ++probe_seq_next;
+    node->probe_seq = seq;
+    node->probe_pending = true;
+    // Counted before the send so a fast pong never finds more received than sent
+    node->lat.sent++;
+    layer_series(node->layer)->sent++;
+    int layer = node->layer;
+    mesh_addr_t to;
+    memcpy(to.addr, node->route, 6);
+    xSemaphoreGive(registry_lock);
+
+    char ping_str[80];
+    int n = snprintf(ping_str, sizeof(ping_str), "{\"cmd\":\"ping\",\"seq\":%u,\"t\":%lld}",
+                     seq, (long long)esp_timer_get_time());
+    mesh_data_t data = {
+        .data = (uint8_t*)ping_str,
+        .size = n,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P
+    };
+    if (esp_mesh_send(&to, &data, MESH_DATA_P2P, NULL, 0) != ESP_OK) {
+        xSemaphoreTake(registry_lock, portMAX_DELAY);
+        node = registry_find(&registry, mac);
+        if (node && node->probe_pending && node->probe_seq == seq) {
+            node->probe_pending = false;
+            node->lat.sent--;
+        }
+        layer_series(layer)->sent--;
+        xSemaphoreGive(registry_lock);
+    }
+}
+
+// Periodic low-rate probe: next active node in round-robin order
+static void probe_cb(tw_timer_t *timer, void *arg) {
+    uint8_t mac[6];
+    bool found = false;
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    for (int tries = 0; tries < registry.count && !found; tries++) {
+        probe_rr = (probe_rr + 1) % registry.count;
+        if (registry.nodes[probe_rr].is_active && registry.nodes[probe_rr].has_route) {
+            memcpy(mac, registry.nodes[probe_rr].mac, 6);
+            found = true;
+        }
+    }
+    xSemaphoreGive(registry_lock);
+    if (found) {
+        send_probe(mac);
+    }
+}
+
+static void probe_burst_cb(tw_timer_t *timer, void *arg) {
+    for (int i = 0; ; i++) {
+        uint8_t mac[6];
+        xSemaphoreTake(registry_lock, portMAX_DELAY);
+        bool more = i < registry.count;
+        if (more) {
+            memcpy(mac, registry.nodes[i].mac, 6);
+        }
+        xSemaphoreGive(registry_lock);
+        if (!more) {
+            break;
+        }
+        send_probe(mac);
+    }
+    if (--probe_burst_rounds <= 0) {
+        timer_service_cancel(&probe_burst_timer);
+    }
+}
+
+static void handle_pong(const mesh_msg_t *m) {
+    if (!m->has_mac || !m->has_seq) {
+        return;
+    }
+    int64_t rtt_us = esp_timer_get_time() - m->t;
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    node_info_t *node = registry_find(&registry, m->mac);
+    if (!node) {
+        xSemaphoreGive(registry_lock);
+        return;
+    }
+    if (node->probe_pending && node->probe_seq == (uint16_t)m->seq && rtt_us >= 0) {
+        node->probe_pending = false;
+        node->lat.received++;
+        lat_record(&node->lat, (uint32_t)rtt_us);
+        lat_series_t *ls = layer_series(node->layer);
+        ls->received++;
+        lat_record(ls, (uint32_t)rtt_us);
+        // The node stamped the ping with its mesh time; assume that happened half way through the round trip
+        if (m->has_mesh_time) {
+            node->sync_err_us = (int32_t)(m->mesh_t - (mesh_time_of(m->t) + rtt_us / 2));
+            node->has_sync_err = true;
+        }
+    } else {
+        node->lat.late++;
+        layer_series(node->layer)->late++;
+    }
+    xSemaphoreGive(registry_lock);
+}
+
+static void probe_start(void) {
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    for (int i = 0; i <= PROBE_MAX_LAYER; i++) {
+        lat_series_init(&layer_lat[i]);
+    }
+    xSemaphoreGive(registry_lock);
+    if (PROBE_INTERVAL_MS > 0) {
+        timer_service_arm_ms(&probe_timer, PROBE_INTERVAL_MS, PROBE_INTERVAL_MS);
+    }
+}
+
+static void probe_stop(void) {
+    timer_service_cancel(&probe_timer);
+    timer_service_cancel(&probe_burst_timer);
+    probe_burst_rounds = 0;
+}
+
+// Benchmark Functions
+static int bench_mesh_send(void *ctx, const uint8_t dst[6], const uint8_t *frame, size_t len, uint8_t tos) {
+    static const uint8_t root_addr[6] = {0};
+    mesh_data_t data = {
+        .data = (uint8_t*)frame,
+        .size = len,
+        .proto = MESH_PROTO_BIN,
+        .tos = tos == BENCH_TOS_E2E ? MESH_TOS_E2E : tos == BENCH_TOS_DEF ? MESH_TOS_DEF : MESH_TOS_P2P
+    };
+    // Non-blocking: a full TX queue is a send failure, which is exactly what we want to measure
+    if (memcmp(dst, root_addr, 6) == 0) {
+        return esp_mesh_send(NULL, &data, MESH_DATA_NONBLOCK, NULL, 0) == ESP_OK ? 0 : -1;
+    }
+    mesh_addr_t to = {0};
+    memcpy(to.addr, dst, 6);
+    return esp_mesh_send(&to, &data, MESH_DATA_P2P | MESH_DATA_NONBLOCK, NULL, 0) == ESP_OK ? 0 : -1;
+}
+
+// Paces the generator at the FreeRTOS tick; sleeps on a notification between runs
+static void bench_task(void *arg) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        bool active = true;
+        while (active) {
+            xSemaphoreTake(bench_lock, portMAX_DELAY);
+            bench_tx_poll(&bench, esp_timer_get_time());
+            active = bench.tx_active;
+            xSemaphoreGive(bench_lock);
+            vTaskDelay(1);
+        }
+        ESP_LOGI(TAG, "Benchmark run %u done: sent %lu, failed %lu, skipped %lu", bench.params.run,
+                 (unsigned long)bench.tx_sent, (unsigned long)bench.tx_failed, (unsigned long)bench.tx_skipped);
+    }
+}
+
+static void bench_init_local(void) {
+    const uint8_t *self_addr = self_sta_mac;
+    bench_transport_t tp = {.send = bench_mesh_send, .ctx = NULL};
+    bench_lock = xSemaphoreCreateMutex();
+    bench_init(&bench, self_addr, &tp);
+}
+
+// Handle {"cmd":"bench_start",...}: everyone resets its receiver for the run, listed senders start
+static void bench_handle_start(const char *msg) {
+    char *run_ptr = strstr(msg, "\"run\":");
+    char *rate_ptr = strstr(msg, "\"rate\":");
+    char *size_ptr = strstr(msg, "\"size\":");
+    char *tos_ptr = strstr(msg, "\"tos\":");
+    char *dur_ptr = strstr(msg, "\"dur_ms\":");
+    char *dst_ptr = strstr(msg, "\"dst\":\"");
+    char *senders_ptr = strstr(msg, "\"senders\":\"");
+    if (!run_ptr || !rate_ptr || !size_ptr || !tos_ptr || !dur_ptr || !dst_ptr || !senders_ptr) {
+        return;
+    }
+    bench_params_t p = {
+        .run = (uint16_t)atoi(run_ptr + 6),
+        .rate = (uint32_t)atoi(rate_ptr + 7),
+        .size = (uint16_t)atoi(size_ptr + 7),
+        .tos = (uint8_t)atoi(tos_ptr + 6),
+        .duration_ms = (uint32_t)atoi(dur_ptr + 9),
+    };
+    if (dst_ptr[7] != '"') {
+        mesh_msg_parse_mac_hex12(dst_ptr + 7, p.dst);
+    }
+    const uint8_t *self_addr = self_sta_mac;
+    bool selected = false;
+    const char *c = senders_ptr + 12;
+    if (strncmp(c, "all\"", 4) == 0) {
+        selected = !is_root_node;
+    } else {
+        uint8_t mac[6];
+        while (*c != '"' && mesh_msg_parse_mac_hex12(c, mac)) {
+            if (memcmp(mac, self_addr, 6) == 0) {
+                selected = true;
+                break;
+            }
+            c += 12;
+            if (*c == ',') c++;
+        }
+    }
+    if (memcmp(p.dst, self_addr, 6) == 0 || (is_root_node && !(p.dst[0] | p.dst[1] | p.dst[2] | p.dst[3] | p.dst[4] | p.dst[5]))) {
+        selected = false; // never send to ourselves
+    }
+
+    xSemaphoreTake(bench_lock, portMAX_DELAY);
+    if (selected) {
+        bench_start(&bench, &p, esp_timer_get_time());
+    } else {
+        bench_stop(&bench, esp_timer_get_time());
+        bench_reset(&bench, p.run);
+    }
+    xSemaphoreGive(bench_lock);
+
+    if (selected) {
+        ESP_LOGI(TAG, "Benchmark run %u: sending %lu frames/s x %u bytes for %lu ms", p.run,
+                 (unsigned long)p.rate, p.size, (unsigned long)p.duration_ms);
+        if (!bench_task_handle) {
+            xTaskCreate(bench_task, "bench", 3072, NULL, 3, &bench_task_handle);
+        }
+        xTaskNotifyGive(bench_task_handle);
+    }
+}
+
+// Send a JSON message to one node, unicast along its route when we have one and broadcast
+// otherwise (nodes filter on target_mac), or to every node when target is NULL
+static esp_err_t mesh_send_msg(const uint8_t *target, const char *msg, size_t len) {
+    mesh_data_t data = {
+        .data = (uint8_t*)msg,
+        .size = len,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P
+    };
+    mesh_addr_t to;
+    bool routed = false;
+    if (target) {
+        xSemaphoreTake(registry_lock, portMAX_DELAY);
+        node_info_t *node = registry_find(&registry, target);
+        if (node && node->has_route) {
+            memcpy(to.addr, node->route, 6);
+            routed = true;
+        }
+        xSemaphoreGive(registry_lock);
+    }
+    if (routed) {
+        esp_err_t uerr = esp_mesh_send(&to, &data, MESH_DATA_P2P, NULL, 0);
+        ESP_LOGI(TAG, "Unicast to %02x:%02x:%02x:%02x:%02x:%02x via %02x:%02x:%02x:%02x:%02x:%02x: %s",
+                 target[0], target[1], target[2], target[3], target[4], target[5], to.addr[0], to.addr[1],
+                 to.addr[2], to.addr[3], to.addr[4], to.addr[5], esp_err_to_name(uerr));
+        if (uerr == ESP_OK) {
+            return ESP_OK;
+        }
+    }
+    mesh_addr_t bcast = {0};
+    memset(bcast.addr, 0xFF, 6);
+    bcast.mip.port = MESH_DATA_P2P;
+    return esp_mesh_send(&bcast, &data, MESH_DATA_P2P, NULL, 0);
+}
+
+// Reply to {"cmd":"bench_report"} with our result wrapped as {"cmd":"bench_result","result":{...}}
+static void bench_send_result(const mesh_addr_t *to) {
+    char *msg = mem_budget_get(MEM_POOL_MSG);
+    if (!msg) {
+        return;
+    }
+    int n = snprintf(msg, MSG_BUF_SZ, "{\"cmd\":\"bench_result\",\"result\":");
+    xSemaphoreTake(bench_lock, portMAX_DELAY);
+    n += bench_format_result(&bench, msg + n, NODE_RESULT_MAX, esp_timer_get_time());
+    xSemaphoreGive(bench_lock);
+    n += snprintf(msg + n, MSG_BUF_SZ - n, "}");
+    mesh_data_t data = {
+        .data = (uint8_t*)msg,
+        .size = n,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P
+    };
+    esp_mesh_send(to, &data, MESH_DATA_P2P, NULL, 0);
+    mem_budget_put(MEM_POOL_MSG, msg);
+}
+
+// Root: keep the latest result per node
+static void bench_store_result(const char *msg) {
+    xSemaphoreTake(results_lock, portMAX_DELAY);
+    node_results_store(&bench_results, msg, bench_run, esp_timer_get_time());
+    xSemaphoreGive(results_lock);
+}
+
+static void bench_report_cb(tw_timer_t *timer, void *arg) {
+    char msg[48];
+    int n = snprintf(msg, sizeof(msg), "{\"cmd\":\"bench_report\",\"run\":%u}", bench_run);
+    mesh_send_msg(NULL, msg, n);
+}
+
+static int bench_layer_of(void *ctx, const uint8_t mac[6]) {
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    node_info_t *node = registry_find(&registry, mac);
+    int layer = node ? node->layer : -1;
+    xSemaphoreGive(registry_lock);
+    return layer;
+}
+
+static gptimer_handle_t prof_gptimer = NULL;
+static prof_task_t prof_tasks[PROF_MAX_TASKS];
+
+#if CONFIG_MESH_PROFILE
+static TaskStatus_t prof_status[PROF_MAX_TASKS];
+
+static int prof_snapshot(uint32_t *total) {
+    configRUN_TIME_COUNTER_TYPE run_total = 0;
+    int n = uxTaskGetSystemState(prof_status, PROF_MAX_TASKS, &run_total);
+    if (n == 0) {
+        ESP_LOGW(TAG, "More than %d tasks - profile has no task list", PROF_MAX_TASKS);
+    }
+    for (int i = 0; i < n; i++) {
+        prof_task_t *t = &prof_tasks[i];
+        t->id = prof_status[i].xTaskNumber;
+        snprintf(t->name, sizeof(t->name), "%s", prof_status[i].pcTaskName);
+        t->runtime = prof_status[i].ulRunTimeCounter;
+        t->stack_free = prof_status[i].usStackHighWaterMark;
+        t->prio = prof_status[i].uxCurrentPriority;
+    }
+    *total = run_total;
+    return n;
+}
+
+// mepc still holds the PC the timer interrupted: the vector saved it to the frame, and only
+// a nested interrupt would overwrite it before we run
+static bool prof_gptimer_cb(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *ctx) {
+    prof_sample(&prof, RV_READ_CSR(mepc));
+    return false;
+}
+
+static void prof_timer_setup(void) {
+    gptimer_config_t cfg = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000000,
+    };
+    gptimer_alarm_config_t alarm = {
+        .alarm_count = 1000000 / PROFILE_HZ,
+        .reload_count = 0,
+        .flags.auto_reload_on_alarm = true,
+    };
+    gptimer_event_callbacks_t cbs = { .on_alarm = prof_gptimer_cb };
+    if (gptimer_new_timer(&cfg, &prof_gptimer) != ESP_OK ||
+        gptimer_register_event_callbacks(prof_gptimer, &cbs, NULL) != ESP_OK ||
+        gptimer_set_alarm_action(prof_gptimer, &alarm) != ESP_OK) {
+        ESP_LOGE(TAG, "Profiler timer unavailable - /api/profile has task stats only");
+        prof_gptimer = NULL;
+    }
+}
+#else
+static int prof_snapshot(uint32_t *total) {
+    *total = 0;
+    return 0;
+}
+#endif
+
+// The closed window is formatted once, as {"cmd":"profile_result","result":{...}}: kept with
+// the node results (our own shows up in /api/profile like any node's) and sent to whoever
+// asked for it
+static void profile_publish_result(void) {
+    char *msg = mem_budget_get(MEM_POOL_MSG);
+    if (!msg) {
+        return;
+    }
+    const uint8_t *s = self_sta_mac;
+    char mac[18];
+    snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x", s[0], s[1], s[2], s[3], s[4], s[5]);
+    int n = snprintf(msg, MSG_BUF_SZ, "{\"cmd\":\"profile_result\",\"result\":");
+    n += prof_format(&prof, mac, msg + n, NODE_RESULT_MAX);
+    n += snprintf(msg + n, MSG_BUF_SZ - n, "}");
+    xSemaphoreTake(results_lock, portMAX_DELAY);
+    node_results_store(&profile_results, msg, 0, esp_timer_get_time());
+    xSemaphoreGive(results_lock);
+    if (prof_report) {
+        mesh_data_t data = {
+            .data = (uint8_t*)msg,
+            .size = n,
+            .proto = MESH_PROTO_BIN,
+            .tos = MESH_TOS_P2P
+        };
+        esp_mesh_send(&prof_report_to, &data, MESH_DATA_P2P, NULL, 0);
+    }
+    mem_budget_put(MEM_POOL_MSG, msg);
+}
+
+static void prof_done_cb(tw_timer_t *timer, void *arg) {
+    if (prof_gptimer) {
+        gptimer_stop(prof_gptimer);
+        gptimer_disable(prof_gptimer);
+    }
+    uint32_t total;
+    int n = prof_snapshot(&total);
+    prof_end(&prof, prof_tasks, n, total, esp_timer_get_time());
+    ESP_LOGI(TAG, "Profile done: %lu samples, %d tasks", (unsigned long)prof.samples, n);
+    profile_publish_result();
+    taskENTER_CRITICAL(&prof_mux);
+    prof_running = false;
+    taskEXIT_CRITICAL(&prof_mux);
+}
+
+// Opens a profiling window of ms; if to is given the result is sent there when it closes
+static esp_err_t profile_start(uint32_t ms, const mesh_addr_t *to) {
+    if (!PROFILE_ENABLED) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    taskENTER_CRITICAL(&prof_mux);
+    bool busy = prof_running;
+    prof_running = true;
+    taskEXIT_CRITICAL(&prof_mux);
+    if (busy) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    prof_report = to != NULL;
+    if (to) {
+        prof_report_to = *to;
+    }
+    uint32_t total;
+    int n = prof_snapshot(&total);
+    prof_begin(&prof, prof_tasks, n, total, esp_timer_get_time());
+    if (prof_gptimer) {
+        gptimer_enable(prof_gptimer);
+        gptimer_start(prof_gptimer);
+    }
+    timer_service_arm_ms(&prof_done_timer, ms, 0);
+    ESP_LOGI(TAG, "Profiling for %lu ms (%d tasks, PC samples at %d Hz)", (unsigned long)ms, n, PROFILE_HZ);
+    return ESP_OK;
+}
+
+static void profile_setup(void) {
+    tw_timer_init(&prof_done_timer, prof_done_cb, NULL);
+#if CONFIG_MESH_PROFILE
+    prof_timer_setup();
+#endif
+}
+
+// {"cmd":"profile","ms":N[,"target_mac":..]}: start a window, report to whoever asked
+static void profile_handle_request(const mesh_msg_t *m, const mesh_addr_t *from) {
+    if (m->has_target && memcmp(m->target, self_sta_mac, 6) != 0) {
+        return;
+    }
+    int ms = m->duration_ms;
+    if (ms < 100 || ms > PROFILE_MAX_MS) {
+        ms = 2000;
+    }
+    esp_err_t err = profile_start(ms, from);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Profile request ignored: %s", esp_err_to_name(err));
+    }
+}
+
+// Root: keep the latest result per node
+static void profile_store_result(const char *msg) {
+    xSemaphoreTake(results_lock, portMAX_DELAY);
+    node_results_store(&profile_results, msg, 0, esp_timer_get_time());
+    xSemaphoreGive(results_lock);
+}
+
+// Send {"cmd":<cmd>,"target_mac":<mac>} to a node: unicast if we have a route for it, else broadcast.
+// A nonzero seq goes along and comes back in the node's ack.
+static esp_err_t mesh_send_command(const char *mac_param, const char *cmd, uint32_t seq) {
+    char *cmd_str = mem_budget_get(MEM_POOL_MSG);
+    if (!cmd_str) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (seq) {
+        snprintf(cmd_str, MSG_BUF_SZ, "{\"cmd\":\"%s\",\"target_mac\":\"%s\",\"seq\":%lu}", cmd, mac_param,
+                 (unsigned long)seq);
+    } else {
+        snprintf(cmd_str, MSG_BUF_SZ, "{\"cmd\":\"%s\",\"target_mac\":\"%s\"}", cmd, mac_param);
+    }
+
+    uint8_t target[6];
+    bool parsed = mesh_msg_parse_mac(mac_param, target);
+    esp_err_t err = mesh_send_msg(parsed ? target : NULL, cmd_str, strlen(cmd_str));
+    mem_budget_put(MEM_POOL_MSG, cmd_str);
+    ESP_LOGI(TAG, "Sent %s to %s: %s", cmd, mac_param, esp_err_to_name(err));
+    return err;
+}
+
+static bool cmd_unreachable(const uint8_t mac[6]) {
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    node_info_t *node = registry_find(&registry, mac);
+    bool unreachable = !node || !node->is_active || !node->has_route;
+    xSemaphoreGive(registry_lock);
+    return unreachable;
+}
+
+// Queue led_toggle or status_request for a node we cannot reach. A toggle is stored as the
+// state the node should end up in: the opposite of what is already queued, else of what the
+// node last reported. False if the queue has no room for another node.
+static bool cmd_queue_command(const uint8_t mac[6], const char *cmd, bool *led_out) {
+    uint32_t now = now_ms();
+    bool ok;
+    if (strcmp(cmd, "led_toggle") == 0) {
+        xSemaphoreTake(registry_lock, portMAX_DELAY);
+        node_info_t *node = registry_find(&registry, mac);
+        bool led = node && node->led_state;
+        xSemaphoreGive(registry_lock);
+        taskENTER_CRITICAL(&cmd_queue_mux);
+        uint8_t queued;
+        if (cmdq_peek(&cmd_queue, mac, CMDQ_LED, &queued)) {
+            led = queued;
+        }
+        ok = cmdq_put(&cmd_queue, mac, CMDQ_LED, !led, now);
+        taskEXIT_CRITICAL(&cmd_queue_mux);
+        if (led_out) {
+            *led_out = !led;
+        }
+    } else {
+        taskENTER_CRITICAL(&cmd_queue_mux);
+        ok = cmdq_put(&cmd_queue, mac, CMDQ_STATUS, 0, now);
+        taskEXIT_CRITICAL(&cmd_queue_mux);
+    }
+    ESP_LOGI(TAG, "%s %s for %02x:%02x:%02x:%02x:%02x:%02x until it reports", ok ? "Queued" : "No room to queue",
+             cmd, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    return ok;
+}
+
+// The node just reported: send it whatever was queued while it was away. The entries stay
+// queued until the node acks the batch's seq; until then each heartbeat sends the batch again
+// (a status_response only sends what has not gone out yet, it may be crossing our batch).
+static void cmd_queue_flush(const uint8_t mac[6], const mesh_addr_t *to, bool heartbeat) {
+    uint32_t now = now_ms();
+    taskENTER_CRITICAL(&cmd_queue_mux);
+    bool due = cmdq_due(&cmd_queue, mac, heartbeat, now);
+    taskEXIT_CRITICAL(&cmd_queue_mux);
+    if (!due) {
+        return;
+    }
+    // A seq of its own so the ack cannot close a parked HTTP command by mistake
+    taskENTER_CRITICAL(&cmd_wait_mux);
+    cmd_seq_next = cmd_seq_next + 1 ? cmd_seq_next + 1 : 1;
+    uint32_t seq = cmd_seq_next;
+    taskEXIT_CRITICAL(&cmd_wait_mux);
+    cmdq_batch_t b;
+    taskENTER_CRITICAL(&cmd_queue_mux);
+    bool any = cmdq_send(&cmd_queue, mac, seq, now, &b);
+    taskEXIT_CRITICAL(&cmd_queue_mux);
+    if (!any) {
+        return;
+    }
+    char msg[112];
+    int n = snprintf(msg, sizeof(msg), "{\"cmd\":\"cmd_batch\",\"target_mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"seq\":%lu",
+                     mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], (unsigned long)seq);
+    if (b.led >= 0) {
+        n += snprintf(msg + n, sizeof(msg) - n, ",\"led\":%d", b.led);
+    }
+    n += snprintf(msg + n, sizeof(msg) - n, "}");
+    mesh_data_t data = {
+        .data = (uint8_t*)msg,
+        .size = n,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P
+    };
+    esp_err_t err = esp_mesh_send(to, &data, MESH_DATA_P2P, NULL, 0);
+    ESP_LOGI(TAG, "Sent queued commands to %02x:%02x:%02x:%02x:%02x:%02x (seq %lu, led %d, %u coalesced, oldest %lu ms): %s",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], (unsigned long)seq, b.led, b.coalesced,
+             (unsigned long)b.oldest_ms, esp_err_to_name(err));
+}
+
+// status_response echoing a cmd_batch seq: what that batch carried has arrived
+static void cmd_queue_ack(const uint8_t mac[6], uint32_t seq) {
+    taskENTER_CRITICAL(&cmd_queue_mux);
+    int acked = cmdq_ack(&cmd_queue, mac, seq);
+    taskEXIT_CRITICAL(&cmd_queue_mux);
+    if (acked) {
+        ESP_LOGI(TAG, "Queued commands for %02x:%02x:%02x:%02x:%02x:%02x acked (seq %lu, %d entries)",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], (unsigned long)seq, acked);
+    }
+}
+
+// MQTT command topic -> mesh (only commands a node knows how to handle are forwarded)
+static void mqtt_command_cb(const char *target_mac, const char *cmd) {
+    if (strcmp(cmd, "led_toggle") != 0 && strcmp(cmd, "status_request") != 0) {
+        ESP_LOGW(TAG, "Unsupported MQTT command '%s'", cmd);
+        return;
+    }
+    uint8_t target[6];
+    bool parsed = mesh_msg_parse_mac(target_mac, target);
+    if (parsed && memcmp(target, self_sta_mac, 6) == 0) {
+        if (strcmp(cmd, "led_toggle") == 0) {
+            led_toggle();
+        }
+        return;
+    }
+    if (parsed && cmd_unreachable(target)) {
+        cmd_queue_command(target, cmd, NULL);
+        return;
+    }
+    mesh_send_command(target_mac, cmd, 0);
+}
+
+static esp_err_t api_mqtt_handler(httpd_req_t *req) {
+    mqtt_uplink_stats_t st;
+    mqtt_uplink_get_stats(&st);
+    // Throughput over the uplink's lifetime
+    uint32_t secs = st.uptime_ms / 1000;
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    int n = snprintf(buf, HTTP_BUF_SZ,
+                     "{\"enabled\":%s,\"connected\":%s,\"uptime_ms\":%lu,\"batches\":%lu,\"updates\":%lu,"
+                     "\"coalesced\":%lu,\"bytes\":%lu,\"updates_per_s\":%lu,\"bytes_per_s\":%lu,"
+                     "\"queue_depth\":%lu,\"queue_drops\":%lu,\"cmds\":%lu,"
+                     "\"e2e\":{\"samples\":%lu,\"last_ms\":%lu,\"min_ms\":%lu,\"avg_ms\":%lu,\"max_ms\":%lu}}",
+                     st.enabled ? "true" : "false", st.connected ? "true" : "false",
+                     (unsigned long)st.uptime_ms, (unsigned long)st.batches_sent, (unsigned long)st.updates_sent,
+                     (unsigned long)st.updates_coalesced, (unsigned long)st.bytes_sent,
+                     (unsigned long)(secs ? st.updates_sent / secs : 0), (unsigned long)(secs ? st.bytes_sent / secs : 0),
+                     (unsigned long)st.queue_depth, (unsigned long)st.queue_drops, (unsigned long)st.cmds_received,
+                     (unsigned long)st.e2e_samples, (unsigned long)st.e2e_last_ms, (unsigned long)st.e2e_min_ms,
+                     (unsigned long)st.e2e_avg_ms, (unsigned long)st.e2e_max_ms);
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t err = httpd_resp_send(req, buf, n);
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    return err;
+}
+
+static esp_err_t api_topology_handler(httpd_req_t *req) {
+    // Snapshot under the lock, then stream without holding it
+    static topo_t snap;
+    if (!topology_ready) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Topology only available on root");
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(topo_lock, portMAX_DELAY);
+    snap = topology;
+    xSemaphoreGive(topo_lock);
+
+    topo_summary_t sum;
+    topo_get_summary(&snap, &sum);
+    int avg_x100 = sum.nodes > 1 ? sum.depth_sum * 100 / (sum.nodes - 1) : 0;
+
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/json");
+    const uint8_t *r = snap.nodes[snap.root].mac;
+    int n = snprintf(buf, HTTP_BUF_SZ,
+                     "{\"root\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"summary\":{\"nodes\":%d,\"orphans\":%d,"
+                     "\"max_depth\":%d,\"avg_depth\":%d.%02d,\"max_branch\":%d,\"min_branch\":%d,\"changes\":%lu},\"links\":[",
+                     r[0], r[1], r[2], r[3], r[4], r[5], sum.nodes, sum.orphans, sum.max_depth,
+                     avg_x100 / 100, avg_x100 % 100, sum.max_branch, sum.min_branch, (unsigned long)sum.changes);
+    httpd_resp_send_chunk(req, buf, n);
+
+    bool first = true;
+    for (int i = 0; i < TOPO_MAX_NODES; i++) {
+        const topo_node_t *nd = &snap.nodes[i];
+        if (!nd->used || i == snap.root) {
+            continue;
+        }
+        char parent_str[18] = "";
+        if (nd->parent != TOPO_NONE) {
+            const uint8_t *p = snap.nodes[nd->parent].mac;
+            snprintf(parent_str, sizeof(parent_str), "%02x:%02x:%02x:%02x:%02x:%02x", p[0], p[1], p[2], p[3], p[4], p[5]);
+        }
+        n = snprintf(buf, HTTP_BUF_SZ,
+                     "%s{\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"parent\":\"%s\",\"hops\":%d,\"rssi\":%d,"
+                     "\"children\":%d,\"subtree\":%d,\"reachable\":%s}",
+                     first ? "" : ",", nd->mac[0], nd->mac[1], nd->mac[2], nd->mac[3], nd->mac[4], nd->mac[5],
+                     parent_str, nd->reachable ? nd->depth : -1, nd->rssi, nd->child_count, nd->subtree,
+                     nd->reachable ? "true" : "false");
+        httpd_resp_send_chunk(req, buf, n);
+        first = false;
+    }
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    httpd_resp_send_chunk(req, "]}", 2);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t api_timers_handler(httpd_req_t *req) {
+    tw_stats_t st;
+    timer_service_get_stats(&st);
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    int nodes = registry.count;
+    int active_nodes = registry_active_count(&registry);
+    uint32_t evictions = registry.evictions;
+    uint32_t drops = registry.drops;
+    xSemaphoreGive(registry_lock);
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    int n = snprintf(buf, HTTP_BUF_SZ,
+                     "{\"tick_ms\":%d,\"active\":%lu,\"armed\":%lu,\"cancelled\":%lu,\"fired\":%lu,"
+                     "\"cascaded\":%lu,\"overruns\":%lu,\"max_late_ms\":%lu,"
+                     "\"registry\":{\"nodes\":%d,\"active\":%d,\"capacity\":%d,\"evictions\":%lu,\"drops\":%lu}}",
+                     TIMER_SERVICE_TICK_MS, (unsigned long)st.active, (unsigned long)st.armed,
+                     (unsigned long)st.cancelled, (unsigned long)st.fired, (unsigned long)st.cascaded,
+                     (unsigned long)st.overruns, (unsigned long)st.max_late * TIMER_SERVICE_TICK_MS,
+                     nodes, active_nodes, MAX_MESH_NODES, (unsigned long)evictions, (unsigned long)drops);
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t err = httpd_resp_send(req, buf, n);
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    return err;
+}
+
+// One latency object: "head" is the pre-formatted identifying fields (mac/layer/...); buf holds the chunk
+static int format_latency(char *buf, const char *head, const lat_series_t *s, bool first) {
+    lat_pct_t p;
+    lat_percentiles(s, &p);
+    return snprintf(buf, HTTP_BUF_SZ,
+                     "%s{%s,\"sent\":%lu,\"received\":%lu,\"lost\":%lu,\"late\":%lu,\"n\":%d,"
+                     "\"p50_us\":%lu,\"p95_us\":%lu,\"p99_us\":%lu,\"min_us\":%lu,\"max_us\":%lu}",
+                     first ? "" : ",", head,
+                     (unsigned long)s->sent, (unsigned long)s->received, (unsigned long)s->lost,
+                     (unsigned long)s->late, p.n, (unsigned long)p.p50_us, (unsigned long)p.p95_us,
+                     (unsigned long)p.p99_us, (unsigned long)p.min_us, (unsigned long)p.max_us);
+}
+
+static esp_err_t api_latency_handler(httpd_req_t *req) {
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/json");
+    char head[112];
+    int n = snprintf(buf, HTTP_BUF_SZ, "{\"interval_ms\":%d,\"burst_rounds_left\":%d,\"layers\":[",
+                     PROBE_INTERVAL_MS, probe_burst_rounds);
+    httpd_resp_send_chunk(req, buf, n);
+    bool first = true;
+    for (int l = 1; l <= PROBE_MAX_LAYER; l++) {
+        snprintf(head, sizeof(head), "\"layer\":%d", l);
+        xSemaphoreTake(registry_lock, portMAX_DELAY);
+        n = layer_lat[l].sent ? format_latency(buf, head, &layer_lat[l], first) : 0;
+        xSemaphoreGive(registry_lock);
+        if (n) {
+            httpd_resp_send_chunk(req, buf, n);
+            first = false;
+        }
+    }
+    httpd_resp_send_chunk(req, "],\"nodes\":[", 11);
+    first = true;
+    for (int i = 0; ; i++) {
+        xSemaphoreTake(registry_lock, portMAX_DELAY);
+        if (i >= registry.count) {
+            xSemaphoreGive(registry_lock);
+            break;
+        }
+        const node_info_t *node = &registry.nodes[i];
+        const uint8_t *m = node->mac;
+        snprintf(head, sizeof(head), "\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"layer\":%d,\"last_cmd_ms\":%d",
+                 m[0], m[1], m[2], m[3], m[4], m[5], node->layer, node->cmd_rtt_ms);
+        n = format_latency(buf, head, &node->lat, first);
+        xSemaphoreGive(registry_lock);
+        httpd_resp_send_chunk(req, buf, n);
+        first = false;
+    }
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    httpd_resp_send_chunk(req, "]}", 2);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// POST /api/latency?rounds=N: probe every active node N times, PROBE_BURST_INTERVAL_MS apart
+static esp_err_t api_latency_probe_handler(httpd_req_t *req) {
+    int rounds = 5;
+    char query[32];
+    char val[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "rounds", val, sizeof(val)) == ESP_OK) {
+        rounds = atoi(val);
+    }
+    if (rounds < 1) rounds = 1;
+    if (rounds > PROBE_BURST_MAX_ROUNDS) rounds = PROBE_BURST_MAX_ROUNDS;
+
+    probe_burst_rounds = rounds;
+    timer_service_arm_ms(&probe_burst_timer, 0, PROBE_BURST_INTERVAL_MS);
+
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf), "{\"rounds\":%d,\"interval_ms\":%d}", rounds, PROBE_BURST_INTERVAL_MS);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, buf, n);
+}
+
+// POST /api/bench?rate=&size=&tos=p2p|e2e|def&dur=&dst=root|<mac>&senders=all|<mac>,<mac>...
+// POST /api/bench?stop=1 ends the current run early
+static esp_err_t api_bench_start_handler(httpd_req_t *req) {
+    char query[256];
+    char val[128];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
+        query[0] = '\0';
+    }
+    if (httpd_query_key_value(query, "stop", val, sizeof(val)) == ESP_OK) {
+        char msg[48];
+        int n = snprintf(msg, sizeof(msg), "{\"cmd\":\"bench_stop\",\"run\":%u}", bench_run);
+        mesh_send_msg(NULL, msg, n);
+        timer_service_arm_ms(&bench_report_timer, BENCH_REPORT_DELAY_MS, 0);
+        httpd_resp_set_type(req, "application/json");
+        return httpd_resp_sendstr(req, "{\"stopped\":true}");
+    }
+
+    int rate = 20, size = 200, tos = BENCH_TOS_P2P, dur = 10000;
+    if (httpd_query_key_value(query, "rate", val, sizeof(val)) == ESP_OK) rate = atoi(val);
+    if (httpd_query_key_value(query, "size", val, sizeof(val)) == ESP_OK) size = atoi(val);
+    if (httpd_query_key_value(query, "dur", val, sizeof(val)) == ESP_OK) dur = atoi(val);
+    if (httpd_query_key_value(query, "tos", val, sizeof(val)) == ESP_OK) {
+        tos = strcmp(val, "e2e") == 0 ? BENCH_TOS_E2E : strcmp(val, "def") == 0 ? BENCH_TOS_DEF : BENCH_TOS_P2P;
+    }
+    if (rate < 1 || rate > BENCH_MAX_RATE || size < BENCH_HDR_SIZE || size > BENCH_MAX_FRAME ||
+        dur < 1000 || dur > 600000) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "rate 1-2000, size 20-1400, dur 1000-600000");
+        return ESP_FAIL;
+    }
+    char dst_hex[13] = "";
+    if (httpd_query_key_value(query, "dst", val, sizeof(val)) == ESP_OK && strcmp(val, "root") != 0) {
+        uint8_t d[6];
+        if (!mesh_msg_parse_mac(val, d)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid dst");
+            return ESP_FAIL;
+        }
+        snprintf(dst_hex, sizeof(dst_hex), "%02x%02x%02x%02x%02x%02x", d[0], d[1], d[2], d[3], d[4], d[5]);
+    }
+    char senders[MAX_MESH_NODES * 13 + 1] = "all";
+    if (httpd_query_key_value(query, "senders", val, sizeof(val)) == ESP_OK && strcmp(val, "all") != 0) {
+        int n = 0;
+        senders[0] = '\0';
+        for (const char *c = val; *c && n < MAX_MESH_NODES; c += 17) {
+            uint8_t m[6];
+            if (!mesh_msg_parse_mac(c, m)) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid senders");
+                return ESP_FAIL;
+            }
+            snprintf(senders + n * 13, sizeof(senders) - n * 13, "%s%02x%02x%02x%02x%02x%02x",
+                     n ? "," : "", m[0], m[1], m[2], m[3], m[4], m[5]);
+            n++;
+            if (c[17] == ',') c++;
+            else break;
+        }
+    }
+
+    char *msg = mem_budget_get(MEM_POOL_MSG);
+    if (!msg) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "Out of message buffers");
+    }
+    bench_run++;
+    int len = snprintf(msg, MSG_BUF_SZ,
+             "{\"cmd\":\"bench_start\",\"run\":%u,\"rate\":%d,\"size\":%d,\"tos\":%d,\"dur_ms\":%d,"
+             "\"dst\":\"%s\",\"senders\":\"%s\"}",
+             bench_run, rate, size, tos, dur, dst_hex, senders);
+    // Apply locally first (the root is usually the receiver), then start the senders
+    bench_handle_start(msg);
+    mesh_send_msg(NULL, msg, len);
+    mem_budget_put(MEM_POOL_MSG, msg);
+    timer_service_arm_ms(&bench_report_timer, dur + BENCH_REPORT_DELAY_MS, 0);
+
+    char resp[64];
+    int n = snprintf(resp, sizeof(resp), "{\"run\":%u,\"report_in_ms\":%d}", bench_run, dur + BENCH_REPORT_DELAY_MS);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, resp, n);
+}
+
+static esp_err_t api_bench_handler(httpd_req_t *req) {
+    static char buf[3072];
+    httpd_resp_set_type(req, "application/json");
+    xSemaphoreTake(bench_lock, portMAX_DELAY);
+    int n = snprintf(buf, sizeof(buf), "{\"run\":%u,\"root\":", bench_run);
+    n += bench_format_result(&bench, buf + n, sizeof(buf) - n - 16, esp_timer_get_time());
+    httpd_resp_send_chunk(req, buf, n);
+    bench_layer_t layers[BENCH_MAX_LAYERS + 1];
+    bench_layer_summary(&bench, bench_layer_of, NULL, layers);
+    xSemaphoreGive(bench_lock);
+
+    n = snprintf(buf, sizeof(buf), ",\"layers\":");
+    n += bench_format_layers(layers, buf + n, sizeof(buf) - n);
+    n += snprintf(buf + n, sizeof(buf) - n, ",\"nodes\":[");
+    httpd_resp_send_chunk(req, buf, n);
+    bool first = true;
+    for (int i = 0; i < NODE_RESULTS_MAX_NODES; i++) {
+        // Copied under the lock: a late result may land in the slot while we send
+        xSemaphoreTake(results_lock, portMAX_DELAY);
+        const node_result_t *r = &bench_results.slots[i];
+        bool current = r->used && r->run == bench_run && bench_run != 0;
+        n = current ? snprintf(buf, sizeof(buf), "%s%s", first ? "" : ",", r->json) : 0;
+        xSemaphoreGive(results_lock);
+        if (current) {
+            httpd_resp_send_chunk(req, buf, n);
+            first = false;
+        }
+    }
+    httpd_resp_send_chunk(req, "]}", 2);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// GET /api/profile: our last window, then the last result from each node. Both come from
+// profile_results (ours is stored when the window closes), copied out under results_lock.
+static esp_err_t api_profile_handler(httpd_req_t *req) {
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    taskENTER_CRITICAL(&prof_mux);
+    bool running = prof_running;
+    taskEXIT_CRITICAL(&prof_mux);
+    httpd_resp_set_type(req, "application/json");
+    int n = snprintf(buf, HTTP_BUF_SZ, "{\"enabled\":%s,\"hz\":%d,\"running\":%s,\"local\":",
+                     PROFILE_ENABLED ? "true" : "false", PROFILE_HZ,
+                     running ? "true" : "false");
+    httpd_resp_send_chunk(req, buf, n);
+    // The previous window stays stored while the next one runs, but it is not the one asked about
+    n = 0;
+    if (!running) {
+        xSemaphoreTake(results_lock, portMAX_DELAY);
+        for (int i = 0; i < NODE_RESULTS_MAX_NODES; i++) {
+            const node_result_t *r = &profile_results.slots[i];
+            if (r->used && memcmp(r->mac, self_sta_mac, 6) == 0) {
+                n = snprintf(buf, HTTP_BUF_SZ, "%s", r->json);
+                break;
+            }
+        }
+        xSemaphoreGive(results_lock);
+    }
+    if (n) {
+        httpd_resp_send_chunk(req, buf, n);
+    } else {
+        httpd_resp_send_chunk(req, "null", 4);
+    }
+    httpd_resp_send_chunk(req, ",\"nodes\":[", 10);
+    int64_t now = esp_timer_get_time();
+    bool first = true;
+    for (int i = 0; i < NODE_RESULTS_MAX_NODES; i++) {
+        xSemaphoreTake(results_lock, portMAX_DELAY);
+        const node_result_t *r = &profile_results.slots[i];
+        bool node = r->used && memcmp(r->mac, self_sta_mac, 6) != 0;
+        n = node ? snprintf(buf, HTTP_BUF_SZ, "%s{\"age_ms\":%lld,\"result\":%s}", first ? "" : ",",
+                            (long long)((now - r->at_us) / 1000), r->json) : 0;
+        xSemaphoreGive(results_lock);
+        if (node) {
+            httpd_resp_send_chunk(req, buf, n);
+            first = false;
+        }
+    }
+    httpd_resp_send_chunk(req, "]}", 2);
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// POST /api/profile?ms=N[&mac=<mac>|all]: profile the root (no mac), one node, or every node
+// and the root. Results show up in GET /api/profile once the window closes.
+static esp_err_t api_profile_start_handler(httpd_req_t *req) {
+    char query[64];
+    char val[24];
+    int ms = 2000;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
+        query[0] = '\0';
+    }
+    if (httpd_query_key_value(query, "ms", val, sizeof(val)) == ESP_OK) {
+        ms = atoi(val);
+    }
+    if (ms < 100 || ms > PROFILE_MAX_MS) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "ms out of range");
+        return ESP_FAIL;
+    }
+    uint8_t target[6];
+    bool all = false, remote = false;
+    if (httpd_query_key_value(query, "mac", val, sizeof(val)) == ESP_OK) {
+        all = strcmp(val, "all") == 0;
+        if (!all && !mesh_msg_parse_mac(val, target)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid MAC address format");
+            return ESP_FAIL;
+        }
+        remote = !all && memcmp(target, self_sta_mac, 6) != 0;
+    }
+
+    if (all || remote) {
+        // Along the node's route when we know it; nodes filter on target_mac either way
+        char msg[80];
+        int n = snprintf(msg, sizeof(msg), "{\"cmd\":\"profile\",\"ms\":%d", ms);
+        if (remote) {
+            n += snprintf(msg + n, sizeof(msg) - n, ",\"target_mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\"",
+                          target[0], target[1], target[2], target[3], target[4], target[5]);
+        }
+        n += snprintf(msg + n, sizeof(msg) - n, "}");
+        mesh_send_msg(remote ? target : NULL, msg, n);
+    }
+    esp_err_t err = remote ? ESP_OK : profile_start(ms, NULL);
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        httpd_resp_set_status(req, "501 Not Implemented");
+        httpd_resp_sendstr(req, "Profiling needs FreeRTOS run-time stats");
+        return ESP_OK;
+    }
+    if (err != ESP_OK && !all) {
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_sendstr(req, "A profile is already running");
+        return ESP_OK;
+    }
+    char buf[96];
+    int n = snprintf(buf, sizeof(buf), "{\"ms\":%d,\"target\":\"%s\",\"local\":%s}", ms,
+                     all ? "all" : remote ? "node" : "root", err == ESP_OK && !remote ? "true" : "false");
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, buf, n);
+}
+
+// Memory budget: pool usage, stack high-water marks, heap low-water mark and steady-state allocations
+static esp_err_t api_memory_handler(httpd_req_t *req) {
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    mem_budget_heap_t h;
+    mem_budget_get_heap(&h);
+    httpd_resp_set_type(req, "application/json");
+    int n = snprintf(buf, HTTP_BUF_SZ,
+                     "{\"heap\":{\"free\":%lu,\"min_free\":%lu,\"largest_block\":%lu,\"blocks\":%lu,"
+                     "\"alloc_failures\":%lu},\"steady\":{\"reached\":%s,\"age_ms\":%lu,\"base_blocks\":%lu,"
+                     "\"peak_blocks\":%lu,\"hooks\":%s,\"allocs\":%lu,\"alloc_bytes\":%lu},"
+                     "\"static\":{\"registry\":%u,\"topology\":%u,\"bench_results\":%u,\"max_nodes\":%d},\"pools\":[",
+                     (unsigned long)h.free_bytes, (unsigned long)h.min_free_bytes, (unsigned long)h.largest_free_block,
+                     (unsigned long)h.allocated_blocks, (unsigned long)h.alloc_failures, h.steady ? "true" : "false",
+                     (unsigned long)h.steady_age_ms, (unsigned long)h.steady_base_blocks,
+                     (unsigned long)h.steady_peak_blocks, h.hooks ? "true" : "false", (unsigned long)h.steady_allocs,
+                     (unsigned long)h.steady_alloc_bytes, (unsigned)sizeof(registry), (unsigned)sizeof(topology),
+                     (unsigned)sizeof(bench_results), MAX_MESH_NODES);
+    httpd_resp_send_chunk(req, buf, n);
+    for (int i = 0; i < MEM_POOL_COUNT; i++) {
+        mem_pool_t p;
+        mem_budget_get_pool(i, &p);
+        n = snprintf(buf, HTTP_BUF_SZ,
+                     "%s{\"name\":\"%s\",\"block_size\":%u,\"blocks\":%u,\"in_use\":%u,\"peak\":%u,"
+                     "\"gets\":%lu,\"fails\":%lu}",
+                     i ? "," : "", p.name, p.block_size, p.blocks, mem_pool_in_use(&p), p.peak,
+                     (unsigned long)p.gets, (unsigned long)p.fails);
+        httpd_resp_send_chunk(req, buf, n);
+    }
+    httpd_resp_send_chunk(req, "],\"tasks\":[", 11);
+    mem_budget_task_t tasks[MEM_BUDGET_MAX_TASKS];
+    int count = mem_budget_get_tasks(tasks, MEM_BUDGET_MAX_TASKS);
+    bool first = true;
+    for (int i = 0; i < count; i++) {
+        if (!tasks[i].present) {
+            continue;
+        }
+        n = snprintf(buf, HTTP_BUF_SZ, "%s{\"name\":\"%s\",\"stack_free_min\":%lu,\"steady_allocs\":%lu}",
+                     first ? "" : ",", tasks[i].name, (unsigned long)tasks[i].stack_free_min,
+                     (unsigned long)tasks[i].steady_allocs);
+        httpd_resp_send_chunk(req, buf, n);
+        first = false;
+    }
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    httpd_resp_send_chunk(req, "]}", 2);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// Our own controller in full, then what each node last reported in its heartbeat/status
+static esp_err_t api_flow_handler(httpd_req_t *req) {
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    taskENTER_CRITICAL(&flow_mux);
+    flow_ctl_t fc = flow;
+    taskEXIT_CRITICAL(&flow_mux);
+    httpd_resp_set_type(req, "application/json");
+    int n = snprintf(buf, HTTP_BUF_SZ,
+                     "{\"enabled\":%s,\"self\":{\"congested\":%s,\"rate_mps\":%lu,\"backlog\":%u,\"local\":%u,"
+                     "\"parent\":%u,\"max_backlog\":%u,\"sent\":%lu,\"exempt\":%lu,\"deferred\":%lu,\"retried\":%lu,"
+                     "\"dropped\":%lu,\"decreases\":%lu,\"min_rate_mps\":%lu,\"max_rate_mps\":%lu,\"high_water\":%u,"
+                     "\"low_water\":%u},\"nodes\":[",
+                     FLOW_ENFORCED ? "true" : "false", fc.congested ? "true" : "false",
+                     (unsigned long)fc.rate_mps, flow_backlog(&fc), fc.local_backlog, fc.parent_backlog, fc.max_backlog,
+                     (unsigned long)fc.sent, (unsigned long)fc.exempt, (unsigned long)fc.deferred,
+                     (unsigned long)fc.retried, (unsigned long)fc.dropped, (unsigned long)fc.decreases,
+                     (unsigned long)fc.cfg.min_rate_mps, (unsigned long)fc.cfg.max_rate_mps, fc.cfg.high_water,
+                     fc.cfg.low_water);
+    httpd_resp_send_chunk(req, buf, n);
+    bool first = true;
+    for (int i = 0; ; i++) {
+        xSemaphoreTake(registry_lock, portMAX_DELAY);
+        if (i >= registry.count) {
+            xSemaphoreGive(registry_lock);
+            break;
+        }
+        const node_info_t *node = &registry.nodes[i];
+        if (node->backlog < 0) {
+            xSemaphoreGive(registry_lock);
+            continue;
+        }
+        const uint8_t *m = node->mac;
+        n = snprintf(buf, HTTP_BUF_SZ,
+                     "%s{\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"layer\":%d,\"active\":%s,\"backlog\":%d,"
+                     "\"congested\":%s,\"rate_mps\":%lu,\"deferred\":%lu,\"dropped\":%lu}",
+                     first ? "" : ",", m[0], m[1], m[2], m[3], m[4], m[5], node->layer,
+                     node->is_active ? "true" : "false", node->backlog, node->flow_congested ? "true" : "false",
+                     (unsigned long)node->flow_rate_mps, (unsigned long)node->flow_deferred,
+                     (unsigned long)node->flow_dropped);
+        xSemaphoreGive(registry_lock);
+        httpd_resp_send_chunk(req, buf, n);
+        first = false;
+    }
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    httpd_resp_send_chunk(req, "]}", 2);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// "null" or the number, for fields a node has not reported yet
+static const char *opt_long(char *out, size_t len, bool has, long v) {
+    if (!has) {
+        return "null";
+    }
+    snprintf(out, len, "%ld", v);
+    return out;
+}
+
+static esp_err_t api_time_handler(httpd_req_t *req) {
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    taskENTER_CRITICAL(&tsync_mux);
+    time_sync_t ts = tsync;
+    taskEXIT_CRITICAL(&tsync_mux);
+    char late[16];
+    httpd_resp_set_type(req, "application/json");
+    int n = snprintf(buf, HTTP_BUF_SZ,
+                     "{\"mesh_time_us\":%lld,\"period_ms\":%d,\"self\":{\"synced\":%s,\"offset_us\":%lld,"
+                     "\"drift_ppb\":%ld,\"uncert_us\":%ld,\"residual_us\":%ld,\"exchanges\":%lu,\"filtered\":%lu,"
+                     "\"steps\":%lu,\"late_us\":%s},\"nodes\":[",
+                     (long long)mesh_time_now(), CONFIG_MESH_TIME_SYNC_PERIOD_MS,
+                     ts.synced || is_root_node ? "true" : "false", (long long)ts.ref_offset_us, (long)ts.drift_ppb,
+                     (long)ts.uncert_us, (long)ts.residual_us, (unsigned long)ts.exchanges,
+                     (unsigned long)ts.filtered, (unsigned long)ts.steps,
+                     opt_long(late, sizeof(late), action_ran, action_late_us));
+    httpd_resp_send_chunk(req, buf, n);
+    for (int i = 0; ; i++) {
+        xSemaphoreTake(registry_lock, portMAX_DELAY);
+        if (i >= registry.count) {
+            xSemaphoreGive(registry_lock);
+            break;
+        }
+        const node_info_t *node = &registry.nodes[i];
+        const uint8_t *m = node->mac;
+        char err[16];
+        n = snprintf(buf, HTTP_BUF_SZ,
+                     "%s{\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"layer\":%d,\"active\":%s,\"synced\":%s,"
+                     "\"err_us\":%s,\"drift_ppb\":%ld,\"uncert_us\":%ld,\"late_us\":%s}",
+                     i ? "," : "", m[0], m[1], m[2], m[3], m[4], m[5], node->layer,
+                     node->is_active ? "true" : "false", node->time_synced ? "true" : "false",
+                     opt_long(err, sizeof(err), node->has_sync_err, node->sync_err_us), (long)node->drift_ppb,
+                     (long)node->sync_uncert_us, opt_long(late, sizeof(late), node->has_exec_late, node->exec_late_us));
+        xSemaphoreGive(registry_lock);
+        httpd_resp_send_chunk(req, buf, n);
+    }
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    httpd_resp_send_chunk(req, "]}", 2);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// POST /api/time?toggle_in_ms=N: every node toggles its LED at the same mesh time, N ms from now
+static esp_err_t api_time_toggle_handler(httpd_req_t *req) {
+    char query[32];
+    char val[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "toggle_in_ms", val, sizeof(val)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "toggle_in_ms required");
+        return ESP_FAIL;
+    }
+    int in_ms = atoi(val);
+    // The broadcast has to reach the deepest layer first; beyond a minute the drift estimate dominates
+    if (in_ms < 50 || in_ms > 60000) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "toggle_in_ms must be 50..60000");
+        return ESP_FAIL;
+    }
+    int64_t at = mesh_time_now() + (int64_t)in_ms * 1000;
+    char cmd_str[48];
+    int n = snprintf(cmd_str, sizeof(cmd_str), "{\"cmd\":\"led_toggle\",\"at\":%lld}", (long long)at);
+    mesh_data_t cmd_data = {
+        .data = (uint8_t*)cmd_str,
+        .size = n,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P
+    };
+    mesh_addr_t bcast = {0};
+    memset(bcast.addr, 0xFF, 6);
+    bcast.mip.port = MESH_DATA_P2P;
+    esp_mesh_send(&bcast, &cmd_data, MESH_DATA_P2P, NULL, 0);
+    schedule_led_toggle(at);
+
+    char buf[64];
+    n = snprintf(buf, sizeof(buf), "{\"at\":%lld,\"in_ms\":%d}", (long long)at, in_ms);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, buf, n);
+}
+
+static const char *const trace_mode_names[] = { "off", "hash", "full" };
+
+static esp_err_t trace_send_info(httpd_req_t *req) {
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    taskENTER_CRITICAL(&trace_mux);
+    trace_t tr = trace;
+    uint32_t used = trace_dump_size(&trace) - sizeof(trace_file_hdr_t);
+    taskEXIT_CRITICAL(&trace_mux);
+    int n = snprintf(buf, HTTP_BUF_SZ,
+                     "{\"mode\":\"%s\",\"max_payload\":%u,\"buf_size\":%lu,\"used\":%lu,\"records\":%lu,"
+                     "\"captured\":%lu,\"dropped\":%lu,\"missed\":%lu}",
+                     trace_mode_names[tr.mode], tr.max_payload, (unsigned long)tr.cap, (unsigned long)used,
+                     (unsigned long)tr.records, (unsigned long)tr.captured, (unsigned long)tr.dropped,
+                     (unsigned long)tr.missed);
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t err = httpd_resp_send(req, buf, n);
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    return err;
+}
+
+// GET /api/trace downloads the capture (host/trace_replay reads it); ?info=1 gives its state.
+// Capture pauses while the dump streams so the ring cannot move under it.
+static esp_err_t api_trace_handler(httpd_req_t *req) {
+    char query[16];
+    char val[4];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "info", val, sizeof(val)) == ESP_OK) {
+        return trace_send_info(req);
+    }
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL(&trace_mux);
+    trace.paused = true;
+    uint32_t size = trace_dump_size(&trace);
+    taskEXIT_CRITICAL(&trace_mux);
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"mesh.trace\"");
+    esp_err_t err = ESP_OK;
+    for (uint32_t off = 0; off < size && err == ESP_OK;) {
+        taskENTER_CRITICAL(&trace_mux);
+        size_t n = trace_dump_read(&trace, now, off, (uint8_t *)buf, HTTP_BUF_SZ);
+        taskEXIT_CRITICAL(&trace_mux);
+        err = httpd_resp_send_chunk(req, buf, n);
+        off += n;
+    }
+    taskENTER_CRITICAL(&trace_mux);
+    trace.paused = false;
+    taskEXIT_CRITICAL(&trace_mux);
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// POST /api/trace?mode=off|hash|full&max_payload=N&clear=1
+static esp_err_t api_trace_set_handler(httpd_req_t *req) {
+    char query[64];
+    char val[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "mode, max_payload or clear required");
+        return ESP_FAIL;
+    }
+    int mode = -1;
+    if (httpd_query_key_value(query, "mode", val, sizeof(val)) == ESP_OK) {
+        for (int i = 0; i < 3; i++) {
+            if (strcmp(val, trace_mode_names[i]) == 0) {
+                mode = i;
+            }
+        }
+        if (mode < 0) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "mode must be off, hash or full");
+            return ESP_FAIL;
+        }
+    }
+    int max_payload = -1;
+    if (httpd_query_key_value(query, "max_payload", val, sizeof(val)) == ESP_OK) {
+        max_payload = atoi(val);
+        if (max_payload < 0 || max_payload > UINT16_MAX) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "max_payload must be 0..65535");
+            return ESP_FAIL;
+        }
+    }
+    bool clear = httpd_query_key_value(query, "clear", val, sizeof(val)) == ESP_OK && atoi(val) != 0;
+
+    taskENTER_CRITICAL(&trace_mux);
+    if (clear) {
+        trace_clear(&trace);
+    }
+    if (mode >= 0) {
+        trace.mode = (trace_mode_t)mode;
+    }
+    if (max_payload >= 0) {
+        trace.max_payload = (uint16_t)max_payload;
+    }
+    taskEXIT_CRITICAL(&trace_mux);
+    ESP_LOGI(TAG, "Trace capture %s%s", trace_mode_names[trace.mode], clear ? " (cleared)" : "");
+    return trace_send_info(req);
+}
+
+// Averages as integer hundredths, like the other decimal fields
+static int quality_json(char *out, size_t len, const tree_quality_t *q) {
+    int avg_layer = q->nodes ? q->layer_sum * 100 / q->nodes : 0;
+    int avg_rssi = q->rssi_nodes ? q->rssi_sum * 100 / q->rssi_nodes : 0;
+    return snprintf(out, len,
+                    "{\"age_s\":%lld,\"nodes\":%d,\"avg_layer\":%d.%02d,\"max_layer\":%d,\"avg_rssi\":%s%d.%02d,"
+                    "\"weak\":%d,\"switches\":%lu}",
+                    (long long)((esp_timer_get_time() - q->at_us) / 1000000), q->nodes, avg_layer / 100,
+                    avg_layer % 100, q->max_layer, avg_rssi < 0 ? "-" : "", abs(avg_rssi) / 100, abs(avg_rssi) % 100,
+                    q->weak, (unsigned long)q->switches);
+}
+
+// GET /api/parent_opt: this node's optimizer, and on the root the tree before (baseline) and now
+static esp_err_t api_parent_opt_handler(httpd_req_t *req) {
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    const po_config_t *cfg = &parent_opt.cfg;
+    char ps[16], bs[16];
+    httpd_resp_set_type(req, "application/json");
+    int n = snprintf(buf, HTTP_BUF_SZ,
+                     "{\"enabled\":%s,\"min_rssi\":%d,\"margin\":%u,\"confirm\":%u,\"hold_s\":%lu,"
+                     "\"self\":{\"layer\":%d,\"scans\":%lu,\"switches\":%lu,\"held\":%lu,\"parent_score\":%s,"
+                     "\"best_score\":%s},\"baseline\":",
+                     PARENT_OPT_ENABLED ? "true" : "false", cfg->min_rssi, cfg->margin, cfg->confirm,
+                     (unsigned long)(cfg->hold_ms / 1000), esp_mesh_get_layer(), (unsigned long)parent_opt.scans,
+                     (unsigned long)parent_opt.switches, (unsigned long)parent_opt.held,
+                     opt_long(ps, sizeof(ps), parent_opt.parent_score != INT32_MIN, parent_opt.parent_score),
+                     opt_long(bs, sizeof(bs), parent_opt.best_score != INT32_MIN, parent_opt.best_score));
+    if (quality_baseline_set) {
+        n += quality_json(buf + n, HTTP_BUF_SZ - n, &quality_baseline);
+    } else {
+        n += snprintf(buf + n, HTTP_BUF_SZ - n, "null");
+    }
+    tree_quality_t now;
+    tree_quality_get(&now);
+    n += snprintf(buf + n, HTTP_BUF_SZ - n, ",\"current\":");
+    n += quality_json(buf + n, HTTP_BUF_SZ - n, &now);
+    n += snprintf(buf + n, HTTP_BUF_SZ - n, ",\"nodes\":[");
+    httpd_resp_send_chunk(req, buf, n);
+    bool first = true;
+    for (int i = 0; ; i++) {
+        xSemaphoreTake(registry_lock, portMAX_DELAY);
+        if (i >= registry.count) {
+            xSemaphoreGive(registry_lock);
+            break;
+        }
+        const node_info_t *node = &registry.nodes[i];
+        if (!node->is_active) {
+            xSemaphoreGive(registry_lock);
+            continue;
+        }
+        const uint8_t *m = node->mac;
+        n = snprintf(buf, HTTP_BUF_SZ,
+                     "%s{\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"layer\":%d,\"rssi\":%d,\"switches\":%lu}",
+                     first ? "" : ",", m[0], m[1], m[2], m[3], m[4], m[5], node->layer, node->rssi,
+                     (unsigned long)node->parent_switches);
+        xSemaphoreGive(registry_lock);
+        httpd_resp_send_chunk(req, buf, n);
+        first = false;
+    }
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    httpd_resp_send_chunk(req, "]}", 2);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// POST /api/parent_opt?baseline=1: take the tree as it is now as the new "before"
+static esp_err_t api_parent_opt_set_handler(httpd_req_t *req) {
+    char query[16];
+    char val[4];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "baseline", val, sizeof(val)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "baseline required");
+        return ESP_FAIL;
+    }
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    tree_quality_get(&quality_baseline);
+    quality_baseline_set = true;
+    int n = quality_json(buf, HTTP_BUF_SZ, &quality_baseline);
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t err = httpd_resp_send(req, buf, n);
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    return err;
+}
+
+static esp_err_t api_config_handler(httpd_req_t *req) {
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    node_config_t c;
+    node_config_get(&c);
+    // Push progress: nodes that reported our version, another one, or none yet
+    int current = 0, other = 0, unknown = 0;
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    for (int i = 0; i < registry.count; i++) {
+        const node_info_t *node = &registry.nodes[i];
+        if (!node->is_active) {
+            continue;
+        }
+        if (!node->has_config_version) {
+            unknown++;
+        } else if (node->config_version == c.version) {
+            current++;
+        } else {
+            other++;
+        }
+    }
+    xSemaphoreGive(registry_lock);
+    const uint8_t *m = c.mesh_id;
+    httpd_resp_set_type(req, "application/json");
+    int n = snprintf(buf, HTTP_BUF_SZ,
+                     "{\"version\":%lu,\"heartbeat_ms\":%lu,\"status_ms\":%lu,\"stale_ms\":%lu,\"start_delay_ms\":%lu,"
+                     "\"max_connection\":%u,\"mesh_id\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"router_ssid\":\"%s\","
+                     "\"router_pass_set\":%s,\"restart_pending\":%s,\"nodes\":{\"current\":%d,\"other\":%d,\"unknown\":%d}}",
+                     (unsigned long)c.version, (unsigned long)c.heartbeat_ms, (unsigned long)c.status_ms,
+                     (unsigned long)c.stale_ms, (unsigned long)c.start_delay_ms, c.max_connection,
+                     m[0], m[1], m[2], m[3], m[4], m[5], c.router_ssid, c.router_pass[0] ? "true" : "false",
+                     node_config_restart_pending() ? "true" : "false", current, other, unknown);
+    esp_err_t err = httpd_resp_send(req, buf, n);
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    return err;
+}
+
+// Query values arrive percent-encoded ('+' is a space)
+static void url_decode(char *s) {
+    char *out = s;
+    for (; *s; s++) {
+        if (*s == '%' && s[1] && s[2]) {
+            char hex[3] = { s[1], s[2], '\0' };
+            *out++ = (char)strtol(hex, NULL, 16);
+            s += 2;
+        } else {
+            *out++ = *s == '+' ? ' ' : *s;
+        }
+    }
+    *out = '\0';
+}
+
+// Apply the fields present in query to c; NULL, or why the query is rejected
+static const char *config_from_query(const char *query, node_config_t *c) {
+    char val[3 * NODE_CONFIG_PASS_MAX + 1];
+    if (httpd_query_key_value(query, "heartbeat_ms", val, sizeof(val)) == ESP_OK) c->heartbeat_ms = strtoul(val, NULL, 10);
+    if (httpd_query_key_value(query, "status_ms", val, sizeof(val)) == ESP_OK) c->status_ms = strtoul(val, NULL, 10);
+    if (httpd_query_key_value(query, "stale_ms", val, sizeof(val)) == ESP_OK) c->stale_ms = strtoul(val, NULL, 10);
+    if (httpd_query_key_value(query, "start_delay_ms", val, sizeof(val)) == ESP_OK) c->start_delay_ms = strtoul(val, NULL, 10);
+    if (httpd_query_key_value(query, "max_connection", val, sizeof(val)) == ESP_OK) {
+        int mc = atoi(val);
+        c->max_connection = mc < 0 || mc > 255 ? 0 : (uint8_t)mc;
+    }
+    if (httpd_query_key_value(query, "mesh_id", val, sizeof(val)) == ESP_OK) {
+        url_decode(val);
+        if (!mesh_msg_parse_mac(val, c->mesh_id)) {
+            return "mesh_id must be aa:bb:cc:dd:ee:ff";
+        }
+    }
+    if (httpd_query_key_value(query, "router_ssid", val, sizeof(val)) == ESP_OK) {
+        url_decode(val);
+        if (strlen(val) > NODE_CONFIG_SSID_MAX) {
+            return "router_ssid too long";
+        }
+        strcpy(c->router_ssid, val);
+    }
+    if (httpd_query_key_value(query, "router_pass", val, sizeof(val)) == ESP_OK) {
+        url_decode(val);
+        if (strlen(val) > NODE_CONFIG_PASS_MAX) {
+            return "router_pass too long";
+        }
+        strcpy(c->router_pass, val);
+    }
+    return NULL;
+}
+
+// Change any subset of the fields; the result gets a new version and is pushed to every node.
+// The query (router_ssid and router_pass percent-encoded) is read into a pooled buffer.
+static esp_err_t api_config_set_handler(httpd_req_t *req) {
+    char *query = http_buf_get(req);
+    if (!query) {
+        return ESP_FAIL;
+    }
+    if (httpd_req_get_url_query_str(req, query, HTTP_BUF_SZ) != ESP_OK) {
+        query[0] = '\0';
+    }
+    node_config_t c;
+    node_config_get(&c);
+    const char *bad = config_from_query(query, &c);
+    mem_budget_put(MEM_POOL_HTTP, query);
+    if (bad) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, bad);
+        return ESP_FAIL;
+    }
+    c.version = (c.version > config_seen_version ? c.version : config_seen_version) + 1;
+
+    const char *why = NULL;
+    esp_err_t err = config_adopt(&c, &why);
+    if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, why);
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, why);
+        return ESP_FAIL;
+    }
+    config_send(NULL);
+    return api_config_handler(req);
+}
+
+// GET /api/rules: the rule set as text with per-rule fire counts, push progress and how long
+// a dispatch takes on this node
+static esp_err_t api_rules_handler(httpd_req_t *req) {
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    // Counters are copied out under the lock; the text is formatted a line at a time into the
+    // pooled buffer, so no request holds the lock while sending or keeps a copy of the set
+    uint32_t fires[RULES_MAX];
+    xSemaphoreTake(rules_lock, portMAX_DELAY);
+    uint32_t version = rules.version;
+    int count = rules.count;
+    uint32_t cooled = rules.cooled;
+    uint32_t hop_limited = rules.hop_limited;
+    memcpy(fires, rules.fires, sizeof(fires));
+    xSemaphoreGive(rules_lock);
+    int current = 0, other = 0;
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    for (int i = 0; i < registry.count; i++) {
+        const node_info_t *node = &registry.nodes[i];
+        if (node->is_active && node->has_rules_version) {
+            current += node->rules_version == version;
+            other += node->rules_version != version;
+        }
+    }
+    xSemaphoreGive(registry_lock);
+    httpd_resp_set_type(req, "application/json");
+    int n = snprintf(buf, HTTP_BUF_SZ,
+                     "{\"version\":%lu,\"nodes\":{\"current\":%d,\"other\":%d},\"evals\":%lu,\"eval_avg_us\":%ld,"
+                     "\"eval_max_us\":%ld,\"cooled\":%lu,\"hop_limited\":%lu,\"signals_rx\":%lu,\"signals_tx\":%lu,"
+                     "\"fires\":[",
+                     (unsigned long)version, current, other, (unsigned long)rules_evals,
+                     (long)(rules_evals ? rules_eval_us / rules_evals : 0), (long)rules_eval_max_us,
+                     (unsigned long)cooled, (unsigned long)hop_limited, (unsigned long)rules_signals_rx,
+                     (unsigned long)rules_signals_tx);
+    for (int i = 0; i < count; i++) {
+        n += snprintf(buf + n, HTTP_BUF_SZ - n, "%s%lu", i ? "," : "", (unsigned long)fires[i]);
+    }
+    n += snprintf(buf + n, HTTP_BUF_SZ - n, "],\"text\":[");
+    httpd_resp_send_chunk(req, buf, n);
+    // One string per line; the text form has no characters that need escaping. A new set
+    // adopted meanwhile ends the list rather than mixing two versions.
+    for (int line = 0;; line++) {
+        n = line ? snprintf(buf, HTTP_BUF_SZ, ",\"") : snprintf(buf, HTTP_BUF_SZ, "\"");
+        xSemaphoreTake(rules_lock, portMAX_DELAY);
+        int len = rules.version == version ? rules_format_line(&rules, line, buf + n, HTTP_BUF_SZ - n - 1) : -1;
+        xSemaphoreGive(rules_lock);
+        if (len < 0) {
+            break;
+        }
+        n += len;
+        buf[n++] = '"';
+        httpd_resp_send_chunk(req, buf, n);
+    }
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    httpd_resp_send_chunk(req, "]}", 2);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// POST /api/rules with the rule text as the body (empty clears them): compile, store under a
+// new version and push mesh-wide
+static esp_err_t api_rules_set_handler(httpd_req_t *req) {
+    if (req->content_len >= HTTP_BUF_SZ) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Rule text too long");
+        return ESP_FAIL;
+    }
+    char *text = http_buf_get(req);
+    if (!text) {
+        return ESP_FAIL;
+    }
+    size_t got = 0;
+    while (got < req->content_len) {
+        int r = httpd_req_recv(req, text + got, req->content_len - got);
+        if (r <= 0) {
+            mem_budget_put(MEM_POOL_HTTP, text);
+            return ESP_FAIL;
+        }
+        got += r;
+    }
+    text[got] = '\0';
+    uint8_t blob[RULES_BLOB_MAX];
+    const char *why;
+    int line;
+    int len = rules_compile(text, blob, sizeof(blob), &why, &line);
+    mem_budget_put(MEM_POOL_HTTP, text);
+    if (len < 0) {
+        char msg[96];
+        if (line > 0) {
+            snprintf(msg, sizeof(msg), "line %d: %s", line, why);
+        } else {
+            snprintf(msg, sizeof(msg), "%s", why);
+        }
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, msg);
+        return ESP_FAIL;
+    }
+    uint32_t current = rules_version();
+    uint32_t version = (current > rules_seen_version ? current : rules_seen_version) + 1;
+    why = rules_adopt(version, blob, len, true);
+    if (why) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, why);
+        return ESP_FAIL;
+    }
+    rules_send(NULL);
+    return api_rules_handler(req);
+}
+
+static void cmd_wait_respond(void *arg) {
+    cmd_wait_t *w = arg;
+    httpd_req_t *req = w->req;
+    const uint8_t *m = w->mac;
+    int ms = (int)((w->done_us - w->sent_us) / 1000);
+    // With the pool empty the client gets a 503; the request is completed either way
+    char *buf = http_buf_get(req);
+    if (buf) {
+        int n;
+        if (strcmp(w->result, "ok") == 0) {
+            n = snprintf(buf, HTTP_BUF_SZ,
+                         "{\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"result\":\"ok\",\"seq\":%lu,\"latency_ms\":%d,"
+                         "\"led_state\":%s,\"layer\":%d}",
+                         m[0], m[1], m[2], m[3], m[4], m[5], (unsigned long)w->seq, ms,
+                         w->led_state ? "true" : "false", w->layer);
+        } else {
+            httpd_resp_set_status(req, strcmp(w->result, "timeout") == 0 ? "504 Gateway Timeout" :
+                                       strcmp(w->result, "send_failed") == 0 ? "502 Bad Gateway" :
+                                       "503 Service Unavailable");
+            n = snprintf(buf, HTTP_BUF_SZ,
+                         "{\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"result\":\"%s\",\"seq\":%lu,\"waited_ms\":%d}",
+                         m[0], m[1], m[2], m[3], m[4], m[5], w->result, (unsigned long)w->seq, ms);
+        }
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_send(req, buf, n);
+        mem_budget_put(MEM_POOL_HTTP, buf);
+    }
+    httpd_req_async_handler_complete(req);
+    taskENTER_CRITICAL(&cmd_wait_mux);
+    w->state = CMD_WAIT_FREE;
+    taskEXIT_CRITICAL(&cmd_wait_mux);
+}
+
+// w is DONE and its timer is no longer armed; nobody else touches it until it is FREE again
+static void cmd_wait_finish(cmd_wait_t *w) {
+    if (!web_server || httpd_queue_work(web_server, cmd_wait_respond, w) != ESP_OK) {
+        cmd_wait_respond(w);
+    }
+}
+
+// Moves a parked slot to DONE; false if the ack, the timeout or a send failure got there first
+static bool cmd_wait_close(cmd_wait_t *w, const char *result) {
+    bool closed = false;
+    taskENTER_CRITICAL(&cmd_wait_mux);
+    if (w->state == CMD_WAIT_PARKED) {
+        w->state = CMD_WAIT_DONE;
+        w->result = result;
+        w->done_us = esp_timer_get_time();
+        closed = true;
+    }
+    taskEXIT_CRITICAL(&cmd_wait_mux);
+    return closed;
+}
+
+static void cmd_wait_timeout_cb(tw_timer_t *timer, void *arg) {
+    cmd_wait_t *w = arg;
+    if (cmd_wait_close(w, "timeout")) {
+        cmd_timed_out++;
+        ESP_LOGW(TAG, "No ack for command seq %lu to %02x:%02x:%02x:%02x:%02x:%02x", (unsigned long)w->seq,
+                 w->mac[0], w->mac[1], w->mac[2], w->mac[3], w->mac[4], w->mac[5]);
+        cmd_wait_finish(w);
+    }
+}
+
+// From a status_response: only the ack echoing a parked command's seq completes it. Reports
+// without a seq (periodic status, older firmware) prove nothing about a given command, so
+// those requests run into their timeout.
+static void cmd_wait_ack(const mesh_msg_t *m) {
+    if (!m->has_seq) {
+        return;
+    }
+    cmd_wait_t *hit = NULL;
+    taskENTER_CRITICAL(&cmd_wait_mux);
+    for (int i = 0; i < CONFIG_MESH_HTTP_CMD_MAX && !hit; i++) {
+        cmd_wait_t *w = &cmd_waits[i];
+        if (w->state == CMD_WAIT_PARKED && w->seq == m->seq && memcmp(w->mac, m->mac, 6) == 0) {
+            hit = w;
+        }
+    }
+    if (hit) {
+        hit->state = CMD_WAIT_DONE;
+        hit->result = "ok";
+        hit->done_us = esp_timer_get_time();
+        hit->led_state = m->led_state;
+        hit->layer = m->layer;
+    }
+    taskEXIT_CRITICAL(&cmd_wait_mux);
+    if (hit) {
+        cmd_acked++;
+        // Before the slot can be freed and re-armed by a new request
+        timer_service_cancel(&hit->timer);
+        cmd_wait_finish(hit);
     }
-    char buf[256];
-    int n = snprintf(buf, sizeof(buf),
-                     "{\"mac\":\"%s\",\"layer\":%d,\"active\":true,\"led\":%s,\"rssi\":%d,\"signal\":%d,\"via\":\"root\"}",
-                     mac_str, esp_mesh_get_layer(), led_state ? "true" : "false", self_rssi, rssi_to_percent(self_rssi));
-    if (n > 0) httpd_resp_send_chunk(req, buf, n);
-    
-    // Add known nodes (show both active and inactive)
-    for (int i = 0; i < node_count; i++) {
-        snprintf(mac_str, sizeof(mac_str), "%02x:%02x:%02x:%02x:%02x:%02x",
-                 known_nodes[i].addr.addr[0], known_nodes[i].addr.addr[1], known_nodes[i].addr.addr[2],
-                 known_nodes[i].addr.addr[3], known_nodes[i].addr.addr[4], known_nodes[i].addr.addr[5]);
+}
 
-        char via_str[18] = "";
-        if (known_nodes[i].has_route) {
-            snprintf(via_str, sizeof(via_str), "%02x:%02x:%02x:%02x:%02x:%02x",
-                     known_nodes[i].last_from.addr[0], known_nodes[i].last_from.addr[1], known_nodes[i].last_from.addr[2],
-                     known_nodes[i].last_from.addr[3], known_nodes[i].last_from.addr[4], known_nodes[i].last_from.addr[5]);
-            // If via equals node MAC, treat as direct
-            if (strcmp(via_str, mac_str) == 0) {
-                strcpy(via_str, "direct");
-            }
-        } else {
-            strcpy(via_str, "?");
+// Server going away (root lost): answer everything still parked while the sockets exist
+static void cmd_wait_abort_all(void) {
+    for (int i = 0; i < CONFIG_MESH_HTTP_CMD_MAX; i++) {
+        cmd_wait_t *w = &cmd_waits[i];
+        if (cmd_wait_close(w, "aborted")) {
+            timer_service_cancel(&w->timer);
+            cmd_wait_respond(w);
         }
-        n = snprintf(buf, sizeof(buf),
-                     ",{\"mac\":\"%s\",\"layer\":%d,\"active\":%s,\"led\":%s,\"rssi\":%d,\"signal\":%d,\"via\":\"%s\"}",
-                     mac_str, known_nodes[i].layer,
-                     known_nodes[i].is_active ? "true" : "false",
-                     known_nodes[i].led_state ? "true" : "false",
-                     known_nodes[i].rssi, rssi_to_percent(known_nodes[i].rssi), via_str);
-        if (n > 0) httpd_resp_send_chunk(req, buf, n);
     }
+}
 
-    // End JSON array
-    httpd_resp_send_chunk(req, "]", 1);
-    return httpd_resp_send_chunk(req, NULL, 0);
+static void led_reply_local(httpd_req_t *req) {
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf), "{\"result\":\"ok\",\"latency_ms\":0,\"led_state\":%s}",
+                     led_state ? "true" : "false");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, buf, n);
+}
+
+// Nothing to wait for: 202 with the state the node will be set to when it reports
+static esp_err_t led_reply_queued(httpd_req_t *req, const uint8_t m[6]) {
+    // The buffer first: a 503 for an empty pool must not leave the toggle queued
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_OK;
+    }
+    bool led;
+    if (!cmd_queue_command(m, "led_toggle", &led)) {
+        mem_budget_put(MEM_POOL_HTTP, buf);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "Command queue full");
+        return ESP_OK;
+    }
+    int depth = 0, coalesced = 0;
+    taskENTER_CRITICAL(&cmd_queue_mux);
+    for (int i = 0; i < CMDQ_MAX_NODES; i++) {
+        const cmdq_node_t *n = &cmd_queue.nodes[i];
+        if (n->used && memcmp(n->mac, m, 6) == 0) {
+            depth = cmdq_depth(n);
+            coalesced = n->coalesced;
+        }
+    }
+    taskEXIT_CRITICAL(&cmd_queue_mux);
+    int n = snprintf(buf, HTTP_BUF_SZ,
+                     "{\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"result\":\"queued\",\"led_state\":%s,"
+                     "\"depth\":%d,\"coalesced\":%d,\"expires_ms\":%lu}",
+                     m[0], m[1], m[2], m[3], m[4], m[5], led ? "true" : "false", depth, coalesced,
+                     (unsigned long)cmd_queue.ttl_ms);
+    httpd_resp_set_status(req, "202 Accepted");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, buf, n);
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    return ESP_OK;
 }
 
+// POST /api/led/<mac>: toggle and answer with the outcome. For another node the request is
+// parked until its ack or CONFIG_MESH_HTTP_CMD_TIMEOUT_MS; a node the root cannot reach gets
+// the command queued (202).
 static esp_err_t api_led_handler(httpd_req_t *req) {
     // Extract MAC from URL (e.g., /api/led/aa:bb:cc:dd:ee:ff)
     const char *uri = req->uri;
-    ESP_LOGI(TAG, "LED handler called for URI: %s", uri);
-    
     const char *mac_start = strrchr(uri, '/');
-    if (!mac_start || strlen(mac_start + 1) != 17) {
+    uint8_t target[6];
+    if (!mac_start || strlen(mac_start + 1) != 17 || !mesh_msg_parse_mac(mac_start + 1, target)) {
         ESP_LOGW(TAG, "Invalid URI format: %s", uri);
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid MAC address format");
         return ESP_FAIL;
     }
-    
     char mac_param[18];
-    if (mac_start && strlen(mac_start + 1) == 17) {
-        strncpy(mac_param, mac_start + 1, 17);
-        mac_param[17] = '\0';
-        
-        // Check if it's for this device
-        uint8_t self_addr[6];
-        esp_wifi_get_mac(WIFI_IF_STA, self_addr);
-        char self_mac[18];
-        snprintf(self_mac, sizeof(self_mac), "%02x:%02x:%02x:%02x:%02x:%02x",
-                 self_addr[0], self_addr[1], self_addr[2],
-                 self_addr[3], self_addr[4], self_addr[5]);
-        
-        if (strcmp(mac_param, self_mac) == 0) {
-            // Toggle local LED
-            led_toggle();
-            httpd_resp_send(req, "OK", 2);
-            return ESP_OK;
-        } else {
-            // Send command to mesh network
-            char cmd_str[128];
-            snprintf(cmd_str, sizeof(cmd_str), "{\"cmd\":\"led_toggle\",\"target_mac\":\"%s\"}", mac_param);
-            
-            mesh_data_t data = {
-                .data = (uint8_t*)cmd_str,
-                .size = strlen(cmd_str),
-                .proto = MESH_PROTO_BIN,
-                .tos = MESH_TOS_P2P
-            };
-            // Try unicast first if we have a route for this MAC; fallback to broadcast
-            bool sent = false;
-            for (int i = 0; i < node_count; i++) {
-                char node_mac[18];
-                snprintf(node_mac, sizeof(node_mac), "%02x:%02x:%02x:%02x:%02x:%02x",
-                         known_nodes[i].addr.addr[0], known_nodes[i].addr.addr[1], known_nodes[i].addr.addr[2],
-                         known_nodes[i].addr.addr[3], known_nodes[i].addr.addr[4], known_nodes[i].addr.addr[5]);
-                if (strcmp(node_mac, mac_param) == 0 && known_nodes[i].has_route) {
-                    esp_err_t uerr = esp_mesh_send(&known_nodes[i].last_from, &data, MESH_DATA_P2P, NULL, 0);
-                    ESP_LOGI(TAG, "Sent LED toggle (unicast) to %s via %02x:%02x:%02x:%02x:%02x:%02x: %s",
-                             mac_param,
-                             known_nodes[i].last_from.addr[0], known_nodes[i].last_from.addr[1], known_nodes[i].last_from.addr[2],
-                             known_nodes[i].last_from.addr[3], known_nodes[i].last_from.addr[4], known_nodes[i].last_from.addr[5],
-                             esp_err_to_name(uerr));
-                    sent = (uerr == ESP_OK);
-                    break;
-                }
-            }
-            if (!sent) {
-                mesh_addr_t bcast = {0};
-                memset(bcast.addr, 0xFF, 6);
-                bcast.mip.port = MESH_DATA_P2P;
-                esp_err_t berr = esp_mesh_send(&bcast, &data, MESH_DATA_P2P, NULL, 0);
-                ESP_LOGI(TAG, "Sent LED toggle (broadcast) to %s: %s", mac_param, esp_err_to_name(berr));
+    snprintf(mac_param, sizeof(mac_param), "%02x:%02x:%02x:%02x:%02x:%02x",
+             target[0], target[1], target[2], target[3], target[4], target[5]);
+
+    if (memcmp(target, self_sta_mac, 6) == 0) {
+        led_toggle();
+        led_reply_local(req);
+        return ESP_OK;
+    }
+    if (cmd_unreachable(target)) {
+        return led_reply_queued(req, target);
+    }
+
+    cmd_wait_t *w = NULL;
+    taskENTER_CRITICAL(&cmd_wait_mux);
+    for (int i = 0; i < CONFIG_MESH_HTTP_CMD_MAX && !w; i++) {
+        if (cmd_waits[i].state == CMD_WAIT_FREE) {
+            w = &cmd_waits[i];
+            w->state = CMD_WAIT_RESERVED;
+        }
+    }
+    taskEXIT_CRITICAL(&cmd_wait_mux);
+    if (!w) {
+        cmd_rejected++;
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "Too many commands in flight");
+        return ESP_OK;
+    }
+    if (httpd_req_async_handler_begin(req, &w->req) != ESP_OK) {
+        w->state = CMD_WAIT_FREE;
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Cannot park request");
+        return ESP_FAIL;
+    }
+    tw_timer_init(&w->timer, cmd_wait_timeout_cb, w);
+    timer_service_arm_ms(&w->timer, CONFIG_MESH_HTTP_CMD_TIMEOUT_MS, 0);
+    // Only now can an ack or the timeout close it
+    taskENTER_CRITICAL(&cmd_wait_mux);
+    cmd_seq_next = cmd_seq_next + 1 ? cmd_seq_next + 1 : 1;  // zero is "no seq" on the wire
+    w->seq = cmd_seq_next;
+    memcpy(w->mac, target, 6);
+    w->sent_us = esp_timer_get_time();
+    w->state = CMD_WAIT_PARKED;
+    taskEXIT_CRITICAL(&cmd_wait_mux);
+
+    // The ack also closes out the registry's toggle round trip
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    node_info_t *node = registry_find(&registry, target);
+    if (node) {
+        node->cmd_sent_us = w->sent_us;
+    }
+    xSemaphoreGive(registry_lock);
+    if (mesh_send_command(mac_param, "led_toggle", w->seq) != ESP_OK && cmd_wait_close(w, "send_failed")) {
+        timer_service_cancel(&w->timer);
+        cmd_wait_finish(w);
+    }
+    return ESP_OK;
+}
+
+// GET /api/commands: parked LED commands and how earlier ones ended, and what the root holds
+// for nodes it cannot reach
+static esp_err_t api_commands_handler(httpd_req_t *req) {
+    char *buf = http_buf_get(req);
+    if (!buf) {
+        return ESP_FAIL;
+    }
+    int64_t now = esp_timer_get_time();
+    httpd_resp_set_type(req, "application/json");
+    int n = snprintf(buf, HTTP_BUF_SZ,
+                     "{\"slots\":%d,\"timeout_ms\":%d,\"acked\":%lu,\"timed_out\":%lu,\"rejected\":%lu,\"parked\":[",
+                     CONFIG_MESH_HTTP_CMD_MAX, CONFIG_MESH_HTTP_CMD_TIMEOUT_MS, (unsigned long)cmd_acked,
+                     (unsigned long)cmd_timed_out, (unsigned long)cmd_rejected);
+    bool first = true;
+    for (int i = 0; i < CONFIG_MESH_HTTP_CMD_MAX; i++) {
+        taskENTER_CRITICAL(&cmd_wait_mux);
+        cmd_wait_t w = cmd_waits[i];
+        taskEXIT_CRITICAL(&cmd_wait_mux);
+        if (w.state != CMD_WAIT_PARKED || n + 80 > HTTP_BUF_SZ) {
+            continue;
+        }
+        const uint8_t *m = w.mac;
+        n += snprintf(buf + n, HTTP_BUF_SZ - n, "%s{\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"seq\":%lu,\"age_ms\":%d}",
+                      first ? "" : ",", m[0], m[1], m[2], m[3], m[4], m[5], (unsigned long)w.seq,
+                      (int)((now - w.sent_us) / 1000));
+        first = false;
+    }
+
+    uint32_t now_q = now_ms();
+    taskENTER_CRITICAL(&cmd_queue_mux);
+    cmdq_expire(&cmd_queue, now_q);
+    cmd_queue_t q = cmd_queue;
+    taskEXIT_CRITICAL(&cmd_queue_mux);
+    n += snprintf(buf + n, HTTP_BUF_SZ - n,
+                  "],\"queue\":{\"depth\":%d,\"nodes_max\":%d,\"ttl_ms\":%lu,\"queued\":%lu,\"coalesced\":%lu,"
+                  "\"expired\":%lu,\"rejected\":%lu,\"batches\":%lu,\"resent\":%lu,\"delivered\":%lu,\"pending\":[",
+                  cmdq_total(&q), CMDQ_MAX_NODES, (unsigned long)q.ttl_ms, (unsigned long)q.queued,
+                  (unsigned long)q.coalesced, (unsigned long)q.expired, (unsigned long)q.rejected,
+                  (unsigned long)q.batches, (unsigned long)q.resent, (unsigned long)q.delivered);
+    first = true;
+    for (int i = 0; i < CMDQ_MAX_NODES; i++) {
+        const cmdq_node_t *qn = &q.nodes[i];
+        if (!qn->used || n + 128 > HTTP_BUF_SZ) {
+            continue;
+        }
+        const uint8_t *m = qn->mac;
+        uint32_t expires = 0;
+        for (int k = 0; k < CMDQ_KIND_COUNT; k++) {
+            if ((qn->pending & (1u << k)) && qn->expires_ms[k] - now_q > expires) {
+                expires = qn->expires_ms[k] - now_q;
             }
-            
-            httpd_resp_send(req, "OK", 2);
-            return ESP_OK;
         }
+        n += snprintf(buf + n, HTTP_BUF_SZ - n,
+                      "%s{\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"depth\":%d,\"unacked\":%d,\"led\":%s,"
+                      "\"status\":%s,\"coalesced\":%u,\"expires_ms\":%lu}",
+                      first ? "" : ",", m[0], m[1], m[2], m[3], m[4], m[5], cmdq_depth(qn),
+                      __builtin_popcount(qn->sent),
+                      !(qn->pending & (1u << CMDQ_LED)) ? "null" : qn->arg[CMDQ_LED] ? "true" : "false",
+                      qn->pending & (1u << CMDQ_STATUS) ? "true" : "false", qn->coalesced, (unsigned long)expires);
+        first = false;
     }
-    
-    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid MAC address");
-    return ESP_FAIL;
+    n += snprintf(buf + n, HTTP_BUF_SZ - n, "]}}");
+    esp_err_t err = httpd_resp_send(req, buf, n);
+    mem_budget_put(MEM_POOL_HTTP, buf);
+    return err;
 }
 
 // Web Server Management
+// Every request passes through here so it lands in the trace; user_ctx is the real handler
+static esp_err_t http_dispatch(httpd_req_t *req) {
+    trace_capture_http(req);
+    esp_err_t (*handler)(httpd_req_t *) = req->user_ctx;
+    return handler(req);
+}
+
+static const struct {
+    const char *uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t *req);
+} web_routes[] = {
+    { "/",              HTTP_GET,  root_handler },
+    { "/api/nodes",     HTTP_GET,  api_nodes_handler },
+    { "/api/led/*",     HTTP_POST, api_led_handler },
+    { "/api/commands",  HTTP_GET,  api_commands_handler },
+    { "/api/profile",   HTTP_GET,  api_profile_handler },
+    { "/api/profile",   HTTP_POST, api_profile_start_handler },
+    { "/api/timers",    HTTP_GET,  api_timers_handler },
+    { "/api/memory",    HTTP_GET,  api_memory_handler },
+    { "/api/flow",      HTTP_GET,  api_flow_handler },
+    { "/api/config",    HTTP_GET,  api_config_handler },
+    { "/api/config",    HTTP_POST, api_config_set_handler },
+    { "/api/rules",     HTTP_GET,  api_rules_handler },
+    { "/api/rules",     HTTP_POST, api_rules_set_handler },
+    { "/api/time",      HTTP_GET,  api_time_handler },
+    { "/api/time",      HTTP_POST, api_time_toggle_handler },
+    { "/api/trace",     HTTP_GET,  api_trace_handler },
+    { "/api/trace",     HTTP_POST, api_trace_set_handler },
+    { "/api/parent_opt", HTTP_GET,  api_parent_opt_handler },
+    { "/api/parent_opt", HTTP_POST, api_parent_opt_set_handler },
+    { "/api/mqtt",      HTTP_GET,  api_mqtt_handler },
+    { "/api/topology",  HTTP_GET,  api_topology_handler },
+    { "/api/latency",   HTTP_GET,  api_latency_handler },
+    { "/api/latency",   HTTP_POST, api_latency_probe_handler },
+    { "/api/bench",     HTTP_GET,  api_bench_handler },
+    { "/api/bench",     HTTP_POST, api_bench_start_handler },
+};
+
 static esp_err_t start_web_server(void) {
     if (web_server != NULL) {
         ESP_LOGW(TAG, "Web server already running");
@@ -350,38 +3531,27 @@ static esp_err_t start_web_server(void) {
     
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = 80;
-    config.max_uri_handlers = 8;
-    // Increase HTTPD stack: default is ~4KB, bump to 8KB to handle JSON building and templating
-    config.stack_size = 8192;
+    config.max_uri_handlers = sizeof(web_routes) / sizeof(web_routes[0]);
+    // Response buffers come from the HTTP pool; the stack only covers httpd itself and snprintf
+    config.stack_size = CONFIG_MESH_HTTPD_STACK_SIZE;
     // Enable wildcard URI matching so handlers like "/api/led/*" work
     config.uri_match_fn = httpd_uri_match_wildcard;
+    // Each parked command holds its connection; httpd keeps three sockets for itself and the
+    // MQTT uplink needs one
+    config.max_open_sockets = CONFIG_LWIP_MAX_SOCKETS - 4;
     
     ESP_LOGI(TAG, "Starting web server on port %d", config.server_port);
     
     if (httpd_start(&web_server, &config) == ESP_OK) {
-        httpd_uri_t root_uri = {
-            .uri = "/",
-            .method = HTTP_GET,
-            .handler = root_handler,
-            .user_ctx = NULL
-        };
-        httpd_register_uri_handler(web_server, &root_uri);
-        
-        httpd_uri_t api_nodes_uri = {
-            .uri = "/api/nodes",
-            .method = HTTP_GET,
-            .handler = api_nodes_handler,
-            .user_ctx = NULL
-        };
-        httpd_register_uri_handler(web_server, &api_nodes_uri);
-        
-        httpd_uri_t api_led_uri = {
-            .uri = "/api/led/*",
-            .method = HTTP_POST,
-            .handler = api_led_handler,
-            .user_ctx = NULL
-        };
-        httpd_register_uri_handler(web_server, &api_led_uri);
+        for (size_t i = 0; i < sizeof(web_routes) / sizeof(web_routes[0]); i++) {
+            httpd_uri_t uri = {
+                .uri = web_routes[i].uri,
+                .method = web_routes[i].method,
+                .handler = http_dispatch,
+                .user_ctx = (void *)web_routes[i].handler
+            };
+            httpd_register_uri_handler(web_server, &uri);
+        }
         
         ESP_LOGI(TAG, "Web server started successfully");
         return ESP_OK;
@@ -394,6 +3564,7 @@ static esp_err_t start_web_server(void) {
 static void stop_web_server(void) {
     if (web_server != NULL) {
         ESP_LOGI(TAG, "Stopping web server");
+        cmd_wait_abort_all();
         httpd_stop(web_server);
         web_server = NULL;
     }
@@ -431,12 +3602,20 @@ static void handle_root_transition(bool becoming_root) {
     if (becoming_root && !is_root_node) {
         ESP_LOGI(TAG, "Becoming root node - starting web services");
         is_root_node = true;
+        // Web server, mDNS and MQTT allocate at startup; re-take the heap baseline once they settle
+        mem_budget_restart_steady();
+        topology_reset();
+        topology_refresh_self();
+        rules_raise(RULE_EV_ROOT, 0);
         
-        // Start background task to wait for IP assignment
-        if (!ip_check_active) {
-            ip_check_active = true;
-            xTaskCreate(ip_check_task, "ip_check", 4096, NULL, 5, NULL);
-            ESP_LOGI(TAG, "Started IP monitoring task");
+        // Poll for IP assignment on the timer service
+        if (!tw_is_armed(&ip_wait_timer)) {
+            ip_wait_retries = 0;
+            ESP_LOGI(TAG, "Waiting for DHCP assignment");
+            log_all_netifs("ip wait start");
+            // On the first pass, attempt to start DHCP on all netifs (harmless if already running)
+            try_start_dhcp_on_all();
+            timer_service_arm_ms(&ip_wait_timer, IP_WAIT_PERIOD_MS, IP_WAIT_PERIOD_MS);
         }
         
         // Start web server
@@ -444,6 +3623,11 @@ static void handle_root_transition(bool becoming_root) {
         
         // Start mDNS service
         start_mdns_service();
+
+        // Publish node state upstream over MQTT (no-op unless enabled in menuconfig)
+        mqtt_uplink_start(self_sta_mac, mqtt_command_cb);
+
+        probe_start();
         
         // Request status from all nodes
         const char *cmd_str = "{\"cmd\":\"status_request\"}";
@@ -463,16 +3647,21 @@ static void handle_root_transition(bool becoming_root) {
     } else if (!becoming_root && is_root_node) {
         ESP_LOGI(TAG, "No longer root node - stopping web services");
         is_root_node = false;
+        topology_ready = false;
         
         // Stop web server
         stop_web_server();
         
         // Stop mDNS
         mdns_free();
+
+        mqtt_uplink_stop();
+        probe_stop();
     }
 }
 
 static void mesh_event_handler(void *arg, esp_event_base_t base, int32_t id, void *data) {
+    trace_capture_event(TRACE_SRC_MESH, id);
     static uint32_t event_count = 0;
     event_count++;
     
@@ -499,13 +3688,42 @@ static void mesh_event_handler(void *arg, esp_event_base_t base, int32_t id, voi
                  esp_mesh_get_layer(), 
                  conn->connected.bssid[0], conn->connected.bssid[1], conn->connected.bssid[2],
                  conn->connected.bssid[3], conn->connected.bssid[4], conn->connected.bssid[5]);
+
+        // Targeted rejoin worked: hand control back to self-organization without dropping this parent
+        if (rejoin_attempt_active) {
+            rejoin_attempt_active = false;
+            timer_service_cancel(&rejoin_fallback_timer);
+            esp_mesh_set_self_organized(true, false);
+        }
+        rejoin_cache_store(conn, esp_mesh_get_layer());
+        parent_opt_connected();
+        rules_raise(RULE_EV_CONNECTED, 0);
+
+        join_parent_us = esp_timer_get_time();
+        join_registered_us = 0;
+        ESP_LOGI(TAG, "JOIN_TIME: parent connected after %d ms", join_elapsed_ms(join_parent_us));
+        // The root is registered with itself as soon as it reaches the router
+        if (esp_mesh_get_layer() == 1) {
+            join_registered_us = join_parent_us;
+        }
+        // Slow start: a subtree that reconnects at once ramps up instead of bursting
+        taskENTER_CRITICAL(&flow_mux);
+        flow_restart(&flow, esp_timer_get_time());
+        parent_backlog_us = 0;
+        taskEXIT_CRITICAL(&flow_mux);
+        // Announce right away rather than waiting for the next heartbeat period
+        request_announce();
+        // Sync now instead of waiting for the next round
+        if (CONFIG_MESH_TIME_SYNC_PERIOD_MS > 0) {
+            time_req_schedule();
+        }
         
         // Add parent to node registry (but skip if it's the router - only track mesh nodes)
         // Root connects to router, not another mesh node, so don't add it to registry
         if (esp_mesh_get_layer() > 1) {
-            mesh_addr_t parent_addr;
-            memcpy(parent_addr.addr, conn->connected.bssid, 6);
-            add_or_update_node(&parent_addr, esp_mesh_get_layer() - 1);
+            uint8_t parent_sta[6];
+            mac_sta_from_ap(conn->connected.bssid, parent_sta);
+            add_or_update_node(parent_sta, esp_mesh_get_layer() - 1);
         }
         
         // Check if we became root (connected directly to router)
@@ -528,6 +3746,13 @@ static void mesh_event_handler(void *arg, esp_event_base_t base, int32_t id, voi
     case MESH_EVENT_PARENT_DISCONNECTED: {
         mesh_event_disconnected_t *disconn = (mesh_event_disconnected_t *)data;
         ESP_LOGW(TAG, "PARENT_DISCONNECTED, reason=%d, will scan for new parent", disconn->reason);
+        rules_raise(RULE_EV_DISCONNECTED, 0);
+        // Time the next join from here so self-heal shows up in join timing too
+        if (join_parent_us) {
+            join_start_us = esp_timer_get_time();
+            join_parent_us = 0;
+            join_registered_us = 0;
+        }
         break;
     }
     case MESH_EVENT_CHILD_CONNECTED: {
@@ -535,6 +3760,7 @@ static void mesh_event_handler(void *arg, esp_event_base_t base, int32_t id, voi
         ESP_LOGI(TAG, "CHILD_CONNECTED: %02x:%02x:%02x:%02x:%02x:%02x",
                  conn->connected.bssid[0], conn->connected.bssid[1], conn->connected.bssid[2],
                  conn->connected.bssid[3], conn->connected.bssid[4], conn->connected.bssid[5]);
+        topology_refresh_self();
         // Don't add here (field may not reflect child's WiFi MAC). Ask for status; child will add itself properly via response
         const char *cmd_str = "{\"cmd\":\"status_request\"}";
         mesh_data_t data_req = {
@@ -552,6 +3778,7 @@ static void mesh_event_handler(void *arg, esp_event_base_t base, int32_t id, voi
     case MESH_EVENT_CHILD_DISCONNECTED: {
         mesh_event_disconnected_t *disconn = (mesh_event_disconnected_t *)data;
         ESP_LOGW(TAG, "CHILD_DISCONNECTED, reason=%d", disconn->reason);
+        topology_refresh_self();
         break;
     }
     case MESH_EVENT_ROOT_ADDRESS: {
@@ -580,9 +3807,8 @@ static void mesh_event_handler(void *arg, esp_event_base_t base, int32_t id, voi
         break;
     case MESH_EVENT_ROOT_SWITCH_ACK:
         ESP_LOGI(TAG, "ROOT_SWITCH_ACK - checking if we are new root");
-        // Small delay to ensure mesh state is updated
-        vTaskDelay(pdMS_TO_TICKS(100));
-        handle_root_transition(esp_mesh_is_root());
+        // Debounce so mesh state is updated before we check (without stalling the event loop)
+        timer_service_arm_ms(&root_check_timer, ROOT_SWITCH_DEBOUNCE_MS, 0);
         break;
     case MESH_EVENT_ROUTING_TABLE_ADD: {
         int new_sz = esp_mesh_get_routing_table_size();
@@ -595,10 +3821,14 @@ static void mesh_event_handler(void *arg, esp_event_base_t base, int32_t id, voi
         break;
     }
     case MESH_EVENT_NO_PARENT_FOUND:
+        rejoin_fallback("no parent found");
         if (event_count % 50 == 1) { // Only log every 50th occurrence to reduce spam
             ESP_LOGW(TAG, "NO_PARENT_FOUND - scanning for mesh network... (count: %lu)", event_count);
         }
         break;
+    case MESH_EVENT_SCAN_DONE:
+        parent_opt_scan_done(((mesh_event_scan_done_t *)data)->number);
+        break;
     case MESH_EVENT_LAYER_CHANGE: {
         mesh_event_layer_change_t *layer_change = (mesh_event_layer_change_t *)data;
         ESP_LOGI(TAG, "LAYER_CHANGE, new_layer=%d", layer_change->new_layer);
@@ -612,52 +3842,35 @@ static void mesh_event_handler(void *arg, esp_event_base_t base, int32_t id, voi
     }
 }
 
-static void ip_check_task(void *arg) {
-    int retry_count = 0;
-    const int max_retries = 60; // Try for 60 seconds
-    bool dhcp_kicked = false;
-    
-    ESP_LOGI(TAG, "Starting IP check task - waiting for DHCP assignment");
-    log_all_netifs("ip_check_task start");
-    
-    while (retry_count < max_retries && is_root_node) {
-        // On first pass, attempt to start DHCP on all netifs (harmless if already running)
-        if (!dhcp_kicked) {
-            try_start_dhcp_on_all();
-            dhcp_kicked = true;
-        }
+static void ip_wait_cb(tw_timer_t *timer, void *arg) {
+    if (!is_root_node) {
+        timer_service_cancel(timer);
+        return;
+    }
 
-        // Check all netifs for an assigned IP
-        for (esp_netif_t *n = esp_netif_next_unsafe(NULL); n != NULL; n = esp_netif_next_unsafe(n)) {
-            esp_netif_ip_info_t ip_info;
-            if (esp_netif_get_ip_info(n, &ip_info) == ESP_OK && ip_info.ip.addr != 0) {
-                const char *ifkey = esp_netif_get_ifkey(n);
-                ESP_LOGI(TAG, "IP assigned on [%s]! Address: " IPSTR, ifkey ? ifkey : "(null)", IP2STR(&ip_info.ip));
-                ESP_LOGI(TAG, "Netmask: " IPSTR, IP2STR(&ip_info.netmask));
-                ESP_LOGI(TAG, "Gateway: " IPSTR, IP2STR(&ip_info.gw));
-                ESP_LOGI(TAG, "Device should now be accessible at http://mesh-controller.local");
-                ESP_LOGI(TAG, "Or directly at http://" IPSTR, IP2STR(&ip_info.ip));
-                ip_check_active = false;
-                vTaskDelete(NULL);
-                return;
-            }
-        }
-        
-        vTaskDelay(1000 / portTICK_PERIOD_MS); // Wait 1 second
-        retry_count++;
-        
-        if (retry_count % 10 == 0) {
-            ESP_LOGI(TAG, "Still waiting for IP assignment... (%d/%d)", retry_count, max_retries);
-            log_all_netifs("waiting");
+    // Check all netifs for an assigned IP
+    for (esp_netif_t *n = esp_netif_next_unsafe(NULL); n != NULL; n = esp_netif_next_unsafe(n)) {
+        esp_netif_ip_info_t ip_info;
+        if (esp_netif_get_ip_info(n, &ip_info) == ESP_OK && ip_info.ip.addr != 0) {
+            const char *ifkey = esp_netif_get_ifkey(n);
+            ESP_LOGI(TAG, "IP assigned on [%s]! Address: " IPSTR, ifkey ? ifkey : "(null)", IP2STR(&ip_info.ip));
+            ESP_LOGI(TAG, "Netmask: " IPSTR, IP2STR(&ip_info.netmask));
+            ESP_LOGI(TAG, "Gateway: " IPSTR, IP2STR(&ip_info.gw));
+            ESP_LOGI(TAG, "Device should now be accessible at http://mesh-controller.local");
+            ESP_LOGI(TAG, "Or directly at http://" IPSTR, IP2STR(&ip_info.ip));
+            timer_service_cancel(timer);
+            return;
         }
     }
-    
-    if (retry_count >= max_retries) {
-        ESP_LOGW(TAG, "Timeout waiting for IP assignment after %d seconds", max_retries);
+
+    ip_wait_retries++;
+    if (ip_wait_retries >= IP_WAIT_MAX_RETRIES) {
+        ESP_LOGW(TAG, "Timeout waiting for IP assignment after %d seconds", IP_WAIT_MAX_RETRIES * IP_WAIT_PERIOD_MS / 1000);
+        timer_service_cancel(timer);
+    } else if (ip_wait_retries % 10 == 0) {
+        ESP_LOGI(TAG, "Still waiting for IP assignment... (%d/%d)", ip_wait_retries, IP_WAIT_MAX_RETRIES);
+        log_all_netifs("waiting");
     }
-    
-    ip_check_active = false;
-    vTaskDelete(NULL);
 }
 
 static void log_all_netifs(const char *reason) {
@@ -681,6 +3894,7 @@ static void try_start_dhcp_on_all(void) {
 }
 
 static void ip_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+    trace_capture_event(TRACE_SRC_IP, event_id);
     switch (event_id) {
         case IP_EVENT_STA_GOT_IP: {
             ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
@@ -692,8 +3906,8 @@ static void ip_event_handler(void* arg, esp_event_base_t event_base, int32_t eve
             ESP_LOGI(TAG, "Direct: http://" IPSTR, IP2STR(&event->ip_info.ip));
             ESP_LOGI(TAG, "=============================");
             
-            // Stop the IP check task since we now have an IP
-            ip_check_active = false;
+            // Stop polling for an IP since we now have one
+            timer_service_cancel(&ip_wait_timer);
             break;
         }
         case IP_EVENT_STA_LOST_IP:
@@ -704,226 +3918,312 @@ static void ip_event_handler(void* arg, esp_event_base_t event_base, int32_t eve
     }
 }
 
+// Heartbeat/status_response: registry, topology, toggle round trip, uplink and join_ack
+static void handle_status_report(const mesh_msg_t *m, const mesh_addr_t *from) {
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    xSemaphoreTake(registry_lock, portMAX_DELAY);
+    uint32_t drops = registry.drops;
+    bool is_new;
+    node_info_t *node = registry_apply_status(&registry, m, from->addr, esp_mesh_get_layer(), now, &is_new);
+    if (!node) {
+        bool dropped = registry.drops != drops;
+        xSemaphoreGive(registry_lock);
+        if (dropped) {
+            ESP_LOGW(TAG, "Registry full of active nodes - dropping %02x:%02x:%02x:%02x:%02x:%02x",
+                     m->mac[0], m->mac[1], m->mac[2], m->mac[3], m->mac[4], m->mac[5]);
+        }
+        return;
+    }
+    node_seen(node, is_new);
+    int cmd_rtt_ms = -1;
+    if (m->type == MESH_MSG_STATUS_RESPONSE && node->cmd_sent_us) {
+        node->cmd_rtt_ms = (int)((esp_timer_get_time() - node->cmd_sent_us) / 1000);
+        node->cmd_sent_us = 0;
+        cmd_rtt_ms = node->cmd_rtt_ms;
+    }
+    uplink_node(node, MQTT_UPLINK_EV_UPDATE);
+    xSemaphoreGive(registry_lock);
+
+    const uint8_t *mac = m->mac;
+    topology_apply_report(mac, m);
+    if (m->type == MESH_MSG_STATUS_RESPONSE) {
+        cmd_wait_ack(m);
+    }
+    if (cmd_rtt_ms >= 0) {
+        ESP_LOGI(TAG, "LED toggle on %02x:%02x:%02x:%02x:%02x:%02x confirmed after %d ms",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], cmd_rtt_ms);
+    }
+    if (is_root_node) {
+        if (m->type == MESH_MSG_STATUS_RESPONSE && m->has_seq) {
+            cmd_queue_ack(mac, m->seq);
+        }
+        cmd_queue_flush(mac, from, m->type == MESH_MSG_HEARTBEAT);
+    }
+
+    // Nodes on another config version (missed a push, joined since, or ahead of a new root)
+    // get ours; one that is ahead answers with its own
+    if (m->type == MESH_MSG_HEARTBEAT && is_root_node && m->has_config_version) {
+        if (m->config_version > config_seen_version) {
+            config_seen_version = m->config_version;
+        }
+        if (m->config_version != node_config_version()) {
+            config_send(from);
+        }
+    }
+    if (m->type == MESH_MSG_HEARTBEAT && is_root_node && m->has_rules_version) {
+        if (m->rules_version > rules_seen_version) {
+            rules_seen_version = m->rules_version;
+        }
+        if (m->rules_version != rules_version()) {
+            rules_send(from);
+        }
+    }
+
+    // A joining node without reg_ms is waiting for us to confirm registration
+    if (m->type == MESH_MSG_HEARTBEAT && is_root_node && m->join_ms >= 0 && m->reg_ms < 0) {
+        const char *ack_str = "{\"cmd\":\"join_ack\"}";
+        mesh_data_t ack_data = {
+            .data = (uint8_t*)ack_str,
+            .size = strlen(ack_str),
+            .proto = MESH_PROTO_BIN,
+            .tos = MESH_TOS_P2P
+        };
+        esp_mesh_send(from, &ack_data, MESH_DATA_P2P, NULL, 0);
+    }
+}
+
+// Echo seq and the root's timestamp straight back; handled first to keep the RTT honest
+static void send_pong(const mesh_msg_t *m, const mesh_addr_t *to, int64_t rx_us) {
+    // Probes yield to state reports under congestion; the root sees a lost ping
+    if (flow_gate(FLOW_CLASS_PROBE) != FLOW_SEND) {
+        return;
+    }
+    char *pong_str = mem_budget_get(MEM_POOL_MSG);
+    if (!pong_str) {
+        return;
+    }
+    const uint8_t *s = self_sta_mac;
+    int n = snprintf(pong_str, MSG_BUF_SZ,
+                     "{\"cmd\":\"pong\",\"seq\":%lu,\"t\":%lld,\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\"",
+                     (unsigned long)m->seq, (long long)m->t, s[0], s[1], s[2], s[3], s[4], s[5]);
+    // Our mesh time at arrival lets the root measure how far off our clock is
+    taskENTER_CRITICAL(&tsync_mux);
+    bool synced = tsync.synced;
+    taskEXIT_CRITICAL(&tsync_mux);
+    if (synced) {
+        n += snprintf(pong_str + n, MSG_BUF_SZ - n, ",\"mt\":%lld", (long long)mesh_time_of(rx_us));
+    }
+    n += snprintf(pong_str + n, MSG_BUF_SZ - n, "}");
+    mesh_data_t pong_data = {
+        .data = (uint8_t*)pong_str,
+        .size = n,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P
+    };
+    esp_mesh_send(to, &pong_data, MESH_DATA_P2P, NULL, 0);
+    mem_budget_put(MEM_POOL_MSG, pong_str);
+}
+
+// rx_dispatch handlers: the module has already applied the root/node and addressing checks
+static void rx_on_ping(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    if (m->has_seq) {
+        send_pong(m, f->src, f->rx_us);
+    }
+}
+
+static void rx_on_pong(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    handle_pong(m);
+}
+
+static void rx_on_bench_start(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    bench_handle_start(f->raw);
+}
+
+static void rx_on_bench_stop(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    xSemaphoreTake(bench_lock, portMAX_DELAY);
+    bench_stop(&bench, esp_timer_get_time());
+    xSemaphoreGive(bench_lock);
+}
+
+static void rx_on_bench_report(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    bench_send_result(f->src);
+}
+
+static void rx_on_bench_result(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    bench_store_result(f->raw);
+}
+
+static void rx_on_time_sync(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    time_req_schedule();
+}
+
+static void rx_on_time_req(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    handle_time_req(m, f->src, f->rx_us);
+}
+
+static void rx_on_time_resp(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    handle_time_resp(m, f->rx_us);
+}
+
+static void rx_on_led_toggle(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    // Scheduled in mesh time if it carries "at"
+    if (m->has_at) {
+        schedule_led_toggle(m->at);
+    } else {
+        led_toggle();
+    }
+    if (m->has_target) {
+        // Send status response to root (the command ack, never throttled)
+        send_status_response(f->src, FLOW_CLASS_CONTROL, m);
+    }
+}
+
+static void rx_on_profile(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    profile_handle_request(m, f->src);
+}
+
+static void rx_on_profile_result(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    profile_store_result(f->raw);
+}
+
+static void rx_on_cmd_batch(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    // What the root kept for us while we were away; the ack carries our state now
+    if (m->led_set >= 0) {
+        led_set(m->led_set);
+    }
+    send_status_response(f->src, FLOW_CLASS_CONTROL, m);
+}
+
+static void rx_on_status_request(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    send_status_response(f->src, FLOW_CLASS_STATE, NULL);
+}
+
+// Heartbeats double as discovery: presence, layer, route, LED, RSSI, tree position
+static void rx_on_heartbeat(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    flow_note_parent(f->src, m->backlog);
+    handle_status_report(m, f->src);
+}
+
+static void rx_on_status_response(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    handle_status_report(m, f->src);
+}
+
+static void rx_on_backlog(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    flow_note_parent(f->src, m->backlog);
+}
+
+static void rx_on_config(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    config_handle_push(f->raw, f->src);
+}
+
+static void rx_on_rules(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    rules_handle_push(f->raw, f->src);
+}
+
+static void rx_on_signal(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    rules_handle_signal(m);
+}
+
+static void rx_on_join_ack(void *ctx, const mesh_msg_t *m, const rx_frame_t *f) {
+    // Root has us in its registry: close out join timing and re-announce so it records reg_ms
+    if (join_parent_us && !join_registered_us) {
+        join_registered_us = esp_timer_get_time();
+        ESP_LOGI(TAG, "JOIN_TIME: boot/disconnect -> parent %d ms -> registered at root %d ms",
+                 join_elapsed_ms(join_parent_us), join_elapsed_ms(join_registered_us));
+        request_announce();
+    }
+}
+
 static void rx_task(void *arg) {
+    static rx_dispatch_t rx;
+    rx_dispatch_init(&rx, self_sta_mac, NULL);
+    rx.on[MESH_MSG_PING] = rx_on_ping;
+    rx.on[MESH_MSG_PONG] = rx_on_pong;
+    rx.on[MESH_MSG_BENCH_START] = rx_on_bench_start;
+    rx.on[MESH_MSG_BENCH_STOP] = rx_on_bench_stop;
+    rx.on[MESH_MSG_BENCH_REPORT] = rx_on_bench_report;
+    rx.on[MESH_MSG_BENCH_RESULT] = rx_on_bench_result;
+    rx.on[MESH_MSG_TIME_SYNC] = rx_on_time_sync;
+    rx.on[MESH_MSG_TIME_REQ] = rx_on_time_req;
+    rx.on[MESH_MSG_TIME_RESP] = rx_on_time_resp;
+    rx.on[MESH_MSG_LED_TOGGLE] = rx_on_led_toggle;
+    rx.on[MESH_MSG_PROFILE] = rx_on_profile;
+    rx.on[MESH_MSG_PROFILE_RESULT] = rx_on_profile_result;
+    rx.on[MESH_MSG_CMD_BATCH] = rx_on_cmd_batch;
+    rx.on[MESH_MSG_STATUS_REQUEST] = rx_on_status_request;
+    rx.on[MESH_MSG_HEARTBEAT] = rx_on_heartbeat;
+    rx.on[MESH_MSG_STATUS_RESPONSE] = rx_on_status_response;
+    rx.on[MESH_MSG_BACKLOG] = rx_on_backlog;
+    rx.on[MESH_MSG_CONFIG] = rx_on_config;
+    rx.on[MESH_MSG_RULES] = rx_on_rules;
+    rx.on[MESH_MSG_SIGNAL] = rx_on_signal;
+    rx.on[MESH_MSG_JOIN_ACK] = rx_on_join_ack;
     while (true) {
         mesh_addr_t from = {0};
-        mesh_data_t data = {.data = rx_buf, .size = RX_BUF_SZ, .proto = MESH_PROTO_BIN, .tos = MESH_TOS_P2P};
+        // One byte short of the buffer so the payload can be NUL-terminated in place
+        mesh_data_t data = {.data = rx_buf, .size = sizeof(rx_buf) - 1, .proto = MESH_PROTO_BIN, .tos = MESH_TOS_P2P};
         int flag = 0;
         mesh_opt_t opt[1] = {0};
 
-        if (esp_mesh_recv(&from, &data, portMAX_DELAY, &flag, opt, 1) == ESP_OK) {
-            ESP_LOGI(TAG, "RX from %02x:%02x:%02x:%02x:%02x:%02x (%d bytes): %.*s",
-                     from.addr[0], from.addr[1], from.addr[2], from.addr[3], from.addr[4], from.addr[5],
-                     data.size, data.size, (char*)data.data);
-
-            // Add sender to node registry
-            add_or_update_node(&from, -1); // Layer will be updated by mesh events
-            
-            // Parse simple JSON commands using string matching
-            char *msg = (char*)data.data;
-            
-            // Ensure null termination
-            char msg_copy[256];
-            int copy_len = (data.size < sizeof(msg_copy) - 1) ? data.size : sizeof(msg_copy) - 1;
-            memcpy(msg_copy, msg, copy_len);
-            msg_copy[copy_len] = '\0';
-            
-            if (strstr(msg_copy, "\"cmd\":\"toggle\"") || strstr(msg_copy, "\"cmd\":\"led_toggle\"")) {
-                // Check if this command is for us
-                char *target_mac_start = strstr(msg_copy, "\"target_mac\":\"");
-                if (target_mac_start) {
-                    target_mac_start += 14; // Skip past "target_mac":"
-                    char target_mac[18];
-                    strncpy(target_mac, target_mac_start, 17);
-                    target_mac[17] = '\0';
-                    
-                    uint8_t self_addr[6];
-                    esp_wifi_get_mac(WIFI_IF_STA, self_addr);
-                    char self_mac[18];
-                    snprintf(self_mac, sizeof(self_mac), "%02x:%02x:%02x:%02x:%02x:%02x",
-                             self_addr[0], self_addr[1], self_addr[2],
-                             self_addr[3], self_addr[4], self_addr[5]);
-                    
-                    if (strncmp(target_mac, self_mac, 17) == 0) {
-                        led_toggle();
-                        
-                        // Send status response to root
-            // Capture our current RSSI to parent/router
-            int my_rssi = -127;
-            wifi_ap_record_t aprec = {0};
-            if (esp_wifi_sta_get_ap_info(&aprec) == ESP_OK) {
-                my_rssi = aprec.rssi;
-            }
-            char resp_str[160];
-            snprintf(resp_str, sizeof(resp_str),
-                "{\"cmd\":\"status_response\",\"mac\":\"%s\",\"led_state\":%s,\"layer\":%d,\"rssi\":%d}",
-                self_mac, led_state ? "true" : "false", esp_mesh_get_layer(), my_rssi);
-                        
-                        mesh_data_t resp_data = {
-                            .data = (uint8_t*)resp_str,
-                            .size = strlen(resp_str),
-                            .proto = MESH_PROTO_BIN,
-                            .tos = MESH_TOS_P2P
-                        };
-                        esp_mesh_send(&from, &resp_data, MESH_DATA_P2P, NULL, 0);
-                    }
-                } else {
-                    // Legacy toggle command
-                    led_toggle();
-                }
-            } else if (strstr(msg_copy, "\"cmd\":\"status_request\"")) {
-                // Send our status back
-                uint8_t self_addr[6];
-                esp_wifi_get_mac(WIFI_IF_STA, self_addr);
-                char self_mac[18];
-                snprintf(self_mac, sizeof(self_mac), "%02x:%02x:%02x:%02x:%02x:%02x",
-                         self_addr[0], self_addr[1], self_addr[2],
-                         self_addr[3], self_addr[4], self_addr[5]);
-                
-        int my_rssi = -127;
-        wifi_ap_record_t aprec = {0};
-        if (esp_wifi_sta_get_ap_info(&aprec) == ESP_OK) {
-            my_rssi = aprec.rssi;
-        }
-        char resp_str[160];
-        snprintf(resp_str, sizeof(resp_str),
-            "{\"cmd\":\"status_response\",\"mac\":\"%s\",\"led_state\":%s,\"layer\":%d,\"rssi\":%d}",
-            self_mac, led_state ? "true" : "false", esp_mesh_get_layer(), my_rssi);
-                
-                mesh_data_t resp_data = {
-                    .data = (uint8_t*)resp_str,
-                    .size = strlen(resp_str),
-                    .proto = MESH_PROTO_BIN,
-                    .tos = MESH_TOS_P2P
-                };
-                esp_mesh_send(&from, &resp_data, MESH_DATA_P2P, NULL, 0);
-            } else if (strstr(msg_copy, "\"cmd\":\"status_response\"")) {
-                // Parse MAC address from response
-                char *mac_start = strstr(msg_copy, "\"mac\":\"");
-                if (mac_start) {
-                    mac_start += 7; // Skip past "mac":"
-                    char resp_mac[18];
-                    strncpy(resp_mac, mac_start, 17);
-                    resp_mac[17] = '\0';
-                    // Parse layer if present
-                    int resp_layer = -1;
-                    char *layer_ptr = strstr(msg_copy, "\"layer\":");
-                    if (layer_ptr) {
-                        resp_layer = atoi(layer_ptr + 8);
-                    }
-                    // Update/add this node using its WiFi MAC
-                    uint8_t mac_bytes[6];
-                    if (parse_mac_str(resp_mac, mac_bytes)) {
-                        mesh_addr_t node_addr = {0};
-                        memcpy(node_addr.addr, mac_bytes, 6);
-                        add_or_update_node(&node_addr, resp_layer > 0 ? resp_layer : esp_mesh_get_layer());
-                        // Record route hint from source
-                        for (int i = 0; i < node_count; i++) {
-                            if (memcmp(known_nodes[i].addr.addr, node_addr.addr, 6) == 0) {
-                                known_nodes[i].last_from = from;
-                                known_nodes[i].has_route = true;
-                                break;
-                            }
-                        }
-                    }
-                    
-                    // Parse LED state
-                    bool resp_led_state = strstr(msg_copy, "\"led_state\":true") != NULL;
-                    // Parse RSSI if present
-                    int resp_rssi = -127;
-                    char *rssi_ptr = strstr(msg_copy, "\"rssi\":");
-                    if (rssi_ptr) {
-                        resp_rssi = atoi(rssi_ptr + 7);
-                    }
-                    
-                    // Update node registry
-                    for (int i = 0; i < node_count; i++) {
-                        char node_mac[18];
-                        snprintf(node_mac, sizeof(node_mac), "%02x:%02x:%02x:%02x:%02x:%02x",
-                                 known_nodes[i].addr.addr[0], known_nodes[i].addr.addr[1], known_nodes[i].addr.addr[2],
-                                 known_nodes[i].addr.addr[3], known_nodes[i].addr.addr[4], known_nodes[i].addr.addr[5]);
-                        
-                        if (strcmp(node_mac, resp_mac) == 0) {
-                            known_nodes[i].led_state = resp_led_state;
-                            known_nodes[i].rssi = resp_rssi;
-                            // don't break: update all duplicates if any
-                        }
-                    }
-                }
-            } else if (strstr(msg_copy, "\"cmd\":\"heartbeat\"")) {
-                // Use heartbeat for discovery: update the node's presence and layer; record route; update LED state if provided
-                char *mac_start = strstr(msg_copy, "\"mac\":\"");
-                if (mac_start) {
-                    mac_start += 7;
-                    char hb_mac[18];
-                    strncpy(hb_mac, mac_start, 17);
-                    hb_mac[17] = '\0';
-                    // Parse layer if present
-                    int hb_layer = -1;
-                    char *layer_ptr = strstr(msg_copy, "\"layer\":");
-                    if (layer_ptr) {
-                        hb_layer = atoi(layer_ptr + 8);
-                    }
-                    bool hb_led_state = strstr(msg_copy, "\"led_state\":true") != NULL;
-                    int hb_rssi = -127;
-                    char *rssi_ptr = strstr(msg_copy, "\"rssi\":");
-                    if (rssi_ptr) {
-                        hb_rssi = atoi(rssi_ptr + 7);
-                    }
-                    uint8_t mac_bytes[6];
-                    if (parse_mac_str(hb_mac, mac_bytes)) {
-                        mesh_addr_t node_addr = {0};
-                        memcpy(node_addr.addr, mac_bytes, 6);
-                        add_or_update_node(&node_addr, hb_layer > 0 ? hb_layer : esp_mesh_get_layer());
-                        // Record route hint from source and update LED if we track this node
-                        for (int i = 0; i < node_count; i++) {
-                            if (memcmp(known_nodes[i].addr.addr, node_addr.addr, 6) == 0) {
-                                known_nodes[i].last_from = from;
-                                known_nodes[i].has_route = true;
-                                known_nodes[i].led_state = hb_led_state;
-                                known_nodes[i].rssi = hb_rssi;
-                                break;
-                            }
-                        }
-                    }
-                }
-            }
+        if (esp_mesh_recv(&from, &data, portMAX_DELAY, &flag, opt, 1) != ESP_OK) {
+            continue;
         }
+        int64_t rx_us = esp_timer_get_time();
+        trace_capture_rx(&from, &data, rx_us);
+        // Benchmark frames are binary and may arrive at high rate: no logging, no parsing
+        if (bench_is_frame(data.data, data.size)) {
+            xSemaphoreTake(bench_lock, portMAX_DELAY);
+            bench_on_frame(&bench, from.addr, data.data, data.size, esp_timer_get_time());
+            xSemaphoreGive(bench_lock);
+            continue;
+        }
+        ESP_LOGI(TAG, "RX from %02x:%02x:%02x:%02x:%02x:%02x (%d bytes): %.*s",
+                 from.addr[0], from.addr[1], from.addr[2], from.addr[3], from.addr[4], from.addr[5],
+                 data.size, data.size, (char*)data.data);
+
+        // Single pass over the JSON; the few handlers that need the raw text get it NUL-terminated
+        rx_buf[data.size] = '\0';
+        rx_frame_t frame = {
+            .raw = (const char *)rx_buf,
+            .len = data.size,
+            .from = from.addr,
+            .src = &from,
+            .rx_us = rx_us,
+        };
+        rx.is_root = is_root_node;
+        rx_dispatch(&rx, &frame);
     }
 }
 
-static void status_task(void *arg) {
-    while (true) {
-        vTaskDelay(pdMS_TO_TICKS(10000)); // Every 10 seconds
-        bool is_connected = esp_mesh_is_device_active();
-        int layer = esp_mesh_get_layer();
-        int table_size = esp_mesh_get_routing_table_size();
-        
-        ESP_LOGI(TAG, "STATUS: connected=%s, layer=%d, routing_table_size=%d", 
-                 is_connected ? "YES" : "NO", layer, table_size);
+static void status_cb(tw_timer_t *timer, void *arg) {
+    bool is_connected = esp_mesh_is_device_active();
+    int layer = esp_mesh_get_layer();
+    int table_size = esp_mesh_get_routing_table_size();
+    
+    ESP_LOGI(TAG, "STATUS: connected=%s, layer=%d, routing_table_size=%d", 
+             is_connected ? "YES" : "NO", layer, table_size);
+    
+    // Check IP address if we're root
+    if (is_root_node && layer == 1) {
+        esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+        if (!netif) {
+            netif = esp_netif_get_default_netif();
+        }
         
-        // Check IP address if we're root
-        if (is_root_node && layer == 1) {
-            esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
-            if (!netif) {
-                netif = esp_netif_get_default_netif();
-            }
-            
-            if (netif) {
-                esp_netif_ip_info_t ip_info;
-                if (esp_netif_get_ip_info(netif, &ip_info) == ESP_OK) {
-                    if (ip_info.ip.addr != 0) {
-                        ESP_LOGI(TAG, "Root IP: " IPSTR, IP2STR(&ip_info.ip));
-                    } else {
-                        ESP_LOGW(TAG, "Root node has no IP address assigned");
-                    }
+        if (netif) {
+            esp_netif_ip_info_t ip_info;
+            if (esp_netif_get_ip_info(netif, &ip_info) == ESP_OK) {
+                if (ip_info.ip.addr != 0) {
+                    ESP_LOGI(TAG, "Root IP: " IPSTR, IP2STR(&ip_info.ip));
+                } else {
+                    ESP_LOGW(TAG, "Root node has no IP address assigned");
                 }
             }
         }
-        
-        if (!is_connected && layer == 0) {
-            ESP_LOGW(TAG, "Device not connected to mesh - check if root node is running with matching MESH_ID");
-        }
+    }
+    
+    if (!is_connected && layer == 0) {
+        ESP_LOGW(TAG, "Device not connected to mesh - check if root node is running with matching mesh ID");
     }
 }
 
@@ -944,6 +4244,10 @@ static void start_mesh(void) {
     wifi_init_config_t wicfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&wicfg));
     ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_FLASH));
+    // Our MAC and the registry must be in place before the first mesh event can add a parent
+    esp_wifi_get_mac(WIFI_IF_STA, self_sta_mac);
+    registry_init(&registry, self_sta_mac, registry_evict_cb, NULL);
+    bench_init_local();
     ESP_ERROR_CHECK(esp_wifi_start());
 
     // Mesh init
@@ -958,26 +4262,132 @@ static void start_mesh(void) {
     ESP_ERROR_CHECK(esp_mesh_set_self_organized(true, true));
 
     // Mesh config
+    node_config_t nc;
+    node_config_get(&nc);
     mesh_cfg_t cfg = MESH_INIT_CONFIG_DEFAULT();
-    memcpy((uint8_t *)&cfg.mesh_id, MESH_ID, sizeof(cfg.mesh_id));
+    memcpy((uint8_t *)&cfg.mesh_id, nc.mesh_id, sizeof(cfg.mesh_id));
 
     // Backhaul (router) creds - ALL nodes need this for potential root election
-    cfg.router.ssid_len = strlen(ROUTER_SSID);
-    memcpy(cfg.router.ssid, ROUTER_SSID, cfg.router.ssid_len);
-    memcpy(cfg.router.password, ROUTER_PASS, strlen(ROUTER_PASS));
+    cfg.router.ssid_len = strlen(nc.router_ssid);
+    memcpy(cfg.router.ssid, nc.router_ssid, cfg.router.ssid_len);
+    memcpy(cfg.router.password, nc.router_pass, strlen(nc.router_pass));
 
     // SoftAP config for downstream children  
-    cfg.mesh_ap.max_connection = 6;
-    strcpy((char *)cfg.mesh_ap.password, "meshpassword"); // children auth
+    cfg.mesh_ap.max_connection = nc.max_connection;
+    strcpy((char *)cfg.mesh_ap.password, MESH_AP_PASS);
+
+    // Fast rejoin: scan only the cached channel first (widening to all channels on failure), and
+    // for non-root nodes go straight for the cached parent with self-organization held off
+    rejoin_cache_load();
+    bool targeted = false;
+    if (rejoin_cache_valid) {
+        cfg.channel = rejoin_cache.channel;
+        cfg.allow_channel_switch = true;
+        targeted = rejoin_cache.layer > MESH_ROOT_LAYER;
+    }
+    if (targeted) {
+        ESP_ERROR_CHECK(esp_mesh_set_self_organized(false, false));
+    }
+    tw_timer_init(&rejoin_fallback_timer, rejoin_fallback_cb, NULL);
     
     // Apply configuration
     ESP_ERROR_CHECK(esp_mesh_set_config(&cfg));
 
     // Start mesh (topology and IP behavior use defaults from config and self-organization)
     ESP_ERROR_CHECK(esp_mesh_start());
+    if (targeted) {
+        rejoin_start_targeted();
+    }
     ESP_LOGI(TAG, "Mesh started, waiting for links...");
     xTaskCreate(rx_task, "rx_task", 4096, NULL, 5, NULL);
-    xTaskCreate(status_task, "status_task", 4096, NULL, 3, NULL);
+    timer_service_arm_ms(&status_timer, nc.status_ms, nc.status_ms);
+}
+
+static void root_check_cb(tw_timer_t *timer, void *arg) {
+    handle_root_transition(esp_mesh_is_root());
+}
+
+// Periodic status announcement; the first few runs also double-check root status
+static void heartbeat_cb(tw_timer_t *timer, void *arg) {
+    // Periodic root status check (in case we missed the initial detection)
+    static int check_count = 0;
+    check_count++;
+    if (check_count <= 3) { // Check first 3 times
+        bool current_root_status = esp_mesh_is_root();
+        ESP_LOGI(TAG, "Periodic root check #%d: is_root=%s, web_active=%s", 
+                 check_count, current_root_status ? "YES" : "NO", is_root_node ? "YES" : "NO");
+        
+        if (current_root_status && !is_root_node) {
+            ESP_LOGW(TAG, "Root status mismatch detected - fixing web server state");
+            handle_root_transition(true);
+        }
+    }
+    
+    if (esp_mesh_is_device_active()) {
+        send_heartbeat();
+    }
+    // "Before" for /api/parent_opt: the tree as first seen, until POST ?baseline=1 retakes it
+    if (is_root_node && !quality_baseline_set) {
+        tree_quality_t q;
+        tree_quality_get(&q);
+        if (q.nodes > 0) {
+            quality_baseline = q;
+            quality_baseline_set = true;
+        }
+    }
+}
+
+static void flow_setup(void) {
+    flow_config_t cfg;
+    flow_default_config(&cfg);
+#if CONFIG_MESH_FLOW_CONTROL
+    cfg.high_water = CONFIG_MESH_FLOW_HIGH_WATER;
+    cfg.low_water = CONFIG_MESH_FLOW_LOW_WATER;
+    cfg.min_rate_mps = 1000000 / CONFIG_MESH_FLOW_MIN_PERIOD_MS;
+    cfg.max_rate_mps = CONFIG_MESH_FLOW_MAX_RATE * 1000;
+#endif
+    flow_init(&flow, &cfg, esp_timer_get_time());
+    tw_timer_init(&flow_timer, flow_tick_cb, NULL);
+    timer_service_arm_ms(&flow_timer, FLOW_TICK_MS, FLOW_TICK_MS);
+}
+
+// Every node scans at its own offset within the period, so neighbours do not all go quiet at once.
+// The mesh's built-in weak-parent monitor gets the same thresholds.
+static void parent_opt_setup(void) {
+    po_config_t cfg;
+    po_default_config(&cfg);
+#if CONFIG_MESH_PARENT_OPT
+    cfg.min_rssi = CONFIG_MESH_PARENT_OPT_MIN_RSSI;
+    cfg.margin = CONFIG_MESH_PARENT_OPT_MARGIN;
+    cfg.hold_ms = CONFIG_MESH_PARENT_OPT_HOLD_S * 1000;
+#endif
+    po_init(&parent_opt, &cfg, now_ms());
+    tw_timer_init(&parent_opt_timer, parent_opt_cb, NULL);
+    tw_timer_init(&parent_opt_guard_timer, parent_opt_guard_cb, NULL);
+#if CONFIG_MESH_PARENT_OPT
+    mesh_switch_parent_t paras;
+    if (esp_mesh_get_switch_parent_paras(&paras) == ESP_OK) {
+        paras.cnx_rssi = cfg.min_rssi;
+        paras.select_rssi = cfg.min_rssi + cfg.margin;
+        paras.switch_rssi = cfg.min_rssi;
+        esp_mesh_set_switch_parent_paras(&paras);
+    }
+    uint32_t period = CONFIG_MESH_PARENT_OPT_PERIOD_S * 1000;
+    uint32_t offset = ((uint32_t)self_sta_mac[4] << 8 | self_sta_mac[5]) % period;
+    timer_service_arm_ms(&parent_opt_timer, period + offset, period);
+#endif
+}
+
+// Capture starts before the mesh so a trace taken at boot covers the join
+static void trace_setup(void) {
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    trace_init(&trace, trace_buf, sizeof(trace_buf), mac);
+#if CONFIG_MESH_TRACE_BOOT_FULL
+    trace.mode = TRACE_FULL;
+#elif CONFIG_MESH_TRACE_BOOT_HASH
+    trace.mode = TRACE_HASH;
+#endif
 }
 
 void app_main(void) {
@@ -987,66 +4397,48 @@ void app_main(void) {
     esp_log_level_set("wifi", ESP_LOGW);
     esp_log_level_set("net80211", ESP_LOGW);
     ESP_ERROR_CHECK(nvs_flash_init());
+    ESP_ERROR_CHECK(node_config_init());
     
     // Initialize LED
     led_init();
+
+    topo_lock = xSemaphoreCreateMutex();
+    registry_lock = xSemaphoreCreateMutex();
+    results_lock = xSemaphoreCreateMutex();
+    node_results_init(&bench_results);
+    node_results_init(&profile_results);
+
+    // Timers for heartbeats, status, staleness and protocol timeouts all run on one service
+    ESP_ERROR_CHECK(timer_service_start());
+    ESP_ERROR_CHECK(mem_budget_init());
+    flow_setup();
+    rules_setup();
+    cmdq_init(&cmd_queue, CONFIG_MESH_CMD_QUEUE_TTL_S * 1000);
+    profile_setup();
+    trace_setup();
+    tw_timer_init(&heartbeat_timer, heartbeat_cb, NULL);
+    tw_timer_init(&announce_timer, announce_cb, NULL);
+    tw_timer_init(&status_timer, status_cb, NULL);
+    tw_timer_init(&ip_wait_timer, ip_wait_cb, NULL);
+    tw_timer_init(&root_check_timer, root_check_cb, NULL);
+    tw_timer_init(&probe_timer, probe_cb, NULL);
+    tw_timer_init(&probe_burst_timer, probe_burst_cb, NULL);
+    tw_timer_init(&bench_report_timer, bench_report_cb, NULL);
+    ts_init(&tsync);
+    tw_timer_init(&time_sync_timer, time_sync_cb, NULL);
+    tw_timer_init(&time_req_timer, time_req_cb, NULL);
+    const esp_timer_create_args_t action_args = { .callback = action_cb, .name = "action" };
+    ESP_ERROR_CHECK(esp_timer_create(&action_args, &action_timer));
     
     start_mesh();
+    parent_opt_setup();
 
-    // Wait longer before sending test message to allow mesh to stabilize
-    vTaskDelay(pdMS_TO_TICKS(15000));
-    
-    // Send periodic status announcements if we're connected to mesh
-    while (true) {
-        vTaskDelay(pdMS_TO_TICKS(30000)); // Every 30 seconds
-        
-        // Periodic root status check (in case we missed the initial detection)
-        static int check_count = 0;
-        check_count++;
-        if (check_count <= 3) { // Check first 3 times (first 90 seconds)
-            bool current_root_status = esp_mesh_is_root();
-            ESP_LOGI(TAG, "Periodic root check #%d: is_root=%s, web_active=%s", 
-                     check_count, current_root_status ? "YES" : "NO", is_root_node ? "YES" : "NO");
-            
-            if (current_root_status && !is_root_node) {
-                ESP_LOGW(TAG, "Root status mismatch detected - fixing web server state");
-                handle_root_transition(true);
-            }
-        }
-        
-        if (esp_mesh_is_device_active()) {
-            uint8_t self_addr[6];
-            esp_wifi_get_mac(WIFI_IF_STA, self_addr);
-            char self_mac[18];
-            snprintf(self_mac, sizeof(self_mac), "%02x:%02x:%02x:%02x:%02x:%02x",
-                     self_addr[0], self_addr[1], self_addr[2],
-                     self_addr[3], self_addr[4], self_addr[5]);
-            
-        // Attach RSSI to heartbeat for link quality visualization
-        int my_rssi = -127;
-        wifi_ap_record_t aprec = {0};
-        if (esp_wifi_sta_get_ap_info(&aprec) == ESP_OK) {
-        my_rssi = aprec.rssi;
-        }
-        char ann_str[160];
-        snprintf(ann_str, sizeof(ann_str),
-            "{\"cmd\":\"heartbeat\",\"mac\":\"%s\",\"led_state\":%s,\"layer\":%d,\"rssi\":%d}",
-            self_mac, led_state ? "true" : "false", esp_mesh_get_layer(), my_rssi);
-            
-            mesh_data_t d = {
-                .data = (uint8_t*)ann_str,
-                .size = strlen(ann_str),
-                .proto = MESH_PROTO_BIN,
-                .tos = MESH_TOS_P2P
-            };
-            mesh_addr_t bcast = {0};
-            bcast.mip.port = MESH_DATA_P2P;
-            memset(bcast.addr, 0xFF, 6);
-            esp_err_t r = esp_mesh_send(&bcast, &d, MESH_DATA_P2P, NULL, 0);
-            
-            if (r == ESP_OK) {
-                ESP_LOGD(TAG, "Sent heartbeat broadcast");
-            }
-        }
+    // Allow the mesh to stabilize before periodic announcements start;
+    // PARENT_CONNECTED announces immediately regardless
+    node_config_t nc;
+    node_config_get(&nc);
+    timer_service_arm_ms(&heartbeat_timer, nc.start_delay_ms, nc.heartbeat_ms);
+    if (CONFIG_MESH_TIME_SYNC_PERIOD_MS > 0) {
+        timer_service_arm_ms(&time_sync_timer, CONFIG_MESH_TIME_SYNC_PERIOD_MS, CONFIG_MESH_TIME_SYNC_PERIOD_MS);
     }
 }
@@ -0,0 +1,55 @@
+#include <string.h>
+#include "latency.h"
+
+void lat_series_init(lat_series_t *s) {
+    memset(s, 0, sizeof(*s));
+    s->min_us = UINT32_MAX;
+}
+
+void lat_record(lat_series_t *s, uint32_t rtt_us) {
+    s->samples[s->head] = rtt_us;
+    s->head = (s->head + 1) % LAT_WINDOW;
+    if (s->count < LAT_WINDOW) {
+        s->count++;
+    }
+    if (rtt_us < s->min_us) {
+        s->min_us = rtt_us;
+    }
+    if (rtt_us > s->max_us) {
+        s->max_us = rtt_us;
+    }
+}
+
+// Nearest-rank percentile on a sorted array
+static uint32_t lat_rank(const uint32_t *sorted, int n, int pct) {
+    int rank = (pct * n + 99) / 100;
+    if (rank < 1) {
+        rank = 1;
+    }
+    return sorted[rank - 1];
+}
+
+void lat_percentiles(const lat_series_t *s, lat_pct_t *out) {
+    memset(out, 0, sizeof(*out));
+    int n = s->count;
+    if (n == 0) {
+        return;
+    }
+    // Insertion sort: the window is small and mostly arrives in similar order
+    uint32_t sorted[LAT_WINDOW];
+    for (int i = 0; i < n; i++) {
+        uint32_t v = s->samples[i];
+        int j = i;
+        while (j > 0 && sorted[j - 1] > v) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = v;
+    }
+    out->n = n;
+    out->p50_us = lat_rank(sorted, n, 50);
+    out->p95_us = lat_rank(sorted, n, 95);
+    out->p99_us = lat_rank(sorted, n, 99);
+    out->min_us = s->min_us;
+    out->max_us = s->max_us;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Sliding-window RTT statistics for mesh probes. Plain C with no RTOS dependency;
+// callers serialize access.
+//
+// Each series keeps the last LAT_WINDOW samples; percentiles are computed on demand from
+// a sorted copy (nearest-rank), so recording stays O(1).
+
+#define LAT_WINDOW 64
+
+typedef struct {
+    uint32_t samples[LAT_WINDOW]; // RTT in us, ring buffer
+    uint16_t count;               // valid samples (<= LAT_WINDOW)
+    uint16_t head;                // next write position
+    uint32_t sent;                // probes sent
+    uint32_t received;            // matching replies
+    uint32_t lost;                // probes superseded before a reply arrived
+    uint32_t late;                // replies for a probe already counted lost
+    uint32_t min_us;
+    uint32_t max_us;
+} lat_series_t;
+
+typedef struct {
+    int n;
+    uint32_t p50_us;
+    uint32_t p95_us;
+    uint32_t p99_us;
+    uint32_t min_us;  // over the lifetime of the series, not just the window
+    uint32_t max_us;
+} lat_pct_t;
+
+void lat_series_init(lat_series_t *s);
+void lat_record(lat_series_t *s, uint32_t rtt_us);
+// Percentiles over the current window; all zero when there are no samples
+void lat_percentiles(const lat_series_t *s, lat_pct_t *out);
@@ -0,0 +1,189 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "timer_service.h"
+#include "mem_budget.h"
+
+static const char *TAG = "MEM_BUDGET";
+
+#define CHECK_PERIOD_MS 5000
+
+MEM_POOL_STORAGE(msg, CONFIG_MESH_MSG_BLOCK_SIZE, CONFIG_MESH_MSG_POOL_BLOCKS);
+MEM_POOL_STORAGE(http, CONFIG_MESH_HTTP_BLOCK_SIZE, CONFIG_MESH_HTTP_POOL_BLOCKS);
+
+static mem_pool_t pools[MEM_POOL_COUNT];
+static portMUX_TYPE pool_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Tasks whose stacks we report and to which steady-state allocations are attributed
+static const char *const watched_names[MEM_BUDGET_MAX_TASKS] = {
+    "rx_task", "timer_svc", "bench", "httpd", "mqtt_task", "tiT", "sys_evt", "esp_timer",
+};
+static TaskHandle_t watched[MEM_BUDGET_MAX_TASKS];
+static volatile uint32_t task_allocs[MEM_BUDGET_MAX_TASKS];
+static bool task_reported[MEM_BUDGET_MAX_TASKS];
+
+static tw_timer_t check_timer;
+static volatile bool steady;
+static int64_t steady_at_us;
+static uint32_t base_blocks;
+static uint32_t peak_blocks;
+static volatile uint32_t steady_allocs;
+static volatile uint32_t steady_alloc_bytes;
+static volatile uint32_t alloc_failures;
+
+#if CONFIG_HEAP_USE_HOOKS
+// Called by the heap on every allocation; must not allocate or log
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps) {
+    if (!steady || !ptr) {
+        return;
+    }
+    steady_allocs++;
+    steady_alloc_bytes += size;
+    if (xPortInIsrContext()) {
+        return;
+    }
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < MEM_BUDGET_MAX_TASKS; i++) {
+        if (watched[i] == self) {
+            task_allocs[i]++;
+            break;
+        }
+    }
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr) {
+}
+#endif
+
+static void alloc_failed_cb(size_t size, uint32_t caps, const char *function_name) {
+    alloc_failures++;
+}
+
+static void refresh_task_handles(void) {
+    for (int i = 0; i < MEM_BUDGET_MAX_TASKS; i++) {
+        watched[i] = xTaskGetHandle(watched_names[i]);
+    }
+}
+
+static void take_baseline(void) {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_DEFAULT);
+    base_blocks = info.allocated_blocks;
+    peak_blocks = info.allocated_blocks;
+    steady_allocs = 0;
+    steady_alloc_bytes = 0;
+    for (int i = 0; i < MEM_BUDGET_MAX_TASKS; i++) {
+        task_allocs[i] = 0;
+        task_reported[i] = false;
+    }
+    steady_at_us = esp_timer_get_time();
+    steady = true;
+    ESP_LOGI(TAG, "Steady state: %lu heap blocks allocated, %lu bytes free",
+             (unsigned long)info.allocated_blocks, (unsigned long)info.total_free_bytes);
+}
+
+static void check_cb(tw_timer_t *timer, void *arg) {
+    refresh_task_handles();
+    if (!steady) {
+        if (esp_timer_get_time() - steady_at_us >= (int64_t)CONFIG_MESH_STEADY_STATE_MS * 1000) {
+            take_baseline();
+        }
+        return;
+    }
+    // Net growth past the previous peak looks like a leak or an unbounded queue
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_DEFAULT);
+    if (info.allocated_blocks > peak_blocks) {
+        peak_blocks = info.allocated_blocks;
+        ESP_LOGW(TAG, "Heap grew to %lu blocks (+%lu since steady state), min free %lu bytes",
+                 (unsigned long)info.allocated_blocks, (unsigned long)(info.allocated_blocks - base_blocks),
+                 (unsigned long)info.minimum_free_bytes);
+    }
+    for (int i = 0; i < MEM_BUDGET_MAX_TASKS; i++) {
+        if (task_allocs[i] && !task_reported[i]) {
+            task_reported[i] = true;
+            ESP_LOGW(TAG, "Steady-state heap allocation from task %s", watched_names[i]);
+        }
+    }
+}
+
+esp_err_t mem_budget_init(void) {
+    MEM_POOL_INIT(&pools[MEM_POOL_MSG], msg, "msg", CONFIG_MESH_MSG_BLOCK_SIZE, CONFIG_MESH_MSG_POOL_BLOCKS);
+    MEM_POOL_INIT(&pools[MEM_POOL_HTTP], http, "http", CONFIG_MESH_HTTP_BLOCK_SIZE, CONFIG_MESH_HTTP_POOL_BLOCKS);
+    heap_caps_register_failed_alloc_callback(alloc_failed_cb);
+    steady_at_us = esp_timer_get_time();
+    tw_timer_init(&check_timer, check_cb, NULL);
+    timer_service_arm_ms(&check_timer, CHECK_PERIOD_MS, CHECK_PERIOD_MS);
+    return ESP_OK;
+}
+
+void *mem_budget_get(mem_pool_id_t id) {
+    taskENTER_CRITICAL(&pool_mux);
+    void *block = mem_pool_get(&pools[id]);
+    taskEXIT_CRITICAL(&pool_mux);
+    if (!block) {
+        ESP_LOGW(TAG, "Pool '%s' exhausted (%u blocks)", pools[id].name, pools[id].blocks);
+    }
+    return block;
+}
+
+void mem_budget_put(mem_pool_id_t id, void *block) {
+    taskENTER_CRITICAL(&pool_mux);
+    mem_pool_put(&pools[id], block);
+    taskEXIT_CRITICAL(&pool_mux);
+}
+
+size_t mem_budget_block_size(mem_pool_id_t id) {
+    return pools[id].block_size;
+}
+
+void mem_budget_restart_steady(void) {
+    steady = false;
+    steady_at_us = esp_timer_get_time();
+}
+
+void mem_budget_get_pool(mem_pool_id_t id, mem_pool_t *out) {
+    taskENTER_CRITICAL(&pool_mux);
+    *out = pools[id];
+    taskEXIT_CRITICAL(&pool_mux);
+}
+
+void mem_budget_get_heap(mem_budget_heap_t *out) {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_DEFAULT);
+    memset(out, 0, sizeof(*out));
+    out->free_bytes = info.total_free_bytes;
+    out->min_free_bytes = info.minimum_free_bytes;
+    out->largest_free_block = info.largest_free_block;
+    out->allocated_blocks = info.allocated_blocks;
+    out->alloc_failures = alloc_failures;
+#if CONFIG_HEAP_USE_HOOKS
+    out->hooks = true;
+#endif
+    out->steady = steady;
+    if (steady) {
+        out->steady_age_ms = (uint32_t)((esp_timer_get_time() - steady_at_us) / 1000);
+        out->steady_base_blocks = base_blocks;
+        out->steady_peak_blocks = peak_blocks;
+        out->steady_allocs = steady_allocs;
+        out->steady_alloc_bytes = steady_alloc_bytes;
+    }
+}
+
+int mem_budget_get_tasks(mem_budget_task_t *out, int max) {
+    int n = 0;
+    for (int i = 0; i < MEM_BUDGET_MAX_TASKS && n < max; i++, n++) {
+        TaskHandle_t h = xTaskGetHandle(watched_names[i]);
+        out[n].name = watched_names[i];
+        out[n].present = h != NULL;
+        // ESP-IDF reports the high-water mark in bytes
+        out[n].stack_free_min = h ? uxTaskGetStackHighWaterMark(h) : 0;
+        out[n].steady_allocs = task_allocs[i];
+    }
+    return n;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "mem_pool.h"
+
+// Memory budget: fixed pools for mesh message and HTTP response buffers (sized in
+// menuconfig under "Memory budget"), plus heap and stack accounting for /api/memory.
+//
+// Once the node has been up for CONFIG_MESH_STEADY_STATE_MS it is considered in steady
+// state: the allocated block count at that moment is the baseline, and growth beyond it is
+// logged. With CONFIG_HEAP_USE_HOOKS every heap allocation after that point is counted
+// and attributed to the allocating task.
+
+typedef enum {
+    MEM_POOL_MSG,   // outgoing mesh JSON (status, heartbeat, commands, bench results)
+    MEM_POOL_HTTP,  // HTTP response chunks
+    MEM_POOL_COUNT,
+} mem_pool_id_t;
+
+#define MEM_BUDGET_MAX_TASKS 8
+
+typedef struct {
+    uint32_t free_bytes;
+    uint32_t min_free_bytes;      // low-water mark since boot
+    uint32_t largest_free_block;
+    uint32_t allocated_blocks;
+    uint32_t alloc_failures;      // heap allocations that returned NULL
+    bool hooks;                   // per-allocation accounting available
+    bool steady;
+    uint32_t steady_age_ms;       // time since the baseline was taken
+    uint32_t steady_base_blocks;  // allocated blocks at the baseline
+    uint32_t steady_peak_blocks;
+    uint32_t steady_allocs;       // heap allocations since the baseline (hooks only)
+    uint32_t steady_alloc_bytes;
+} mem_budget_heap_t;
+
+typedef struct {
+    const char *name;
+    bool present;
+    uint32_t stack_free_min;      // bytes never touched since the task started
+    uint32_t steady_allocs;       // heap allocations made from this task since the baseline
+} mem_budget_task_t;
+
+// Pools are usable right away; heap/stack sampling starts with the timer service
+esp_err_t mem_budget_init(void);
+
+// NULL when the pool is exhausted (counted in the pool's fails)
+void *mem_budget_get(mem_pool_id_t id);
+void mem_budget_put(mem_pool_id_t id, void *block);
+size_t mem_budget_block_size(mem_pool_id_t id);
+
+// Take a new steady-state baseline after CONFIG_MESH_STEADY_STATE_MS (e.g. after becoming root)
+void mem_budget_restart_steady(void);
+
+void mem_budget_get_pool(mem_pool_id_t id, mem_pool_t *out);
+void mem_budget_get_heap(mem_budget_heap_t *out);
+// Returns the number of entries written; tasks that do not exist report present = false
+int mem_budget_get_tasks(mem_budget_task_t *out, int max);
@@ -0,0 +1,44 @@
+#include "mem_pool.h"
+
+void mem_pool_init(mem_pool_t *p, const char *name, uint8_t *storage, uint16_t *free_idx,
+                   uint16_t block_size, uint16_t blocks) {
+    p->name = name;
+    p->storage = storage;
+    p->free_idx = free_idx;
+    p->block_size = block_size;
+    p->blocks = blocks;
+    p->peak = 0;
+    p->gets = 0;
+    p->fails = 0;
+    // Hand out low blocks first so a memory dump shows usage at the front
+    for (uint16_t i = 0; i < blocks; i++) {
+        free_idx[i] = blocks - 1 - i;
+    }
+    p->free_count = blocks;
+}
+
+void *mem_pool_get(mem_pool_t *p) {
+    if (p->free_count == 0) {
+        p->fails++;
+        return NULL;
+    }
+    uint16_t idx = p->free_idx[--p->free_count];
+    p->gets++;
+    if (mem_pool_in_use(p) > p->peak) {
+        p->peak = mem_pool_in_use(p);
+    }
+    return p->storage + (size_t)idx * p->block_size;
+}
+
+bool mem_pool_owns(const mem_pool_t *p, const void *block) {
+    const uint8_t *b = block;
+    return b >= p->storage && b < p->storage + (size_t)p->blocks * p->block_size &&
+           (size_t)(b - p->storage) % p->block_size == 0;
+}
+
+void mem_pool_put(mem_pool_t *p, void *block) {
+    if (!block || !mem_pool_owns(p, block) || p->free_count == p->blocks) {
+        return;
+    }
+    p->free_idx[p->free_count++] = (uint16_t)(((uint8_t *)block - p->storage) / p->block_size);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-size block pool over caller-provided static storage. Plain C with no RTOS
+// dependency; callers serialize access.
+//
+// Free blocks are kept as a stack of indices, so get/put are O(1) and never touch the
+// heap. An exhausted pool returns NULL and counts a failure: the budget is a hard limit,
+// not a hint.
+
+typedef struct {
+    const char *name;
+    uint8_t *storage;       // blocks * block_size bytes
+    uint16_t *free_idx;     // blocks entries
+    uint16_t block_size;
+    uint16_t blocks;
+    uint16_t free_count;
+    uint16_t peak;          // most blocks ever in use at once
+    uint32_t gets;
+    uint32_t fails;         // gets refused because every block was in use
+} mem_pool_t;
+
+// Static backing storage for a pool named id: MEM_POOL_STORAGE(msg, 512, 4);
+#define MEM_POOL_STORAGE(id, block_size, blocks) \
+    static uint8_t id##_pool_storage[(blocks) * (block_size)] __attribute__((aligned(4))); \
+    static uint16_t id##_pool_free[(blocks)]
+
+#define MEM_POOL_INIT(pool, id, name, block_size, blocks) \
+    mem_pool_init((pool), (name), id##_pool_storage, id##_pool_free, (block_size), (blocks))
+
+void mem_pool_init(mem_pool_t *p, const char *name, uint8_t *storage, uint16_t *free_idx,
+                   uint16_t block_size, uint16_t blocks);
+void *mem_pool_get(mem_pool_t *p);
+void mem_pool_put(mem_pool_t *p, void *block);
+bool mem_pool_owns(const mem_pool_t *p, const void *block);
+
+static inline uint16_t mem_pool_in_use(const mem_pool_t *p) {
+    return p->blocks - p->free_count;
+}
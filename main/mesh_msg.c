@@ -0,0 +1,317 @@
+#include <string.h>
+#include "mesh_msg.h"
+
+static int hex_nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20; // lower case
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static bool hex_byte(const char *s, uint8_t *out) {
+    int hi = hex_nibble(s[0]);
+    int lo = hex_nibble(s[1]);
+    if (hi < 0 || lo < 0) {
+        return false;
+    }
+    *out = (uint8_t)((hi << 4) | lo);
+    return true;
+}
+
+bool mesh_msg_parse_mac(const char *s, uint8_t out[6]) {
+    if (!s) return false;
+    for (int i = 0; i < 6; i++) {
+        if (!hex_byte(s + i * 3, &out[i]) || (i < 5 && s[i * 3 + 2] != ':')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool mesh_msg_parse_mac_hex12(const char *s, uint8_t out[6]) {
+    for (int i = 0; i < 6; i++) {
+        if (!hex_byte(s + i * 2, &out[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int64_t parse_int(const char *p, const char *end) {
+    bool neg = false;
+    if (p < end && *p == '-') {
+        neg = true;
+        p++;
+    }
+    int64_t v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+    }
+    return neg ? -v : v;
+}
+
+#define KEY_IS(k, lit) (k##_len == sizeof(lit) - 1 && memcmp(k, lit, sizeof(lit) - 1) == 0)
+
+// Wire names; classify() matches against these, so tools that print them stay in step
+static const char *const type_names[MESH_MSG_TYPE_COUNT] = {
+    [MESH_MSG_UNKNOWN] = "unknown",
+    [MESH_MSG_HEARTBEAT] = "heartbeat",
+    [MESH_MSG_STATUS_REQUEST] = "status_request",
+    [MESH_MSG_STATUS_RESPONSE] = "status_response",
+    [MESH_MSG_LED_TOGGLE] = "led_toggle",
+    [MESH_MSG_JOIN_ACK] = "join_ack",
+    [MESH_MSG_PING] = "ping",
+    [MESH_MSG_PONG] = "pong",
+    [MESH_MSG_BENCH_START] = "bench_start",
+    [MESH_MSG_BENCH_STOP] = "bench_stop",
+    [MESH_MSG_BENCH_REPORT] = "bench_report",
+    [MESH_MSG_BENCH_RESULT] = "bench_result",
+    [MESH_MSG_BACKLOG] = "backlog",
+    [MESH_MSG_CONFIG] = "config",
+    [MESH_MSG_TIME_SYNC] = "time_sync",
+    [MESH_MSG_TIME_REQ] = "time_req",
+    [MESH_MSG_TIME_RESP] = "time_resp",
+    [MESH_MSG_RULES] = "rules",
+    [MESH_MSG_SIGNAL] = "signal",
+    [MESH_MSG_CMD_BATCH] = "cmd_batch",
+    [MESH_MSG_PROFILE] = "profile",
+    [MESH_MSG_PROFILE_RESULT] = "profile_result",
+};
+
+const char *mesh_msg_type_name(mesh_msg_type_t type) {
+    return type < MESH_MSG_TYPE_COUNT && type_names[type] ? type_names[type] : "unknown";
+}
+
+// Candidates are picked by length, so only names of length n are compared
+#define CMD_IS(type) (memcmp(s, type_names[type], n) == 0)
+
+static mesh_msg_type_t classify(const char *s, size_t n) {
+    switch (n) {
+    case 4:
+        if (CMD_IS(MESH_MSG_PING)) return MESH_MSG_PING;
+        if (CMD_IS(MESH_MSG_PONG)) return MESH_MSG_PONG;
+        break;
+    case 6:
+        if (memcmp(s, "toggle", 6) == 0) return MESH_MSG_LED_TOGGLE;
+        if (CMD_IS(MESH_MSG_CONFIG)) return MESH_MSG_CONFIG;
+        if (CMD_IS(MESH_MSG_SIGNAL)) return MESH_MSG_SIGNAL;
+        break;
+    case 5:
+        if (CMD_IS(MESH_MSG_RULES)) return MESH_MSG_RULES;
+        break;
+    case 7:
+        if (CMD_IS(MESH_MSG_BACKLOG)) return MESH_MSG_BACKLOG;
+        if (CMD_IS(MESH_MSG_PROFILE)) return MESH_MSG_PROFILE;
+        break;
+    case 8:
+        if (CMD_IS(MESH_MSG_JOIN_ACK)) return MESH_MSG_JOIN_ACK;
+        if (CMD_IS(MESH_MSG_TIME_REQ)) return MESH_MSG_TIME_REQ;
+        break;
+    case 9:
+        if (CMD_IS(MESH_MSG_HEARTBEAT)) return MESH_MSG_HEARTBEAT;
+        if (CMD_IS(MESH_MSG_TIME_SYNC)) return MESH_MSG_TIME_SYNC;
+        if (CMD_IS(MESH_MSG_TIME_RESP)) return MESH_MSG_TIME_RESP;
+        if (CMD_IS(MESH_MSG_CMD_BATCH)) return MESH_MSG_CMD_BATCH;
+        break;
+    case 10:
+        if (CMD_IS(MESH_MSG_LED_TOGGLE)) return MESH_MSG_LED_TOGGLE;
+        if (CMD_IS(MESH_MSG_BENCH_STOP)) return MESH_MSG_BENCH_STOP;
+        break;
+    case 11:
+        if (CMD_IS(MESH_MSG_BENCH_START)) return MESH_MSG_BENCH_START;
+        break;
+    case 12:
+        if (CMD_IS(MESH_MSG_BENCH_REPORT)) return MESH_MSG_BENCH_REPORT;
+        if (CMD_IS(MESH_MSG_BENCH_RESULT)) return MESH_MSG_BENCH_RESULT;
+        break;
+    case 14:
+        if (CMD_IS(MESH_MSG_STATUS_REQUEST)) return MESH_MSG_STATUS_REQUEST;
+        if (CMD_IS(MESH_MSG_PROFILE_RESULT)) return MESH_MSG_PROFILE_RESULT;
+        break;
+    case 15:
+        if (CMD_IS(MESH_MSG_STATUS_RESPONSE)) return MESH_MSG_STATUS_RESPONSE;
+        break;
+    }
+    return MESH_MSG_UNKNOWN;
+}
+
+static void parse_children(mesh_msg_t *m, const char *s, size_t n) {
+    const char *end = s + n;
+    while (s + 12 <= end && m->child_count < MESH_MSG_MAX_CHILDREN &&
+           mesh_msg_parse_mac_hex12(s, m->children[m->child_count])) {
+        m->child_count++;
+        s += 12;
+        if (s < end && *s == ',') s++;
+    }
+}
+
+bool mesh_msg_parse(const char *buf, size_t len, mesh_msg_t *m) {
+    memset(m, 0, sizeof(*m));
+    m->layer = -1;
+    m->rssi = -127;
+    m->join_ms = -1;
+    m->reg_ms = -1;
+    m->backlog = -1;
+    m->signal = -1;
+    m->led_set = -1;
+    m->duration_ms = -1;
+    bool has_cmd = false;
+    bool has_parent_key = false;
+    bool has_children_key = false;
+
+    const char *p = buf;
+    const char *end = buf + len;
+    if (p >= end || *p != '{') {
+        return false;
+    }
+    p++;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == ',')) p++;
+        if (p >= end || *p != '"') {
+            break; // '}' or malformed
+        }
+        const char *key = ++p;
+        const char *q = memchr(p, '"', end - p);
+        if (!q) break;
+        size_t key_len = q - key;
+        p = q + 1;
+        while (p < end && *p == ' ') p++;
+        if (p >= end || *p != ':') break;
+        p++;
+        while (p < end && *p == ' ') p++;
+        if (p >= end || *p == '{' || *p == '[') {
+            break; // nested values are left to the specific handler
+        }
+
+        const char *val;
+        size_t val_len;
+        bool is_str = *p == '"';
+        if (is_str) {
+            val = ++p;
+            q = memchr(p, '"', end - p);
+            if (!q) break;
+            val_len = q - val;
+            p = q + 1;
+        } else {
+            val = p;
+            while (p < end && *p != ',' && *p != '}') p++;
+            val_len = p - val;
+        }
+
+        if (key_len == 0) {
+            continue;
+        }
+        switch (key[0]) {
+        case 'c':
+            if (KEY_IS(key, "cmd") && is_str) {
+                m->type = classify(val, val_len);
+                has_cmd = true;
+            } else if (KEY_IS(key, "children") && is_str) {
+                has_children_key = true;
+                parse_children(m, val, val_len);
+            } else if (KEY_IS(key, "cv")) {
+                m->has_config_version = true;
+                m->config_version = (uint32_t)parse_int(val, val + val_len);
+            }
+            break;
+        case 'm':
+            if (KEY_IS(key, "mac") && is_str && val_len == 17) {
+                m->has_mac = mesh_msg_parse_mac(val, m->mac);
+            } else if (KEY_IS(key, "mt")) {
+                m->has_mesh_time = true;
+                m->mesh_t = parse_int(val, val + val_len);
+            } else if (KEY_IS(key, "ms")) {
+                m->duration_ms = (int)parse_int(val, val + val_len);
+            }
+            break;
+        case 't':
+            if (KEY_IS(key, "target_mac") && is_str && val_len == 17) {
+                m->has_target = mesh_msg_parse_mac(val, m->target);
+            } else if (KEY_IS(key, "t")) {
+                m->t = parse_int(val, val + val_len);
+            } else if (key_len == 2) {
+                int64_t v = parse_int(val, val + val_len);
+                switch (key[1]) {
+                case '1': m->t1 = v; break;
+                case '2': m->t2 = v; break;
+                case '3': m->t3 = v; break;
+                case 's': m->has_time = true; m->time_synced = v != 0; break;
+                case 'd': m->drift_ppb = (int32_t)v; break;
+                case 'u': m->sync_uncert_us = (int32_t)v; break;
+                case 'l': m->has_exec_late = true; m->exec_late_us = (int32_t)v; break;
+                }
+            }
+            break;
+        case 'a':
+            if (KEY_IS(key, "at")) {
+                m->has_at = true;
+                m->at = parse_int(val, val + val_len);
+            }
+            break;
+        case 'l':
+            if (KEY_IS(key, "led_state")) {
+                m->led_state = val_len == 4 && memcmp(val, "true", 4) == 0;
+            } else if (KEY_IS(key, "led")) {
+                m->led_set = parse_int(val, val + val_len) != 0;
+            } else if (KEY_IS(key, "layer")) {
+                m->layer = (int)parse_int(val, val + val_len);
+            }
+            break;
+        case 'r':
+            if (KEY_IS(key, "rssi")) {
+                m->rssi = (int)parse_int(val, val + val_len);
+            } else if (KEY_IS(key, "reg_ms")) {
+                m->reg_ms = (int)parse_int(val, val + val_len);
+            } else if (KEY_IS(key, "rv")) {
+                m->has_rules_version = true;
+                m->rules_version = (uint32_t)parse_int(val, val + val_len);
+            }
+            break;
+        case 'j':
+            if (KEY_IS(key, "join_ms")) {
+                m->join_ms = (int)parse_int(val, val + val_len);
+            }
+            break;
+        case 'p':
+            if (KEY_IS(key, "parent") && is_str) {
+                has_parent_key = true;
+                m->has_parent = val_len == 17 && mesh_msg_parse_mac(val, m->parent);
+            } else if (KEY_IS(key, "ps")) {
+                m->parent_switches = (uint32_t)parse_int(val, val + val_len);
+            }
+            break;
+        case 's':
+            if (KEY_IS(key, "seq")) {
+                m->has_seq = true;
+                m->seq = (uint32_t)parse_int(val, val + val_len);
+            } else if (KEY_IS(key, "sig")) {
+                m->signal = (int)parse_int(val, val + val_len);
+            }
+            break;
+        case 'h':
+            if (KEY_IS(key, "h")) {
+                m->hops = (int)parse_int(val, val + val_len);
+            }
+            break;
+        case 'q':
+            if (KEY_IS(key, "q")) {
+                m->backlog = (int)parse_int(val, val + val_len);
+            }
+            break;
+        case 'f':
+            if (KEY_IS(key, "fr")) {
+                m->has_flow = true;
+                m->flow_rate_mps = (uint32_t)parse_int(val, val + val_len);
+            } else if (KEY_IS(key, "fd")) {
+                m->flow_deferred = (uint32_t)parse_int(val, val + val_len);
+            } else if (KEY_IS(key, "fx")) {
+                m->flow_dropped = (uint32_t)parse_int(val, val + val_len);
+            } else if (KEY_IS(key, "fc")) {
+                m->flow_congested = val_len == 1 && *val == '1';
+            }
+            break;
+        }
+    }
+    m->has_tree = has_parent_key && has_children_key;
+    return has_cmd;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Single-pass parser for the flat JSON control messages exchanged over the mesh
+// ({"cmd":"heartbeat","mac":"..",...}). Plain C with no RTOS dependency.
+//
+// The message is scanned once: "cmd" is classified by length + compare instead of a chain
+// of strstr calls, and known keys are decoded in place (MACs with a table-free hex decoder,
+// integers without sscanf). Unknown keys are skipped, nested objects end the scan.
+
+#define MESH_MSG_MAX_CHILDREN 10
+
+typedef enum {
+    MESH_MSG_UNKNOWN = 0,
+    MESH_MSG_HEARTBEAT,
+    MESH_MSG_STATUS_REQUEST,
+    MESH_MSG_STATUS_RESPONSE,
+    MESH_MSG_LED_TOGGLE,       // "led_toggle" and legacy "toggle"
+    MESH_MSG_JOIN_ACK,
+    MESH_MSG_PING,
+    MESH_MSG_PONG,
+    MESH_MSG_BENCH_START,
+    MESH_MSG_BENCH_STOP,
+    MESH_MSG_BENCH_REPORT,
+    MESH_MSG_BENCH_RESULT,
+    MESH_MSG_BACKLOG,          // parent -> children flow-control advert
+    MESH_MSG_CONFIG,           // root -> nodes runtime config (decoded by node_config)
+    MESH_MSG_TIME_SYNC,        // root starts a sync round
+    MESH_MSG_TIME_REQ,         // node -> root: t1
+    MESH_MSG_TIME_RESP,        // root -> node: t1, t2, t3
+    MESH_MSG_RULES,            // root -> nodes edge rules (decoded by rules.c)
+    MESH_MSG_SIGNAL,           // node -> node, raised by an edge rule
+    MESH_MSG_CMD_BATCH,        // root -> node: commands queued while it was unreachable
+    MESH_MSG_PROFILE,          // root -> node(s): profile for "ms"
+    MESH_MSG_PROFILE_RESULT,   // node -> root, raw JSON handled by the caller
+    MESH_MSG_TYPE_COUNT,
+} mesh_msg_type_t;
+
+typedef struct {
+    mesh_msg_type_t type;
+    bool has_mac;
+    uint8_t mac[6];              // "mac": sender station MAC
+    bool has_target;
+    uint8_t target[6];           // "target_mac"
+    bool led_state;
+    int layer;                   // -1 if absent
+    int rssi;                    // -127 if absent
+    int join_ms;                 // -1 if absent
+    int reg_ms;                  // -1 if absent
+    bool has_tree;               // both "parent" and "children" present
+    bool has_parent;             // "parent" non-empty
+    uint8_t parent[6];
+    int child_count;
+    uint8_t children[MESH_MSG_MAX_CHILDREN][6];
+    bool has_seq;
+    uint32_t seq;
+    int64_t t;                   // "t": timestamp echoed by ping/pong
+    int64_t t1, t2, t3;          // time sync exchange
+    bool has_at;
+    int64_t at;                  // "at": execute at this mesh time (us)
+    bool has_mesh_time;
+    int64_t mesh_t;              // "mt": sender's mesh time when it received the ping
+    bool has_time;               // "ts" present (heartbeat/status)
+    bool time_synced;            // "ts"
+    int32_t drift_ppb;           // "td": clock drift against the root
+    int32_t sync_uncert_us;      // "tu"
+    bool has_exec_late;
+    int32_t exec_late_us;        // "tl": how late the last scheduled action ran
+    int backlog;                 // "q": sender's upstream backlog in frames, -1 if absent
+    bool has_flow;               // "fr" present
+    bool flow_congested;         // "fc"
+    uint32_t flow_rate_mps;      // "fr": current state-message rate (milli-messages/s)
+    uint32_t flow_deferred;      // "fd"
+    uint32_t flow_dropped;       // "fx"
+    bool has_config_version;
+    uint32_t config_version;     // "cv": runtime config version the sender runs
+    uint32_t parent_switches;    // "ps": parent optimizer switches since boot
+    bool has_rules_version;
+    uint32_t rules_version;      // "rv": edge rules version the sender runs
+    int signal;                  // "sig": signal number, -1 if absent
+    int hops;                    // "h": rule actions that led to this signal
+    int led_set;                 // "led": desired LED state in a cmd_batch, -1 if absent
+    int duration_ms;             // "ms": profiling window, -1 if absent
+} mesh_msg_t;
+
+// Returns false if the buffer is not a {"cmd":...} message
+bool mesh_msg_parse(const char *buf, size_t len, mesh_msg_t *out);
+
+// The "cmd" string for a type ("unknown" if out of range)
+const char *mesh_msg_type_name(mesh_msg_type_t type);
+
+// "aa:bb:cc:dd:ee:ff" (case-insensitive)
+bool mesh_msg_parse_mac(const char *s, uint8_t out[6]);
+// "aabbccddeeff"
+bool mesh_msg_parse_mac_hex12(const char *s, uint8_t out[6]);
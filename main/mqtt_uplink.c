@@ -0,0 +1,336 @@
+#include <string.h>
+#include <stdlib.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "mqtt_uplink.h"
+
+#if CONFIG_MESH_MQTT_ENABLE
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "mqtt_client.h"
+#include "timer_service.h"
+
+static const char *TAG = "MQTT_UPLINK";
+
+#define UPLINK_MAX_PENDING 24   // distinct nodes per window before an early flush
+#define UPLINK_BATCH_MAX   1024 // fits UPLINK_MAX_PENDING entries
+#define UPLINK_TOPIC_MAX   64
+
+typedef struct {
+    mqtt_uplink_node_t node;
+    uint8_t events;
+} pending_entry_t;
+
+static esp_mqtt_client_handle_t client = NULL;
+static SemaphoreHandle_t uplink_lock = NULL;
+static tw_timer_t window_timer;
+static bool connected = false;
+static int64_t start_us = 0;
+
+static char topic_nodes[UPLINK_TOPIC_MAX];
+static char topic_cmd[UPLINK_TOPIC_MAX];
+static mqtt_uplink_cmd_cb_t cmd_handler = NULL;
+
+// Current window
+static pending_entry_t pending[UPLINK_MAX_PENDING];
+static int pending_count = 0;
+static int64_t pending_oldest_us = 0;
+static uint32_t batch_seq = 0;
+
+// Offline queue (ring of encoded batches)
+static char offline_buf[CONFIG_MESH_MQTT_OFFLINE_QUEUE][UPLINK_BATCH_MAX];
+static uint16_t offline_len[CONFIG_MESH_MQTT_OFFLINE_QUEUE];
+static int offline_head = 0;
+static int offline_count = 0;
+
+static mqtt_uplink_stats_t stats;
+static uint64_t e2e_total_ms = 0;
+
+static char batch_buf[UPLINK_BATCH_MAX];
+
+// Hand a batch to the MQTT client; false if it must be queued instead
+static bool uplink_publish(const char *data, int len) {
+    if (!connected) {
+        return false;
+    }
+    // enqueue copies into the client outbox and returns without waiting on the socket
+    int msg_id = esp_mqtt_client_enqueue(client, topic_nodes, data, len, 1, 0, true);
+    if (msg_id < 0) {
+        return false;
+    }
+    stats.batches_sent++;
+    stats.bytes_sent += len;
+    return true;
+}
+
+static void offline_push(const char *data, int len) {
+    if (offline_count == CONFIG_MESH_MQTT_OFFLINE_QUEUE) {
+        // Drop the oldest so the backend sees the most recent state once we reconnect
+        offline_head = (offline_head + 1) % CONFIG_MESH_MQTT_OFFLINE_QUEUE;
+        offline_count--;
+        stats.queue_drops++;
+    }
+    int slot = (offline_head + offline_count) % CONFIG_MESH_MQTT_OFFLINE_QUEUE;
+    memcpy(offline_buf[slot], data, len);
+    offline_len[slot] = len;
+    offline_count++;
+}
+
+static void offline_flush(void) {
+    while (offline_count > 0) {
+        if (!uplink_publish(offline_buf[offline_head], offline_len[offline_head])) {
+            break;
+        }
+        offline_head = (offline_head + 1) % CONFIG_MESH_MQTT_OFFLINE_QUEUE;
+        offline_count--;
+    }
+}
+
+// Encode and send (or queue) the current window; caller holds uplink_lock
+static void uplink_flush_locked(void) {
+    if (pending_count == 0) {
+        return;
+    }
+    int n = snprintf(batch_buf, sizeof(batch_buf), "{\"seq\":%lu,\"t\":%lld,\"n\":[",
+                     (unsigned long)batch_seq++, (long long)(pending_oldest_us / 1000));
+    for (int i = 0; i < pending_count && n < (int)sizeof(batch_buf); i++) {
+        const mqtt_uplink_node_t *nd = &pending[i].node;
+        n += snprintf(batch_buf + n, sizeof(batch_buf) - n,
+                      "%s[\"%02x%02x%02x%02x%02x%02x\",%d,%d,%d,%d,%d]",
+                      i ? "," : "",
+                      nd->mac[0], nd->mac[1], nd->mac[2], nd->mac[3], nd->mac[4], nd->mac[5],
+                      nd->layer, nd->active ? 1 : 0, nd->led ? 1 : 0, nd->rssi, pending[i].events);
+    }
+    if (n < (int)sizeof(batch_buf)) {
+        n += snprintf(batch_buf + n, sizeof(batch_buf) - n, "]}");
+    }
+    if (n >= (int)sizeof(batch_buf)) {
+        ESP_LOGE(TAG, "Batch of %d updates overflowed %d bytes - dropped", pending_count, UPLINK_BATCH_MAX);
+        pending_count = 0;
+        return;
+    }
+    stats.updates_sent += pending_count;
+    pending_count = 0;
+
+    // Preserve ordering: anything already queued goes first
+    offline_flush();
+    if (offline_count > 0 || !uplink_publish(batch_buf, n)) {
+        offline_push(batch_buf, n);
+    }
+}
+
+static void window_cb(tw_timer_t *timer, void *arg) {
+    xSemaphoreTake(uplink_lock, portMAX_DELAY);
+    uplink_flush_locked();
+    xSemaphoreGive(uplink_lock);
+}
+
+static void handle_command(esp_mqtt_event_handle_t event) {
+    // Topic is <prefix>/<root>/cmd/<node mac>; payload is the command name (e.g. "led_toggle")
+    size_t prefix_len = strlen(topic_cmd) - 1; // without trailing '+'
+    if (event->topic_len != (int)(prefix_len + 17) || event->data_len <= 0 || event->data_len > 31) {
+        ESP_LOGW(TAG, "Ignoring malformed command on %.*s", event->topic_len, event->topic);
+        return;
+    }
+    char target_mac[18];
+    memcpy(target_mac, event->topic + prefix_len, 17);
+    target_mac[17] = '\0';
+    char cmd[32];
+    memcpy(cmd, event->data, event->data_len);
+    cmd[event->data_len] = '\0';
+    stats.cmds_received++;
+    ESP_LOGI(TAG, "Command '%s' for %s", cmd, target_mac);
+    if (cmd_handler) {
+        cmd_handler(target_mac, cmd);
+    }
+}
+
+static void handle_loopback(esp_mqtt_event_handle_t event) {
+    // Only whole single-fragment batches carry a usable timestamp at the front
+    if (event->current_data_offset != 0 || event->data_len < 8) {
+        return;
+    }
+    char head[48];
+    int len = event->data_len < (int)sizeof(head) - 1 ? event->data_len : (int)sizeof(head) - 1;
+    memcpy(head, event->data, len);
+    head[len] = '\0';
+    char *t_ptr = strstr(head, "\"t\":");
+    if (!t_ptr) {
+        return;
+    }
+    int64_t sent_ms = strtoll(t_ptr + 4, NULL, 10);
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    if (now_ms < sent_ms) {
+        return;
+    }
+    uint32_t e2e = (uint32_t)(now_ms - sent_ms);
+    xSemaphoreTake(uplink_lock, portMAX_DELAY);
+    stats.e2e_last_ms = e2e;
+    if (stats.e2e_samples == 0 || e2e < stats.e2e_min_ms) stats.e2e_min_ms = e2e;
+    if (e2e > stats.e2e_max_ms) stats.e2e_max_ms = e2e;
+    stats.e2e_samples++;
+    e2e_total_ms += e2e;
+    stats.e2e_avg_ms = (uint32_t)(e2e_total_ms / stats.e2e_samples);
+    xSemaphoreGive(uplink_lock);
+}
+
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
+    esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t)event_data;
+    switch ((esp_mqtt_event_id_t)event_id) {
+    case MQTT_EVENT_CONNECTED:
+        ESP_LOGI(TAG, "Connected to %s", CONFIG_MESH_MQTT_BROKER_URI);
+        esp_mqtt_client_subscribe(client, topic_cmd, 1);
+#if CONFIG_MESH_MQTT_LOOPBACK
+        esp_mqtt_client_subscribe(client, topic_nodes, 0);
+#endif
+        xSemaphoreTake(uplink_lock, portMAX_DELAY);
+        connected = true;
+        offline_flush();
+        xSemaphoreGive(uplink_lock);
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        ESP_LOGW(TAG, "Disconnected - batches will be queued (max %d)", CONFIG_MESH_MQTT_OFFLINE_QUEUE);
+        connected = false;
+        break;
+    case MQTT_EVENT_DATA:
+        if (event->topic_len == (int)strlen(topic_nodes) && memcmp(event->topic, topic_nodes, event->topic_len) == 0) {
+            handle_loopback(event);
+        } else if (event->topic_len > 0) {
+            handle_command(event);
+        }
+        break;
+    case MQTT_EVENT_ERROR:
+        ESP_LOGW(TAG, "MQTT error");
+        break;
+    default:
+        break;
+    }
+}
+
+esp_err_t mqtt_uplink_start(const uint8_t root_mac[6], mqtt_uplink_cmd_cb_t cmd_cb) {
+    if (client != NULL) {
+        return ESP_OK;
+    }
+    if (uplink_lock == NULL) {
+        uplink_lock = xSemaphoreCreateMutex();
+        if (uplink_lock == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        tw_timer_init(&window_timer, window_cb, NULL);
+    }
+
+    snprintf(topic_nodes, sizeof(topic_nodes), "%s/%02x%02x%02x%02x%02x%02x/nodes", CONFIG_MESH_MQTT_TOPIC_PREFIX,
+             root_mac[0], root_mac[1], root_mac[2], root_mac[3], root_mac[4], root_mac[5]);
+    snprintf(topic_cmd, sizeof(topic_cmd), "%s/%02x%02x%02x%02x%02x%02x/cmd/+", CONFIG_MESH_MQTT_TOPIC_PREFIX,
+             root_mac[0], root_mac[1], root_mac[2], root_mac[3], root_mac[4], root_mac[5]);
+    cmd_handler = cmd_cb;
+
+    char client_id[32];
+    snprintf(client_id, sizeof(client_id), "mesh-root-%02x%02x%02x", root_mac[3], root_mac[4], root_mac[5]);
+    esp_mqtt_client_config_t cfg = {
+        .broker.address.uri = CONFIG_MESH_MQTT_BROKER_URI,
+        .credentials.client_id = client_id,
+    };
+    client = esp_mqtt_client_init(&cfg);
+    if (client == NULL) {
+        ESP_LOGE(TAG, "Failed to create MQTT client");
+        return ESP_FAIL;
+    }
+    esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, mqtt_event_handler, NULL);
+
+    xSemaphoreTake(uplink_lock, portMAX_DELAY);
+    memset(&stats, 0, sizeof(stats));
+    e2e_total_ms = 0;
+    pending_count = 0;
+    start_us = esp_timer_get_time();
+    xSemaphoreGive(uplink_lock);
+
+    esp_err_t err = esp_mqtt_client_start(client);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start MQTT client: %s", esp_err_to_name(err));
+        esp_mqtt_client_destroy(client);
+        client = NULL;
+        return err;
+    }
+    timer_service_arm_ms(&window_timer, CONFIG_MESH_MQTT_BATCH_WINDOW_MS, CONFIG_MESH_MQTT_BATCH_WINDOW_MS);
+    ESP_LOGI(TAG, "Uplink started: publish %s, commands %s, window %d ms",
+             topic_nodes, topic_cmd, CONFIG_MESH_MQTT_BATCH_WINDOW_MS);
+    return ESP_OK;
+}
+
+void mqtt_uplink_stop(void) {
+    if (client == NULL) {
+        return;
+    }
+    timer_service_cancel(&window_timer);
+    esp_mqtt_client_stop(client);
+    esp_mqtt_client_destroy(client);
+    xSemaphoreTake(uplink_lock, portMAX_DELAY);
+    client = NULL;
+    connected = false;
+    pending_count = 0;
+    offline_count = 0;
+    xSemaphoreGive(uplink_lock);
+    ESP_LOGI(TAG, "Uplink stopped");
+}
+
+void mqtt_uplink_node_event(const mqtt_uplink_node_t *node, uint8_t events) {
+    if (client == NULL) {
+        return;
+    }
+    xSemaphoreTake(uplink_lock, portMAX_DELAY);
+    for (int i = 0; i < pending_count; i++) {
+        if (memcmp(pending[i].node.mac, node->mac, 6) == 0) {
+            pending[i].node = *node;
+            pending[i].events |= events;
+            stats.updates_coalesced++;
+            xSemaphoreGive(uplink_lock);
+            return;
+        }
+    }
+    if (pending_count == UPLINK_MAX_PENDING) {
+        uplink_flush_locked();
+    }
+    if (pending_count == 0) {
+        pending_oldest_us = esp_timer_get_time();
+    }
+    pending[pending_count].node = *node;
+    pending[pending_count].events = events;
+    pending_count++;
+    xSemaphoreGive(uplink_lock);
+}
+
+void mqtt_uplink_get_stats(mqtt_uplink_stats_t *out) {
+    if (uplink_lock == NULL) {
+        memset(out, 0, sizeof(*out));
+        out->enabled = true;
+        return;
+    }
+    xSemaphoreTake(uplink_lock, portMAX_DELAY);
+    *out = stats;
+    out->enabled = true;
+    out->connected = connected;
+    out->queue_depth = offline_count;
+    out->uptime_ms = client ? (uint32_t)((esp_timer_get_time() - start_us) / 1000) : 0;
+    xSemaphoreGive(uplink_lock);
+}
+
+#else // !CONFIG_MESH_MQTT_ENABLE
+
+esp_err_t mqtt_uplink_start(const uint8_t root_mac[6], mqtt_uplink_cmd_cb_t cmd_cb) {
+    return ESP_OK;
+}
+
+void mqtt_uplink_stop(void) {
+}
+
+void mqtt_uplink_node_event(const mqtt_uplink_node_t *node, uint8_t events) {
+}
+
+void mqtt_uplink_get_stats(mqtt_uplink_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+}
+
+#endif
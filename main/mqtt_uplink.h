@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Batched MQTT uplink from the root. Node updates are coalesced per window (latest state
+// per node, event flags OR-ed) and published as one compact message:
+//   {"seq":N,"t":<ms of oldest update>,"n":[["<mac hex>",layer,active,led,rssi,events],...]}
+// Batches that cannot be published are held in a bounded offline queue.
+// Disabled (all calls are no-ops) unless CONFIG_MESH_MQTT_ENABLE is set.
+
+#define MQTT_UPLINK_EV_JOIN   0x01
+#define MQTT_UPLINK_EV_UPDATE 0x02
+#define MQTT_UPLINK_EV_STALE  0x04
+#define MQTT_UPLINK_EV_EVICT  0x08
+
+typedef struct {
+    uint8_t mac[6];
+    int layer;
+    bool active;
+    bool led;
+    int rssi;
+} mqtt_uplink_node_t;
+
+typedef struct {
+    bool enabled;
+    bool connected;
+    uint32_t uptime_ms;          // since mqtt_uplink_start
+    uint32_t batches_sent;
+    uint32_t updates_sent;
+    uint32_t updates_coalesced;  // updates merged into an entry already pending in the window
+    uint32_t bytes_sent;
+    uint32_t queue_depth;
+    uint32_t queue_drops;
+    uint32_t cmds_received;
+    uint32_t e2e_samples;        // loopback: oldest update in batch -> received back from broker
+    uint32_t e2e_last_ms;
+    uint32_t e2e_min_ms;
+    uint32_t e2e_max_ms;
+    uint32_t e2e_avg_ms;
+} mqtt_uplink_stats_t;
+
+// Called with the node MAC ("aa:bb:cc:dd:ee:ff") and command payload from <prefix>/<root>/cmd/<mac>
+typedef void (*mqtt_uplink_cmd_cb_t)(const char *target_mac, const char *cmd);
+
+esp_err_t mqtt_uplink_start(const uint8_t root_mac[6], mqtt_uplink_cmd_cb_t cmd_cb);
+void mqtt_uplink_stop(void);
+void mqtt_uplink_node_event(const mqtt_uplink_node_t *node, uint8_t events);
+void mqtt_uplink_get_stats(mqtt_uplink_stats_t *out);
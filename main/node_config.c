@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "mesh_msg.h"
+#include "node_config.h"
+
+static const char *TAG = "NODE_CONFIG";
+
+#define NVS_NAMESPACE "mesh_cfg"
+#define NVS_KEY       "cfg"
+#define STORE_LAYOUT  1 // bump when node_config_t changes
+
+// Compiled-in defaults (same for all nodes until the root pushes a config)
+#define DEFAULT_HEARTBEAT_MS   30000
+#define DEFAULT_STATUS_MS      10000
+#define DEFAULT_STALE_MS       60000
+#define DEFAULT_START_DELAY_MS 15000
+#define DEFAULT_MAX_CONNECTION 6
+static const uint8_t DEFAULT_MESH_ID[6] = { 0x11,0x22,0x33,0x44,0x55,0x66 };
+#define DEFAULT_ROUTER_SSID    "IsolationSwitchWiFi"
+#define DEFAULT_ROUTER_PASS    "Cutoutswitch1"
+
+typedef struct {
+    uint8_t layout;
+    node_config_t cfg;
+} stored_config_t;
+
+static node_config_t current;
+static node_config_t booted; // what the mesh was started with
+static portMUX_TYPE cfg_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void set_defaults(node_config_t *c) {
+    memset(c, 0, sizeof(*c));
+    c->heartbeat_ms = DEFAULT_HEARTBEAT_MS;
+    c->status_ms = DEFAULT_STATUS_MS;
+    c->stale_ms = DEFAULT_STALE_MS;
+    c->start_delay_ms = DEFAULT_START_DELAY_MS;
+    c->max_connection = DEFAULT_MAX_CONNECTION;
+    memcpy(c->mesh_id, DEFAULT_MESH_ID, 6);
+    strcpy(c->router_ssid, DEFAULT_ROUTER_SSID);
+    strcpy(c->router_pass, DEFAULT_ROUTER_PASS);
+}
+
+// Printable ASCII without '"' and '\\', so values can go into JSON and logs as they are
+static bool plain_string(const char *s, size_t max) {
+    size_t n = strnlen(s, max + 1);
+    if (n > max) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] < 0x20 || s[i] > 0x7e || s[i] == '"' || s[i] == '\\') {
+            return false;
+        }
+    }
+    return true;
+}
+
+const char *node_config_validate(const node_config_t *c) {
+    if (c->heartbeat_ms < 1000 || c->heartbeat_ms > 600000) {
+        return "heartbeat_ms must be 1000..600000";
+    }
+    if (c->status_ms < 1000 || c->status_ms > 600000) {
+        return "status_ms must be 1000..600000";
+    }
+    // A node must get at least two heartbeats in before it is marked inactive
+    if (c->stale_ms < 2 * c->heartbeat_ms || c->stale_ms > 3600000) {
+        return "stale_ms must be at least 2 x heartbeat_ms and at most 3600000";
+    }
+    if (c->start_delay_ms > 600000) {
+        return "start_delay_ms must be 0..600000";
+    }
+    if (c->max_connection < 1 || c->max_connection > 10) {
+        return "max_connection must be 1..10";
+    }
+    if (!plain_string(c->router_ssid, NODE_CONFIG_SSID_MAX) || c->router_ssid[0] == '\0') {
+        return "router_ssid must be 1..32 printable characters";
+    }
+    size_t pass_len = strnlen(c->router_pass, NODE_CONFIG_PASS_MAX + 1);
+    if (!plain_string(c->router_pass, NODE_CONFIG_PASS_MAX) || (pass_len > 0 && pass_len < 8)) {
+        return "router_pass must be empty or 8..64 printable characters";
+    }
+    return NULL;
+}
+
+static uint32_t diff(const node_config_t *a, const node_config_t *b) {
+    uint32_t changed = 0;
+    if (a->heartbeat_ms != b->heartbeat_ms || a->status_ms != b->status_ms || a->stale_ms != b->stale_ms ||
+        a->start_delay_ms != b->start_delay_ms) {
+        changed |= NODE_CONFIG_CHANGED_TIMING;
+    }
+    if (a->max_connection != b->max_connection || memcmp(a->mesh_id, b->mesh_id, 6) != 0 ||
+        strcmp(a->router_ssid, b->router_ssid) != 0 || strcmp(a->router_pass, b->router_pass) != 0) {
+        changed |= NODE_CONFIG_CHANGED_RESTART;
+    }
+    return changed;
+}
+
+esp_err_t node_config_init(void) {
+    node_config_t c;
+    set_defaults(&c);
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &h) == ESP_OK) {
+        stored_config_t s;
+        size_t len = sizeof(s);
+        esp_err_t err = nvs_get_blob(h, NVS_KEY, &s, &len);
+        nvs_close(h);
+        if (err == ESP_OK && len == sizeof(s) && s.layout == STORE_LAYOUT &&
+            s.cfg.router_ssid[NODE_CONFIG_SSID_MAX] == '\0' && s.cfg.router_pass[NODE_CONFIG_PASS_MAX] == '\0' &&
+            !node_config_validate(&s.cfg)) {
+            c = s.cfg;
+        } else {
+            ESP_LOGW(TAG, "Stored config missing or invalid (%s) - using defaults", esp_err_to_name(err));
+        }
+    }
+    current = c;
+    booted = c;
+    ESP_LOGI(TAG, "Config v%lu: heartbeat %lu ms, status %lu ms, stale %lu ms, start delay %lu ms, max_connection %u",
+             (unsigned long)c.version, (unsigned long)c.heartbeat_ms, (unsigned long)c.status_ms,
+             (unsigned long)c.stale_ms, (unsigned long)c.start_delay_ms, c.max_connection);
+    return ESP_OK;
+}
+
+void node_config_get(node_config_t *out) {
+    taskENTER_CRITICAL(&cfg_mux);
+    *out = current;
+    taskEXIT_CRITICAL(&cfg_mux);
+}
+
+uint32_t node_config_version(void) {
+    taskENTER_CRITICAL(&cfg_mux);
+    uint32_t v = current.version;
+    taskEXIT_CRITICAL(&cfg_mux);
+    return v;
+}
+
+esp_err_t node_config_set(const node_config_t *c, uint32_t *changed, const char **why) {
+    *changed = 0;
+    *why = node_config_validate(c);
+    if (*why) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    stored_config_t s;
+    memset(&s, 0, sizeof(s));
+    s.layout = STORE_LAYOUT;
+    s.cfg = *c;
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &h);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(h, NVS_KEY, &s, sizeof(s));
+        if (err == ESP_OK) {
+            err = nvs_commit(h);
+        }
+        nvs_close(h);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to store config: %s", esp_err_to_name(err));
+        *why = "NVS write failed";
+        return err;
+    }
+    taskENTER_CRITICAL(&cfg_mux);
+    *changed = diff(&current, c);
+    current = s.cfg;
+    taskEXIT_CRITICAL(&cfg_mux);
+    ESP_LOGI(TAG, "Config v%lu stored%s%s", (unsigned long)c->version,
+             (*changed & NODE_CONFIG_CHANGED_TIMING) ? ", timing applied" : "",
+             (*changed & NODE_CONFIG_CHANGED_RESTART) ? ", restart needed for mesh/router settings" : "");
+    return ESP_OK;
+}
+
+bool node_config_restart_pending(void) {
+    taskENTER_CRITICAL(&cfg_mux);
+    bool pending = (diff(&booted, &current) & NODE_CONFIG_CHANGED_RESTART) != 0;
+    taskEXIT_CRITICAL(&cfg_mux);
+    return pending;
+}
+
+static int hex_encode(char *out, const char *s) {
+    int n = 0;
+    for (; *s; s++) {
+        n += sprintf(out + n, "%02x", (uint8_t)*s);
+    }
+    return n;
+}
+
+int node_config_encode(const node_config_t *c, char *buf, size_t len) {
+    char ssid_hex[NODE_CONFIG_SSID_MAX * 2 + 1] = "";
+    char pass_hex[NODE_CONFIG_PASS_MAX * 2 + 1] = "";
+    hex_encode(ssid_hex, c->router_ssid);
+    hex_encode(pass_hex, c->router_pass);
+    const uint8_t *m = c->mesh_id;
+    int n = snprintf(buf, len,
+                     "{\"cmd\":\"config\",\"ver\":%lu,\"hb\":%lu,\"st\":%lu,\"sl\":%lu,\"sd\":%lu,\"mc\":%u,"
+                     "\"mid\":\"%02x%02x%02x%02x%02x%02x\",\"ss\":\"%s\",\"sp\":\"%s\"}",
+                     (unsigned long)c->version, (unsigned long)c->heartbeat_ms, (unsigned long)c->status_ms,
+                     (unsigned long)c->stale_ms, (unsigned long)c->start_delay_ms, c->max_connection,
+                     m[0], m[1], m[2], m[3], m[4], m[5], ssid_hex, pass_hex);
+    return n < 0 || (size_t)n >= len ? -1 : n;
+}
+
+// Pointer just past "key": in msg, or NULL
+static const char *field(const char *msg, const char *key) {
+    char pat[8];
+    int n = snprintf(pat, sizeof(pat), "\"%s\":", key);
+    const char *p = strstr(msg, pat);
+    return p ? p + n : NULL;
+}
+
+static bool field_u32(const char *msg, const char *key, uint32_t *out) {
+    const char *p = field(msg, key);
+    if (!p) {
+        return false;
+    }
+    *out = (uint32_t)strtoul(p, NULL, 10);
+    return true;
+}
+
+// "hex" into a NUL-terminated string of at most max characters
+static bool field_hex_str(const char *msg, const char *key, char *out, size_t max) {
+    const char *p = field(msg, key);
+    if (!p || *p++ != '"') {
+        return false;
+    }
+    const char *end = strchr(p, '"');
+    if (!end || (end - p) % 2 != 0 || (size_t)(end - p) / 2 > max) {
+        return false;
+    }
+    size_t n = 0;
+    for (; p < end; p += 2) {
+        char pair[3] = { p[0], p[1], '\0' };
+        char *e;
+        unsigned long v = strtoul(pair, &e, 16);
+        if (*e != '\0' || v == 0) {
+            return false;
+        }
+        out[n++] = (char)v;
+    }
+    out[n] = '\0';
+    return true;
+}
+
+bool node_config_decode(const char *msg, node_config_t *out) {
+    node_config_t c = *out;
+    if (!field_u32(msg, "ver", &c.version)) {
+        return false;
+    }
+    field_u32(msg, "hb", &c.heartbeat_ms);
+    field_u32(msg, "st", &c.status_ms);
+    field_u32(msg, "sl", &c.stale_ms);
+    field_u32(msg, "sd", &c.start_delay_ms);
+    uint32_t mc;
+    if (field_u32(msg, "mc", &mc)) {
+        c.max_connection = mc > 255 ? 0 : (uint8_t)mc;
+    }
+    const char *mid = field(msg, "mid");
+    if (mid && (*mid != '"' || !mesh_msg_parse_mac_hex12(mid + 1, c.mesh_id))) {
+        return false;
+    }
+    if (field(msg, "ss") && !field_hex_str(msg, "ss", c.router_ssid, NODE_CONFIG_SSID_MAX)) {
+        return false;
+    }
+    if (field(msg, "sp") && !field_hex_str(msg, "sp", c.router_pass, NODE_CONFIG_PASS_MAX)) {
+        return false;
+    }
+    *out = c;
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Runtime configuration: timing, softAP capacity, mesh ID and router credentials, stored in
+// NVS on top of compiled-in defaults. The root owns the mesh-wide copy: every change made
+// through /api/config gets a higher version and is pushed to all nodes, which take any
+// version newer than their own.
+//
+// Timing fields take effect as soon as the caller re-arms its timers. Mesh ID, router
+// credentials and max_connection are read once when the mesh starts, so they need a
+// restart (node_config_restart_pending tells whether one is outstanding).
+
+#define NODE_CONFIG_SSID_MAX 32
+#define NODE_CONFIG_PASS_MAX 64
+
+// node_config_set() reports which group of fields changed
+#define NODE_CONFIG_CHANGED_TIMING  0x01
+#define NODE_CONFIG_CHANGED_RESTART 0x02
+
+typedef struct {
+    uint32_t version;         // 0 = compiled-in defaults
+    uint32_t heartbeat_ms;
+    uint32_t status_ms;       // local status log
+    uint32_t stale_ms;        // no heartbeat/status for this long marks a node inactive
+    uint32_t start_delay_ms;  // first periodic heartbeat/root check after boot
+    uint8_t max_connection;   // mesh softAP children
+    uint8_t mesh_id[6];
+    char router_ssid[NODE_CONFIG_SSID_MAX + 1];
+    char router_pass[NODE_CONFIG_PASS_MAX + 1];
+} node_config_t;
+
+// Load the stored config (defaults if missing or invalid). Needs nvs_flash_init.
+esp_err_t node_config_init(void);
+
+void node_config_get(node_config_t *out);
+uint32_t node_config_version(void);
+
+// Validate, persist and make current. On ESP_ERR_INVALID_ARG *why names the bad field.
+// *changed gets NODE_CONFIG_CHANGED_* flags (0 if nothing but the version changed).
+esp_err_t node_config_set(const node_config_t *c, uint32_t *changed, const char **why);
+
+// A restart-only field differs from what the mesh was started with
+bool node_config_restart_pending(void);
+
+// NULL if valid
+const char *node_config_validate(const node_config_t *c);
+
+// {"cmd":"config","ver":..,...} for the mesh; strings travel hex-encoded so credentials
+// need no escaping. Returns the length, or -1 if buf is too small.
+int node_config_encode(const node_config_t *c, char *buf, size_t len);
+// Parses a config message (NUL-terminated); fields not present are left as they are
+bool node_config_decode(const char *msg, node_config_t *out);
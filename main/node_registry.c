@@ -0,0 +1,121 @@
+#include <string.h>
+#include "node_registry.h"
+
+void registry_init(node_registry_t *r, const uint8_t self[6], registry_evict_fn on_evict, void *ctx) {
+    memset(r, 0, sizeof(*r));
+    memcpy(r->self, self, 6);
+    r->on_evict = on_evict;
+    r->ctx = ctx;
+}
+
+node_info_t *registry_find(node_registry_t *r, const uint8_t mac[6]) {
+    for (int i = 0; i < r->count; i++) {
+        if (memcmp(r->nodes[i].mac, mac, 6) == 0) {
+            return &r->nodes[i];
+        }
+    }
+    return NULL;
+}
+
+int registry_active_count(const node_registry_t *r) {
+    int n = 0;
+    for (int i = 0; i < r->count; i++) {
+        if (r->nodes[i].is_active) n++;
+    }
+    return n;
+}
+
+static node_info_t *registry_alloc_slot(node_registry_t *r) {
+    if (r->count < REGISTRY_MAX_NODES) {
+        return &r->nodes[r->count++];
+    }
+    node_info_t *victim = NULL;
+    for (int i = 0; i < r->count; i++) {
+        node_info_t *n = &r->nodes[i];
+        if (!n->is_active && (!victim || (int32_t)(n->last_seen - victim->last_seen) < 0)) {
+            victim = n;
+        }
+    }
+    if (victim) {
+        if (r->on_evict) {
+            r->on_evict(r->ctx, victim);
+        }
+        r->evictions++;
+    }
+    return victim;
+}
+
+node_info_t *registry_touch(node_registry_t *r, const uint8_t mac[6], int layer, uint32_t now_ms, bool *is_new) {
+    *is_new = false;
+    // Ignore non-mesh layers and our own heartbeat loopback
+    if (layer < 1 || memcmp(mac, r->self, 6) == 0) {
+        return NULL;
+    }
+    node_info_t *node = registry_find(r, mac);
+    if (!node) {
+        node = registry_alloc_slot(r);
+        if (!node) {
+            r->drops++;
+            return NULL;
+        }
+        memset(node, 0, sizeof(*node));
+        memcpy(node->mac, mac, 6);
+        node->rssi = -127;
+        node->join_ms = -1;
+        node->reg_ms = -1;
+        node->cmd_rtt_ms = -1;
+        node->backlog = -1;
+        lat_series_init(&node->lat);
+        *is_new = true;
+    }
+    node->last_seen = now_ms;
+    node->layer = layer;
+    node->is_active = true;
+    return node;
+}
+
+node_info_t *registry_apply_status(node_registry_t *r, const mesh_msg_t *m, const uint8_t route[6],
+                                   int fallback_layer, uint32_t now_ms, bool *is_new) {
+    *is_new = false;
+    if (!m->has_mac) {
+        return NULL;
+    }
+    node_info_t *node = registry_touch(r, m->mac, m->layer > 0 ? m->layer : fallback_layer, now_ms, is_new);
+    if (!node) {
+        return NULL;
+    }
+    memcpy(node->route, route, 6);
+    node->has_route = true;
+    node->led_state = m->led_state;
+    node->rssi = m->rssi;
+    if (m->has_flow) {
+        node->backlog = m->backlog;
+        node->flow_congested = m->flow_congested;
+        node->flow_rate_mps = m->flow_rate_mps;
+        node->flow_deferred = m->flow_deferred;
+        node->flow_dropped = m->flow_dropped;
+    }
+    if (m->has_config_version) {
+        node->has_config_version = true;
+        node->config_version = m->config_version;
+    }
+    if (m->has_rules_version) {
+        node->has_rules_version = true;
+        node->rules_version = m->rules_version;
+    }
+    if (m->has_time) {
+        node->time_synced = m->time_synced;
+        node->drift_ppb = m->drift_ppb;
+        node->sync_uncert_us = m->sync_uncert_us;
+    }
+    if (m->has_exec_late) {
+        node->has_exec_late = true;
+        node->exec_late_us = m->exec_late_us;
+    }
+    node->parent_switches = m->parent_switches;
+    if (m->type == MESH_MSG_HEARTBEAT) {
+        node->join_ms = m->join_ms;
+        node->reg_ms = m->reg_ms;
+    }
+    return node;
+}
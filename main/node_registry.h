@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "latency.h"
+#include "mesh_msg.h"
+#include "timer_wheel.h"
+
+// Root-side registry of known mesh nodes keyed by station MAC. Plain C with no RTOS
+// dependency: the caller supplies the clock and owns the stale timers.
+//
+// When full, a new node replaces the least recently seen inactive one; with every slot
+// active the new node is dropped.
+
+#ifndef REGISTRY_MAX_NODES
+#define REGISTRY_MAX_NODES 10
+#endif
+
+typedef struct {
+    uint8_t mac[6];
+    uint32_t last_seen;   // ms
+    bool led_state;
+    int layer;
+    bool is_active;
+    // Route hint: last mesh source address we saw for this node (for unicast P2P)
+    uint8_t route[6];
+    bool has_route;
+    int rssi; // last reported RSSI (dBm) to parent/router on the node side
+    // Join timing reported by the node (ms from boot/disconnect; -1 = not reported yet)
+    int join_ms; // until parent connected
+    int reg_ms;  // until registered at root
+    tw_timer_t stale_timer; // re-armed on every update; expiry marks the node inactive
+    // RTT probing (root side)
+    lat_series_t lat;
+    uint16_t probe_seq;   // seq of the outstanding ping
+    bool probe_pending;
+    int64_t cmd_sent_us;  // last led_toggle sent, cleared by the node's status_response
+    int cmd_rtt_ms;       // toggle -> status_response round trip; -1 = none yet
+    // Flow control as last reported by the node
+    int backlog;          // upstream backlog in frames; -1 = not reported
+    bool flow_congested;
+    uint32_t flow_rate_mps;
+    uint32_t flow_deferred;
+    uint32_t flow_dropped;
+    bool has_config_version;
+    uint32_t config_version; // runtime config version the node last reported
+    bool has_rules_version;
+    uint32_t rules_version;  // edge rules version the node last reported
+    // Time sync: the node's own view from its heartbeat, plus the error the root measured
+    bool time_synced;
+    int32_t drift_ppb;
+    int32_t sync_uncert_us;
+    bool has_exec_late;
+    int32_t exec_late_us;    // last scheduled action, mesh time of execution minus "at"
+    bool has_sync_err;
+    int32_t sync_err_us;     // node's mesh time minus the root's, from the last ping
+    uint32_t parent_switches; // parent optimizer moves the node reported
+} node_info_t;
+
+typedef void (*registry_evict_fn)(void *ctx, node_info_t *node);
+
+typedef struct {
+    node_info_t nodes[REGISTRY_MAX_NODES];
+    int count;
+    uint8_t self[6];        // our own station MAC; never registered
+    uint32_t evictions;     // inactive nodes replaced to make room
+    uint32_t drops;         // new nodes rejected with every slot active
+    registry_evict_fn on_evict; // called before an evicted slot is reused
+    void *ctx;
+} node_registry_t;
+
+void registry_init(node_registry_t *r, const uint8_t self[6], registry_evict_fn on_evict, void *ctx);
+node_info_t *registry_find(node_registry_t *r, const uint8_t mac[6]);
+int registry_active_count(const node_registry_t *r);
+
+// Mark a node seen at a layer, adding it if needed. Returns NULL for ourselves, for
+// layer < 1 and when the registry is full of active nodes. *is_new is set when the slot
+// was just (re)initialized.
+node_info_t *registry_touch(node_registry_t *r, const uint8_t mac[6], int layer, uint32_t now_ms, bool *is_new);
+
+// Apply a heartbeat or status_response received from route: presence, layer (falling back
+// to fallback_layer), route hint, LED, RSSI, flow-control state, config and rules versions, time sync
+// state, parent switches and, for heartbeats, join timing.
+node_info_t *registry_apply_status(node_registry_t *r, const mesh_msg_t *m, const uint8_t route[6],
+                                   int fallback_layer, uint32_t now_ms, bool *is_new);
@@ -0,0 +1,54 @@
+#include <string.h>
+#include "mesh_msg.h"
+#include "node_results.h"
+
+void node_results_init(node_results_t *r) {
+    memset(r, 0, sizeof(*r));
+}
+
+static node_result_t *pick_slot(node_results_t *r, const uint8_t mac[6], uint16_t run) {
+    node_result_t *free_slot = NULL, *old_run = NULL, *oldest = NULL;
+    for (int i = 0; i < NODE_RESULTS_MAX_NODES; i++) {
+        node_result_t *s = &r->slots[i];
+        if (!s->used) {
+            free_slot = free_slot ? free_slot : s;
+            continue;
+        }
+        if (memcmp(s->mac, mac, 6) == 0) {
+            return s;
+        }
+        if (s->run != run && (!old_run || s->at_us < old_run->at_us)) {
+            old_run = s;
+        }
+        if (!oldest || s->at_us < oldest->at_us) {
+            oldest = s;
+        }
+    }
+    return free_slot ? free_slot : old_run ? old_run : oldest;
+}
+
+bool node_results_store(node_results_t *r, const char *msg, uint16_t run, int64_t now_us) {
+    const char *res = strstr(msg, "\"result\":{");
+    const char *mac_ptr = res ? strstr(res, "\"mac\":\"") : NULL;
+    uint8_t mac[6];
+    if (!mac_ptr || !mesh_msg_parse_mac(mac_ptr + 7, mac)) {
+        return false;
+    }
+    res += 9;
+    size_t len = strlen(res);
+    if (len < 2) {
+        return false;
+    }
+    len--; // drop the wrapper's closing brace
+    if (len >= NODE_RESULT_MAX) {
+        len = NODE_RESULT_MAX - 1;
+    }
+    node_result_t *s = pick_slot(r, mac, run);
+    s->used = true;
+    memcpy(s->mac, mac, 6);
+    s->run = run;
+    s->at_us = now_us;
+    memcpy(s->json, res, len);
+    s->json[len] = '\0';
+    return true;
+}
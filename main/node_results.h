@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Root-side store of the latest result each node reported for a collection run (benchmark,
+// CPU profile). Plain C with no RTOS dependency; callers serialize access.
+//
+// Results arrive wrapped as {"cmd":..,"result":{..,"mac":"..",..}}; the inner object is kept
+// as text, keyed by the "mac" inside it and tagged with the run it belongs to. A node that
+// reports again replaces its own entry. With every slot taken a new node takes the entry of
+// an older run, else the oldest one.
+
+#ifndef NODE_RESULTS_MAX_NODES
+#define NODE_RESULTS_MAX_NODES 10
+#endif
+#define NODE_RESULT_MAX 440      // result JSON (fits one mesh message)
+
+typedef struct {
+    bool used;
+    uint8_t mac[6];
+    uint16_t run;
+    int64_t at_us;               // when it arrived
+    char json[NODE_RESULT_MAX];
+} node_result_t;
+
+typedef struct {
+    node_result_t slots[NODE_RESULTS_MAX_NODES];
+} node_results_t;
+
+void node_results_init(node_results_t *r);
+
+// Stores the result carried by msg (NUL-terminated) under run; false if msg has none.
+// Results longer than NODE_RESULT_MAX are cut short.
+bool node_results_store(node_results_t *r, const char *msg, uint16_t run, int64_t now_us);
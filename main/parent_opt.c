@@ -0,0 +1,76 @@
+#include <string.h>
+#include "parent_opt.h"
+
+void po_default_config(po_config_t *cfg) {
+    cfg->min_rssi = -80;
+    cfg->margin = 8;
+    cfg->confirm = 2;
+    cfg->hold_ms = 300000;
+    cfg->layer_cost = 10;  // an extra hop costs about as much as 10 dB of link margin
+    cfg->load_cost = 6;
+}
+
+void po_init(parent_opt_t *po, const po_config_t *cfg, uint32_t now_ms) {
+    memset(po, 0, sizeof(*po));
+    po->cfg = *cfg;
+    po->settled_ms = now_ms;
+    po->parent_score = INT32_MIN;
+    po->best_score = INT32_MIN;
+}
+
+void po_settled(parent_opt_t *po, uint32_t now_ms) {
+    po->settled_ms = now_ms;
+    po->pending_count = 0;
+}
+
+int po_score(const po_config_t *cfg, const po_candidate_t *c) {
+    int rssi = c->rssi < -90 ? -90 : c->rssi > -50 ? -50 : c->rssi;
+    int score = rssi + 90 - cfg->layer_cost * c->layer;
+    if (c->assoc_cap > 0) {
+        score -= cfg->load_cost * c->assoc / c->assoc_cap;
+    }
+    return score;
+}
+
+int po_evaluate(parent_opt_t *po, const po_candidate_t *c, int n, int my_layer, uint32_t now_ms) {
+    po->scans++;
+    int parent = -1, best = -1;
+    int parent_score = INT32_MIN, best_score = INT32_MIN;
+    for (int i = 0; i < n; i++) {
+        int s = po_score(&po->cfg, &c[i]);
+        if (c[i].is_parent) {
+            parent = i;
+            parent_score = s;
+            continue;
+        }
+        // Same or deeper layer could be our own descendant; a full softAP refuses us
+        if (c[i].layer >= my_layer || c[i].rssi < po->cfg.min_rssi || c[i].assoc >= c[i].assoc_cap) {
+            continue;
+        }
+        if (s > best_score) {
+            best = i;
+            best_score = s;
+        }
+    }
+    po->parent_score = parent_score;
+    po->best_score = best_score;
+
+    // Parent missing from the scan (out of range for a moment, or channel busy): no judgement
+    if (parent < 0 || best < 0 || best_score < parent_score + po->cfg.margin) {
+        po->pending_count = 0;
+        return -1;
+    }
+    if (po->pending_count > 0 && memcmp(po->pending, c[best].bssid, 6) == 0) {
+        po->pending_count++;
+    } else {
+        memcpy(po->pending, c[best].bssid, 6);
+        po->pending_count = 1;
+    }
+    if (po->pending_count < po->cfg.confirm || now_ms - po->settled_ms < po->cfg.hold_ms) {
+        po->held++;
+        return -1;
+    }
+    po->switches++;
+    po_settled(po, now_ms);
+    return best;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Parent choice for a non-root node from a scan of nearby mesh APs. Plain C with no RTOS
+// dependency; callers serialize access.
+//
+// Each candidate gets a score from its RSSI (clipped to -90..-50 dBm), minus a penalty per
+// layer and a penalty for how full its softAP is. Only candidates above our current
+// parent's layer are considered: they cannot be in our own subtree and the move never
+// makes the tree deeper. A switch needs the same best candidate, ahead of the current
+// parent by the margin, on confirm consecutive scans, and hold_ms since the last switch
+// or (re)join, so a node does not flap between two similar parents.
+
+#define PO_MAX_CANDIDATES 16
+
+typedef struct {
+    uint8_t bssid[6];     // softAP MAC
+    int8_t rssi;
+    uint8_t layer;        // the candidate's own layer (root = 1)
+    uint8_t assoc;        // children connected
+    uint8_t assoc_cap;    // softAP max_connection
+    uint8_t channel;
+    bool is_parent;       // our current parent
+} po_candidate_t;
+
+typedef struct {
+    int8_t min_rssi;      // weaker candidates are never chosen
+    uint8_t margin;       // score points (~dB) a candidate must be ahead of the parent
+    uint8_t confirm;      // consecutive scans agreeing on the same candidate
+    uint32_t hold_ms;     // minimum time between switches, and after a (re)join
+    uint8_t layer_cost;   // score points per layer
+    uint8_t load_cost;    // score points for a full softAP (scaled by assoc / assoc_cap)
+} po_config_t;
+
+typedef struct {
+    po_config_t cfg;
+    uint8_t pending[6];   // best candidate of the last scan(s)
+    uint8_t pending_count;
+    uint32_t settled_ms;  // last switch or (re)join
+    // Counters
+    uint32_t scans;
+    uint32_t switches;
+    uint32_t held;        // better candidate seen but hysteresis said wait
+    // Last evaluation, for reporting
+    int parent_score;     // INT32_MIN if the parent was not in the scan
+    int best_score;
+} parent_opt_t;
+
+void po_default_config(po_config_t *cfg);
+void po_init(parent_opt_t *po, const po_config_t *cfg, uint32_t now_ms);
+// A new parent was connected (by us or by the mesh): restart hold time and confirmation
+void po_settled(parent_opt_t *po, uint32_t now_ms);
+
+int po_score(const po_config_t *cfg, const po_candidate_t *c);
+
+// Returns the index of the candidate to switch to, or -1 to stay. my_layer is our layer.
+int po_evaluate(parent_opt_t *po, const po_candidate_t *c, int n, int my_layer, uint32_t now_ms);
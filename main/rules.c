@@ -0,0 +1,551 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mesh_msg.h"
+#include "rules.h"
+
+#define BLOB_FORMAT     1
+#define MIN_TIMER_DS    5     // 500 ms
+#define MAX_GROUP       8
+
+static const char *const event_names[RULE_EV_COUNT] = {
+    NULL, "connected", "disconnected", "root", "led_on", "led_off",
+};
+static const char *const led_names[] = { "off", "on", "toggle" };
+
+void rules_init(rules_t *rs, rules_action_cb_t cb, void *ctx) {
+    memset(rs, 0, sizeof(*rs));
+    rs->cb = cb;
+    rs->ctx = ctx;
+}
+
+typedef struct {
+    const char *p;
+    const char *end;
+    char tok[24];
+} lexer_t;
+
+// Next whitespace-separated token into lx->tok; false at the end of the statement
+static bool next_tok(lexer_t *lx) {
+    while (lx->p < lx->end && (*lx->p == ' ' || *lx->p == '\t' || *lx->p == '\r')) {
+        lx->p++;
+    }
+    size_t n = 0;
+    while (lx->p < lx->end && *lx->p != ' ' && *lx->p != '\t' && *lx->p != '\r') {
+        if (n + 1 < sizeof(lx->tok)) {
+            lx->tok[n++] = *lx->p;
+        }
+        lx->p++;
+    }
+    lx->tok[n] = '\0';
+    return n > 0;
+}
+
+static bool tok_is(const lexer_t *lx, const char *s) {
+    return strcmp(lx->tok, s) == 0;
+}
+
+static bool tok_num(const lexer_t *lx, long lo, long hi, long *out) {
+    char *e;
+    long v = strtol(lx->tok, &e, 10);
+    if (lx->tok[0] == '\0' || *e != '\0' || v < lo || v > hi) {
+        return false;
+    }
+    *out = v;
+    return true;
+}
+
+// Index of mac in the node table, adding it if new; -1 when the table is full
+static int node_index(rules_t *rs, const uint8_t mac[6]) {
+    for (int i = 0; i < rs->node_count; i++) {
+        if (memcmp(rs->nodes[i].mac, mac, 6) == 0) {
+            return i;
+        }
+    }
+    if (rs->node_count == RULES_MAX_NODES) {
+        return -1;
+    }
+    rule_node_t *n = &rs->nodes[rs->node_count];
+    memcpy(n->mac, mac, 6);
+    n->groups = 0;
+    return rs->node_count++;
+}
+
+static const char *compile_group(rules_t *rs, lexer_t *lx) {
+    long g;
+    if (!next_tok(lx) || !tok_num(lx, 1, MAX_GROUP, &g)) {
+        return "group number must be 1..8";
+    }
+    int members = 0;
+    while (next_tok(lx)) {
+        uint8_t mac[6];
+        if (strlen(lx->tok) != 17 || !mesh_msg_parse_mac(lx->tok, mac)) {
+            return "bad MAC in group";
+        }
+        int i = node_index(rs, mac);
+        if (i < 0) {
+            return "too many nodes";
+        }
+        rs->nodes[i].groups |= 1 << (g - 1);
+        members++;
+    }
+    return members ? NULL : "group needs at least one MAC";
+}
+
+static const char *compile_rule(rules_t *rs, lexer_t *lx) {
+    if (rs->count == RULES_MAX) {
+        return "too many rules";
+    }
+    rule_t r = { .src = RULES_ANY };
+    long v;
+    next_tok(lx);
+    if (tok_is(lx, "event")) {
+        r.trig = RULE_TRIG_EVENT;
+        next_tok(lx);
+        for (int e = 1; e < RULE_EV_COUNT; e++) {
+            if (tok_is(lx, event_names[e])) {
+                r.trig_arg = (uint8_t)e;
+            }
+        }
+        if (!r.trig_arg) {
+            return "unknown event";
+        }
+        next_tok(lx);
+    } else if (tok_is(lx, "signal")) {
+        r.trig = RULE_TRIG_SIGNAL;
+        next_tok(lx);
+        if (!tok_is(lx, "*")) {
+            if (!tok_num(lx, 1, 255, &v)) {
+                return "signal must be 1..255 or *";
+            }
+            r.trig_arg = (uint8_t)v;
+        }
+        next_tok(lx);
+        if (tok_is(lx, "from")) {
+            uint8_t mac[6];
+            if (!next_tok(lx) || strlen(lx->tok) != 17 || !mesh_msg_parse_mac(lx->tok, mac)) {
+                return "bad MAC after from";
+            }
+            int i = node_index(rs, mac);
+            if (i < 0) {
+                return "too many nodes";
+            }
+            r.src = (uint8_t)i;
+            next_tok(lx);
+        }
+    } else if (tok_is(lx, "timer")) {
+        r.trig = RULE_TRIG_TIMER;
+        if (!next_tok(lx) || !tok_num(lx, MIN_TIMER_DS * 100, 65535L * 100, &v)) {
+            return "timer must be 500..6553500 ms";
+        }
+        r.period_ds = (uint16_t)(v / 100);
+        next_tok(lx);
+    } else {
+        return "expected event, signal or timer after on";
+    }
+
+    if (!tok_is(lx, "do")) {
+        return "expected do";
+    }
+    next_tok(lx);
+    if (tok_is(lx, "led")) {
+        r.act = RULE_ACT_LED;
+        next_tok(lx);
+        r.act_arg = 0xFF;
+        for (int i = 0; i < 3; i++) {
+            if (tok_is(lx, led_names[i])) {
+                r.act_arg = (uint8_t)i;
+            }
+        }
+        if (r.act_arg == 0xFF) {
+            return "led must be on, off or toggle";
+        }
+    } else if (tok_is(lx, "signal")) {
+        r.act = RULE_ACT_SIGNAL;
+        if (!next_tok(lx) || !tok_num(lx, 1, 255, &v)) {
+            return "signal must be 1..255";
+        }
+        r.act_arg = (uint8_t)v;
+        if (!next_tok(lx) || !tok_is(lx, "to") || !next_tok(lx) || !tok_num(lx, 1, MAX_GROUP, &v)) {
+            return "expected to <group 1..8>";
+        }
+        r.group = (uint8_t)v;
+    } else {
+        return "expected led or signal after do";
+    }
+
+    if (next_tok(lx)) {
+        if (!tok_is(lx, "cooldown") || r.trig == RULE_TRIG_TIMER) {
+            return "unexpected text after action";
+        }
+        if (!next_tok(lx) || !tok_num(lx, 0, 65535L * 100, &v)) {
+            return "cooldown must be 0..6553500 ms";
+        }
+        r.period_ds = (uint16_t)((v + 99) / 100);
+        if (next_tok(lx)) {
+            return "unexpected text after cooldown";
+        }
+    }
+    rs->rules[rs->count++] = r;
+    return NULL;
+}
+
+int rules_compile(const char *text, uint8_t *blob, size_t cap, const char **why, int *line) {
+    static rules_t rs; // too big for a task stack
+    rules_init(&rs, NULL, NULL);
+    *line = 0;
+    const char *p = text;
+    while (*p) {
+        const char *eol = p + strcspn(p, "\n;");
+        (*line)++;
+        lexer_t lx = { .p = p, .end = eol };
+        *why = NULL;
+        if (next_tok(&lx) && lx.tok[0] != '#') {
+            if (tok_is(&lx, "group")) {
+                *why = compile_group(&rs, &lx);
+            } else if (tok_is(&lx, "on")) {
+                *why = compile_rule(&rs, &lx);
+            } else {
+                *why = "expected group or on";
+            }
+        }
+        if (*why) {
+            return -1;
+        }
+        p = *eol ? eol + 1 : eol;
+    }
+    // A signal to a group nobody is in would go nowhere
+    for (int i = 0; i < rs.count; i++) {
+        const rule_t *r = &rs.rules[i];
+        bool members = false;
+        for (int n = 0; r->act == RULE_ACT_SIGNAL && n < rs.node_count; n++) {
+            members |= rules_in_group(&rs, n, r->group);
+        }
+        if (r->act == RULE_ACT_SIGNAL && !members) {
+            *why = "signal to an empty group";
+            *line = 0;
+            return -1;
+        }
+    }
+    *why = NULL;
+    if (cap < RULES_BLOB_MAX) {
+        *why = "blob buffer too small";
+        return -1;
+    }
+    return (int)rules_save(&rs, blob, cap);
+}
+
+size_t rules_save(const rules_t *rs, uint8_t *blob, size_t cap) {
+    size_t need = 4 + rs->node_count * 7 + rs->count * 8;
+    if (cap < need) {
+        return 0;
+    }
+    uint8_t *p = blob;
+    *p++ = BLOB_FORMAT;
+    *p++ = (uint8_t)rs->node_count;
+    *p++ = (uint8_t)rs->count;
+    *p++ = 0;
+    for (int i = 0; i < rs->node_count; i++) {
+        memcpy(p, rs->nodes[i].mac, 6);
+        p[6] = rs->nodes[i].groups;
+        p += 7;
+    }
+    for (int i = 0; i < rs->count; i++) {
+        const rule_t *r = &rs->rules[i];
+        p[0] = r->trig;
+        p[1] = r->trig_arg;
+        p[2] = r->src;
+        p[3] = r->act;
+        p[4] = r->act_arg;
+        p[5] = r->group;
+        p[6] = (uint8_t)r->period_ds;
+        p[7] = (uint8_t)(r->period_ds >> 8);
+        p += 8;
+    }
+    return need;
+}
+
+static const char *check_rule(const rule_t *r, int node_count) {
+    switch (r->trig) {
+    case RULE_TRIG_EVENT:
+        if (r->trig_arg < 1 || r->trig_arg >= RULE_EV_COUNT) {
+            return "unknown event";
+        }
+        break;
+    case RULE_TRIG_SIGNAL:
+        if (r->src != RULES_ANY && r->src >= node_count) {
+            return "signal source out of range";
+        }
+        break;
+    case RULE_TRIG_TIMER:
+        if (r->period_ds < MIN_TIMER_DS) {
+            return "timer period too short";
+        }
+        break;
+    default:
+        return "unknown trigger";
+    }
+    if (r->act == RULE_ACT_LED) {
+        return r->act_arg <= RULE_LED_TOGGLE ? NULL : "unknown LED mode";
+    }
+    if (r->act == RULE_ACT_SIGNAL) {
+        return r->act_arg && r->group >= 1 && r->group <= MAX_GROUP ? NULL : "bad signal action";
+    }
+    return "unknown action";
+}
+
+const char *rules_load(rules_t *rs, uint32_t version, const uint8_t *blob, size_t len, uint32_t now_ms) {
+    if (len < 4 || blob[0] != BLOB_FORMAT || blob[1] > RULES_MAX_NODES || blob[2] > RULES_MAX ||
+        len != 4 + (size_t)blob[1] * 7 + (size_t)blob[2] * 8) {
+        return "malformed rule blob";
+    }
+    int node_count = blob[1];
+    int count = blob[2];
+    const uint8_t *p = blob + 4;
+    rule_node_t nodes[RULES_MAX_NODES];
+    for (int i = 0; i < node_count; i++, p += 7) {
+        memcpy(nodes[i].mac, p, 6);
+        nodes[i].groups = p[6];
+    }
+    rule_t rules[RULES_MAX];
+    for (int i = 0; i < count; i++, p += 8) {
+        rule_t *r = &rules[i];
+        r->trig = p[0];
+        r->trig_arg = p[1];
+        r->src = p[2];
+        r->act = p[3];
+        r->act_arg = p[4];
+        r->group = p[5];
+        r->period_ds = (uint16_t)(p[6] | p[7] << 8);
+        const char *why = check_rule(r, node_count);
+        if (why) {
+            return why;
+        }
+    }
+
+    rules_init(rs, rs->cb, rs->ctx);
+    rs->version = version;
+    rs->node_count = node_count;
+    memcpy(rs->nodes, nodes, sizeof(nodes[0]) * node_count);
+    rs->count = count;
+    memcpy(rs->rules, rules, sizeof(rules[0]) * count);
+    for (int i = 0; i < count; i++) {
+        const rule_t *r = &rs->rules[i];
+        if (r->trig == RULE_TRIG_EVENT) {
+            rs->by_event[r->trig_arg] |= 1 << i;
+        } else if (r->trig == RULE_TRIG_SIGNAL) {
+            rs->by_signal |= 1 << i;
+        } else {
+            rs->timers |= 1 << i;
+            rs->due_ms[i] = now_ms + r->period_ds * 100u;
+        }
+    }
+    return NULL;
+}
+
+bool rules_in_group(const rules_t *rs, int node, uint8_t group) {
+    return group >= 1 && group <= MAX_GROUP && (rs->nodes[node].groups >> (group - 1) & 1);
+}
+
+static void fire(rules_t *rs, int i, uint8_t hops, uint32_t now_ms) {
+    const rule_t *r = &rs->rules[i];
+    if (hops >= RULES_MAX_HOPS) {
+        rs->hop_limited++;
+        return;
+    }
+    if (r->trig != RULE_TRIG_TIMER && r->period_ds && rs->fired_once[i] &&
+        now_ms - rs->last_ms[i] < r->period_ds * 100u) {
+        rs->cooled++;
+        return;
+    }
+    rs->fired_once[i] = true;
+    rs->last_ms[i] = now_ms;
+    rs->fires[i]++;
+    rule_action_t a = { .rule = i, .act = r->act, .arg = r->act_arg, .group = r->group, .hops = hops + 1 };
+    if (rs->cb) {
+        rs->cb(rs->ctx, &a);
+    }
+}
+
+// Bits are taken lowest first, so rules fire in the order they were written
+static void fire_mask(rules_t *rs, uint16_t mask, uint8_t hops, uint32_t now_ms) {
+    while (mask) {
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        fire(rs, i, hops, now_ms);
+    }
+}
+
+void rules_event(rules_t *rs, rule_event_t ev, uint8_t hops, uint32_t now_ms) {
+    if (ev < 1 || ev >= RULE_EV_COUNT) {
+        return;
+    }
+    fire_mask(rs, rs->by_event[ev], hops, now_ms);
+}
+
+void rules_signal(rules_t *rs, const uint8_t src[6], uint8_t sig, uint8_t hops, uint32_t now_ms) {
+    uint16_t mask = 0;
+    for (uint16_t m = rs->by_signal; m; m &= m - 1) {
+        int i = __builtin_ctz(m);
+        const rule_t *r = &rs->rules[i];
+        if ((r->trig_arg == 0 || r->trig_arg == sig) &&
+            (r->src == RULES_ANY || memcmp(rs->nodes[r->src].mac, src, 6) == 0)) {
+            mask |= 1 << i;
+        }
+    }
+    fire_mask(rs, mask, hops, now_ms);
+}
+
+uint32_t rules_tick(rules_t *rs, uint32_t now_ms) {
+    uint32_t next = UINT32_MAX;
+    for (uint16_t m = rs->timers; m; m &= m - 1) {
+        int i = __builtin_ctz(m);
+        uint32_t period = rs->rules[i].period_ds * 100u;
+        if ((int32_t)(now_ms - rs->due_ms[i]) >= 0) {
+            fire(rs, i, 0, now_ms);
+            rs->due_ms[i] += period;
+            // Fell behind by more than a period (node busy or clock jump): no catch-up burst
+            if ((int32_t)(now_ms - rs->due_ms[i]) >= 0) {
+                rs->due_ms[i] = now_ms + period;
+            }
+        }
+        uint32_t in = rs->due_ms[i] - now_ms;
+        next = in < next ? in : next;
+    }
+    return next;
+}
+
+static int fmt_mac(char *buf, size_t len, const uint8_t *m) {
+    return snprintf(buf, len, "%02x:%02x:%02x:%02x:%02x:%02x", m[0], m[1], m[2], m[3], m[4], m[5]);
+}
+
+#define APPEND(...) do { \
+        int k_ = snprintf(buf + n, n < (int)len ? len - n : 0, __VA_ARGS__); \
+        n += k_ > 0 ? k_ : 0; \
+    } while (0)
+
+static int format_group(const rules_t *rs, int g, char *buf, size_t len) {
+    int n = 0;
+    char mac[18];
+    if (len) {
+        buf[0] = '\0';
+    }
+    for (int i = 0; i < rs->node_count; i++) {
+        if (rules_in_group(rs, i, (uint8_t)g)) {
+            if (!n) {
+                APPEND("group %d", g);
+            }
+            fmt_mac(mac, sizeof(mac), rs->nodes[i].mac);
+            APPEND(" %s", mac);
+        }
+    }
+    return n;
+}
+
+static int format_rule(const rules_t *rs, const rule_t *r, char *buf, size_t len) {
+    int n = 0;
+    char mac[18];
+    if (r->trig == RULE_TRIG_EVENT) {
+        APPEND("on event %s", event_names[r->trig_arg]);
+    } else if (r->trig == RULE_TRIG_SIGNAL) {
+        if (r->trig_arg) {
+            APPEND("on signal %u", r->trig_arg);
+        } else {
+            APPEND("on signal *");
+        }
+        if (r->src != RULES_ANY) {
+            fmt_mac(mac, sizeof(mac), rs->nodes[r->src].mac);
+            APPEND(" from %s", mac);
+        }
+    } else {
+        APPEND("on timer %lu", (unsigned long)r->period_ds * 100);
+    }
+    if (r->act == RULE_ACT_LED) {
+        APPEND(" do led %s", led_names[r->act_arg]);
+    } else {
+        APPEND(" do signal %u to %u", r->act_arg, r->group);
+    }
+    if (r->trig != RULE_TRIG_TIMER && r->period_ds) {
+        APPEND(" cooldown %lu", (unsigned long)r->period_ds * 100);
+    }
+    return n;
+}
+
+int rules_format_line(const rules_t *rs, int line, char *buf, size_t len) {
+    if (len) {
+        buf[0] = '\0';
+    }
+    for (int g = 1; g <= MAX_GROUP; g++) {
+        int n = format_group(rs, g, buf, len);
+        if (n && line-- == 0) {
+            return n < (int)len ? n : (int)len - 1;
+        }
+    }
+    if (line < 0 || line >= rs->count) {
+        return -1;
+    }
+    int n = format_rule(rs, &rs->rules[line], buf, len);
+    return n < (int)len ? n : (int)len - 1;
+}
+
+int rules_format(const rules_t *rs, char *buf, size_t len) {
+    int n = 0;
+    if (len) {
+        buf[0] = '\0';
+    }
+    for (int line = 0; n < (int)len; line++) {
+        int k = rules_format_line(rs, line, buf + n, len - n);
+        if (k < 0) {
+            break;
+        }
+        n += k;
+        APPEND("\n");
+    }
+    return n < (int)len ? n : (int)len - 1;
+}
+
+int rules_encode(const rules_t *rs, char *buf, size_t len) {
+    uint8_t blob[RULES_BLOB_MAX];
+    size_t blen = rules_save(rs, blob, sizeof(blob));
+    int n = snprintf(buf, len, "{\"cmd\":\"rules\",\"ver\":%lu,\"r\":\"", (unsigned long)rs->version);
+    if (n < 0 || (size_t)n + blen * 2 + 3 > len) {
+        return -1;
+    }
+    for (size_t i = 0; i < blen; i++) {
+        n += sprintf(buf + n, "%02x", blob[i]);
+    }
+    n += sprintf(buf + n, "\"}");
+    return n;
+}
+
+static int hex_nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+bool rules_decode(const char *msg, uint32_t *version, uint8_t *blob, size_t cap, size_t *len) {
+    const char *v = strstr(msg, "\"ver\":");
+    const char *r = strstr(msg, "\"r\":\"");
+    if (!v || !r) {
+        return false;
+    }
+    *version = (uint32_t)strtoul(v + 6, NULL, 10);
+    r += 5;
+    const char *end = strchr(r, '"');
+    if (!end || (end - r) % 2 != 0 || (size_t)(end - r) / 2 > cap) {
+        return false;
+    }
+    size_t n = 0;
+    for (; r < end; r += 2) {
+        int hi = hex_nibble(r[0]);
+        int lo = hex_nibble(r[1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        blob[n++] = (uint8_t)(hi << 4 | lo);
+    }
+    *len = n;
+    return true;
+}
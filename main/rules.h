@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Edge rules: small trigger -> action table that every node runs locally, so a reaction to
+// a neighbour's signal takes one hop instead of a round trip through the root. Plain C with
+// no RTOS dependency; callers serialize access.
+//
+// The root compiles the text form (rules_compile) into a compact blob that is stored in NVS
+// and pushed mesh-wide like the runtime config. rules_load validates the blob and builds
+// per-trigger bitmaps, so dispatching an event or signal only visits the rules it can fire.
+// Cost is bounded: at most RULES_MAX rules per dispatch, a per-rule cooldown, and a hop
+// count on every chain of actions (local or across nodes) that stops at RULES_MAX_HOPS.
+//
+// Text form, one statement per line (or ';'):
+//   group <1..8> <mac> [<mac>...]
+//   on event <connected|disconnected|root|led_on|led_off> do <action> [cooldown <ms>]
+//   on signal <1..255|*> [from <mac>] do <action> [cooldown <ms>]
+//   on timer <ms> do <action>
+// where <action> is "led on|off|toggle" or "signal <1..255> to <group>".
+
+#define RULES_MAX       16
+#define RULES_MAX_NODES 12   // MACs the rules refer to (group members and signal sources)
+#define RULES_MAX_HOPS  4
+#define RULES_ANY       0xFF // signal source: any node
+#define RULES_BLOB_MAX  (4 + RULES_MAX_NODES * 7 + RULES_MAX * 8)
+
+typedef enum {
+    RULE_TRIG_EVENT = 1,
+    RULE_TRIG_SIGNAL,
+    RULE_TRIG_TIMER,
+} rule_trig_t;
+
+typedef enum {
+    RULE_EV_CONNECTED = 1,     // parent connected
+    RULE_EV_DISCONNECTED,
+    RULE_EV_ROOT,              // became root
+    RULE_EV_LED_ON,
+    RULE_EV_LED_OFF,
+    RULE_EV_COUNT,
+} rule_event_t;
+
+typedef enum {
+    RULE_ACT_LED = 1,
+    RULE_ACT_SIGNAL,
+} rule_act_t;
+
+typedef enum {
+    RULE_LED_OFF = 0,
+    RULE_LED_ON,
+    RULE_LED_TOGGLE,
+} rule_led_t;
+
+// 8 bytes in the blob
+typedef struct {
+    uint8_t trig;              // rule_trig_t
+    uint8_t trig_arg;          // event, or signal number (0 = any)
+    uint8_t src;               // signal source node index, or RULES_ANY
+    uint8_t act;               // rule_act_t
+    uint8_t act_arg;           // rule_led_t, or signal number
+    uint8_t group;             // signal target group (1..8)
+    uint16_t period_ds;        // timer period, else cooldown; in 100 ms units
+} rule_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t groups;            // bit g-1 set: member of group g
+} rule_node_t;
+
+// What a fired rule asks the caller to do
+typedef struct {
+    int rule;
+    uint8_t act;               // rule_act_t
+    uint8_t arg;               // rule_led_t, or signal number
+    uint8_t group;
+    uint8_t hops;              // for a signal: the hop count it carries
+} rule_action_t;
+
+typedef void (*rules_action_cb_t)(void *ctx, const rule_action_t *a);
+
+typedef struct {
+    uint32_t version;          // 0 = none
+    int count;
+    rule_t rules[RULES_MAX];
+    int node_count;
+    rule_node_t nodes[RULES_MAX_NODES];
+    // Built by rules_load
+    uint16_t by_event[RULE_EV_COUNT];
+    uint16_t by_signal;
+    uint16_t timers;
+    uint32_t due_ms[RULES_MAX];
+    uint32_t last_ms[RULES_MAX];
+    bool fired_once[RULES_MAX];
+    // Counters
+    uint32_t fires[RULES_MAX];
+    uint32_t cooled;           // skipped by cooldown
+    uint32_t hop_limited;      // dropped at RULES_MAX_HOPS
+    rules_action_cb_t cb;
+    void *ctx;
+} rules_t;
+
+void rules_init(rules_t *rs, rules_action_cb_t cb, void *ctx);
+
+// Text -> blob. On failure returns -1 with *why and *line set (1-based; 0 if not one line's fault).
+int rules_compile(const char *text, uint8_t *blob, size_t cap, const char **why, int *line);
+// Blob -> rule set, replacing the current one (counters restart). NULL if valid, else why not.
+const char *rules_load(rules_t *rs, uint32_t version, const uint8_t *blob, size_t len, uint32_t now_ms);
+// Current rule set -> blob; returns its length
+size_t rules_save(const rules_t *rs, uint8_t *blob, size_t cap);
+// Current rule set -> text form; returns the length written
+int rules_format(const rules_t *rs, char *buf, size_t len);
+// One line of the text form, without the newline: groups first, then rules in order. Returns
+// the length written, or -1 past the last line.
+int rules_format_line(const rules_t *rs, int line, char *buf, size_t len);
+
+// Dispatch. hops is how many actions led here (0 for something that did not come from a rule).
+void rules_event(rules_t *rs, rule_event_t ev, uint8_t hops, uint32_t now_ms);
+void rules_signal(rules_t *rs, const uint8_t src[6], uint8_t sig, uint8_t hops, uint32_t now_ms);
+// Fires due timer rules; returns ms until the next one is due, or UINT32_MAX if none
+uint32_t rules_tick(rules_t *rs, uint32_t now_ms);
+
+// Members of group (1..8), for RULE_ACT_SIGNAL
+bool rules_in_group(const rules_t *rs, int node, uint8_t group);
+
+// {"cmd":"rules","ver":..,"r":"<hex blob>"}; returns the length, or -1 if buf is too small
+int rules_encode(const rules_t *rs, char *buf, size_t len);
+// Parses a rules message (NUL-terminated) into version and blob; false if malformed
+bool rules_decode(const char *msg, uint32_t *version, uint8_t *blob, size_t cap, size_t *len);
@@ -0,0 +1,52 @@
+#include <string.h>
+#include "rx_dispatch.h"
+
+enum { RX_ANY = 0, RX_ROOT, RX_NODE };
+enum { RX_TARGET_ANY = 0, RX_TARGET_SELF_OR_ALL, RX_TARGET_SELF };
+
+typedef struct {
+    uint8_t role;
+    uint8_t target;
+} rx_route_t;
+
+static const rx_route_t routes[MESH_MSG_TYPE_COUNT] = {
+    [MESH_MSG_PONG]           = { RX_ROOT, RX_TARGET_ANY },
+    [MESH_MSG_BENCH_START]    = { RX_NODE, RX_TARGET_ANY },
+    [MESH_MSG_BENCH_REPORT]   = { RX_NODE, RX_TARGET_ANY },
+    [MESH_MSG_BENCH_RESULT]   = { RX_ROOT, RX_TARGET_ANY },
+    [MESH_MSG_TIME_SYNC]      = { RX_NODE, RX_TARGET_ANY },
+    [MESH_MSG_TIME_REQ]       = { RX_ROOT, RX_TARGET_ANY },
+    [MESH_MSG_TIME_RESP]      = { RX_NODE, RX_TARGET_ANY },
+    [MESH_MSG_LED_TOGGLE]     = { RX_ANY, RX_TARGET_SELF_OR_ALL },
+    [MESH_MSG_PROFILE_RESULT] = { RX_ROOT, RX_TARGET_ANY },
+    [MESH_MSG_CMD_BATCH]      = { RX_ANY, RX_TARGET_SELF },
+};
+
+void rx_dispatch_init(rx_dispatch_t *d, const uint8_t self[6], void *ctx) {
+    memset(d, 0, sizeof(*d));
+    d->self = self;
+    d->ctx = ctx;
+}
+
+const mesh_msg_t *rx_dispatch(rx_dispatch_t *d, const rx_frame_t *f) {
+    mesh_msg_t *m = &d->msg;
+    if (!mesh_msg_parse(f->raw, f->len, m)) {
+        return NULL;
+    }
+    rx_handler_t h = d->on[m->type];
+    if (!h) {
+        return m;
+    }
+    const rx_route_t *r = &routes[m->type];
+    if ((r->role == RX_ROOT && !d->is_root) || (r->role == RX_NODE && d->is_root)) {
+        return m;
+    }
+    if (r->target != RX_TARGET_ANY) {
+        bool to_self = m->has_target && memcmp(m->target, d->self, 6) == 0;
+        if (!to_self && (r->target == RX_TARGET_SELF || m->has_target)) {
+            return m;
+        }
+    }
+    h(d->ctx, m, f);
+    return m;
+}
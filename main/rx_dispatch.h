@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mesh_msg.h"
+
+// Receive path for JSON mesh frames: one mesh_msg_parse pass, then the frame goes to the
+// handler registered for its type. Plain C with no RTOS dependency; callers serialize access.
+//
+// The role and addressing checks live here rather than in the handlers, so the firmware's
+// rx_task, the host replayer and rx_bench route every frame the same way: root-only and
+// node-only messages are dropped on the wrong side, led_toggle is taken when broadcast or
+// addressed to self, cmd_batch only when addressed to self. Types without a handler are
+// parsed and ignored.
+
+typedef struct {
+    const char *raw;          // the frame, NUL-terminated, for handlers that re-read it
+    size_t len;
+    const uint8_t *from;      // sender as the mesh reported it
+    const void *src;          // caller's own form of the sender (mesh_addr_t in the firmware)
+    int64_t rx_us;
+} rx_frame_t;
+
+typedef void (*rx_handler_t)(void *ctx, const mesh_msg_t *m, const rx_frame_t *f);
+
+typedef struct {
+    const uint8_t *self;      // station MAC, for addressed commands
+    bool is_root;             // kept current by the caller
+    void *ctx;
+    rx_handler_t on[MESH_MSG_TYPE_COUNT];
+    mesh_msg_t msg;           // last parsed frame (large; kept off the caller's stack)
+} rx_dispatch_t;
+
+void rx_dispatch_init(rx_dispatch_t *d, const uint8_t self[6], void *ctx);
+
+// Parses and routes one frame; returns the parsed message (handled or not), NULL if the
+// frame is not a {"cmd":...} message
+const mesh_msg_t *rx_dispatch(rx_dispatch_t *d, const rx_frame_t *f);
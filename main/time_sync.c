@@ -0,0 +1,116 @@
+#include <math.h>
+#include <string.h>
+#include "time_sync.h"
+
+#define STEP_US        50000   // prediction error treated as a jump in mesh time
+#define DELAY_SLACK_US 2000    // round trips within best + max(best / 2, this) are fitted
+#define MAX_DRIFT_PPB  500000  // 500 ppm: anything beyond is a bad fit, not a crystal
+#define MIN_SPAN_US    2000000 // samples closer together than this give no usable slope
+
+void ts_init(time_sync_t *ts) {
+    memset(ts, 0, sizeof(*ts));
+}
+
+static int64_t model_offset(const time_sync_t *ts, int64_t local_us) {
+    return ts->ref_offset_us + (local_us - ts->ref_local_us) * ts->drift_ppb / 1000000000LL;
+}
+
+int64_t ts_to_mesh(const time_sync_t *ts, int64_t local_us) {
+    return ts->synced ? local_us + model_offset(ts, local_us) : local_us;
+}
+
+int64_t ts_to_local(const time_sync_t *ts, int64_t mesh_us) {
+    if (!ts->synced) {
+        return mesh_us;
+    }
+    // The offset changes by at most ppm over the difference, so one refinement is exact to 1 us
+    int64_t local = mesh_us - ts->ref_offset_us;
+    return mesh_us - model_offset(ts, local);
+}
+
+static void refit(time_sync_t *ts) {
+    int32_t best = INT32_MAX;
+    for (int i = 0; i < ts->count; i++) {
+        if (ts->samples[i].delay_us < best) {
+            best = ts->samples[i].delay_us;
+        }
+    }
+    int32_t limit = best + (best / 2 > DELAY_SLACK_US ? best / 2 : DELAY_SLACK_US);
+
+    // Least squares over the fast samples, relative to the newest one to keep numbers small
+    const ts_sample_t *newest = &ts->samples[(ts->head + TS_WINDOW - 1) % TS_WINDOW];
+    int n = 0;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int64_t x_min = INT64_MAX, x_max = INT64_MIN;
+    for (int i = 0; i < ts->count; i++) {
+        const ts_sample_t *s = &ts->samples[i];
+        if (s->delay_us > limit) {
+            continue;
+        }
+        double x = (double)(s->local_us - newest->local_us);
+        double y = (double)(s->offset_us - newest->offset_us);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        x_min = s->local_us < x_min ? s->local_us : x_min;
+        x_max = s->local_us > x_max ? s->local_us : x_max;
+        n++;
+    }
+    ts->filtered += ts->count - n;
+
+    double slope = 0;
+    double den = n * sxx - sx * sx;
+    if (n >= 2 && x_max - x_min >= MIN_SPAN_US && den > 0) {
+        slope = (n * sxy - sx * sy) / den;
+        if (slope > MAX_DRIFT_PPB / 1e9 || slope < -MAX_DRIFT_PPB / 1e9) {
+            slope = ts->drift_ppb / 1e9; // keep the previous estimate
+        }
+    }
+    double intercept = (sy - slope * sx) / n; // at the newest sample
+    double rss = 0;
+    for (int i = 0; i < ts->count; i++) {
+        const ts_sample_t *s = &ts->samples[i];
+        if (s->delay_us > limit) {
+            continue;
+        }
+        double r = (double)(s->offset_us - newest->offset_us) - (intercept + slope * (double)(s->local_us - newest->local_us));
+        rss += r * r;
+    }
+
+    ts->ref_local_us = newest->local_us;
+    ts->ref_offset_us = newest->offset_us + (int64_t)(intercept >= 0 ? intercept + 0.5 : intercept - 0.5);
+    ts->drift_ppb = (int32_t)(slope * 1e9);
+    ts->uncert_us = best / 2;
+    ts->residual_us = (int32_t)sqrt(rss / n);
+    ts->synced = true;
+}
+
+bool ts_add_exchange(time_sync_t *ts, int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+    int64_t delay = (t4 - t1) - (t3 - t2);
+    if (delay < 0 || t3 < t2 || delay > INT32_MAX) {
+        return false;
+    }
+    ts_sample_t s = {
+        .local_us = t1 + (t4 - t1) / 2,
+        .offset_us = ((t2 - t1) + (t3 - t4)) / 2,
+        .delay_us = (int32_t)delay,
+    };
+    ts->exchanges++;
+    if (ts->synced) {
+        int64_t err = s.offset_us - model_offset(ts, s.local_us);
+        if ((err > STEP_US || err < -STEP_US) && delay < STEP_US) {
+            ts->count = 0;
+            ts->head = 0;
+            ts->drift_ppb = 0;
+            ts->steps++;
+        }
+    }
+    ts->samples[ts->head] = s;
+    ts->head = (ts->head + 1) % TS_WINDOW;
+    if (ts->count < TS_WINDOW) {
+        ts->count++;
+    }
+    refit(ts);
+    return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Mesh time estimator for a node. Plain C with no RTOS dependency; callers serialize
+// access.
+//
+// Mesh time is the root's clock. Each exchange with the root gives the four NTP
+// timestamps: t1 (request sent, local), t2 (received at root, mesh), t3 (reply sent, mesh),
+// t4 (reply received, local). offset = ((t2 - t1) + (t3 - t4)) / 2 assumes the path
+// delay is the same both ways, which holds for the hop count but not for queueing, so only
+// samples whose round trip is close to the best in the window are used. A least-squares
+// line through those samples gives the offset and the drift of our crystal against the
+// root's; between exchanges mesh time is extrapolated along it.
+//
+// A sample far off the line means mesh time itself moved (a new root that was never
+// synced): the window restarts from that sample.
+
+#define TS_WINDOW 8
+
+typedef struct {
+    int64_t local_us;   // midpoint of t1 and t4
+    int64_t offset_us;  // mesh - local
+    int32_t delay_us;   // round trip minus time spent at the root
+} ts_sample_t;
+
+typedef struct {
+    ts_sample_t samples[TS_WINDOW];
+    uint8_t count;
+    uint8_t head;
+    // Model: mesh = local + ref_offset + drift * (local - ref_local)
+    bool synced;
+    int64_t ref_local_us;
+    int64_t ref_offset_us;
+    int32_t drift_ppb;
+    int32_t uncert_us;      // half the best round trip in the fit: bound on asymmetry error
+    int32_t residual_us;    // RMS distance of the fitted samples from the line
+    // Counters
+    uint32_t exchanges;
+    uint32_t filtered;      // samples left out of the fit for a slow round trip
+    uint32_t steps;         // window restarts
+} time_sync_t;
+
+void ts_init(time_sync_t *ts);
+
+// Feed one completed exchange. Returns false if it was discarded (negative round trip).
+bool ts_add_exchange(time_sync_t *ts, int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+
+// Local clock to mesh time and back (identity until the first exchange)
+int64_t ts_to_mesh(const time_sync_t *ts, int64_t local_us);
+int64_t ts_to_local(const time_sync_t *ts, int64_t mesh_us);
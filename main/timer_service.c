@@ -0,0 +1,92 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "timer_service.h"
+
+static const char *TAG = "TIMER_SVC";
+
+static tw_wheel_t wheel;
+static SemaphoreHandle_t wheel_lock = NULL;
+static TaskHandle_t service_task = NULL;
+static tw_timer_t *running = NULL;  // callback in progress (under wheel_lock)
+
+// Ticks follow esp_timer rather than the RTOS tick so a starved service task shows up as overruns
+static uint32_t timer_service_now(void) {
+    return (uint32_t)(esp_timer_get_time() / (TIMER_SERVICE_TICK_MS * 1000LL));
+}
+
+static uint32_t ms_to_ticks(uint32_t ms) {
+    return (ms + TIMER_SERVICE_TICK_MS - 1) / TIMER_SERVICE_TICK_MS;
+}
+
+static void timer_service_task(void *arg) {
+    TickType_t last_wake = xTaskGetTickCount();
+    while (true) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(TIMER_SERVICE_TICK_MS));
+        xSemaphoreTake(wheel_lock, portMAX_DELAY);
+        tw_expire(&wheel, timer_service_now());
+        xSemaphoreGive(wheel_lock);
+
+        // Callbacks run unlocked: one that blocks (httpd_stop, a full mesh queue) must not
+        // hold up a task that is arming or cancelling a timer meanwhile
+        while (true) {
+            xSemaphoreTake(wheel_lock, portMAX_DELAY);
+            tw_timer_t *t = tw_pop_expired(&wheel);
+            running = t;
+            xSemaphoreGive(wheel_lock);
+            if (!t) {
+                break;
+            }
+            t->cb(t, t->arg);
+            xSemaphoreTake(wheel_lock, portMAX_DELAY);
+            running = NULL;
+            xSemaphoreGive(wheel_lock);
+        }
+    }
+}
+
+esp_err_t timer_service_start(void) {
+    if (wheel_lock != NULL) {
+        return ESP_OK;
+    }
+    wheel_lock = xSemaphoreCreateMutex();
+    if (wheel_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    tw_init(&wheel, timer_service_now());
+    if (xTaskCreate(timer_service_task, "timer_svc", 4096, NULL, 4, &service_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create timer service task");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Timer service started (tick=%d ms)", TIMER_SERVICE_TICK_MS);
+    return ESP_OK;
+}
+
+void timer_service_arm_ms(tw_timer_t *t, uint32_t delay_ms, uint32_t period_ms) {
+    xSemaphoreTake(wheel_lock, portMAX_DELAY);
+    tw_arm(&wheel, t, ms_to_ticks(delay_ms), ms_to_ticks(period_ms));
+    xSemaphoreGive(wheel_lock);
+}
+
+bool timer_service_cancel(tw_timer_t *t) {
+    xSemaphoreTake(wheel_lock, portMAX_DELAY);
+    bool was_armed = tw_cancel(&wheel, t);
+    // A callback already under way for t finishes before we return, so the caller may reuse
+    // what it points at; a callback cancelling its own timer does not wait for itself
+    while (running == t && xTaskGetCurrentTaskHandle() != service_task) {
+        xSemaphoreGive(wheel_lock);
+        vTaskDelay(1);
+        xSemaphoreTake(wheel_lock, portMAX_DELAY);
+    }
+    xSemaphoreGive(wheel_lock);
+    return was_armed;
+}
+
+void timer_service_get_stats(tw_stats_t *out) {
+    xSemaphoreTake(wheel_lock, portMAX_DELAY);
+    *out = wheel.stats;
+    xSemaphoreGive(wheel_lock);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "timer_wheel.h"
+
+// Single timer service for staleness, eviction and protocol timeouts: one task advances
+// a shared timer wheel every TIMER_SERVICE_TICK_MS. Callbacks run on that task without the
+// wheel lock, so they may arm/cancel timers; one that blocks only delays the timers after it.
+// timer_service_cancel returns once a callback already running for that timer has finished.
+
+#define TIMER_SERVICE_TICK_MS 100
+
+esp_err_t timer_service_start(void);
+
+// Delays are rounded up to whole ticks; period_ms = 0 makes a one-shot timer
+void timer_service_arm_ms(tw_timer_t *t, uint32_t delay_ms, uint32_t period_ms);
+bool timer_service_cancel(tw_timer_t *t);
+void timer_service_get_stats(tw_stats_t *out);
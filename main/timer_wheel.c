@@ -0,0 +1,156 @@
+#include <stddef.h>
+#include <string.h>
+#include "timer_wheel.h"
+
+static void tw_link(tw_timer_t **head, tw_timer_t *t) {
+    t->next = *head;
+    if (*head) {
+        (*head)->pprev = &t->next;
+    }
+    *head = t;
+    t->pprev = head;
+}
+
+static void tw_unlink(tw_timer_t *t) {
+    *t->pprev = t->next;
+    if (t->next) {
+        t->next->pprev = t->pprev;
+    }
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+// Slot choice is relative to the next tick to be processed (now + 1)
+static void tw_place(tw_wheel_t *w, tw_timer_t *t) {
+    uint32_t delta = t->expires - (w->now + 1);
+    int level = 0;
+    while (level < TW_LEVELS - 1 && delta >= (1u << (TW_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    uint32_t idx = (t->expires >> (TW_SLOT_BITS * level)) & (TW_SLOTS - 1);
+    tw_link(&w->slots[level][idx], t);
+}
+
+static void tw_cascade(tw_wheel_t *w, int level, uint32_t idx) {
+    tw_timer_t *t = w->slots[level][idx];
+    w->slots[level][idx] = NULL;
+    while (t) {
+        tw_timer_t *next = t->next;
+        t->next = NULL;
+        t->pprev = NULL;
+        tw_place(w, t);
+        w->stats.cascaded++;
+        t = next;
+    }
+}
+
+void tw_init(tw_wheel_t *w, uint32_t now) {
+    memset(w, 0, sizeof(*w));
+    w->now = now;
+}
+
+void tw_timer_init(tw_timer_t *t, tw_callback_t cb, void *arg) {
+    memset(t, 0, sizeof(*t));
+    t->cb = cb;
+    t->arg = arg;
+}
+
+void tw_arm(tw_wheel_t *w, tw_timer_t *t, uint32_t delay, uint32_t period) {
+    if (tw_is_armed(t)) {
+        tw_unlink(t);
+    } else {
+        w->stats.active++;
+    }
+    if (delay == 0) {
+        delay = 1;
+    }
+    if (delay > TW_MAX_DELAY) {
+        delay = TW_MAX_DELAY;
+    }
+    if (period > TW_MAX_DELAY) {
+        period = TW_MAX_DELAY;
+    }
+    t->expires = w->now + delay;
+    t->period = period;
+    tw_place(w, t);
+    w->stats.armed++;
+}
+
+bool tw_cancel(tw_wheel_t *w, tw_timer_t *t) {
+    if (!tw_is_armed(t)) {
+        return false;
+    }
+    tw_unlink(t);
+    w->stats.active--;
+    w->stats.cancelled++;
+    return true;
+}
+
+void tw_expire(tw_wheel_t *w, uint32_t now) {
+    tw_timer_t **tail = &w->expired;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    while ((int32_t)(now - w->now) > 0) {
+        uint32_t tick = w->now + 1;
+
+        // Pull the next range down from each upper level whose lower bits just rolled over
+        for (int level = 1; level < TW_LEVELS; level++) {
+            if (tick & ((1u << (TW_SLOT_BITS * level)) - 1)) {
+                break;
+            }
+            tw_cascade(w, level, (tick >> (TW_SLOT_BITS * level)) & (TW_SLOTS - 1));
+        }
+
+        // Move the due slot to the end of the expired list, keeping expiry order
+        tw_timer_t *pending = w->slots[0][tick & (TW_SLOTS - 1)];
+        w->slots[0][tick & (TW_SLOTS - 1)] = NULL;
+        if (pending) {
+            pending->pprev = &pending;
+        }
+        w->now = tick;
+
+        while (pending) {
+            tw_timer_t *t = pending;
+            tw_unlink(t);
+
+            uint32_t late = now - t->expires;
+            if (late > 0) {
+                w->stats.overruns++;
+                if (late > w->stats.max_late) {
+                    w->stats.max_late = late;
+                }
+            }
+            tw_link(tail, t);
+            tail = &t->next;
+        }
+    }
+}
+
+tw_timer_t *tw_pop_expired(tw_wheel_t *w) {
+    tw_timer_t *t = w->expired;
+    if (!t) {
+        return NULL;
+    }
+    tw_unlink(t);
+    if (t->period) {
+        // Keep the cadence, but skip periods that were missed entirely
+        t->expires += t->period;
+        if ((int32_t)(t->expires - w->now) <= 0) {
+            t->expires = w->now + t->period;
+        }
+        tw_place(w, t);
+    } else {
+        w->stats.active--;
+    }
+    w->stats.fired++;
+    return t;
+}
+
+void tw_advance(tw_wheel_t *w, uint32_t now) {
+    tw_expire(w, now);
+    tw_timer_t *t;
+    while ((t = tw_pop_expired(w)) != NULL) {
+        t->cb(t, t->arg);
+    }
+}
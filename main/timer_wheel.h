@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Hierarchical timer wheel (4 levels x 64 slots). Plain C with no RTOS dependency;
+// callers provide the tick source and any locking (see timer_service.h).
+//
+// Level 0 covers the next 64 ticks, each further level covers 64x the range of the
+// one below; timers cascade down a level as their expiry comes within range.
+// Arm and cancel are O(1): timers are intrusive list nodes, unlinked through pprev.
+
+#define TW_LEVELS    4
+#define TW_SLOT_BITS 6
+#define TW_SLOTS     (1u << TW_SLOT_BITS)
+#define TW_MAX_DELAY ((1u << (TW_SLOT_BITS * TW_LEVELS)) - 1) // ~16.7M ticks
+
+typedef struct tw_timer tw_timer_t;
+typedef void (*tw_callback_t)(tw_timer_t *timer, void *arg);
+
+struct tw_timer {
+    tw_timer_t *next;
+    tw_timer_t **pprev;  // NULL when not armed
+    uint32_t expires;    // absolute tick
+    uint32_t period;     // 0 = one-shot
+    tw_callback_t cb;
+    void *arg;
+};
+
+typedef struct {
+    uint32_t active;       // currently armed
+    uint32_t armed;        // total arm calls
+    uint32_t cancelled;    // cancels of an armed timer
+    uint32_t fired;        // callbacks run
+    uint32_t cascaded;     // timers moved down a level
+    uint32_t overruns;     // timers that fired later than their expiry tick
+    uint32_t max_late;     // worst lateness seen (ticks)
+} tw_stats_t;
+
+typedef struct {
+    tw_timer_t *slots[TW_LEVELS][TW_SLOTS];
+    tw_timer_t *expired;   // due, callback not run yet (tw_pop_expired)
+    uint32_t now;          // last processed tick
+    tw_stats_t stats;
+} tw_wheel_t;
+
+void tw_init(tw_wheel_t *w, uint32_t now);
+void tw_timer_init(tw_timer_t *t, tw_callback_t cb, void *arg);
+
+// Arm (or re-arm) a timer delay ticks from now; period > 0 makes it periodic.
+// A delay of 0 fires on the next tick.
+void tw_arm(tw_wheel_t *w, tw_timer_t *t, uint32_t delay, uint32_t period);
+// Returns true if the timer was armed (a due timer still waiting for its callback counts).
+bool tw_cancel(tw_wheel_t *w, tw_timer_t *t);
+
+static inline bool tw_is_armed(const tw_timer_t *t) {
+    return t->pprev != 0;
+}
+
+// Process every tick up to and including now, running expired callbacks in order.
+// Callbacks may arm or cancel any timer, including themselves.
+void tw_advance(tw_wheel_t *w, uint32_t now);
+
+// The same in two steps, for callers that must not hold their lock across callbacks:
+// tw_expire moves every timer due by now onto the expired list, in expiry order;
+// tw_pop_expired takes the first one (re-placing it if periodic) and returns it, NULL when
+// the list is empty. Cancelling or re-arming a timer still on the list takes it off.
+void tw_expire(tw_wheel_t *w, uint32_t now);
+tw_timer_t *tw_pop_expired(tw_wheel_t *w);
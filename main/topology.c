@@ -0,0 +1,194 @@
+#include <string.h>
+#include "topology.h"
+
+static int topo_alloc(topo_t *t, const uint8_t mac[6]) {
+    int idx = topo_find(t, mac);
+    if (idx != TOPO_NONE) {
+        return idx;
+    }
+    for (int i = 0; i < TOPO_MAX_NODES; i++) {
+        if (!t->nodes[i].used) {
+            topo_node_t *n = &t->nodes[i];
+            memset(n, 0, sizeof(*n));
+            memcpy(n->mac, mac, 6);
+            n->used = true;
+            n->parent = TOPO_NONE;
+            n->first_child = TOPO_NONE;
+            n->next_sibling = TOPO_NONE;
+            n->subtree = 1;
+            n->rssi = -127;
+            return i;
+        }
+    }
+    return TOPO_NONE;
+}
+
+static int depth_slot(int depth) {
+    return depth < TOPO_MAX_DEPTH ? depth : TOPO_MAX_DEPTH - 1;
+}
+
+// Re-label depth/reachability for a subtree, keeping the per-depth histogram in step
+static void topo_relabel(topo_t *t, int idx, int depth, bool reachable) {
+    topo_node_t *n = &t->nodes[idx];
+    if (n->reachable) {
+        t->depth_count[depth_slot(n->depth)]--;
+    }
+    n->depth = (uint8_t)depth_slot(depth);
+    n->reachable = reachable;
+    if (reachable) {
+        t->depth_count[depth_slot(depth)]++;
+    }
+    for (int c = n->first_child; c != TOPO_NONE; c = t->nodes[c].next_sibling) {
+        topo_relabel(t, c, depth + 1, reachable);
+    }
+}
+
+static void topo_detach(topo_t *t, int idx) {
+    topo_node_t *n = &t->nodes[idx];
+    int p = n->parent;
+    if (p == TOPO_NONE) {
+        return;
+    }
+    int8_t *link = &t->nodes[p].first_child;
+    while (*link != TOPO_NONE && *link != idx) {
+        link = &t->nodes[*link].next_sibling;
+    }
+    if (*link == idx) {
+        *link = n->next_sibling;
+    }
+    t->nodes[p].child_count--;
+    for (int a = p; a != TOPO_NONE; a = t->nodes[a].parent) {
+        t->nodes[a].subtree -= n->subtree;
+    }
+    n->parent = TOPO_NONE;
+    n->next_sibling = TOPO_NONE;
+    topo_relabel(t, idx, 0, false);
+}
+
+static void topo_attach(topo_t *t, int idx, int p) {
+    topo_node_t *n = &t->nodes[idx];
+    n->parent = (int8_t)p;
+    n->next_sibling = t->nodes[p].first_child;
+    t->nodes[p].first_child = (int8_t)idx;
+    t->nodes[p].child_count++;
+    for (int a = p; a != TOPO_NONE; a = t->nodes[a].parent) {
+        t->nodes[a].subtree += n->subtree;
+    }
+    topo_relabel(t, idx, t->nodes[p].depth + 1, t->nodes[p].reachable);
+}
+
+static bool topo_is_ancestor(const topo_t *t, int anc, int idx) {
+    for (int a = idx; a != TOPO_NONE; a = t->nodes[a].parent) {
+        if (a == anc) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void topo_init(topo_t *t, const uint8_t root_mac[6]) {
+    memset(t, 0, sizeof(*t));
+    t->root = topo_alloc(t, root_mac);
+    t->nodes[t->root].reachable = true;
+    t->depth_count[0] = 1;
+}
+
+int topo_find(const topo_t *t, const uint8_t mac[6]) {
+    for (int i = 0; i < TOPO_MAX_NODES; i++) {
+        if (t->nodes[i].used && memcmp(t->nodes[i].mac, mac, 6) == 0) {
+            return i;
+        }
+    }
+    return TOPO_NONE;
+}
+
+bool topo_set_parent(topo_t *t, const uint8_t child[6], const uint8_t parent[6]) {
+    int c = topo_alloc(t, child);
+    int p = topo_alloc(t, parent);
+    if (c == TOPO_NONE || p == TOPO_NONE || c == t->root || c == p) {
+        return false;
+    }
+    if (t->nodes[c].parent == p) {
+        return false;
+    }
+    // A report that would close a loop is stale; the later report from the other side will fix it up
+    if (topo_is_ancestor(t, c, p)) {
+        return false;
+    }
+    topo_detach(t, c);
+    topo_attach(t, c, p);
+    t->changes++;
+    return true;
+}
+
+bool topo_set_children(topo_t *t, const uint8_t parent[6], const uint8_t (*children)[6], int n) {
+    int p = topo_alloc(t, parent);
+    if (p == TOPO_NONE) {
+        return false;
+    }
+    bool changed = false;
+    // Children no longer listed become orphans until they report their new parent
+    int c = t->nodes[p].first_child;
+    while (c != TOPO_NONE) {
+        int next = t->nodes[c].next_sibling;
+        bool listed = false;
+        for (int i = 0; i < n && !listed; i++) {
+            listed = memcmp(t->nodes[c].mac, children[i], 6) == 0;
+        }
+        if (!listed) {
+            topo_detach(t, c);
+            t->changes++;
+            changed = true;
+        }
+        c = next;
+    }
+    for (int i = 0; i < n; i++) {
+        changed |= topo_set_parent(t, children[i], parent);
+    }
+    return changed;
+}
+
+void topo_set_rssi(topo_t *t, const uint8_t mac[6], int rssi) {
+    int idx = topo_find(t, mac);
+    if (idx != TOPO_NONE) {
+        t->nodes[idx].rssi = (int8_t)(rssi < -127 ? -127 : (rssi > 0 ? 0 : rssi));
+    }
+}
+
+bool topo_remove(topo_t *t, const uint8_t mac[6]) {
+    int idx = topo_find(t, mac);
+    if (idx == TOPO_NONE || idx == t->root) {
+        return false;
+    }
+    topo_detach(t, idx);
+    while (t->nodes[idx].first_child != TOPO_NONE) {
+        topo_detach(t, t->nodes[idx].first_child);
+    }
+    t->nodes[idx].used = false;
+    t->changes++;
+    return true;
+}
+
+void topo_get_summary(const topo_t *t, topo_summary_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (int d = 0; d < TOPO_MAX_DEPTH; d++) {
+        out->nodes += t->depth_count[d];
+        out->depth_sum += d * t->depth_count[d];
+        if (t->depth_count[d]) {
+            out->max_depth = d;
+        }
+    }
+    for (int i = 0; i < TOPO_MAX_NODES; i++) {
+        if (t->nodes[i].used && !t->nodes[i].reachable) {
+            out->orphans++;
+        }
+    }
+    bool first = true;
+    for (int c = t->nodes[t->root].first_child; c != TOPO_NONE; c = t->nodes[c].next_sibling) {
+        int sz = t->nodes[c].subtree;
+        if (first || sz > out->max_branch) out->max_branch = sz;
+        if (first || sz < out->min_branch) out->min_branch = sz;
+        first = false;
+    }
+    out->changes = t->changes;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Incrementally maintained mesh tree, kept on the root. Plain C with no RTOS dependency;
+// callers serialize access.
+//
+// Edges change only when a node reports a different parent or child set; each change
+// re-links one subtree and walks only the affected ancestor paths (subtree sizes) and the
+// moved subtree (depths), so reads never rebuild anything.
+
+#ifndef TOPO_MAX_NODES
+#define TOPO_MAX_NODES 16  // root included
+#endif
+#define TOPO_MAX_DEPTH 32
+#define TOPO_NONE      (-1)
+
+typedef struct {
+    uint8_t mac[6];
+    bool used;
+    bool reachable;      // parent chain ends at the root
+    int8_t parent;       // index or TOPO_NONE
+    int8_t first_child;
+    int8_t next_sibling;
+    uint8_t depth;       // hops from the root (root = 0); relative to the orphan head if unreachable
+    uint8_t child_count;
+    uint16_t subtree;    // nodes in this subtree including itself
+    int8_t rssi;         // link RSSI to parent as reported by the node (dBm), -127 unknown
+} topo_node_t;
+
+typedef struct {
+    topo_node_t nodes[TOPO_MAX_NODES];
+    int root;                              // index of the root node
+    uint16_t depth_count[TOPO_MAX_DEPTH];  // reachable nodes per depth
+    uint32_t changes;                      // edge changes applied
+} topo_t;
+
+typedef struct {
+    int nodes;        // reachable nodes including the root
+    int orphans;      // known nodes not connected to the root
+    int max_depth;
+    int depth_sum;    // sum of depths over reachable nodes (avg = depth_sum / (nodes - 1))
+    int max_branch;   // largest subtree hanging directly off the root
+    int min_branch;   // smallest one (0 if the root has no children)
+    uint32_t changes;
+} topo_summary_t;
+
+void topo_init(topo_t *t, const uint8_t root_mac[6]);
+int topo_find(const topo_t *t, const uint8_t mac[6]);
+
+// Returns true if the tree changed
+bool topo_set_parent(topo_t *t, const uint8_t child[6], const uint8_t parent[6]);
+bool topo_set_children(topo_t *t, const uint8_t parent[6], const uint8_t (*children)[6], int n);
+void topo_set_rssi(topo_t *t, const uint8_t mac[6], int rssi);
+// Drops a node; each of its children becomes the head of an orphaned subtree until it re-reports
+bool topo_remove(topo_t *t, const uint8_t mac[6]);
+
+void topo_get_summary(const topo_t *t, topo_summary_t *out);
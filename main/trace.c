@@ -0,0 +1,185 @@
+#include <string.h>
+#include "trace.h"
+
+void trace_init(trace_t *t, uint8_t *buf, uint32_t cap, const uint8_t self[6]) {
+    memset(t, 0, sizeof(*t));
+    t->buf = buf;
+    t->cap = cap;
+    t->max_payload = UINT16_MAX;
+    memcpy(t->self, self, 6);
+}
+
+void trace_clear(trace_t *t) {
+    t->tail = t->head = t->lim = 0;
+    t->wrapped = false;
+    t->records = 0;
+    t->captured = t->dropped = t->missed = 0;
+}
+
+uint32_t trace_hash(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void drop_oldest(trace_t *t) {
+    const trace_rec_t *r = (const trace_rec_t *)(t->buf + t->tail);
+    t->tail += sizeof(trace_rec_t) + r->len;
+    t->records--;
+    t->dropped++;
+    if (t->wrapped && t->tail == t->lim) {
+        t->tail = 0;
+        t->wrapped = false;
+    }
+}
+
+// Room for size contiguous bytes at head, dropping the oldest records as needed
+static uint8_t *reserve(trace_t *t, uint32_t size) {
+    if (t->records == 0) {
+        t->tail = t->head = 0;
+        t->wrapped = false;
+    }
+    while (true) {
+        if (!t->wrapped) {
+            if (t->head + size <= t->cap) {
+                break;
+            }
+            // Start over at the front; what follows tail up to head stays readable
+            t->lim = t->head;
+            t->head = 0;
+            t->wrapped = true;
+            if (t->tail == t->lim) {
+                t->tail = 0;
+                t->wrapped = false;
+            }
+        } else if (t->head + size <= t->tail) {
+            break;
+        } else {
+            drop_oldest(t);
+        }
+    }
+    uint8_t *p = t->buf + t->head;
+    t->head += size;
+    t->records++;
+    t->captured++;
+    return p;
+}
+
+static uint8_t *begin(trace_t *t, uint8_t type, uint8_t flags, uint32_t t_us, uint32_t body_len) {
+    if (t->mode == TRACE_OFF) {
+        return NULL;
+    }
+    uint32_t size = sizeof(trace_rec_t) + body_len;
+    if (t->paused || body_len > UINT16_MAX || size > t->cap) {
+        t->missed++;
+        return NULL;
+    }
+    uint8_t *p = reserve(t, size);
+    trace_rec_t r = { .type = type, .flags = flags, .len = (uint16_t)body_len, .t_us = t_us };
+    memcpy(p, &r, sizeof(r));
+    return p + sizeof(r);
+}
+
+bool trace_rx(trace_t *t, uint32_t t_us, const uint8_t src[6], const void *data, uint16_t size) {
+    uint16_t keep = 0;
+    if (t->mode == TRACE_FULL) {
+        keep = size < t->max_payload ? size : t->max_payload;
+    }
+    uint8_t *p = begin(t, TRACE_REC_RX, keep < size ? TRACE_RX_TRUNC : 0, t_us, sizeof(trace_rx_t) + keep);
+    if (!p) {
+        return false;
+    }
+    trace_rx_t rx = { .size = size, .hash = trace_hash(data, size) };
+    memcpy(rx.src, src, 6);
+    memcpy(p, &rx, sizeof(rx));
+    memcpy(p + sizeof(rx), data, keep);
+    return true;
+}
+
+bool trace_event(trace_t *t, uint32_t t_us, uint8_t source, int32_t id, int layer) {
+    uint8_t *p = begin(t, TRACE_REC_EVENT, source, t_us, sizeof(trace_event_t));
+    if (!p) {
+        return false;
+    }
+    trace_event_t ev = { .id = id, .layer = (int16_t)layer };
+    memcpy(p, &ev, sizeof(ev));
+    return true;
+}
+
+bool trace_http(trace_t *t, uint32_t t_us, uint8_t method, const char *uri) {
+    size_t n = strlen(uri);
+    uint8_t *p = begin(t, TRACE_REC_HTTP, method, t_us, n);
+    if (!p) {
+        return false;
+    }
+    memcpy(p, uri, n);
+    return true;
+}
+
+static uint32_t ring_bytes(const trace_t *t) {
+    if (t->records == 0) {
+        return 0;
+    }
+    return t->wrapped ? (t->lim - t->tail) + t->head : t->head - t->tail;
+}
+
+uint32_t trace_dump_size(const trace_t *t) {
+    return sizeof(trace_file_hdr_t) + ring_bytes(t);
+}
+
+size_t trace_dump_read(const trace_t *t, int64_t now_us, uint32_t off, uint8_t *out, size_t len) {
+    size_t n = 0;
+    if (off < sizeof(trace_file_hdr_t)) {
+        trace_file_hdr_t h = {
+            .magic = TRACE_MAGIC,
+            .version = TRACE_VERSION,
+            .hdr_len = sizeof(trace_file_hdr_t),
+            .mode = (uint8_t)t->mode,
+            .now_us = now_us,
+            .records = t->records,
+            .dropped = t->dropped,
+            .missed = t->missed,
+        };
+        memcpy(h.self, t->self, 6);
+        size_t k = sizeof(h) - off;
+        k = k < len ? k : len;
+        memcpy(out, (const uint8_t *)&h + off, k);
+        n = k;
+        off += k;
+    }
+    // Map the stream offset onto the one or two ring segments
+    uint32_t pos = off - sizeof(trace_file_hdr_t);
+    uint32_t total = ring_bytes(t);
+    uint32_t first = t->records == 0 ? 0 : t->wrapped ? t->lim - t->tail : t->head - t->tail;
+    while (n < len && pos < total) {
+        uint32_t at, avail;
+        if (pos < first) {
+            at = t->tail + pos;
+            avail = first - pos;
+        } else {
+            at = pos - first;
+            avail = total - pos;
+        }
+        size_t k = len - n < avail ? len - n : avail;
+        memcpy(out + n, t->buf + at, k);
+        n += k;
+        pos += k;
+    }
+    return n;
+}
+
+bool trace_next(const uint8_t *dump, size_t len, size_t *pos, trace_rec_t *rec, const uint8_t **body) {
+    if (*pos + sizeof(trace_rec_t) > len) {
+        return false;
+    }
+    memcpy(rec, dump + *pos, sizeof(*rec));
+    if (rec->type < TRACE_REC_RX || rec->type > TRACE_REC_HTTP || *pos + sizeof(*rec) + rec->len > len) {
+        return false;
+    }
+    *body = dump + *pos + sizeof(*rec);
+    *pos += sizeof(*rec) + rec->len;
+    return true;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary capture of received frames, mesh/IP events and HTTP requests into a RAM ring, in
+// the format host/trace_replay reads. Plain C with no RTOS dependency; callers serialize
+// access.
+//
+// Each record is an 8-byte header and a body, stored contiguously: a record that does not
+// fit before the end of the buffer starts over at offset 0. When the ring is full the
+// oldest records go, so the trace always ends with the activity leading up to the dump.
+// Times are the low 32 bits of the caller's microsecond clock; the dump header carries the
+// full clock at download so a reader can unwrap them (gaps over ~71 min fold).
+//
+// A dump is a trace_file_hdr_t followed by the records oldest first, all little-endian.
+
+#define TRACE_MAGIC   0x4352544du // "MTRC"
+#define TRACE_VERSION 1
+
+typedef enum {
+    TRACE_OFF = 0,
+    TRACE_HASH,   // frames as source, size and hash only
+    TRACE_FULL,   // frames with their payload (up to max_payload bytes)
+} trace_mode_t;
+
+enum {
+    TRACE_REC_RX = 1,
+    TRACE_REC_EVENT,
+    TRACE_REC_HTTP,
+};
+
+// trace_rec_t.flags
+#define TRACE_RX_TRUNC 0x01   // RX: payload cut at max_payload (or absent in hash mode)
+#define TRACE_SRC_MESH 0      // EVENT: MESH_EVENT id
+#define TRACE_SRC_IP   1      // EVENT: IP_EVENT id
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;    // TRACE_REC_*
+    uint8_t flags;   // RX: TRACE_RX_*; EVENT: TRACE_SRC_*; HTTP: method (http_method enum)
+    uint16_t len;    // body bytes
+    uint32_t t_us;
+} trace_rec_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t src[6];
+    uint16_t size;   // frame size as received
+    uint32_t hash;   // FNV-1a over the whole frame
+    // followed by min(size, max_payload) payload bytes in full mode
+} trace_rx_t;
+
+typedef struct __attribute__((packed)) {
+    int32_t id;
+    int16_t layer;   // our mesh layer when the event was handled
+} trace_event_t;
+// HTTP body: the URI including the query, not NUL-terminated
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t hdr_len;    // sizeof(trace_file_hdr_t); records start here
+    uint8_t self[6];     // station MAC of the capturing node
+    uint8_t mode;
+    uint8_t reserved;
+    int64_t now_us;      // capture clock when the dump was taken
+    uint32_t records;    // in this dump
+    uint32_t dropped;    // overwritten by newer records
+    uint32_t missed;     // not captured (paused for a download, or larger than the ring)
+} trace_file_hdr_t;
+
+typedef struct {
+    uint8_t *buf;
+    uint32_t cap;
+    // Records live in [tail, head), or [tail, lim) then [0, head) once wrapped
+    uint32_t tail;
+    uint32_t head;
+    uint32_t lim;
+    bool wrapped;
+    uint32_t records;
+    trace_mode_t mode;
+    uint16_t max_payload;
+    bool paused;         // set while a dump is being read out
+    uint8_t self[6];
+    // Counters since trace_clear
+    uint32_t captured;
+    uint32_t dropped;
+    uint32_t missed;
+} trace_t;
+
+void trace_init(trace_t *t, uint8_t *buf, uint32_t cap, const uint8_t self[6]);
+void trace_clear(trace_t *t);
+
+static inline bool trace_on(const trace_t *t) {
+    return t->mode != TRACE_OFF;
+}
+
+// Each returns false if the record was not captured (off, paused or larger than the ring)
+bool trace_rx(trace_t *t, uint32_t t_us, const uint8_t src[6], const void *data, uint16_t size);
+bool trace_event(trace_t *t, uint32_t t_us, uint8_t source, int32_t id, int layer);
+bool trace_http(trace_t *t, uint32_t t_us, uint8_t method, const char *uri);
+
+uint32_t trace_hash(const void *data, size_t len);
+
+// The dump as one byte stream: header then records. Read it in chunks at increasing
+// offsets with the same now_us, with capture paused in between.
+uint32_t trace_dump_size(const trace_t *t);
+size_t trace_dump_read(const trace_t *t, int64_t now_us, uint32_t off, uint8_t *out, size_t len);
+
+// Reader for a dump in memory: returns the next record and advances *pos, or false at
+// the end or on a malformed record.
+bool trace_next(const uint8_t *dump, size_t len, size_t *pos, trace_rec_t *rec, const uint8_t **body);